@@ -16,6 +16,9 @@ pgrep -l ip_disp >> rebootinfo.txt
 # start camera server (allow camera to be detected)
 sleep 0.2
 cd /home/local/svn/robobot/stream_server
+# camera to shared memory, stream_server (and vision) are readers
+/usr/bin/python3 camera_shm.py 2>camera_shm.err >camera_shm.out &
+sleep 0.5
 /usr/bin/python3 stream_server.py 2>stream_server.err >stream_server.out &
 echo "python3 cam streamer started with PID:" >> /home/local/svn/log/rebootinfo.txt
 sleep 0.1
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Pi camera (Picamera2) capture to the shared memory frame ring.
+# The camera is captured once, and all local users are readers of the ring:
+# stream_server.py (MJPEG to browsers), teensy_interface ([vision] source = shm)
+# and Python vision (shm_frames.py).
+# Run this before the readers, e.g. from setup/on_reboot.bash:
+#   python3 camera_shm.py
+# Only one producer for a ring, so do not run frame_broker (USB camera) too.
+
+import argparse
+import time
+import signal
+from setproctitle import setproctitle
+#
+from picamera2 import Picamera2, MappedArray
+from shm_frames import ShmFramesWriter
+
+# set title of process, so that it is not just called Python
+setproctitle("camera_shm")
+
+parser = argparse.ArgumentParser(description="Pi camera to shared memory frame ring")
+parser.add_argument("-W", "--width", type=int, default=820, help="image width (default 820)")
+parser.add_argument("-H", "--height", type=int, default=616, help="image height (default 616)")
+parser.add_argument("-s", "--shm", default="/robobot_frames", help="shared memory name (default /robobot_frames)")
+parser.add_argument("-n", "--frames", type=int, default=4, help="frames in the ring (default 4)")
+parser.add_argument("--stat", type=float, default=10, help="statistics interval (sec), 0 is none (default 10)")
+args = parser.parse_args()
+
+stop = False
+
+def stop_handler(signum, frame):
+  global stop
+  stop = True
+
+signal.signal(signal.SIGINT, stop_handler)
+signal.signal(signal.SIGTERM, stop_handler)
+
+picam2 = Picamera2()
+# 'RGB888' is B,G,R byte order, as used by OpenCV (and UShmFrames)
+# higher resolution and lower framerate (5 FPS (200000 microseconds between frames))
+picam2.configure(picam2.create_video_configuration(
+  main={"size": (args.width, args.height), "format": "RGB888"},
+  controls={'FrameDurationLimits': (200000, 500000)}))
+picam2.start()
+
+ring = ShmFramesWriter()
+if not ring.create(args.shm, args.width, args.height, 3, args.frames):
+  picam2.stop()
+  exit(1)
+print(f"% camera_shm:: Pi camera {args.width}x{args.height} to shared memory {args.shm} ({args.frames} frames)")
+
+cnt = 0
+stat_time = time.time()
+try:
+  while not stop:
+    request = picam2.capture_request()
+    try:
+      # sensor time (monotonic ns) to wall clock
+      ts = request.get_metadata().get("SensorTimestamp", time.monotonic_ns())
+      capture_time = time.time() - (time.monotonic_ns() - ts) * 1e-9
+      n, img = ring.begin_write()
+      # the only copy, camera buffer to the ring
+      with MappedArray(request, "main") as m:
+        img[:] = m.array[:args.height, :args.width, :3]
+      del img
+      ring.end_write(n, capture_time)
+    finally:
+      request.release()
+    cnt += 1
+    if args.stat > 0 and time.time() - stat_time > args.stat:
+      dt = time.time() - stat_time
+      print(f"% camera_shm:: {cnt / dt:.1f} frames/s")
+      cnt = 0
+      stat_time = time.time()
+finally:
+  picam2.stop()
+  ring.close()
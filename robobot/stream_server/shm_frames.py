@@ -0,0 +1,149 @@
+# Shared memory frame ring (same layout as teensy_interface/src/ushmframes.h)
+# ShmFrames is a reader, ShmFramesWriter is used by the producer
+# (camera_shm.py for the Pi camera, or frame_broker for a USB camera).
+# The reader image is a numpy view of the shared memory (no copy),
+# check is_valid(n) after use, as the producer overwrites the oldest frame.
+#
+# from shm_frames import ShmFrames
+# shm = ShmFrames()
+# if shm.attach():
+#   ok, img, t, n = shm.latest()
+#   ... use img (BGR) ...
+#   if shm.is_valid(n): use the result
+
+import mmap
+import os
+import struct
+import time
+import numpy as np
+
+class ShmFrames:
+  MAGIC = 0x52464252 # "RBFR"
+  VERSION = 1
+  HEADER_SIZE = 64
+  SLOT_HEADER_SIZE = 64
+
+  def __init__(self):
+    self.mm = None
+    self.last = 0
+
+  def attach(self, name = "/robobot_frames"):
+    self.last = 0
+    try:
+      f = open("/dev/shm" + name, "rb")
+      self.mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+      f.close()
+    except OSError:
+      print(f"% ShmFrames:: no frame ring shared memory {name} (camera_shm or frame_broker not running)")
+      return False
+    magic, version, self.slotCnt, self.slotSize, self.width, self.height, self.channels, pid = \
+      struct.unpack_from("<8I", self.mm, 0)
+    if magic != self.MAGIC or version != self.VERSION:
+      print(f"% ShmFrames:: {name} is not a frame ring (or wrong version)")
+      self.mm = None
+      return False
+    return True
+
+  def _slot(self, n):
+    return self.HEADER_SIZE + (n % self.slotCnt) * self.slotSize
+
+  def latest_number(self):
+    return struct.unpack_from("<Q", self.mm, 32)[0]
+
+  def is_valid(self, n):
+    return struct.unpack_from("<Q", self.mm, self._slot(n))[0] == 2 * n
+
+  def latest(self, timeout = 1.0):
+    # wait for a new frame, returns (ok, image, capture time (sec), frame number)
+    t0 = time.time()
+    while time.time() - t0 < timeout:
+      n = self.latest_number()
+      if n != self.last and self.is_valid(n):
+        self.last = n
+        p = self._slot(n)
+        t_us = struct.unpack_from("<Q", self.mm, p + 8)[0]
+        img = np.frombuffer(self.mm, dtype=np.uint8,
+                            count=self.width * self.height * self.channels,
+                            offset=p + self.SLOT_HEADER_SIZE)
+        img = img.reshape((self.height, self.width, self.channels))
+        return True, img, t_us / 1e6, n
+      time.sleep(0.002)
+    return False, None, 0, 0
+
+
+class ShmFramesWriter:
+  # the producer, one only for a ring
+  def __init__(self):
+    self.mm = None
+    self.name = None
+
+  def create(self, name, width, height, channels = 3, slots = 4):
+    self.name = name
+    self.slotCnt = slots
+    self.width = width
+    self.height = height
+    self.channels = channels
+    img_bytes = width * height * channels
+    # round to whole cache lines
+    self.slotSize = (ShmFrames.SLOT_HEADER_SIZE + img_bytes + 63) & ~63
+    size = ShmFrames.HEADER_SIZE + self.slotSize * slots
+    fn = "/dev/shm" + name
+    try:
+      # remove any old (e.g. after a crash)
+      if os.path.exists(fn):
+        os.unlink(fn)
+      f = open(fn, "w+b")
+      f.truncate(size)
+      self.mm = mmap.mmap(f.fileno(), size)
+      f.close()
+    except OSError as e:
+      print(f"% ShmFramesWriter:: failed to create {name}: {e}")
+      return False
+    # header without magic, slot headers, then magic (valid for readers)
+    struct.pack_into("<8IQ", self.mm, 0, 0, ShmFrames.VERSION, slots, self.slotSize,
+                     width, height, channels, os.getpid(), 0)
+    for i in range(slots):
+      struct.pack_into("<QQ3I", self.mm, self._slot(i), 0, 0, width, height, channels)
+    self._barrier()
+    struct.pack_into("<I", self.mm, 0, ShmFrames.MAGIC)
+    self.latest = 0
+    return True
+
+  def _slot(self, n):
+    return ShmFrames.HEADER_SIZE + (n % self.slotCnt) * self.slotSize
+
+  def _barrier(self):
+    # Python has no memory fence, but a system call (msync, no disk write
+    # for /dev/shm) orders the stores before and after it, as the release
+    # fence in UShmFrames (readers may run on another CPU core)
+    self.mm.flush()
+
+  def begin_write(self):
+    # returns (frame number, numpy view of the image in the next slot)
+    n = self.latest + 1
+    p = self._slot(n)
+    # readers of the old frame in this slot can see it is being overwritten
+    struct.pack_into("<Q", self.mm, p, 2 * n - 1)
+    self._barrier()
+    img = np.frombuffer(self.mm, dtype=np.uint8,
+                        count=self.width * self.height * self.channels,
+                        offset=p + ShmFrames.SLOT_HEADER_SIZE)
+    return n, img.reshape((self.height, self.width, self.channels))
+
+  def end_write(self, n, capture_time):
+    # frame n is complete, capture_time is in seconds since epoch
+    p = self._slot(n)
+    struct.pack_into("<Q", self.mm, p + 8, int(capture_time * 1e6))
+    self._barrier()
+    struct.pack_into("<Q", self.mm, p, 2 * n)
+    struct.pack_into("<Q", self.mm, 32, n)
+    self.latest = n
+
+  def close(self):
+    if self.mm is not None:
+      self.mm.close()
+      self.mm = None
+      try:
+        os.unlink("/dev/shm" + self.name)
+      except OSError:
+        pass
@@ -5,18 +5,22 @@
 # Mostly copied from https://picamera.readthedocs.io/en/release-1.13/recipes2.html
 # Run this script, then point a web browser at http:<this-ip-address>:7123
 # Note: needs simplejpeg to be installed (pip3 install simplejpeg).
+#
+# The camera is captured by camera_shm.py (to shared memory), this is a reader
+# of the frame ring (shm_frames.py). A frame is JPEG encoded only when a
+# browser is connected, and once for all connected browsers.
 
 import io
 import logging
 import socketserver
 import socket
+import time
 from http import server
-from threading import Condition
+from threading import Condition, Thread
 from setproctitle import setproctitle
 #
-from picamera2 import Picamera2
-from picamera2.encoders import JpegEncoder
-from picamera2.outputs import FileOutput
+import simplejpeg
+from shm_frames import ShmFrames
 
 # set title of process, so that it is not just called Python
 setproctitle("stream_server")
@@ -41,6 +45,8 @@ class StreamingOutput(io.BufferedIOBase):
     def __init__(self):
         self.frame = None
         self.condition = Condition()
+        # connected browsers
+        self.clients = 0
 
     def write(self, buf):
         with self.condition:
@@ -68,6 +74,8 @@ class StreamingHandler(server.BaseHTTPRequestHandler):
             self.send_header('Pragma', 'no-cache')
             self.send_header('Content-Type', 'multipart/x-mixed-replace; boundary=FRAME')
             self.end_headers()
+            with output.condition:
+                output.clients += 1
             try:
                 while True:
                     with output.condition:
@@ -83,6 +91,8 @@ class StreamingHandler(server.BaseHTTPRequestHandler):
                 logging.warning(
                     'Removed streaming client %s: %s',
                     self.client_address, str(e))
+            with output.condition:
+                output.clients -= 1
         else:
             self.send_error(404)
             self.end_headers()
@@ -92,22 +102,30 @@ class StreamingServer(socketserver.ThreadingMixIn, server.HTTPServer):
     allow_reuse_address = True
     daemon_threads = True
 
-# # 1296x972
-picam2 = Picamera2()
-#picam2.configure(picam2.create_video_configuration(main={"size": (640, 480)}))
-# higher resolution and lower framerate (5 FPS (200000 microseconds between frames))
-picam2.configure(picam2.create_video_configuration(main={"size": (820, 616)},controls={'FrameDurationLimits': (200000, 500000)}))
-#picam2.configure(picam2.create_video_configuration(main={"size": (1296, 972)},controls={'FrameDurationLimits': (200000, 500000)}))
-#picam2.configure(picam2.create_video_configuration(main={"size": (1296, 972)},controls={'FrameDurationLimits': (200000, 200000)}))
-#picam2.configure(picam2.create_video_configuration(main={"size": (1296, 972)},controls={'FrameDurationLimits': (50000, 200000)}))
-#picam2.configure(picam2.create_video_configuration(main={"size": (640, 480)},controls={'FrameDurationLimits': (200000, 500000)}))
-#picam2.configure(picam2.create_video_configuration(main={"size": (320, 240)},controls={'FrameDurationLimits': (200000, 500000)}))
+def encode_frames():
+    # read from the frame ring (made by camera_shm.py) and encode, if needed
+    shm = ShmFrames()
+    while not shm.attach():
+        time.sleep(2)
+    while True:
+        ok, img, t, n = shm.latest(timeout = 2.0)
+        if not ok:
+            # camera_shm may be restarted (new shared memory)
+            shm.attach()
+            continue
+        if output.clients == 0:
+            # no browser connected
+            continue
+        jpeg = simplejpeg.encode_jpeg(img, quality=80, colorspace='BGR')
+        del img
+        if shm.is_valid(n):
+            # not overwritten while encoding
+            output.write(jpeg)
+
 output = StreamingOutput()
-picam2.start_recording(JpegEncoder(), FileOutput(output))
+encoder = Thread(target=encode_frames, daemon=True)
+encoder.start()
 
-try:
-    address = ('', 7123)
-    server = StreamingServer(address, StreamingHandler)
-    server.serve_forever()
-finally:
-    picam2.stop_recording()
+address = ('', 7123)
+server = StreamingServer(address, StreamingHandler)
+server.serve_forever()
@@ -0,0 +1,261 @@
+/***************************************************************************
+ *   Copyright (C) 2014-2025 by DTU
+ *   jca@elektro.dtu.dk
+ *
+ *
+ * The MIT License (MIT)  https://mit-license.org/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software
+ * is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies
+ * or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+/**
+ * Binary telemetry frames (Teensy to host), used after a 'bin 1' command.
+ * The same file is used by the Teensy firmware (teensy_firmware_8/src)
+ * and by teensy_interface (teensy_interface/src) - keep the two copies equal.
+ *
+ * A frame is: 0x00, COBS(type, payload, CRC-16 (little endian)), 0x00
+ * COBS encoding ensures there is no 0x00 inside the frame,
+ * and text messages (';NN...\n') never contain a 0x00,
+ * so text and binary can be mixed on the same stream.
+ * The payload is one of the packed structures below (little endian).
+ * Teensy time is a double, as a float has a resolution of
+ * about 1 ms after 2 hours. */
+
+#ifndef UBINFRAME_H
+#define UBINFRAME_H
+
+#include <stdint.h>
+
+/// message types in a binary frame
+enum UBinType
+{
+  UBIN_NONE = 0,
+  UBIN_ENC,   // enc: encoder ticks
+  UBIN_POSE,  // pose: time x y h tilt
+  UBIN_VEL,   // vel: time, wheel velocity, turnrate, velocity, count
+  UBIN_GYRO,  // gyro: x y z time
+  UBIN_ACC,   // acc: x y z time
+  UBIN_LIV,   // liv: raw line sensor values
+  UBIN_LIVN,  // livn: normalized line sensor values
+  UBIN_HBT,   // hbt: heartbeat
+  UBIN_IR,    // ir: distance and calibration
+  UBIN_IRD,   // ird: distance and raw
+  UBIN_MCA,   // mca: motor current
+  UBIN_TYPES  // number of types
+};
+
+struct __attribute__((packed)) UBinEnc
+{
+  uint32_t enc[2];
+};
+
+struct __attribute__((packed)) UBinPose
+{
+  double time; // Teensy time (sec)
+  float pose[4]; // x, y, h, tilt
+};
+
+struct __attribute__((packed)) UBinVel
+{
+  double time; // Teensy time (sec)
+  float wheelVel[2];
+  float turnrate;
+  float velocity;
+  int32_t cnt;
+};
+
+struct __attribute__((packed)) UBinImu
+{ // used for both gyro and acc
+  float v[3];
+  double time; // Teensy time (sec)
+};
+
+struct __attribute__((packed)) UBinLiv
+{ // used for both liv and livn
+  int32_t v[8];
+  int32_t cnt;
+};
+
+struct __attribute__((packed)) UBinHbt
+{
+  double time; // Teensy time (sec)
+  int32_t deviceID;
+  int32_t revision;
+  float batteryVoltage;
+  int32_t state;
+  int32_t hwType;
+  float load;
+  float supplyCurrent;
+  int32_t batLowCnt;
+};
+
+struct __attribute__((packed)) UBinIr
+{
+  float distance[2];
+  uint32_t raw[2];
+  uint32_t cal13cm[2];
+  uint32_t cal50cm[2];
+  int32_t used;
+};
+
+struct __attribute__((packed)) UBinIrd
+{
+  float distance[2];
+  uint32_t raw[2];
+  int32_t used;
+};
+
+struct __attribute__((packed)) UBinMca
+{
+  float current[2];
+  int32_t cnt;
+};
+
+/// max payload size (largest structure)
+static const int UBIN_MAX_PAYLOAD = 48;
+/// max encoded frame size: 2 delimiters, type, payload, crc and COBS overhead
+static const int UBIN_MAX_FRAME = UBIN_MAX_PAYLOAD + 8;
+
+/**
+ * Payload size for a message type
+ * \returns size in bytes, or -1 for an unknown type */
+inline int ubinPayloadSize(int type)
+{
+  switch (type)
+  {
+    case UBIN_ENC:  return sizeof(UBinEnc);
+    case UBIN_POSE: return sizeof(UBinPose);
+    case UBIN_VEL:  return sizeof(UBinVel);
+    case UBIN_GYRO:
+    case UBIN_ACC:  return sizeof(UBinImu);
+    case UBIN_LIV:
+    case UBIN_LIVN: return sizeof(UBinLiv);
+    case UBIN_HBT:  return sizeof(UBinHbt);
+    case UBIN_IR:   return sizeof(UBinIr);
+    case UBIN_IRD:  return sizeof(UBinIrd);
+    case UBIN_MCA:  return sizeof(UBinMca);
+    default: return -1;
+  }
+}
+
+/**
+ * Message key (as in the text protocol) for a message type
+ * \returns key or nullptr for an unknown type */
+inline const char * ubinKeyName(int type)
+{
+  static const char * names[UBIN_TYPES] =
+    {nullptr, "enc", "pose", "vel", "gyro", "acc", "liv", "livn", "hbt", "ir", "ird", "mca"};
+  if (type > UBIN_NONE and type < UBIN_TYPES)
+    return names[type];
+  return nullptr;
+}
+
+/**
+ * CRC-16-CCITT (polynomial 0x1021, start value 0xffff) */
+inline uint16_t ubinCrc16(const uint8_t * data, int n)
+{
+  uint16_t crc = 0xffff;
+  for (int i = 0; i < n; i++)
+  {
+    crc ^= uint16_t(data[i]) << 8;
+    for (int b = 0; b < 8; b++)
+    {
+      if (crc & 0x8000)
+        crc = (crc << 1) ^ 0x1021;
+      else
+        crc <<= 1;
+    }
+  }
+  return crc;
+}
+
+/**
+ * COBS encode n bytes (n < 254) from src to dst.
+ * dst must have space for n + 1 bytes.
+ * \returns number of bytes in dst */
+inline int ubinCobsEncode(const uint8_t * src, int n, uint8_t * dst)
+{
+  int code = 0; // index of current code byte
+  int d = 1;
+  for (int i = 0; i < n; i++)
+  {
+    if (src[i] == 0)
+    { // code is distance to this zero
+      dst[code] = d - code;
+      code = d++;
+    }
+    else
+      dst[d++] = src[i];
+  }
+  dst[code] = d - code;
+  return d;
+}
+
+/**
+ * COBS decode n bytes (without delimiters) from src to dst.
+ * \param maxLen is the space in dst
+ * \returns number of decoded bytes, or -1 if the frame is invalid */
+inline int ubinCobsDecode(const uint8_t * src, int n, uint8_t * dst, int maxLen)
+{
+  int d = 0;
+  int i = 0;
+  while (i < n)
+  {
+    int code = src[i++];
+    if (code == 0 or i + code - 1 > n)
+      return -1;
+    for (int j = 1; j < code; j++)
+    {
+      if (d >= maxLen)
+        return -1;
+      dst[d++] = src[i++];
+    }
+    if (code < 0xff and i < n)
+    { // a zero, except after the last group
+      if (d >= maxLen)
+        return -1;
+      dst[d++] = 0;
+    }
+  }
+  return d;
+}
+
+/**
+ * Build a full frame (with delimiters) for this message
+ * \param type is the message type
+ * \param payload is the packed structure
+ * \param n is the payload size
+ * \param frame is the destination, at least UBIN_MAX_FRAME bytes
+ * \returns number of bytes in frame, or 0 if payload is too large */
+inline int ubinMakeFrame(uint8_t type, const void * payload, int n, uint8_t * frame)
+{
+  if (n > UBIN_MAX_PAYLOAD)
+    return 0;
+  uint8_t raw[UBIN_MAX_PAYLOAD + 3];
+  raw[0] = type;
+  const uint8_t * p = (const uint8_t *)payload;
+  for (int i = 0; i < n; i++)
+    raw[i + 1] = p[i];
+  uint16_t crc = ubinCrc16(raw, n + 1);
+  raw[n + 1] = crc & 0xff;
+  raw[n + 2] = crc >> 8;
+  frame[0] = 0;
+  int m = ubinCobsEncode(raw, n + 3, &frame[1]);
+  frame[m + 1] = 0;
+  return m + 2;
+}
+
+#endif
@@ -33,6 +33,7 @@
 #include "umotor.h"
 #include "ucurrent.h"
 #include "uad.h"
+#include "ubinframe.h"
 
 UCurrent current;
 
@@ -171,11 +172,19 @@ void UCurrent::sendMotorCurrent()
   char reply[MRL];
   if (motorAvgCnt == 0)
     motorAvgCnt = 1;
-  snprintf(reply, MRL,"mca %.3f %.3f %d\r\n", motorCurrentAvg[0]/motorAvgCnt, motorCurrentAvg[1]/motorAvgCnt, motorAvgCnt);
+  if (usb.binaryMode)
+  {
+    UBinMca b = {{motorCurrentAvg[0]/motorAvgCnt, motorCurrentAvg[1]/motorAvgCnt}, motorAvgCnt};
+    usb.sendBinary(UBIN_MCA, &b, sizeof(b));
+  }
+  else
+  {
+    snprintf(reply, MRL,"mca %.3f %.3f %d\r\n", motorCurrentAvg[0]/motorAvgCnt, motorCurrentAvg[1]/motorAvgCnt, motorAvgCnt);
+    usb.send(reply);
+  }
   motorCurrentAvg[0] = 0;
   motorCurrentAvg[1] = 0;
   motorAvgCnt = 0;
-  usb.send(reply);
 }
 
 void UCurrent::sendMotorCurrentOffset()
@@ -31,6 +31,7 @@
 #include "umotortest.h"
 #include "umotor.h"
 #include "uservice.h"
+#include "ubinframe.h"
 
 UEncoder encoder;
 
@@ -163,6 +164,12 @@ void UEncoder::sendEncStatus()
   char s[MSL];
   // changed to svs rather than svo, the bridge do not handle same name 
   // both to and from robot - gets relayed back to robot (create overhead)
+  if (usb.binaryMode)
+  {
+    UBinEnc b = {{encoder[0], encoder[1]}};
+    usb.sendBinary(UBIN_ENC, &b, sizeof(b));
+    return;
+  }
   snprintf(s, MSL, "enc %lu %lu\r\n", encoder[0], encoder[1]);
   usb.send(s);
 }
@@ -198,6 +205,12 @@ void UEncoder::sendPose()
 {
   const int MSL = 200;
   char s[MSL];
+  if (usb.binaryMode)
+  {
+    UBinPose b = {service.time_sec_double(), {pose[0], pose[1], pose[2], pose[3]}};
+    usb.sendBinary(UBIN_POSE, &b, sizeof(b));
+    return;
+  }
   snprintf(s, MSL, "pose %.4f %.3f %.3f %.4f %.4f\n",
            service.time_sec(),
            pose[0], pose[1], pose[2], pose[3]);
@@ -210,14 +223,26 @@ void UEncoder::sendVelocity()
   char s[MSL];
   if (velSubscribeCnt > 0)
   { // use as average since last report
-    snprintf(s, MSL, "vel %.4f %.3f %.3f %.4f %.3f %d\n",
-             service.time_sec(),
-             wheelVelocityEstSum[0]/velSubscribeCnt,
-             wheelVelocityEstSum[1]/velSubscribeCnt,
-             robotTurnrateSum/velSubscribeCnt,
-             robotVelocitySum/velSubscribeCnt,
-             velSubscribeCnt);
-    usb.send(s);
+    if (usb.binaryMode)
+    {
+      UBinVel b = {service.time_sec_double(),
+                   {wheelVelocityEstSum[0]/velSubscribeCnt, wheelVelocityEstSum[1]/velSubscribeCnt},
+                   robotTurnrateSum/velSubscribeCnt,
+                   robotVelocitySum/velSubscribeCnt,
+                   velSubscribeCnt};
+      usb.sendBinary(UBIN_VEL, &b, sizeof(b));
+    }
+    else
+    {
+      snprintf(s, MSL, "vel %.4f %.3f %.3f %.4f %.3f %d\n",
+              service.time_sec(),
+              wheelVelocityEstSum[0]/velSubscribeCnt,
+              wheelVelocityEstSum[1]/velSubscribeCnt,
+              robotTurnrateSum/velSubscribeCnt,
+              robotVelocitySum/velSubscribeCnt,
+              velSubscribeCnt);
+      usb.send(s);
+    }
     wheelVelocityEstSum[0] = 0;
     wheelVelocityEstSum[1] = 0;
     robotTurnrateSum = 0.0;
@@ -25,6 +25,8 @@
 #include "uencoder.h"
 #include "urobot.h"
 #include "uservice.h"
+#include "uusb.h"
+#include "ubinframe.h"
 
 
 UImu2 imu2;
@@ -294,6 +296,12 @@ void UImu2::sendStatusGyro()
 {
   const int MRL = 250;
   char reply[MRL];
+  if (usb.binaryMode)
+  {
+    UBinImu b = {{gyro[0], gyro[1], gyro[2]}, service.time_sec_double()};
+    usb.sendBinary(UBIN_GYRO, &b, sizeof(b));
+    return;
+  }
   snprintf(reply, MRL, "gyro %f %f %f %.3f\r\n",
            gyro[0], gyro[1], gyro[2], service.time_sec());
   usb.send(reply);
@@ -303,6 +311,12 @@ void UImu2::sendStatusAcc()
 {
   const int MRL = 250;
   char reply[MRL];
+  if (usb.binaryMode)
+  {
+    UBinImu b = {{acc[0], acc[1], acc[2]}, service.time_sec_double()};
+    usb.sendBinary(UBIN_ACC, &b, sizeof(b));
+    return;
+  }
   snprintf(reply, MRL, "acc %f %f %f %.3f\r\n",
            acc[0], acc[1], acc[2], service.time_sec());
   usb.send(reply);
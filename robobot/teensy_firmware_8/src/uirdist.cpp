@@ -25,6 +25,8 @@
 #include "uirdist.h"
 #include "ueeconfig.h"
 #include "uad.h"
+#include "uusb.h"
+#include "ubinframe.h"
 
 /// Sharp IR distance sensor interface object.
 UIrDist irdist;
@@ -100,6 +102,13 @@ void UIrDist::sendStatusDistIR()
 {
   const int MRL = 64;
   char reply[MRL];
+  if (usb.binaryMode)
+  {
+    UBinIr b = {{irDistance[0], irDistance[1]}, {irRaw[0], irRaw[1]},
+                {irCal13cm[0], irCal13cm[1]}, {irCal50cm[0], irCal50cm[1]}, useDistSensor};
+    usb.sendBinary(UBIN_IR, &b, sizeof(b));
+    return;
+  }
   snprintf(reply, MRL, "ir %.3f %.3f %lu %lu %lu %lu %lu %lu %d \r\n" ,
            irDistance[0], irDistance[1],
            irRaw[0], irRaw[1],
@@ -114,6 +123,12 @@ void UIrDist::sendStatusDistIR2()
 {
   const int MRL = 64;
   char reply[MRL];
+  if (usb.binaryMode)
+  {
+    UBinIrd b = {{irDistance[0], irDistance[1]}, {irRaw[0], irRaw[1]}, useDistSensor};
+    usb.sendBinary(UBIN_IRD, &b, sizeof(b));
+    return;
+  }
   snprintf(reply, MRL, "ird %.3f %.3f %lu %lu %d\r\n" ,
            irDistance[0], irDistance[1],
            irRaw[0], irRaw[1],
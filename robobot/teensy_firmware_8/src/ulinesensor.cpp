@@ -31,6 +31,7 @@
 #include "uencoder.h"
 #include "uimu2.h"
 #include "urobot.h"
+#include "ubinframe.h"
 
 ULineSensor ls;
 //////////////////////////////////////////////
@@ -411,6 +412,15 @@ void ULineSensor::sendStatusLineSensor(bool normalized)
     int n = lineSensorValueSumCnt;
     if (n < 1)
       n = 1;
+    if (usb.binaryMode)
+    {
+      UBinLiv b;
+      for (int i = 0; i < 8; i++)
+        b.v[i] = int(lineSensorValueSum[i]/n * 1000);
+      b.cnt = n;
+      usb.sendBinary(UBIN_LIVN, &b, sizeof(b));
+      return;
+    }
     snprintf(reply, MRL, "livn %d %d %d %d %d %d %d %d %d\r\n" ,
              int(lineSensorValueSum[0]/n * 1000),
              int(lineSensorValueSum[1]/n * 1000),
@@ -429,6 +439,18 @@ void ULineSensor::sendStatusLineSensor(bool normalized)
       div = 1;
     else
       div = adcLSDACnt;
+    if (usb.binaryMode)
+    {
+      UBinLiv b;
+      for (int i = 0; i < 8; i++)
+        b.v[i] = adcLSDA[i]/div;
+      b.cnt = div;
+      usb.sendBinary(UBIN_LIV, &b, sizeof(b));
+      adcLSDACnt = 0;
+      for (int i = 0; i < 8; i++)
+        adcLSDA[i] = 0;
+      return;
+    }
     snprintf(reply, MRL, "liv %ld %ld %ld %ld %ld %ld %ld %ld %d\r\n" ,
              adcLSDA[0]/div,
              adcLSDA[1]/div,
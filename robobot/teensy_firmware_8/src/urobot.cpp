@@ -42,6 +42,7 @@
 #include "uledband.h"
 #include "uservice.h"
 #include "ucurrent.h"
+#include "ubinframe.h"
 
 // URobot::URobot()
 // {
@@ -237,6 +238,14 @@ void URobot::sendState()
    *     7 : load 
    *     8,9 : motor enabled (left,right)
    * */
+  if (usb.binaryMode)
+  {
+    UBinHbt b = {service.time_sec_double(), deviceID, command.getRevisionNumber()/10,
+                 robot.batteryVoltage, 4, robotHWversion, load * 100,
+                 current.getSupplyCurrent(), batLowCnt};
+    usb.sendBinary(UBIN_HBT, &b, sizeof(b));
+    return;
+  }
   snprintf(reply, MRL,  "hbt %.4f %d %d %.2f %d %d %.1f %.2f %d\r\n",
            service.time_sec(),
            deviceID,
@@ -65,6 +65,11 @@ public:
   {
     return float(time_us)*1e-6;
   }
+  /// time in seconds with full us resolution (used in binary frames)
+  inline double time_sec_double()
+  {
+    return double(time_us)*1e-6;
+  }
   static void sampleTimeInterrupt();
 
   /**
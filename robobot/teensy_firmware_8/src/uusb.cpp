@@ -30,6 +30,7 @@
 #include "usubss.h"
 #include "uservice.h"
 #include "urobot.h"
+#include "ubinframe.h"
 
 UUSB usb;
 
@@ -161,6 +162,23 @@ bool UUSB::send(const char* str) // , bool blocking)
   return sendOK;
 }
 
+bool UUSB::sendBinary(uint8_t type, const void* payload, int n)
+{
+  bool sendOK = false;
+  if (usbIsUp)
+  {
+    uint8_t frame[UBIN_MAX_FRAME];
+    int m = ubinMakeFrame(type, payload, n, frame);
+    if (m > 0)
+      sendOK = usb_serial_write(frame, m) == m;
+  }
+  if (sendOK == false)
+    usbSendFail++;
+  else
+    usbSendCnt++;
+  return sendOK;
+}
+
 void UUSB::sendData(int item)
 {
   if (item == 0)
@@ -210,6 +228,8 @@ void UUSB::sendHelp()
   send(reply);
   snprintf(reply, MRL, "# -- \tsilent V \tShould USB be silent, if no communication (1=auto silent) silent=%d (pt no effect)\r\n", silenceUSBauto);
   send(reply);
+  snprintf(reply, MRL, "# -- \tbin V \tSend telemetry as binary frames: V=1: binary (is=%d), V=0: text\r\n", binaryMode);
+  send(reply);
   send(                "# -- \talive \tIgnorred, but used to keep communication alive (once a sec is fine)\r\n");
 }
 
@@ -222,6 +242,9 @@ bool UUSB::decode(const char* buf)
     localEcho = *p1 == '1';
     // when local echo, there is no need for CRC, so turn it off
     use_CRC = not localEcho;
+    // and telemetry should be readable
+    if (localEcho)
+      binaryMode = false;
   }
   else if (strncmp(buf, "silent ", 7) == 0)
   {
@@ -233,6 +256,11 @@ bool UUSB::decode(const char* buf)
     const char * p1 = &buf[8];
         allowNoCRC = strtol(p1, nullptr, 10);
   }
+  else if (strncmp(buf, "bin ", 4) == 0)
+  {
+    const char * p1 = &buf[4];
+    binaryMode = strtol(p1, nullptr, 10) == 1 and not localEcho;
+  }
   else if (strncmp(buf, "alive", 5) == 0)
   {
     // accepted, but ignored
@@ -395,9 +423,19 @@ bool UUSB::receivedCharFromUSB(uint8_t n)
             char * msg = &usbRxBuf[3];
             // check for individual confirm character
             bool confirm = msg[0] == '!';
+            // and a potential sequence number, like '!17:sub enc 10'
+            int seqLen = 0;
             if (confirm)
-              // skip the '!'
+            { // skip the '!'
               msg++;
+              while (msg[seqLen] >= '0' and msg[seqLen] <= '9')
+                seqLen++;
+              if (seqLen > 0 and msg[seqLen] == ':')
+                // skip the sequence number too
+                msg += seqLen + 1;
+              else
+                seqLen = 0;
+            }
             command.parse_and_execute_command(msg);
             usbInMsgCnt++;
             debugCnt = 0;
@@ -405,10 +443,17 @@ bool UUSB::receivedCharFromUSB(uint8_t n)
             {
               const int MSL = 250;
               char s[MSL+1];
-              snprintf(s, MSL, "confirm %s\n", &usbRxBuf[3]);
-              // confirm max first 42 characters
-              s[MSL-1] = '\n';
-              s[MSL] = '\0';
+              if (seqLen > 0)
+              { // confirm the sequence number only, like 'confirm !17:'
+                snprintf(s, MSL, "confirm !%.*s:\n", seqLen, &usbRxBuf[4]);
+              }
+              else
+              {
+                snprintf(s, MSL, "confirm %s\n", &usbRxBuf[3]);
+                // confirm max first 42 characters
+                s[MSL-1] = '\n';
+                s[MSL] = '\0';
+              }
               send(s);
             }
           }
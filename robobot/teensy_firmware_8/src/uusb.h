@@ -60,6 +60,8 @@ private:
 public:
   bool usbIsUp = false;
   bool use_CRC = true;
+  /// send telemetry as binary frames (see ubinframe.h), set by 'bin 1'
+  bool binaryMode = false;
 
   void setup();
   /**
@@ -85,6 +87,12 @@ public:
   }
   
   bool sendInfoAsCommentWithTime(const char* info, const char * msg);
+  /** send a binary frame to USB host (see ubinframe.h)
+   * \param type is the message type (UBinType)
+   * \param payload is the packed message structure
+   * \param n is the size of the payload
+   * return true if send. */
+  bool sendBinary(uint8_t type, const void * payload, int n);
   /**
    * send help and status */
   void sendHelp() override;
@@ -0,0 +1,240 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <math.h>
+#include "clinefollow.h"
+#include "cmixer.h"
+#include "sedge.h"
+#include "uservice.h"
+#include "umqtt.h"
+#include "ulogger.h"
+#include "uconfig.h"
+
+// create value
+CLineFollow linefollow;
+
+
+void CLineFollow::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("linefollow"))
+  { // no data yet, so generate some default values
+    ini["linefollow"]["use"] = "true";
+    ini["linefollow"]["log"] = "true";
+    ini["linefollow"]["print"] = "false";
+    ini["linefollow"]["teensy"] = "0"; // Teensy with the line sensor
+    // controller, from line position (sensor spacing) to turnrate (rad/s)
+    ini["linefollow"]["kp"] = "0.5";
+    ini["linefollow"]["lead"] = "0 1.0"; // tau_d (sec) and alpha, tau_d = 0.0 means no function
+    ini["linefollow"]["taui"] = "0.0";   // tau_i (sec) 0.0 is no integrator function
+    ini["linefollow"]["max_turnrate"] = "4.0"; // (rad/s)
+    // line detection (1000 is calibrated white)
+    ini["linefollow"]["valid_threshold"] = "750";
+    ini["linefollow"]["low"] = "650";
+    ini["linefollow"]["lost_samples"] = "20"; // stop when line is lost this many samples
+  }
+  tn = strtol(ini["linefollow"]["teensy"].c_str(), nullptr, 10);
+  if (tn < 0 or tn >= service.teensyCnt)
+    tn = 0;
+  validThreshold = strtol(ini["linefollow"]["valid_threshold"].c_str(), nullptr, 10);
+  low = strtol(ini["linefollow"]["low"].c_str(), nullptr, 10);
+  lostMax = strtol(ini["linefollow"]["lost_samples"].c_str(), nullptr, 10);
+  // sample time from edge module
+  std::string es = "edge" + std::to_string(tn);
+  sampleTime = strtof(ini[es]["interval_livn_ms"].c_str(), nullptr) / 1000.0;
+  if (sampleTime < 0.001)
+    sampleTime = 0.01;
+  setupPid();
+  // MQTT
+  topic = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "line";
+  //
+  if (ini["linefollow"]["use"] == "true")
+  {
+    toConsole = ini["linefollow"]["print"] == "true";
+    if (ini["linefollow"]["log"] == "true" and logCh < 0)
+    { // open logfile
+      logCh = logger.addChannel("log_linefollow", "%d %d %.3f %.3f %.3f %.3f %d");
+      logger.addHeader(logCh, "%% Line follow logfile\n");
+      logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+      logger.addHeader(logCh, "%% 2 \tActive (1 = line follow is controlling the mixer)\n");
+      logger.addHeader(logCh, "%% 3 \tLine valid (1 = valid)\n");
+      logger.addHeader(logCh, "%% 4 \tLine position (-3.5 = left sensor, 3.5 = right sensor)\n");
+      logger.addHeader(logCh, "%% 5 \tReference position\n");
+      logger.addHeader(logCh, "%% 6 \tVelocity (m/s)\n");
+      logger.addHeader(logCh, "%% 7 \tTurnrate (rad/s)\n");
+      logger.addHeader(logCh, "%% 8 \tOutput limited (1 = limited)\n");
+    }
+    if (th1 == nullptr)
+      th1 = new std::thread(runObj, this);
+  }
+}
+
+void CLineFollow::setupPid()
+{
+  float kp = strtof(ini["linefollow"]["kp"].c_str(), nullptr);
+  const char * p1 = ini["linefollow"]["lead"].c_str();
+  float taud = strtof(p1, (char**)&p1);
+  float alpha = strtof(p1, (char**)&p1);
+  float taui = strtof(ini["linefollow"]["taui"].c_str(), nullptr);
+  float maxTr = strtof(ini["linefollow"]["max_turnrate"].c_str(), nullptr);
+  pid.setup(sampleTime, kp, taud, alpha, taui, 0, maxTr);
+}
+
+bool CLineFollow::decode(const char* msg, const char* params, UTime&)
+{
+  bool used = true;
+  const char * p1 = params;
+  if (strcmp(msg, "line") == 0)
+  { // like: 'line 0.25 0.0' velocity and line position
+    float vel = strtof(p1, (char**)&p1);
+    refPosition = strtof(p1, (char**)&p1);
+    if (fabsf(vel) < 0.001)
+    { // stop line follow and robot (ignored by the mixer if not active)
+      mixer.setVelocity(0, 0, 3);
+      active = false;
+    }
+    else
+    {
+      if (not active)
+        // new start, controller is reset by run()
+        restartRequest = true;
+      velocity = vel;
+      active = true;
+    }
+    printf("# CLineFollow::decode: line follow %s, vel=%.3f m/s, ref=%.2f\n",
+           active ? "active" : "stopped", vel, refPosition.load());
+  }
+  else if (strcmp(msg, "linepid") == 0)
+  { // like: 'linepid 0.5 0.0 1.0 0.0 4.0' kp tau_d alpha tau_i max
+    float * v = newPid;
+    for (int i = 0; i < 5; i++)
+      v[i] = strtof(p1, (char**)&p1);
+    // used by run()
+    pidRequest = true;
+    config.setIni("linefollow", "kp", std::to_string(v[0]));
+    config.setIni("linefollow", "lead", std::to_string(v[1]) + " " + std::to_string(v[2]));
+    config.setIni("linefollow", "taui", std::to_string(v[3]));
+    config.setIni("linefollow", "max_turnrate", std::to_string(v[4]));
+  }
+  else
+    used = false;
+  return used;
+}
+
+void CLineFollow::findLine(const SEdge::Data & d)
+{ // center of gravity of the values above 'low'
+  int high = 0;
+  float sum = 0;
+  float posSum = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    if (d.adn[i] > high)
+      high = d.adn[i];
+    int v = d.adn[i] - low;
+    if (v > 0)
+    {
+      sum += v;
+      posSum += i * v;
+    }
+  }
+  lineValid = high >= validThreshold and sum > 0;
+  if (lineValid)
+    position = posSum / sum - 3.5;
+  else
+    position = 0;
+}
+
+void CLineFollow::run()
+{
+  SEdge::Data d;
+  int edgeVersion = 0;
+  UTime t;
+  while (not service.stop)
+  { // run at the line sensor sample rate
+    if (not edge[tn].snapshot.waitForUpdate(edgeVersion, 0.1))
+      continue;
+    edgeVersion = edge[tn].snapshot.read(d);
+    if (pidRequest)
+    { // new controller parameters (from MQTT)
+      pid.setup(sampleTime, newPid[0], newPid[1], newPid[2], newPid[3], 0, newPid[4]);
+      pid.resetHistory();
+      pidRequest = false;
+    }
+    findLine(d);
+    if (not active)
+      continue;
+    if (restartRequest)
+    { // set before active by decode()
+      pid.resetHistory();
+      lostCnt = 0;
+      restartRequest = false;
+    }
+    if (lineValid)
+      lostCnt = 0;
+    else if (++lostCnt > lostMax)
+    { // line is lost, stop (while still owning the drive)
+      mixer.setVelocity(0, 0, 3);
+      active = false;
+      printf("# CLineFollow::run: line lost for %d samples, stopped\n", lostCnt);
+      continue;
+    }
+    if (lineValid)
+      // a line to the right gives a positive position,
+      // the robot should then turn right (negative turnrate)
+      turnrate = pid.pid(refPosition, position, limited, 0);
+    // rejected if an rc order has stopped line follow since the test above
+    mixer.setVelocity(velocity, turnrate, 3);
+    t.now();
+    latency.add(t - d.updTime);
+    toLog(d.updTime);
+  }
+}
+
+void CLineFollow::toLog(UTime & t)
+{
+  if (service.stop)
+    return;
+  if (logCh >= 0 and not service.stop_logging)
+  {
+    logger.log(logCh, t, active.load(), lineValid, position, refPosition.load(), velocity.load(), turnrate, limited);
+  }
+  const int MSL = 100;
+  char s[MSL];
+  snprintf(s, MSL, "%d %.3f %.3f %.3f\n", lineValid, position, velocity.load(), turnrate);
+  mqtt.publish(topic.c_str(), s, t);
+  if (toConsole)
+    printf("%% CLineFollow: %lu.%04ld %d %d %.3f %.3f %.3f %.3f %d\n",
+           t.getSec(), t.getMicrosec()/100,
+           active.load(), lineValid, position, refPosition.load(), velocity.load(), turnrate, limited);
+}
+
+void CLineFollow::terminate()
+{
+  if (th1 != nullptr)
+  {
+    th1->join();
+  }
+  // logfile is closed by the logger
+}
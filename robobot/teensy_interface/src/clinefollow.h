@@ -0,0 +1,121 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef CLINEFOLLOW_H
+#define CLINEFOLLOW_H
+
+#include <thread>
+#include <atomic>
+
+#include "utime.h"
+#include "upid.h"
+#include "uhistogram.h"
+#include "sedge.h"
+
+/**
+ * Line follow controller.
+ * Uses the normalized line sensor values (edge module) to find
+ * the line position and controls the turnrate through the mixer,
+ * at the line sensor sample rate.
+ * Started and stopped by MQTT 'robobot/cmd/ti/line vel ref'.
+ * */
+class CLineFollow
+{
+public:
+  /** setup and initialize parameters */
+  void setup();
+  /**
+   * Decode messages
+   * 'line vel ref' starts line follow with velocity vel (m/s),
+   *           and line position ref (-3.5 (left) .. 3.5 (right)), vel=0 stops.
+   * 'linepid kp tau_d alpha tau_i max' sets controller parameters.
+   * \returns true if used */
+  bool decode(const char* msg, const char * params, UTime & msgTime);
+  /**
+   * thread to do updates, when new line sensor data is available */
+  void run();
+  /**
+   * close down */
+  void terminate();
+
+public:
+  /// line position (-3.5 is left sensor, 3.5 is right sensor, 0 is center)
+  float position = 0;
+  /// highest sensor value is above valid threshold
+  bool lineValid = false;
+  /// line follow is active (set false by an rc order, see CMixer::decode)
+  std::atomic<bool> active{false};
+  /// time from line sensor values are received until new turnrate is set
+  UHistogram latency;
+
+private:
+  static void runObj(CLineFollow * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  /**
+   * Find line position as center of gravity of
+   * sensor values above 'low' */
+  void findLine(const SEdge::Data & d);
+  /**
+   * Read controller parameters from ini-file into the PID controller */
+  void setupPid();
+  /** log data for this module */
+  void toLog(UTime & t);
+  std::thread * th1 = nullptr;
+  /// Teensy with the line sensor
+  int tn = 0;
+  /// controller, measurement is line position, output is turnrate (rad/s)
+  UPID pid;
+  float sampleTime = 0.01;
+  /// velocity (m/s) and line position reference (set by MQTT)
+  std::atomic<float> velocity{0};
+  std::atomic<float> refPosition{0};
+  /// restart (reset controller), and new controller parameters
+  /// (kp tau_d alpha tau_i max), set by decode() and applied by run()
+  std::atomic<bool> restartRequest{false};
+  std::atomic<bool> pidRequest{false};
+  float newPid[5] = {0};
+  /// controller output (rad/s)
+  float turnrate = 0;
+  bool limited = false;
+  /// a line is valid, if highest value is above this (1000 is calibrated white)
+  int validThreshold = 750;
+  /// values below this are ignored in position
+  int low = 650;
+  /// stop if no valid line for this many samples
+  int lostMax = 20;
+  int lostCnt = 0;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
+  bool toConsole = false;
+  /// MQTT
+  std::string topic;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern CLineFollow linefollow;
+
+#endif
@@ -34,6 +34,11 @@
 // #include "csteering.h"
 #include "mjoy.h"
 #include "mvelocity.h"
+#include "ulogger.h"
+#include "ctrajectory.h"
+#include "urealtime.h"
+#include "cpipeline.h"
+#include "clinefollow.h"
 #include <stdlib.h>
 
 // create value
@@ -89,8 +94,8 @@ void CMixer::setup()
   // p1 = ini["mixer"]["turnRight"].c_str();
   // for (int i = 0; i < 3; i++)
   //   turnMotorRight[i] = strtol(p1, (char **)&p1, 10);
-  bool allIdsOK = limitMotorValues(driveMotorLeft, NUM_TEENSY_MAX, 2);
-  allIdsOK &= limitMotorValues(driveMotorRight, NUM_TEENSY_MAX, 2);
+  bool allIdsOK = limitMotorValues(driveMotorLeft, service.teensyCnt, 2);
+  allIdsOK &= limitMotorValues(driveMotorRight, service.teensyCnt, 2);
   // allIdsOK &= limitMotorValues(turnMotorLeft, NUM_TEENSY_MAX, 4);
   // allIdsOK &= limitMotorValues(turnMotorRight, NUM_TEENSY_MAX, 4);
   if (not allIdsOK)
@@ -102,26 +107,28 @@ void CMixer::setup()
     // ini["mixer"]["turnRight"] =  to_string(turnMotorRight[0]) + " " +  to_string(turnMotorRight[1]) + " " +  to_string(turnMotorRight[2]);
   }
   //
-  if (ini["mixer"]["use"] == "true")
+  use = ini["mixer"]["use"] == "true";
+  if (use)
   { // Mixer to drive robot should be active
     toConsole = ini["mixer"]["print"] == "true";
-    if (ini["mixer"]["log"] == "true" and logfile == nullptr)
+    if (ini["mixer"]["log"] == "true" and logCh < 0)
     { // open logfile
-      std::string fn = service.logPath + "log_mixer.txt";
-      logfile = fopen(fn.c_str(), "w");
-      fprintf(logfile, "%% Mixer logfile\n");
-      fprintf(logfile, "%% Wheel base used in calculation: %g m\n", wheelbase);
-      fprintf(logfile, "%% 1 \tTime (sec)\n");
-      fprintf(logfile, "%% 2 \tcontrol source 0 = this, 1 = manuel (gamepad), 2.. = MQTT\n");
-      fprintf(logfile, "%% 3 \tmanual override mode (0= automatic, 1=manuel mode (gamepad))\n");
-      fprintf(logfile, "%% 4 \tLinear velocity (m/s)\n");
-      fprintf(logfile, "%% 5 \tCurvature (rad/m)\n");
-      fprintf(logfile, "%% 6 \tDesired left wheel velocity (rad/s)\n");
-      fprintf(logfile, "%% 7 \tDesired right wheel velocity (rad/s)\n");
-      // fprintf(logfile, "%% 7 \tDesired left turn-motor velocity (rad/s)\n");
-      // fprintf(logfile, "%% 8 \tDesired right turn-motor velocity (rad/s)\n");
+      logCh = logger.addChannel("log_mixer", "%d %d %.3f %.3f %.3f %.3f %d");
+      logger.addHeader(logCh, "%% Mixer logfile\n");
+      logger.addHeader(logCh, "%% Wheel base used in calculation: %g m\n", wheelbase);
+      logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+      logger.addHeader(logCh, "%% 2 \tcontrol source 0 = this, 1 = manuel (gamepad), 2 = MQTT, 3 = line follow, 4 = trajectory\n");
+      logger.addHeader(logCh, "%% 3 \tmanual override mode (0= automatic, 1=manuel mode (gamepad))\n");
+      logger.addHeader(logCh, "%% 4 \tLinear velocity (m/s)\n");
+      logger.addHeader(logCh, "%% 5 \tCurvature (rad/m)\n");
+      logger.addHeader(logCh, "%% 6 \tDesired left wheel velocity (rad/s)\n");
+      logger.addHeader(logCh, "%% 7 \tDesired right wheel velocity (rad/s)\n");
+      // logger.addHeader(logCh, "%% 7 \tDesired left turn-motor velocity (rad/s)\n");
+      // logger.addHeader(logCh, "%% 8 \tDesired right turn-motor velocity (rad/s)\n");
     }
-    if (th1 == nullptr)
+    // else run by the control pipeline of the drive Teensy
+    inPipeline = pipeline.use and not teensy[driveMotorLeft[0]].disabled;
+    if (th1 == nullptr and not inPipeline)
       th1 = new std::thread(runObj, this);
   }
 }
@@ -142,7 +149,11 @@ bool CMixer::decode(const char* msg, const char * params, UTime & msgTime)
     float vel = strtof(p1, (char**)&p1);
     float rot = strtof(p1, (char**)&p1);
     if (rcSource > 1)
-    {
+    { // an rc order overrules line follow
+      {
+        std::lock_guard<std::mutex> lock(setpointLock);
+        linefollow.active = false;
+      }
       setVelocity(vel, rot);
       // notify users of a new update
       updateCnt++;
@@ -159,98 +170,159 @@ bool CMixer::decode(const char* msg, const char * params, UTime & msgTime)
 
 void CMixer::run()
 {
-  bool upd;
-  // bool updTurnMotors;
-  int loop = 0;
+  realtime.configure("mixer");
+  period.start("mixer", 0.001, true);
   while (not service.stop)
   {
-    loop++;
+    step();
+    period.wait();
+  }
+}
+
+void CMixer::step()
+{
+  bool upd;
+  {
+    std::lock_guard<std::mutex> lock(setpointLock);
     upd = autoUpdate;
     autoUpdate = false;
-    // updTurnMotors = false;
-    manualOverride = joy.manualMode();
-    if (joy.updateCnt != oldUpdCntManual and manualOverride)
-    { // new manual values
-      oldUpdCntManual = joy.updateCnt;
-      upd = true;
+  }
+  // updTurnMotors = false;
+  manualOverride = joy.manualMode();
+  if (manualRef.version() != oldUpdCntManual and manualOverride)
+  { // new manual values
+    upd = true;
+  }
+  // trajectory set-points are generated here at the mixer rate
+  bool trajActive = false;
+  if (manualOverride)
+  {
+    if (trajWasActive)
+      traj.clear();
+  }
+  else
+    trajActive = traj.update(trajVel, trajTurnrate);
+  if (trajActive)
+    upd = true;
+  else if (trajWasActive)
+  { // trajectory ended
+    if (not traj.wasCleared())
+    { // finished (or stopped), so stay stopped,
+      // else keep the set-point from the order that cleared it (e.g. rc)
+      std::lock_guard<std::mutex> lock(setpointLock);
+      desiredLinVel = 0;
+      desiredCurvature = 0;
     }
-    if (upd or updateTime.getTimePassed() > 0.5)
-    { // use the new data
-      updateTime.now();
-      if (manualOverride)
-      {  // source is manual control
-        linVel = joy.velocity;
-        turnrate = joy.turnValue;
-        rcSource = 0;
-        // if (loop % 50 == 0)
-        printf("# CMixer, manualOverride, vel=%f (rad/s), curvature=%f (rad/m)\n", linVel, turnrate);
-      }
-      else
-      { // source is MQTT
-        linVel = desiredLinVel;
-        turnrate = desiredCurvature;
-        // if (loop % 50 == 0)
-        //  printf("# CMixer::run: auto, vel=%f (rad/s), curvature=%f (rad/m)\n", linVel, turnrate);
-      }
-      // mix to motor velocities
-      // use actual steering curvature or turnrate (rad/m or rad/s) to adapt driving wheel speed.
-      // velDif = wheelbase * curvature * linVel;
-      velDif = wheelbase * turnrate;
-      // adjust each wheel with half difference
-      // positive curvature (CCV) makes the right
-      // wheel turn faster forward
-      v1 = linVel + velDif/2; // right wheel (m/s)
-      v0 = v1 - velDif;       // left wheel (m/s)
-      //
-      // convert from drive speed (m/s) to motor velocity (rad/s)
-      if (false)
-      { // robobot is using wheel velocity
-        v0 *= motorGear * driveGear / wheelRadius;
-        v1 *= motorGear * driveGear / wheelRadius;
-      }
-      //
-      // tell drive motor controllers
-      // driveMotorXXXXX[0] is teensy number
-      // driveMotorXXXXX[1] is motor on that number (0..3)
-      // driveMotorXXXXX[2] is additional motor or -1 for none
-      //
-      if (shouldWheelsBeRunning())
-      {
-        if (motor[0].inRelax() and updateTime.getSec() > 0)
-          printf("# CMixer:: %lu.%04ld got out of relax (linvel=%g, turnrate=%g)\n",
-                 updateTime.getSec(), updateTime.getMicrosec()/100, linVel, turnrate);
-        motor[0].setRelax(false);
-      }
-      else if (not mvel[0].areMotorsRunning())
-      { // motors has stopped, so relax
-        if (not motor[0].inRelax())
-          printf("# CMixer:: %lu.%04ld got into relax (linvel=%g, turnrate=%g)\n",
-                 updateTime.getSec(), updateTime.getMicrosec()/100, linVel, turnrate);
-        motor[0].setRelax(true);
-      }
-      // left motor(s)
-      motor[driveMotorLeft[0]].desiredVelocity[driveMotorLeft[1]] = v0;  // m1
-      if (driveMotorLeft[2] >= 0)
-        motor[driveMotorLeft[0]].desiredVelocity[driveMotorLeft[2]] = v0; // m2
-      // right motor(s)
-      motor[driveMotorRight[0]].desiredVelocity[driveMotorRight[1]] = v1; // m3
-      if (driveMotorRight[2] >= 0)
-        motor[driveMotorRight[0]].desiredVelocity[driveMotorRight[2]] = v1; // m4
-      //
-      if (updateCnt > 0)
-        toLog();
+    upd = true;
+  }
+  trajWasActive = trajActive;
+  if (upd or updateTime.getTimePassed() > 0.5)
+  { // use the new data
+    updateTime.now();
+    if (manualOverride)
+    {  // source is manual control
+      Manual m;
+      oldUpdCntManual = manualRef.read(m);
+      linVel = m.linVel;
+      turnrate = m.turnrate;
+      rcSource = 0;
+      // if (loop % 50 == 0)
+      printf("# CMixer, manualOverride, vel=%f (rad/s), curvature=%f (rad/m)\n", linVel, turnrate);
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    else if (trajActive)
+    { // source is a trajectory segment
+      linVel = trajVel;
+      turnrate = trajTurnrate;
+      rcSource = 4;
+    }
+    else
+    { // source is MQTT (or line follow)
+      std::lock_guard<std::mutex> lock(setpointLock);
+      linVel = desiredLinVel;
+      turnrate = desiredCurvature;
+      // if (loop % 50 == 0)
+      //  printf("# CMixer::run: auto, vel=%f (rad/s), curvature=%f (rad/m)\n", linVel, turnrate);
+    }
+    // mix to motor velocities
+    // use actual steering curvature or turnrate (rad/m or rad/s) to adapt driving wheel speed.
+    // velDif = wheelbase * curvature * linVel;
+    velDif = wheelbase * turnrate;
+    // adjust each wheel with half difference
+    // positive curvature (CCV) makes the right
+    // wheel turn faster forward
+    v1 = linVel + velDif/2; // right wheel (m/s)
+    v0 = v1 - velDif;       // left wheel (m/s)
+    //
+    // convert from drive speed (m/s) to motor velocity (rad/s)
+    if (false)
+    { // robobot is using wheel velocity
+      v0 *= motorGear * driveGear / wheelRadius;
+      v1 *= motorGear * driveGear / wheelRadius;
+    }
+    //
+    // tell drive motor controllers
+    // driveMotorXXXXX[0] is teensy number
+    // driveMotorXXXXX[1] is motor on that number (0..3)
+    // driveMotorXXXXX[2] is additional motor or -1 for none
+    //
+    if (shouldWheelsBeRunning())
+    {
+      if (motor[0].inRelax() and updateTime.getSec() > 0)
+        printf("# CMixer:: %lu.%04ld got out of relax (linvel=%g, turnrate=%g)\n",
+               updateTime.getSec(), updateTime.getMicrosec()/100, linVel, turnrate);
+      motor[0].setRelax(false);
+    }
+    else if (not mvel[0].areMotorsRunning())
+    { // motors has stopped, so relax
+      if (not motor[0].inRelax())
+        printf("# CMixer:: %lu.%04ld got into relax (linvel=%g, turnrate=%g)\n",
+               updateTime.getSec(), updateTime.getMicrosec()/100, linVel, turnrate);
+      motor[0].setRelax(true);
+    }
+    // the motor reference is a seqlock, as the motors may be on another
+    // Teensy (with its own pipeline thread), the mixer is the only writer
+    CMotor::Reference r;
+    // left motor(s)
+    motor[driveMotorLeft[0]].reference.read(r);
+    r.vel[driveMotorLeft[1]] = v0;  // m1
+    if (driveMotorLeft[2] >= 0)
+      r.vel[driveMotorLeft[2]] = v0; // m2
+    if (driveMotorRight[0] != driveMotorLeft[0])
+    { // right motor on another Teensy
+      motor[driveMotorLeft[0]].reference.write(r);
+      motor[driveMotorRight[0]].reference.read(r);
+    }
+    // right motor(s)
+    r.vel[driveMotorRight[1]] = v1; // m3
+    if (driveMotorRight[2] >= 0)
+      r.vel[driveMotorRight[2]] = v1; // m4
+    motor[driveMotorRight[0]].reference.write(r);
+    //
+    if (updateCnt > 0)
+      toLog();
   }
 }
 
 
-void CMixer::setVelocity(float refLinearVelocity, float refCurvature)
+void CMixer::setManual(float refLinearVelocity, float refTurnrate)
+{
+  manualRef.write({refLinearVelocity, refTurnrate});
+  period.wake();
+}
+
+bool CMixer::setVelocity(float refLinearVelocity, float refCurvature, int source)
 {
+  std::lock_guard<std::mutex> lock(setpointLock);
+  if (source == 3 and not linefollow.active)
+    // line follow is stopped (e.g. by an rc order)
+    return false;
   desiredLinVel = refLinearVelocity;
   desiredCurvature = refCurvature;
+  rcSource = source;
   autoUpdate = true;
-  printf("# CMixer::setVelocity: vel=%.3f (m/s), turnrate=%.3f (rad/sec)\n", refLinearVelocity, refCurvature);
+  if (source == 2)
+    printf("# CMixer::setVelocity: vel=%.3f (m/s), turnrate=%.3f (rad/sec)\n", refLinearVelocity, refCurvature);
+  return true;
 }
 
 
@@ -260,11 +332,7 @@ void CMixer::terminate()
   {
     th1->join();
   }
-  if (logfile != nullptr)
-  {
-    fclose(logfile);
-    logfile = nullptr;
-  }
+  // logfile is closed by the logger
 }
 
 
@@ -279,12 +347,11 @@ void CMixer::toLog()
 {
   if (service.stop)
     return;
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   { // add to log after update
-    fprintf(logfile, "%lu.%04ld %d %d %.3f %.3f %.3f %.3f %d\n",
-            updateTime.getSec(), updateTime.getMicrosec()/100,
-            rcSource, manualOverride, linVel, turnrate, v0, v1, updateCnt
-            );
+    logger.log(logCh, updateTime,
+               rcSource, manualOverride, linVel, turnrate, v0, v1, updateCnt
+               );
   }
   if (toConsole)
   {
@@ -24,8 +24,11 @@
 #ifndef MMIXER_H
 #define MMIXER_H
 
+#include <mutex>
 #include "cmotor.h"
 #include "utime.h"
+#include "useqlock.h"
+#include "urealtime.h"
 // #include "cheading.h"
 //#include "mvelocity.h"
 
@@ -44,8 +47,13 @@ public:
    * Decode messages */
   bool decode(const char* msg, const char * params, UTime & msgTime);
   /**
-   * thread to do updates, when new data is available */
+   * thread to do updates, when new data is available
+   * (not used if the control pipeline is used, see cpipeline.h) */
   void run();
+  /**
+   * Mix the active source (manual, trajectory or MQTT) to desired motor velocity
+   * (mixer stage of the control pipeline of the drive Teensy, or every 1 ms in run()) */
+  void step();
   /**
    * close down */
   void terminate();
@@ -53,8 +61,18 @@ public:
    * Velocity control in automnomous mode
    * \param refLinearVelocity in meter per second
    * \param refCurvature in rad/m
+   * \param source is the control source (see log), 2 is MQTT, 3 is line follow, 4 is trajectory
+   * \returns false if not used, line follow (3) is used only while line follow is active
    * */
-   void setVelocity(float refLinearVelocity, float refCurvature);
+   bool setVelocity(float refLinearVelocity, float refCurvature, int source = 2);
+   /**
+    * New manual (gamepad) reference, used in manual override mode only.
+    * Wakes the mixer loop, so the value is used now
+    * (with the control pipeline it is used at the next sample).
+    * Called from the gamepad thread only.
+    * \param refLinearVelocity in meter per second
+    * \param refTurnrate in rad/s */
+   void setManual(float refLinearVelocity, float refTurnrate);
    /**
     * are wheels commanded to run,
     * \returns true if commanded velocity is > 0 or turning */
@@ -65,11 +83,20 @@ public:
 
 
 public:
+  /// mixer is enabled (robot.ini)
+  bool use = false;
   /// Mixer update cnt
   int updateCnt = 0;
   UTime rcTime;
   int rcSource = 0;
   UTime updateTime;
+  /// mixer is run by the control pipeline (of the drive Teensy), else by run()
+  bool inPipeline = false;
+  /** Teensy with the (left) drive motor, the mixer runs in its pipeline */
+  int driveTeensy()
+  {
+    return driveMotorLeft[0];
+  }
 
 private:
   /// private stuff
@@ -86,20 +113,35 @@ private:
    * third index [2] two must be within -1..motors, -1 means no second motor
    * \retruns true if all is OK */
   bool limitMotorValues(int (&idx)[3], int teensys, int motors);
-  /** autonomous preference */
+  /** autonomous preference (protected by setpointLock) */
+  std::mutex setpointLock;
   float desiredCurvature = 0;
   float desiredLinVel = 0;
   bool autoUpdate = false;
+  /** trajectory set-point (see ctrajectory.h) */
+  float trajVel = 0;
+  float trajTurnrate = 0;
+  bool trajWasActive = false;
+  /** manual (gamepad) set-point */
+  struct Manual
+  {
+    float linVel;
+    float turnrate;
+  };
+  USeqLock<Manual> manualRef;
   /** update count for data sources */
   int oldUpdCntManual = -1;
   int oldUpdCntVelocity = -1;
   int oldUpdCntSteer = -1;
   // mixed motor decired velocity
   float v0, v1;
+  /** mixer loop timing, woken by manual updates */
+  UPeriodic period;
   /** log data for this module */
   void toLog();
   //
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
   bool toConsole = false;
   /// Linear velocity (m/s)
   float linVel = 0;
@@ -33,6 +33,9 @@
 #include "cmixer.h"
 #include "umqtt.h"
 #include "srobot.h"
+#include "ulogger.h"
+#include "urealtime.h"
+#include "cpipeline.h"
 
 // create value
 CMotor motor[NUM_TEENSY_MAX];
@@ -108,6 +111,9 @@ void CMotor::setup(int teensy_number)
   pid[0].toConsole = ini[ini_section]["m1print"] == "true";
   pid[1].toConsole = ini[ini_section]["m2print"] == "true";
   //
+  // messages from Teensy
+  teensy[tn].addKey("mot", [this](const char * params, UTime & msgTime){ decodeMot(params, msgTime); });
+  teensy[tn].addKey("motpwm", [this](const char * params, UTime & msgTime){ decodeMotPwm(params, msgTime); });
   int mvt = strtol(ini[ini_section]["interval_motv_ms"].c_str(), nullptr, 10);
   if (mvt > 0)
   {
@@ -125,42 +131,44 @@ void CMotor::setup(int teensy_number)
   for (int i = 0; i < SRobot::MAX_MOTORS; i++)
   {
     string ts = "m" + to_string(i+1) + "log_PID";
-    if (ini[ini_section][ts] == "true" and logfile[i] == nullptr)
+    if (ini[ini_section][ts] == "true" and logPid[i] < 0)
     { // open logfile
-      std::string fn = service.logPath + "log_t" + to_string(teensy_number) +  "_motor_" + to_string(i) + "_pid.txt";
-      logfile[i] = fopen(fn.c_str(), "w");
-      logfileLeadText(logfile[i], fn.c_str());
-      pid[i].logPIDparams(logfile[i], false);
+      std::string fn = "log_t" + to_string(teensy_number) +  "_motor_" + to_string(i) + "_pid";
+      logPid[i] = logger.addChannel(fn, "%.3f %.3f %.3f %.3f %.3f %.3f %d");
+      fn = service.logPath + fn + ".txt";
+      logfileLeadText(logPid[i], fn.c_str());
+      pid[i].logPIDparams(logPid[i], false);
     }
   }
-  if (ini[ini_section]["log_voltage"] == "true" and logfileMv == nullptr)
+  if (ini[ini_section]["log_voltage"] == "true" and logMv < 0)
   {
-    std::string fn = service.logPath + "log_t" + to_string(tn) + "_motor_voltage.txt";
-    logfileMv = fopen(fn.c_str(), "w");
-    fprintf(logfileMv, "%% Motor voltage for all motors\n");
-    fprintf(logfileMv, "%% 1 \tTime (sec)\n");
-    fprintf(logfileMv, "%% 2-3 \tVoltage to motor (to Teensy) 1,2 (Volt)\n");
-    fprintf(logfileMv, "%% 4-5 \tVoltage to motor (from Teensy) 1,2 (Volt)\n");
-    fprintf(logfileMv, "%% 6-7 \tPWM to motor (+/- 2096) (from Teensy) 1,2\n");
-    fprintf(logfileMv, "%% 8 \tRelax motor controller (standing still for some time)\n");
+    logMv = logger.addChannel("log_t" + to_string(tn) + "_motor_voltage", "%.2f %.2f %.2f %.2f %d %d %d");
+    logger.addHeader(logMv, "%% Motor voltage for all motors\n");
+    logger.addHeader(logMv, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logMv, "%% 2-3 \tVoltage to motor (to Teensy) 1,2 (Volt)\n");
+    logger.addHeader(logMv, "%% 4-5 \tVoltage to motor (from Teensy) 1,2 (Volt)\n");
+    logger.addHeader(logMv, "%% 6-7 \tPWM to motor (+/- 2096) (from Teensy) 1,2\n");
+    logger.addHeader(logMv, "%% 8 \tRelax motor controller (standing still for some time)\n");
   }
   //printf("# cmotor:: debug 6\n");
-  if (th1 == nullptr)
+  relaxTime.now();
+  // else run by the control pipeline
+  if (th1 == nullptr and not pipeline.use)
     th1 = new std::thread(runObj, this);
   //printf("# cmotor:: debug 7\n");
 }
 
-void CMotor::logfileLeadText(FILE * f, const char * ms)
+void CMotor::logfileLeadText(int f, const char * ms)
 {
-    fprintf(f, "%% Teensy %d Motor control (%s) logfile\n", tn, ms);
-    fprintf(f, "%% 1 \tTime (sec)\n");
-    fprintf(f, "%% 2 \tReference for teensy %d motor (rad/sec or mm/s)\n", tn);
-    fprintf(f, "%% 3 \tMeasured velocity for motor (rad/sec or mm/s)\n");
-    fprintf(f, "%% 4 \tValue after Kp (V)\n");
-    fprintf(f, "%% 5 \tValue after Lead (V)\n");
-    fprintf(f, "%% 6 \tIntegrator value (V)\n");
-    fprintf(f, "%% 7 \tMotor voltage output (V)\n");
-    fprintf(f, "%% 8 \tIs output limited (1=limited)\n");
+    logger.addHeader(f, "%% Teensy %d Motor control (%s) logfile\n", tn, ms);
+    logger.addHeader(f, "%% 1 \tTime (sec)\n");
+    logger.addHeader(f, "%% 2 \tReference for teensy %d motor (rad/sec or mm/s)\n", tn);
+    logger.addHeader(f, "%% 3 \tMeasured velocity for motor (rad/sec or mm/s)\n");
+    logger.addHeader(f, "%% 4 \tValue after Kp (V)\n");
+    logger.addHeader(f, "%% 5 \tValue after Lead (V)\n");
+    logger.addHeader(f, "%% 6 \tIntegrator value (V)\n");
+    logger.addHeader(f, "%% 7 \tMotor voltage output (V)\n");
+    logger.addHeader(f, "%% 8 \tIs output limited (1=limited)\n");
 }
 
 void CMotor::terminate()
@@ -172,61 +180,48 @@ void CMotor::terminate()
   t.getDateTimeAsString(d);
   for (int i = 0; i < SRobot::MAX_MOTORS; i++)
   {
-    if (logfile[1] != nullptr and not service.stop_logging)
-    {
-      fprintf(logfile[i], "%% ended at %lu.%4ld %s\n", t.getSec(), t.getMicrosec()/100, d);
-      fclose(logfile[i]);
-      logfile[i] = nullptr;
+    if (logPid[i] >= 0 and not service.stop_logging)
+    { // logfile is closed by the logger
+      logger.addHeader(logPid[i], "%% ended at %lu.%4ld %s\n", t.getSec(), t.getMicrosec()/100, d);
     }
   }
-  if (logfileMv != nullptr)
-    fclose(logfileMv);
 }
 
-bool CMotor::decode(const char* msg, UTime & msgTime)
+void CMotor::decodeMot(const char* params, UTime & msgTime)
 {
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "mot ", 4) == 0)
-  {
-    p1 += 4;
+  const char * p1 = params;
 //     motvTime = msgTime;
-    for (int i = 0; i < SRobot::MAX_MOTORS; i++)
-      motorVoltage[i] = strtof(p1, (char**)&p1);
-    // save to log_encoder_pose
-    toLogMv(msgTime);
-  }
-  else if (strncmp(p1, "motpwm ", 7) == 0)
-  { /* From umotor.cpp (Teensy code)
-    snprintf(s, MSL, "motpwm %d %d %d %d %d %d %d %d  %d  %d %d %d %d\r\n",
-    motorAnkerDir[0], motorAnkerPWM[0], motorAnkerDir[1], motorAnkerPWM[1],
-    motorAnkerDir[2], motorAnkerPWM[2], motorAnkerDir[3], motorAnkerPWM[3],
-    PWMfrq, m1ok, m2ok, m3ok, m4ok);
-    */
-    p1 += 7;
+  for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+    motorVoltage[i] = strtof(p1, (char**)&p1);
+  // save to log_encoder_pose
+  toLogMv(msgTime);
+}
+
+void CMotor::decodeMotPwm(const char* params, UTime & msgTime)
+{ /* From umotor.cpp (Teensy code)
+  snprintf(s, MSL, "motpwm %d %d %d %d %d %d %d %d  %d  %d %d %d %d\r\n",
+  motorAnkerDir[0], motorAnkerPWM[0], motorAnkerDir[1], motorAnkerPWM[1],
+  motorAnkerDir[2], motorAnkerPWM[2], motorAnkerDir[3], motorAnkerPWM[3],
+  PWMfrq, m1ok, m2ok, m3ok, m4ok);
+  */
+  const char * p1 = params;
 //     motvTime = msgTime;
-    for (int i = 0; i < SRobot::MAX_MOTORS; i++)
-    {
-      strtol(p1, (char**)&p1, 10); // Ignore direction
-      motorPWM[i] = strtol(p1, (char**)&p1, 10); // PWM
-    }
-    // save to log_encoder_pose
-    toLogMv(msgTime);
+  for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+  {
+    strtol(p1, (char**)&p1, 10); // Ignore direction
+    motorPWM[i] = strtol(p1, (char**)&p1, 10); // PWM
   }
-  else
-    used = false;
-  return used;
+  // save to log_encoder_pose
+  toLogMv(msgTime);
 }
 
 void CMotor::toLogMv(UTime & updt)
 {
-  if (logfileMv != nullptr and not service.stop_logging)
+  if (logMv >= 0 and not service.stop_logging)
   {
-    fprintf(logfileMv, "%lu.%04ld %.2f %.2f %.2f %.2f %d %d %d\n",
-            updt.getSec(), updt.getMicrosec()/100,
-            u[0], u[1],
-            motorVoltage[0], motorVoltage[1],
-            motorPWM[0], motorPWM[1], relax);
+    logger.log(logMv, updt, u[0], u[1],
+               motorVoltage[0], motorVoltage[1],
+               motorPWM[0], motorPWM[1], relax);
   }
 }
 
@@ -238,81 +233,92 @@ void CMotor::setRelax(bool value)
 
 void CMotor::run()
 {
-  int loop = 0;
-  int euc;
-  UTime t;
-  relaxTime.now();
+  MVelocity::Data vd; // velocity values
+  Reference ref;
+  int velVersion = 0;
+  realtime.configure("motor", tn);
   while (not service.stop)
   { // run an update at same rate as velocity estimate update
-    euc = mvel[tn].updateCnt;
-    if (euc != velUpdateCnt)
-    { // do constant rate control
-      // that is every time new encoder data is available
-      // new motor control values should be calculated.
-      velUpdateCnt = euc;
-      if (not relax)
-      { // do velocity control.
-        // got new encoder data
-        float dt = updTime - mvel[tn].velTime;
-        // desired velocity from mixer
-        if (dt < 1.0)
-        { // valid control timing
-          for (int m= 0; m < SRobot::MAX_MOTORS; m++)
-          {
-            u[m] = pid[m].pid(desiredVelocity[m], mvel[tn].motorVel[m], limited[m], motorVoltageOffset[m]);
-          }
-        }
-        updTime = mvel[tn].velTime;
-        // log_pose - for both motors
-        for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+    if (not mvel[tn].snapshot.waitForUpdate(velVersion, 0.1))
+      continue;
+    velVersion = mvel[tn].snapshot.read(vd);
+    reference.read(ref);
+    step(vd, ref.vel);
+  }
+  teensy[tn].send("motv 0 0\n", true);
+}
+
+void CMotor::step(const MVelocity::Data & vd, const float ref[])
+{
+  int euc = vd.updateCnt;
+  UTime t;
+  if (euc != velUpdateCnt)
+  { // do constant rate control
+    // that is every time new encoder data is available
+    // new motor control values should be calculated.
+    velUpdateCnt = euc;
+    if (not relax)
+    { // do velocity control.
+      // got new encoder data
+      float dt = updTime - vd.velTime;
+      // desired velocity from mixer
+      if (dt < 1.0)
+      { // valid control timing
+        for (int m= 0; m < SRobot::MAX_MOTORS; m++)
         {
-          pid[i].saveToLog(logfile[i], updTime);
+          u[m] = pid[m].pid(ref[m], vd.motorVel[m], limited[m], motorVoltageOffset[m]);
         }
-        // finished calculating motor voltage (into u)
-        const int MSL = 100;
-        char s[MSL];
-        /// Note that left and right requires different sign to move forward.
-        /// This may be hidden by a sign change in the motor driver firmware.
-        snprintf(s, MSL, "motv %.2f %.2f\n", u[0], u[1]);
-        t.now();
-        teensy[tn].send(s, true);
-        // if (mixer.shouldWheelsBeRunning())
-        // { // we are driving (or should)
-        //   relaxTime.now();
-        // }
-        // else if (relaxTime.getTimePassed() > timeToRelax)
-        // { // velocities are commanded zero for some seconds
-        //   // stop controlling the wheels (allow motor controller relax)
-        //   relax = true;
-        //   relaxing = 0;
-        // }
-        relaxing = 0;
       }
-      else
-      { // relax motor loop
-        if (relaxing < 3)
-        { // send relax values
-          for (int i = 0; i < SRobot::MAX_MOTORS; i++)
-          { // clear PID controller
-            u[i] = 0;
-            pid[i].resetHistory();
-          }
-          t.now();
-          teensy[tn].send("motv 0 0\n", true);
-          // printf("# SMotor:: relax %d\n", relaxing);
+      updTime = vd.velTime;
+      // log_pose - for both motors
+      for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+      {
+        pid[i].saveToLog(logPid[i], updTime);
+      }
+      // finished calculating motor voltage (into u)
+      const int MSL = 100;
+      char s[MSL];
+      /// Note that left and right requires different sign to move forward.
+      /// This may be hidden by a sign change in the motor driver firmware.
+      snprintf(s, MSL, "motv %.2f %.2f\n", u[0], u[1]);
+      t.now();
+      UTime sentAt;
+      bool isSent = teensy[tn].send(s, true, &sentAt);
+      latency.add(t - vd.updTime);
+      if (isSent)
+        loopHist.add(sentAt - vd.sampleTime);
+      // if (mixer.shouldWheelsBeRunning())
+      // { // we are driving (or should)
+      //   relaxTime.now();
+      // }
+      // else if (relaxTime.getTimePassed() > timeToRelax)
+      // { // velocities are commanded zero for some seconds
+      //   // stop controlling the wheels (allow motor controller relax)
+      //   relax = true;
+      //   relaxing = 0;
+      // }
+      relaxing = 0;
+    }
+    else
+    { // relax motor loop
+      if (relaxing < 3)
+      { // send relax values
+        for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+        { // clear PID controller
+          u[i] = 0;
+          pid[i].resetHistory();
         }
-        relaxing++;
+        t.now();
+        teensy[tn].send("motv 0 0\n", true);
+        // printf("# SMotor:: relax %d\n", relaxing);
       }
-      toLogMv(t);
+      relaxing++;
     }
-    loop++;
-    // sleep a little while, the sample time is
-    // determined by the encoder (longer than 2ms)
-    // actually determined by the Teensy, so on average
-    // a constant sample rate (defined in the robot.ini file)
-    usleep(500);
+    toLogMv(t);
   }
-  teensy[tn].send("motv 0 0\n", true);
+  // the sample time is determined by the encoder (longer than 2ms)
+  // actually determined by the Teensy, so on average
+  // a constant sample rate (defined in the robot.ini file)
 }
 
 
@@ -27,9 +27,12 @@
 #include <thread>
 
 #include "sencoder.h"
+#include "mvelocity.h"
 #include "utime.h"
 #include "upid.h"
 #include "srobot.h"
+#include "uhistogram.h"
+#include "useqlock.h"
 
 /**
  * Class to do motor velocity control.
@@ -43,11 +46,20 @@ public:
   /** setup and request data */
   void setup(int teensy_number);
   /**
-   * thread to do updates, when new data is available */
+   * thread to do updates, when new data is available
+   * (not used if the control pipeline is used, see cpipeline.h) */
   void run();
   /**
-   * Decode messages from Teensy */
-  bool decode(const char* msg, UTime & msgTime);
+   * Control and send motor voltage for a new velocity
+   * (motor stage of the control pipeline)
+   * \param vd is the new (measured) motor velocity
+   * \param ref is the desired motor velocity */
+  void step(const MVelocity::Data & vd, const float ref[]);
+  /**
+   * Decode 'mot' and 'motpwm' messages from Teensy
+   * \param params is the message after the key */
+  void decodeMot(const char* params, UTime & msgTime);
+  void decodeMotPwm(const char* params, UTime & msgTime);
   /**
    * terminate */
   void terminate();
@@ -70,10 +82,20 @@ protected:
   void toLogMv(UTime & updt);
   //
 public:
-  float desiredVelocity[SRobot::MAX_MOTORS] = {0.0};
+  /// desired motor velocity (rad/s)
+  struct Reference
+  {
+    float vel[SRobot::MAX_MOTORS];
+  };
+  /// set by the mixer, that may run in the pipeline of another Teensy
+  USeqLock<Reference> reference;
   // is output limited, this may be valuable for other controllers.
   bool limited[SRobot::MAX_MOTORS] = {false};
   UTime updTime; // time of last control update
+  /// time from velocity is available until motor voltage is send
+  UHistogram latency;
+  /// time from the Teensy sample until motor voltage is written (full loop)
+  UHistogram loopHist;
 
 private:
   /// number of this teensy
@@ -85,7 +107,7 @@ private:
     // transfer to the class run() function.
     obj->run();
   }
-  void logfileLeadText(FILE * f, const char * ms);
+  void logfileLeadText(int f, const char * ms);
   /**
    * PID controllers, one each motor */
   UPID pid[SRobot::MAX_MOTORS];
@@ -94,8 +116,9 @@ private:
   // controller output
   float u[SRobot::MAX_MOTORS];
   // support variables
-  FILE * logfile[SRobot::MAX_MOTORS] = {nullptr};
-  FILE * logfileMv = nullptr;
+  /// log channels (see ulogger.h)
+  int logPid[SRobot::MAX_MOTORS] = {-1, -1};
+  int logMv = -1;
   float motorVoltage[SRobot::MAX_MOTORS] = {0};
   float motorVoltageOffset[SRobot::MAX_MOTORS] = {0};
   int   motorPWM[SRobot::MAX_MOTORS] = {0};
@@ -0,0 +1,194 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#include <string>
+#include <string.h>
+#include "cpipeline.h"
+#include "cmixer.h"
+#include "cmotor.h"
+#include "steensy.h"
+#include "uservice.h"
+#include "urealtime.h"
+
+// create value
+CPipeline pipeline;
+
+
+CPipeline::~CPipeline()
+{
+  for (int i = 0; i < stagesCnt; i++)
+    delete stages[i];
+}
+
+void CPipeline::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("pipeline"))
+  { // no data yet, so generate some default values
+    // run velocity, mixer and motor control in one thread (per Teensy)
+    ini["pipeline"]["use"] = "true";
+  }
+  use = ini["pipeline"]["use"] == "true";
+  if (not use or stagesCnt > 0)
+    return;
+  // the standard control chain
+  insert("velocity", [](UControlSample & s)
+  { // new motor velocity from encoder sample
+    return mvel[s.tn].step(s.enc, s.vel);
+  });
+  insert("mixer", [](UControlSample & s)
+  { // mixer runs in the pipeline of the Teensy with the (left) drive motor,
+    // and may set motors on any Teensy
+    if (mixer.use and mixer.inPipeline and s.tn == mixer.driveTeensy())
+      mixer.step();
+    CMotor::Reference r;
+    motor[s.tn].reference.read(r);
+    for (int m = 0; m < SRobot::MAX_MOTORS; m++)
+      s.ref[m] = r.vel[m];
+    return true;
+  });
+  insert("motor", [](UControlSample & s)
+  { // PID and send motor voltage
+    motor[s.tn].step(s.vel, s.ref);
+    return true;
+  });
+}
+
+bool CPipeline::insert(const char* name, UStageFunc func, const char* before)
+{
+  if (started or stagesCnt >= MAX_STAGES)
+  {
+    printf("# CPipeline::insert: can not add stage '%s' (started or no space)\n", name);
+    return false;
+  }
+  int idx = stagesCnt;
+  if (before != nullptr)
+  { // find the stage to insert before
+    for (idx = 0; idx < stagesCnt; idx++)
+      if (strcmp(stages[idx]->name, before) == 0)
+        break;
+    if (idx == stagesCnt)
+    {
+      printf("# CPipeline::insert: no stage '%s' to insert '%s' before\n", before, name);
+      return false;
+    }
+  }
+  for (int i = stagesCnt; i > idx; i--)
+    stages[i] = stages[i - 1];
+  UStage * st = new UStage();
+  strncpy(st->name, name, sizeof(st->name) - 1);
+  st->func = func;
+  stages[idx] = st;
+  stagesCnt++;
+  return true;
+}
+
+void CPipeline::start()
+{
+  if (not use or started)
+    return;
+  started = true;
+  for (int tn = 0; tn < service.teensyCnt; tn++)
+  {
+    if (not teensy[tn].disabled and th1[tn] == nullptr)
+      th1[tn] = new std::thread(runObj, this, tn);
+  }
+}
+
+void CPipeline::terminate()
+{
+  for (int tn = 0; tn < NUM_TEENSY_MAX; tn++)
+  {
+    if (th1[tn] != nullptr)
+    {
+      th1[tn]->join();
+      th1[tn] = nullptr;
+    }
+  }
+}
+
+void CPipeline::run(int tn)
+{
+  realtime.configure("pipeline", tn);
+  UControlSample s;
+  s.tn = tn;
+  int encVersion = 0;
+  while (not service.stop)
+  { // wait for a new encoder or velocity sample
+    if (not encoder[tn].snapshot.waitForUpdate(encVersion, 0.1))
+      continue;
+    encVersion = encoder[tn].snapshot.read(s.enc);
+    s.start.now();
+    UTime t = s.start;
+    for (int i = 0; i < stagesCnt; i++)
+    {
+      bool more = stages[i]->func(s);
+      UTime t2("now");
+      stages[i]->time.add(t2 - t);
+      t = t2;
+      if (not more)
+        break;
+    }
+    total.add(t - s.start);
+  }
+  // stop motors (as the motor thread would)
+  teensy[tn].send("motv 0 0\n", true);
+}
+
+void CPipeline::clear()
+{
+  for (int i = 0; i < stagesCnt; i++)
+    stages[i]->time.clear();
+  total.clear();
+}
+
+void CPipeline::print()
+{
+  if (not use)
+    return;
+  const int MSL = 64;
+  char s[MSL];
+  for (int i = 0; i < stagesCnt; i++)
+  {
+    snprintf(s, MSL, "pipeline %s", stages[i]->name);
+    stages[i]->time.print(s);
+  }
+  total.print("pipeline all stages");
+}
+
+const char * CPipeline::format(char* s, int MSL)
+{
+  if (not use)
+    return s;
+  const int MLL = 200;
+  char line[MLL];
+  char name[48];
+  for (int i = 0; i < stagesCnt; i++)
+  {
+    snprintf(name, sizeof(name), "pipe_%s", stages[i]->name);
+    strncat(s, stages[i]->time.format(name, line, MLL), MSL - strlen(s) - 1);
+  }
+  strncat(s, total.format("pipe_all", line, MLL), MSL - strlen(s) - 1);
+  return s;
+}
@@ -0,0 +1,131 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef CPIPELINE_H
+#define CPIPELINE_H
+
+#include <thread>
+#include <functional>
+
+#include "sencoder.h"
+#include "mvelocity.h"
+#include "srobot.h"
+#include "utime.h"
+#include "uhistogram.h"
+
+/**
+ * Data passed through the control pipeline for one encoder sample.
+ * Each stage reads the fields set by the stages before it.
+ * */
+class UControlSample
+{
+public:
+  /// Teensy number
+  int tn = 0;
+  /// input: the encoder (or Teensy velocity) sample
+  SEncoder::Data enc;
+  /// velocity stage output: motor velocity
+  MVelocity::Data vel;
+  /// mixer stage output: desired motor velocity for this Teensy
+  float ref[SRobot::MAX_MOTORS] = {0};
+  /// time the pipeline started on this sample
+  UTime start;
+};
+
+/**
+ * One step of the control pipeline
+ * \returns false to end the pipeline for this sample (e.g. no new velocity) */
+typedef std::function<bool (UControlSample & s)> UStageFunc;
+
+/**
+ * Control pipeline, that runs velocity estimate, mixer and motor control
+ * (and any inserted stages) in order in one thread for each Teensy,
+ * as soon as an encoder sample is decoded.
+ * This replaces the velocity, mixer and motor threads (robot.ini [pipeline] use).
+ * The time used by each stage is collected for the latency report.
+ * */
+class CPipeline
+{
+public:
+  ~CPipeline();
+  /**
+   * Setup from robot.ini, call before the control modules are set up,
+   * as they should not start their own threads, when the pipeline is used */
+  void setup();
+  /**
+   * Start a pipeline thread for each Teensy,
+   * when all modules (and extra stages) are set up */
+  void start();
+  /**
+   * Add a stage, stages can be added before start() only.
+   * \param name is the stage name (for the latency report)
+   * \param func is the stage function
+   * \param before is the name of the stage to insert before, nullptr is at the end
+   * \returns false if there is no space or 'before' is not found */
+  bool insert(const char * name, UStageFunc func, const char * before = nullptr);
+  /**
+   * terminate */
+  void terminate();
+  /** clear stage timing statistics */
+  void clear();
+  /**
+   * Print stage timing to console */
+  void print();
+  /**
+   * Append stage timing lines (like UHistogram::format) to s
+   * \returns s */
+  const char * format(char * s, int MSL);
+  /// pipeline is used (else the modules run their own threads)
+  bool use = false;
+
+private:
+  /**
+   * Run the stages for each new sample from this Teensy */
+  void run(int tn);
+  static void runObj(CPipeline * obj, int tn)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run(tn);
+  }
+  class UStage
+  {
+  public:
+    char name[32] = {'\0'};
+    UStageFunc func;
+    /// execution time for this stage
+    UHistogram time;
+  };
+  static const int MAX_STAGES = 12;
+  UStage * stages[MAX_STAGES] = {nullptr};
+  int stagesCnt = 0;
+  /// from pipeline start until all stages are finished
+  UHistogram total;
+  std::thread * th1[NUM_TEENSY_MAX] = {nullptr};
+  bool started = false;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern CPipeline pipeline;
+
+#endif
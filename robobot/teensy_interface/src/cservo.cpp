@@ -27,6 +27,7 @@
 #include "cservo.h"
 #include "steensy.h"
 #include "uservice.h"
+#include "ulogger.h"
 // create value
 CServo servo[NUM_TEENSY_MAX];
 
@@ -41,6 +42,8 @@ void CServo::setup(int teensyNumber)
     ini[ini_section]["log"] = "true";
     ini[ini_section]["print"] = "true";
   }
+  // messages from Teensy
+  teensy[tn].addKey("svo", [this](const char * params, UTime & msgTime){ decodeSvo(params, msgTime); });
   // use values and subscribe to source data
   // like teensy[0].send("sub pose 4\n");
   std::string s = "sub svo " + ini[ini_section]["interval_ms"] + "\n";
@@ -48,15 +51,14 @@ void CServo::setup(int teensyNumber)
   // debug print
   toConsole = ini[ini_section]["print"] == "true";
   // set servo
-  if (ini[ini_section]["log"] == "true" and logfile == nullptr)
+  if (ini[ini_section]["log"] == "true" and logCh < 0)
   { // open logfile for servo data from Teensy
-    std::string fn = service.logPath + "log_t" + to_string(tn) + "_servo.txt";
-    logfile = fopen(fn.c_str(), "w");
-    fprintf(logfile, "%% Servo logfile (Teensy %d)\n", tn);
-    fprintf(logfile, "%% 1 \tTime (sec)\n");
-    fprintf(logfile, "%% 2 \tServo number\n");
-    fprintf(logfile, "%% 3 \tRequested position\n");
-    fprintf(logfile, "%% 4,5,6 \tEnabled, position, velocity\n");
+    logCh = logger.addChannel("log_t" + to_string(tn) + "_servo", "%d %d %d %d %d", 3);
+    logger.addHeader(logCh, "%% Servo logfile (Teensy %d)\n", tn);
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2 \tServo number\n");
+    logger.addHeader(logCh, "%% 3 \tRequested position\n");
+    logger.addHeader(logCh, "%% 4,5,6 \tEnabled, position, velocity\n");
   }
 }
 
@@ -80,45 +82,29 @@ void CServo::setServo(int servo, bool enabled, int position, int velocity)
 }
 
 void CServo::terminate()
-{
-  if (logfile != nullptr and not service.stop_logging)
-  {
-    fclose(logfile);
-  }
+{ // logfile is closed by the logger
 }
 
-bool CServo::decode(const char* msg, UTime & msgTime)
+void CServo::decodeSvo(const char* params, UTime & msgTime)
 { // return message from Teensy
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "svo ", 4) == 0)
+  const char * p1 = params;
+  for (int i = 0; i < MAX_SERVO_CNT; i++)
   {
-    if (strlen(p1) > 4)
-      p1 += 4;
-    else
-      return false;
-    for (int i = 0; i < MAX_SERVO_CNT; i++)
-    {
-      servo_enabled[i] = strtol(p1, (char**)&p1, 10);
-      servo_position[i] = strtol(p1, (char**)&p1, 10);
-      servo_velocity[i] = strtol(p1, (char**)&p1, 10);
-      toLog(i);
-    }
-    // notify users of a new update
-    updTime = msgTime;
-    updateCnt++;
+    servo_enabled[i] = strtol(p1, (char**)&p1, 10);
+    servo_position[i] = strtol(p1, (char**)&p1, 10);
+    servo_velocity[i] = strtol(p1, (char**)&p1, 10);
+    toLog(i);
   }
-  else
-    used = false;
-  return used;
+  // notify users of a new update
+  updTime = msgTime;
+  updateCnt++;
 }
 
 void CServo::toLog(int i)
 {
-  if (logfile != nullptr and not service.stop)
+  if (logCh >= 0 and not service.stop)
   {
-    fprintf(logfile, "%lu.%03ld %d %d %d %d %d\n",
-            updTime.getSec(), updTime.getMillisec(),
+    logger.log(logCh, updTime,
             i,
             servo_ref[i],
             servo_enabled[i], servo_position[i], servo_velocity[i]
@@ -46,9 +46,9 @@ public:
    * \param velocity is number of servo units per second (0, 1..1000) (0 = as fast as possible)
    * */
   void setServo(int servo, bool enabled, int position=0, int velocity = 0);
-  /** decode an unpacked incoming messages
-   * \returns true if the message us used */
-  bool decode(const char * msg, UTime & msgTime);
+  /** decode 'svo' message from Teensy
+   * \param params is the message after the key */
+  void decodeSvo(const char * params, UTime & msgTime);
   /**
    * terminate */
   void terminate();
@@ -68,7 +68,8 @@ private:
   void toLog(int i);
   // debug print to console
   bool toConsole = false;
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
 };
 
 /**
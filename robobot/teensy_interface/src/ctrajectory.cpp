@@ -0,0 +1,517 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#include <string>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include "ctrajectory.h"
+#include "sencoder.h"
+#include "uservice.h"
+#include "umqtt.h"
+#include "ulogger.h"
+
+// create value
+CTrajectory traj;
+
+
+void UMotionSegment::accTiming(float vp)
+{ // time to reach velocity vp from stand still
+  if (vp * jMax >= aMax * aMax)
+  { // max acceleration is reached
+    tj = aMax / jMax;
+    ta = vp / aMax + tj;
+    aPeak = aMax;
+  }
+  else
+  { // jerk phases only
+    tj = sqrtf(vp / jMax);
+    ta = 2 * tj;
+    aPeak = jMax * tj;
+  }
+  vPeak = vp;
+}
+
+void UMotionSegment::plan()
+{
+  if (vMax < 0.001)
+    vMax = 0.001;
+  if (aMax < 0.001)
+    aMax = 0.001;
+  if (jMax < 0.001)
+    jMax = 0.001;
+  float s = fabsf(length);
+  if (type == ARC)
+    s = fabsf(length * radius);
+  accTiming(vMax);
+  if (s >= vMax * ta)
+    // acceleration and deceleration, with cruise in between
+    tv = (s - vMax * ta) / vMax;
+  else
+  { // max velocity not reached, find peak velocity
+    // distance for acceleration and deceleration is vp * ta(vp)
+    float lo = 0;
+    float hi = vMax;
+    for (int i = 0; i < 40; i++)
+    {
+      float vp = (lo + hi) / 2;
+      accTiming(vp);
+      if (vp * ta > s)
+        hi = vp;
+      else
+        lo = vp;
+    }
+    accTiming(lo);
+    tv = 0;
+  }
+}
+
+void UMotionSegment::accPhase(float t, float & s, float & v)
+{ // acceleration phase is point symmetric around ta/2
+  float j = jMax;
+  if (tj > 1e-6)
+    j = aPeak / tj;
+  if (t <= tj)
+  { // increasing acceleration
+    v = j * t * t / 2;
+    s = j * t * t * t / 6;
+  }
+  else if (t <= ta - tj)
+  { // constant acceleration
+    float tau = t - tj;
+    float v1 = j * tj * tj / 2;
+    v = v1 + aPeak * tau;
+    s = j * tj * tj * tj / 6 + v1 * tau + aPeak * tau * tau / 2;
+  }
+  else
+  { // decreasing acceleration
+    float tau = ta - t;
+    v = vPeak - j * tau * tau / 2;
+    s = vPeak * ta / 2 - vPeak * tau + j * tau * tau * tau / 6;
+  }
+}
+
+float UMotionSegment::accAt(float t)
+{
+  float tEnd = duration();
+  if (t >= tEnd or (t >= ta and t < ta + tv))
+    // stand still or cruise
+    return 0;
+  float sign = 1;
+  if (t >= ta + tv)
+  { // deceleration is the acceleration backwards
+    t = tEnd - t;
+    sign = -1;
+  }
+  float j = jMax;
+  if (tj > 1e-6)
+    j = aPeak / tj;
+  float a;
+  if (t <= tj)
+    a = j * t;
+  else if (t <= ta - tj)
+    a = aPeak;
+  else
+    a = j * (ta - t);
+  return sign * a;
+}
+
+bool UMotionSegment::at(float t, float& s, float& v)
+{
+  float tEnd = duration();
+  float sEnd = vPeak * ta + vPeak * tv;
+  if (t >= tEnd)
+  {
+    s = sEnd;
+    v = 0;
+    return true;
+  }
+  if (t < ta)
+    accPhase(t, s, v);
+  else if (t < ta + tv)
+  {
+    s = vPeak * ta / 2 + vPeak * (t - ta);
+    v = vPeak;
+  }
+  else
+  { // deceleration is the acceleration backwards
+    accPhase(tEnd - t, s, v);
+    s = sEnd - s;
+  }
+  return false;
+}
+
+const char * UMotionSegment::name()
+{
+  switch (type)
+  {
+    case DIST: return "dist";
+    case TURN: return "turn";
+    case ARC:  return "arc";
+  }
+  return "none";
+}
+
+
+void CTrajectory::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("trajectory"))
+  { // no data yet, so generate some default values
+    ini["trajectory"]["log"] = "true";
+    ini["trajectory"]["print"] = "false";
+    ini["trajectory"]["teensy"] = "0"; // Teensy with the drive motors (pose)
+    // default limits for linear motion: velocity (m/s), acc (m/s^2), jerk (m/s^3)
+    ini["trajectory"]["linear"] = "0.3 0.5 2.0";
+    // default limits for turn on the spot: turnrate (rad/s), acc (rad/s^2), jerk (rad/s^3)
+    ini["trajectory"]["turn"] = "1.0 2.0 8.0";
+    // heading correction (rad/s per rad)
+    ini["trajectory"]["heading_kp"] = "0.5";
+    ini["trajectory"]["progress_interval"] = "0.2"; // (sec)
+  }
+  if (not ini["trajectory"].has("position_kp"))
+    // distance correction on straight segments (m/s per m)
+    ini["trajectory"]["position_kp"] = "1.0";
+  tn = strtol(ini["trajectory"]["teensy"].c_str(), nullptr, 10);
+  if (tn < 0 or tn >= service.teensyCnt)
+    tn = 0;
+  const char * p1 = ini["trajectory"]["linear"].c_str();
+  vMax = strtof(p1, (char**)&p1);
+  aMax = strtof(p1, (char**)&p1);
+  jMax = strtof(p1, (char**)&p1);
+  p1 = ini["trajectory"]["turn"].c_str();
+  wMax = strtof(p1, (char**)&p1);
+  awMax = strtof(p1, (char**)&p1);
+  jwMax = strtof(p1, (char**)&p1);
+  headingKp = strtof(ini["trajectory"]["heading_kp"].c_str(), nullptr);
+  positionKp = strtof(ini["trajectory"]["position_kp"].c_str(), nullptr);
+  progressInterval = strtof(ini["trajectory"]["progress_interval"].c_str(), nullptr);
+  toConsole = ini["trajectory"]["print"] == "true";
+  topic = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "traj";
+  if (ini["trajectory"]["log"] == "true" and logCh < 0)
+  { // open logfile
+    logCh = logger.addChannel("log_trajectory", "");
+    logger.addHeader(logCh, "%% Trajectory events\n");
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2 \tEvent, one of\n");
+    logger.addHeader(logCh, "%%   \tqueued id type length [radius] vmax acc jerk\n");
+    logger.addHeader(logCh, "%%   \tstart id type duration (sec) peak velocity\n");
+    logger.addHeader(logCh, "%%   \tprogress id fraction\n");
+    logger.addHeader(logCh, "%%   \tdone id distance (m) heading change (rad) time (sec)\n");
+    logger.addHeader(logCh, "%%   \tstop id, cleared, idle\n");
+  }
+}
+
+bool CTrajectory::decode(const char* msg, const char* params, UTime&)
+{
+  bool used = true;
+  if (strcmp(msg, "traj") == 0)
+  { // like 'dist 1.0 0.3 0.5 2.0' or 'turn 1.57' or 'arc 0.5 1.57' or 'stop'
+    const char * p1 = params;
+    while (isspace(*p1))
+      p1++;
+    UMotionSegment s;
+    int n = 0;
+    if (strncmp(p1, "dist", 4) == 0)
+    {
+      s.type = UMotionSegment::DIST;
+      n = 1;
+    }
+    else if (strncmp(p1, "turn", 4) == 0)
+    {
+      s.type = UMotionSegment::TURN;
+      n = 1;
+    }
+    else if (strncmp(p1, "arc", 3) == 0)
+    {
+      s.type = UMotionSegment::ARC;
+      n = 2;
+    }
+    else if (strncmp(p1, "stop", 4) == 0)
+    { // ramp down and clear the queue
+      std::lock_guard<std::mutex> lock(queueLock);
+      queue.clear();
+      queueSize = 0;
+      stopRequest = true;
+      return true;
+    }
+    else if (strncmp(p1, "clear", 5) == 0)
+    { // stop now
+      clear();
+      return true;
+    }
+    else
+    {
+      printf("# CTrajectory::decode: unknown segment type in '%s'\n", params);
+      return true;
+    }
+    while (isalpha(*p1))
+      p1++;
+    // length (and radius), then optional limits
+    float v[5];
+    int cnt = 0;
+    for (int i = 0; i < n + 3; i++)
+    {
+      const char * p2 = p1;
+      v[i] = strtof(p1, (char**)&p1);
+      if (p1 == p2)
+        break;
+      cnt++;
+    }
+    if (cnt < n)
+    {
+      printf("# CTrajectory::decode: missing length in '%s'\n", params);
+      return true;
+    }
+    if (s.type == UMotionSegment::ARC)
+    {
+      s.radius = v[0];
+      s.length = v[1];
+      if (fabsf(s.radius) < 0.01)
+      {
+        printf("# CTrajectory::decode: arc radius too small in '%s'\n", params);
+        return true;
+      }
+    }
+    else
+      s.length = v[0];
+    if (s.type == UMotionSegment::TURN)
+    {
+      s.vMax = wMax;
+      s.aMax = awMax;
+      s.jMax = jwMax;
+    }
+    else
+    {
+      s.vMax = vMax;
+      s.aMax = aMax;
+      s.jMax = jMax;
+    }
+    if (cnt > n)
+      s.vMax = fabsf(v[n]);
+    if (cnt > n + 1)
+      s.aMax = fabsf(v[n + 1]);
+    if (cnt > n + 2)
+      s.jMax = fabsf(v[n + 2]);
+    s.plan();
+    {
+      std::lock_guard<std::mutex> lock(queueLock);
+      s.id = nextId++;
+      queue.push_back(s);
+      queueSize = queue.size();
+    }
+    event("queued %d %s %g %g %g %g %g", s.id, s.name(), s.length, s.radius, s.vMax, s.aMax, s.jMax);
+  }
+  else
+    used = false;
+  return used;
+}
+
+bool CTrajectory::startNext()
+{
+  {
+    std::lock_guard<std::mutex> lock(queueLock);
+    if (queue.empty())
+      return false;
+    seg = queue.front();
+    queue.pop_front();
+    queueSize = queue.size();
+  }
+  SEncoder::Data ed;
+  encoder[tn].snapshot.read(ed);
+  for (int i = 0; i < 3; i++)
+    startPose[i] = ed.pose[i];
+  headingChange = 0;
+  lastHeading = ed.pose[2];
+  segStart.now();
+  lastProgress = segStart;
+  active = true;
+  stopping = false;
+  event("start %d %s %.3f %.3f", seg.id, seg.name(), seg.duration(), seg.vPeak);
+  return true;
+}
+
+bool CTrajectory::update(float & vel, float & turnrate)
+{
+  cleared = false;
+  if (clearRequest)
+  {
+    clearRequest = false;
+    stopRequest = false;
+    cleared = active and clearByOrder;
+    if (active)
+    {
+      active = false;
+      event("cleared %d", seg.id);
+    }
+    return false;
+  }
+  if (not active)
+  {
+    stopRequest = false;
+    if (not startNext())
+      return false;
+  }
+  UTime t;
+  t.now();
+  float dt = t - segStart;
+  float s = 0, v;
+  bool finished;
+  if (stopRequest and not stopping)
+  { // ramp down from the current velocity and acceleration
+    seg.at(dt, s, v);
+    float a = seg.accAt(dt);
+    stopping = true;
+    stopRequest = false;
+    // if decelerating, the profile is followed to stand still
+    stopPlanned = a >= 0;
+    if (stopPlanned)
+    { // reduce acceleration to zero (jerk limited), then decelerate
+      stopV0 = v;
+      stopA0 = a;
+      stopS0 = s;
+      stopT1 = a / seg.jMax;
+      stopS1 = v * stopT1 + a * stopT1 * stopT1 / 2 - seg.jMax * powf(stopT1, 3) / 6;
+      stopV1 = v + a * stopT1 / 2;
+      seg.accTiming(stopV1);
+      seg.tv = 0;
+      segStart = t;
+      dt = 0;
+    }
+    event("stop %d", seg.id);
+  }
+  if (stopping and stopPlanned)
+  {
+    finished = false;
+    if (dt < stopT1)
+    {
+      v = stopV0 + stopA0 * dt - seg.jMax * dt * dt / 2;
+      s = stopS0 + stopV0 * dt + stopA0 * dt * dt / 2 - seg.jMax * powf(dt, 3) / 6;
+    }
+    else
+    { // deceleration phase (acceleration phase backwards)
+      float tau = dt - stopT1;
+      float sRest = 0;
+      finished = tau >= seg.ta;
+      if (finished)
+        v = 0;
+      else
+        seg.accPhase(seg.ta - tau, sRest, v);
+      s = stopS0 + stopS1 + stopV1 * seg.ta / 2 - sRest;
+    }
+  }
+  else
+    finished = seg.at(dt, s, v);
+  // measured motion since segment start
+  SEncoder::Data ed;
+  encoder[tn].snapshot.read(ed);
+  // heading is folded to +/- pi, so sum the changes
+  headingChange += remainderf(ed.pose[2] - lastHeading, 2 * M_PI);
+  lastHeading = ed.pose[2];
+  float dh = headingChange;
+  switch (seg.type)
+  {
+    case UMotionSegment::DIST:
+    {
+      // distance along the start heading
+      float d = (ed.pose[0] - startPose[0]) * cosf(startPose[2]) +
+                (ed.pose[1] - startPose[1]) * sinf(startPose[2]);
+      vel = copysignf(v, seg.length);
+      // keep the start heading
+      turnrate = 0;
+      if (v > 0)
+      {
+        vel += positionKp * (copysignf(s, seg.length) - d);
+        turnrate = -headingKp * dh;
+      }
+      break;
+    }
+    case UMotionSegment::TURN:
+      vel = 0;
+      turnrate = copysignf(v, seg.length);
+      if (v > 0)
+        turnrate += headingKp * (copysignf(s, seg.length) - dh);
+      break;
+    case UMotionSegment::ARC:
+      vel = copysignf(v, seg.radius);
+      turnrate = copysignf(v / fabsf(seg.radius), seg.length);
+      if (v > 0)
+        turnrate += headingKp * (copysignf(s / fabsf(seg.radius), seg.length) - dh);
+      break;
+  }
+  if (finished)
+  {
+    float dist = hypotf(ed.pose[0] - startPose[0], ed.pose[1] - startPose[1]);
+    event("done %d %.3f %.4f %.3f", seg.id, dist, dh, t - segStart);
+    active = false;
+    if (not stopping and startNext())
+      return true;
+    // next segment (if any) starts at next update
+    if (queueSize == 0)
+      event("idle");
+  }
+  else if (t - lastProgress >= progressInterval and not stopping)
+  {
+    float total = seg.vPeak * (seg.ta + seg.tv);
+    float fraction = 1.0;
+    if (total > 0)
+      fraction = s / total;
+    event("progress %d %.3f", seg.id, fraction);
+    lastProgress = t;
+  }
+  return true;
+}
+
+void CTrajectory::clear(bool newOrder)
+{
+  std::lock_guard<std::mutex> lock(queueLock);
+  queue.clear();
+  queueSize = 0;
+  clearByOrder = newOrder;
+  clearRequest = true;
+}
+
+void CTrajectory::event(const char* format, ...)
+{
+  const int MSL = 200;
+  char s[MSL];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(s, MSL - 1, format, args);
+  va_end(args);
+  strncat(s, "\n", MSL - 1);
+  UTime t;
+  t.now();
+  mqtt.publish(topic.c_str(), s, t);
+  if (logCh >= 0 and not service.stop_logging)
+    logger.logText(logCh, t, "%s", s);
+  if (toConsole)
+    printf("%% CTrajectory: %lu.%04ld %s", t.getSec(), t.getMicrosec()/100, s);
+}
+
+void CTrajectory::terminate()
+{
+  clear();
+  // logfile is closed by the logger
+}
@@ -0,0 +1,191 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef CTRAJECTORY_H
+#define CTRAJECTORY_H
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <string>
+
+#include "utime.h"
+
+/**
+ * One motion segment with a jerk limited velocity profile,
+ * from stand still to stand still.
+ * */
+class UMotionSegment
+{
+public:
+  enum Type {DIST, TURN, ARC};
+  Type type = DIST;
+  int id = 0;
+  /// distance (m) or angle (rad), may be negative
+  float length = 0;
+  /// arc radius (m)
+  float radius = 0;
+  /// max velocity (m/s or rad/s), acceleration and jerk
+  float vMax = 0.3;
+  float aMax = 0.5;
+  float jMax = 2.0;
+  /**
+   * Calculate profile timing from length and limits */
+  void plan();
+  /**
+   * Profile at time t after start
+   * \param s is set to the distance (or angle) from start (positive)
+   * \param v is set to the velocity
+   * \returns true when finished */
+  bool at(float t, float & s, float & v);
+  /** profile duration (sec) */
+  float duration()
+  {
+    return 2 * ta + tv;
+  }
+  /** name for messages */
+  const char * name();
+  /// peak velocity (may be less than vMax for short segments)
+  float vPeak = 0;
+  /// duration of acceleration (incl. jerk phases), jerk phase and cruise
+  float ta = 0;
+  float tj = 0;
+  float tv = 0;
+  /// acceleration in constant acceleration phase
+  float aPeak = 0;
+  /**
+   * Velocity and distance at time t in acceleration phase (0 <= t <= ta) */
+  void accPhase(float t, float & s, float & v);
+  /**
+   * Acceleration phase timing for this peak velocity */
+  void accTiming(float vp);
+  /**
+   * Acceleration at time t after start (negative when decelerating) */
+  float accAt(float t);
+};
+
+/**
+ * Executes a queue of motion segments (drive distance, turn on the spot
+ * or drive an arc) and generates velocity and turnrate set-points for
+ * the mixer at the mixer rate.
+ * Segments are added over MQTT 'robobot/cmd/ti/traj', e.g.
+ *   'dist 1.0 0.3 0.5 2.0'  distance (m), max vel (m/s), acc (m/s^2), jerk (m/s^3)
+ *   'turn 1.57 1.0 2.0 8.0' angle (rad, positive is CCV), max turnrate, acc, jerk
+ *   'arc 0.5 1.57 0.3 0.5 2.0' radius (m), angle (rad), max vel, acc, jerk
+ *   'stop' ramp down now and clear queue
+ * Limits may be omitted (default from robot.ini [trajectory]).
+ * The profile is closed loop on the encoder pose (SEncoder):
+ * the heading change is controlled on all segments (keep start heading
+ * on DIST, profile angle on TURN and ARC), and the distance along the
+ * start heading on DIST.
+ * A stop is jerk limited also from the acceleration phase.
+ * Progress events are published on topic 'traj'.
+ * */
+class CTrajectory
+{
+public:
+  /** setup and initialize parameters */
+  void setup();
+  /**
+   * Decode messages
+   * \returns true if used */
+  bool decode(const char* msg, const char * params, UTime & msgTime);
+  /**
+   * New set-point, called by the mixer
+   * \param vel is set to the linear velocity (m/s)
+   * \param turnrate is set to the turnrate (rad/s)
+   * \returns false if no segment is active */
+  bool update(float & vel, float & turnrate);
+  /**
+   * stop now (no ramp) and clear queue, e.g. for manual override or rc
+   * \param newOrder is true if a new drive order (rc) is given,
+   * so the mixer should not set velocity to zero (see wasCleared()) */
+  void clear(bool newOrder = false);
+  /** close down */
+  void terminate();
+  /** is a segment active or queued */
+  bool isActive()
+  {
+    return active or queueSize > 0;
+  }
+  /**
+   * The last update() ended the active segment because of clear() with
+   * a new drive order (e.g. rc), that owns the drive now (mixer thread only) */
+  bool wasCleared()
+  {
+    return cleared;
+  }
+
+private:
+  /** start next segment from queue
+   * \returns false if queue is empty */
+  bool startNext();
+  /** publish event on MQTT and to log */
+  void event(const char * format, ...) __attribute__((format(printf, 2, 3)));
+  std::mutex queueLock;
+  std::deque<UMotionSegment> queue;
+  std::atomic<int> queueSize = 0;
+  int nextId = 1;
+  /// requests from other threads, handled by update()
+  std::atomic<bool> stopRequest = false;
+  std::atomic<bool> clearRequest = false;
+  std::atomic<bool> clearByOrder = false;
+  /// active segment (mixer thread only)
+  UMotionSegment seg;
+  bool active = false;
+  bool cleared = false;
+  bool stopping = false;
+  /// stop from velocity v0 and acceleration a0: acceleration is reduced
+  /// to zero (time t1, distance s1, velocity v1), then deceleration phase.
+  /// Not planned, if the profile is decelerating already.
+  bool stopPlanned = false;
+  float stopV0 = 0, stopA0 = 0, stopS0 = 0;
+  float stopT1 = 0, stopS1 = 0, stopV1 = 0;
+  UTime segStart;
+  /// pose at segment start (x, y, h)
+  float startPose[3];
+  /// heading change since segment start (not folded)
+  float headingChange = 0;
+  float lastHeading = 0;
+  UTime lastProgress;
+  /// Teensy with the drive motors (pose source)
+  int tn = 0;
+  /// default limits
+  float vMax = 0.3, aMax = 0.5, jMax = 2.0;
+  float wMax = 1.0, awMax = 2.0, jwMax = 8.0;
+  /// heading correction (rad/s per rad)
+  float headingKp = 0.5;
+  /// distance correction on straight segments (m/s per m)
+  float positionKp = 1.0;
+  float progressInterval = 0.2;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
+  bool toConsole = false;
+  std::string topic;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern CTrajectory traj;
+
+#endif
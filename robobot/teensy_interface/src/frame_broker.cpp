@@ -0,0 +1,324 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+
+/**
+ * Frame broker, one camera capture shared by any number of local readers:
+ *   frame_broker -d /dev/video0 -p 7124
+ * For a USB (V4L2) camera; the Pi camera (Picamera2) is captured to the
+ * same ring by stream_server/camera_shm.py, and only one of the two
+ * should run.
+ * Frames (BGR) are placed in a POSIX shared memory ring (see ushmframes.h),
+ * where readers use them without copy, e.g. teensy_interface
+ * ([vision] source = shm) or Python (stream_server/shm_frames.py).
+ * MJPEG over HTTP (http://host:7124/stream.mjpg) is just another reader,
+ * frames are JPEG encoded only when a browser is connected,
+ * and each frame is encoded once for all connected browsers. */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <CLI/CLI.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "uframesource.h"
+#include "ushmframes.h"
+
+static std::atomic<bool> stopBroker{false};
+
+void signalHandler(int /*signum*/)
+{
+  stopBroker = true;
+}
+
+/**
+ * Capture to shared memory and MJPEG server */
+class UFrameBroker
+{
+public:
+  std::string device = "/dev/video0";
+  int width = 820;
+  int height = 616;
+  std::string shmName = "/robobot_frames";
+  int slots = 4;
+  int port = 7124;
+  int quality = 80;
+  float statInterval = 10;
+  /**
+   * Open camera and create shared memory
+   * \returns false if not possible */
+  bool open();
+  /**
+   * capture until stopped */
+  void run();
+  void close();
+
+private:
+  static void runAcceptObj(UFrameBroker * obj)
+  {
+    obj->runAccept();
+  }
+  static void runEncodeObj(UFrameBroker * obj)
+  {
+    obj->runEncode();
+  }
+  /** accept browser connections */
+  void runAccept();
+  /** encode newest frame and send to browsers, if any */
+  void runEncode();
+  /** send to all clients, clients with errors are removed */
+  void sendToClients(const char * data, int n);
+  UFrameSourceV4l * source = nullptr;
+  UShmFrames ring;
+  UVisionFrame frame;
+  int listenSock = -1;
+  std::thread * thAccept = nullptr;
+  std::thread * thEncode = nullptr;
+  std::mutex clientLock;
+  std::vector<int> clients;
+  /// statistics
+  int captureCnt = 0;
+  int copyCnt = 0;
+  int encodeCnt = 0;
+};
+
+bool UFrameBroker::open()
+{
+  source = new UFrameSourceV4l(device, width, height);
+  if (not source->open())
+    return false;
+  // the first frame gives the actual size
+  if (not source->grab(frame) or frame.img.empty())
+  {
+    printf("# UFrameBroker::open: got no frame from %s\n", device.c_str());
+    return false;
+  }
+  width = frame.img.cols;
+  height = frame.img.rows;
+  if (not ring.create(shmName, width, height, 3, slots))
+    return false;
+  printf("# UFrameBroker::open: %s %dx%d to shared memory %s (%d frames)\n",
+         device.c_str(), width, height, shmName.c_str(), slots);
+  if (port > 0)
+  { // MJPEG server
+    listenSock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(listenSock, (struct sockaddr *)&addr, sizeof(addr)) != 0 or listen(listenSock, 5) != 0)
+    {
+      perror("# UFrameBroker::open: MJPEG server not available");
+      ::close(listenSock);
+      listenSock = -1;
+    }
+    else
+    {
+      thAccept = new std::thread(runAcceptObj, this);
+      thEncode = new std::thread(runEncodeObj, this);
+    }
+  }
+  return true;
+}
+
+void UFrameBroker::run()
+{
+  UTime statTime("now");
+  while (not stopBroker)
+  {
+    uint64_t n;
+    uint8_t * p = ring.beginWrite(n);
+    // capture directly into the shared memory slot
+    frame.img = cv::Mat(height, width, CV_8UC3, p);
+    if (not source->grab(frame))
+    { // camera lost, try again
+      sleep(1);
+      source->open();
+      continue;
+    }
+    if (frame.img.data != p)
+    { // driver made a new image, so copy
+      if (frame.img.cols != width or frame.img.rows != height or frame.img.type() != CV_8UC3)
+      {
+        printf("# UFrameBroker::run: frame size changed to %dx%d, ignored\n", frame.img.cols, frame.img.rows);
+        continue;
+      }
+      cv::Mat m(height, width, CV_8UC3, p);
+      frame.img.copyTo(m);
+      copyCnt++;
+    }
+    ring.endWrite(n, frame.captureTime);
+    captureCnt++;
+    if (statInterval > 0 and statTime.getTimePassed() > statInterval)
+    {
+      float dt = statTime.getTimePassed();
+      int nc;
+      {
+        std::lock_guard<std::mutex> lock(clientLock);
+        nc = clients.size();
+      }
+      printf("# UFrameBroker: %.1f frames/s (%d copied), %.1f encoded/s, %d browsers\n",
+             captureCnt / dt, copyCnt, encodeCnt / dt, nc);
+      captureCnt = 0;
+      copyCnt = 0;
+      encodeCnt = 0;
+      statTime.now();
+    }
+  }
+}
+
+void UFrameBroker::runAccept()
+{
+  struct pollfd pfd = {listenSock, POLLIN, 0};
+  while (not stopBroker)
+  {
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+    int s = accept(listenSock, nullptr, nullptr);
+    if (s < 0)
+      continue;
+    // read (and ignore) the request
+    struct timeval tv = {1, 0};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char req[1000];
+    int n = recv(s, req, sizeof(req), 0);
+    const char * hdr = "HTTP/1.0 200 OK\r\n"
+                       "Cache-Control: no-cache, private\r\n"
+                       "Pragma: no-cache\r\n"
+                       "Content-Type: multipart/x-mixed-replace; boundary=FRAME\r\n\r\n";
+    if (n <= 0 or send(s, hdr, strlen(hdr), MSG_NOSIGNAL) <= 0)
+    {
+      ::close(s);
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(clientLock);
+    clients.push_back(s);
+  }
+}
+
+void UFrameBroker::sendToClients(const char* data, int n)
+{
+  std::lock_guard<std::mutex> lock(clientLock);
+  for (auto it = clients.begin(); it != clients.end();)
+  {
+    if (send(*it, data, n, MSG_NOSIGNAL) != n)
+    { // browser is gone (or too slow)
+      ::close(*it);
+      it = clients.erase(it);
+    }
+    else
+      it++;
+  }
+}
+
+void UFrameBroker::runEncode()
+{
+  std::vector<uchar> jpeg;
+  std::vector<int> param = {cv::IMWRITE_JPEG_QUALITY, quality};
+  uint64_t lastN = 0;
+  UTime t;
+  while (not stopBroker)
+  {
+    bool any;
+    {
+      std::lock_guard<std::mutex> lock(clientLock);
+      any = not clients.empty();
+    }
+    uint64_t n = ring.latest();
+    if (not any or n == lastN)
+    { // nobody to send to, or no new frame
+      usleep(5000);
+      continue;
+    }
+    lastN = n;
+    const uint8_t * p = ring.frame(n, t);
+    if (p == nullptr)
+      continue;
+    cv::Mat img(height, width, CV_8UC3, (void *)p);
+    cv::imencode(".jpg", img, jpeg, param);
+    if (not ring.isValid(n))
+      // overwritten while encoding
+      continue;
+    encodeCnt++;
+    const int MSL = 200;
+    char s[MSL];
+    int m = snprintf(s, MSL, "--FRAME\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n", (int)jpeg.size());
+    sendToClients(s, m);
+    sendToClients((const char *)jpeg.data(), jpeg.size());
+    sendToClients("\r\n", 2);
+  }
+}
+
+void UFrameBroker::close()
+{
+  if (thAccept != nullptr)
+    thAccept->join();
+  if (thEncode != nullptr)
+    thEncode->join();
+  for (int s : clients)
+    ::close(s);
+  clients.clear();
+  if (listenSock >= 0)
+    ::close(listenSock);
+  if (source != nullptr)
+    source->close();
+  ring.close();
+}
+
+
+int main(int argc, char ** argv)
+{
+  CLI::App cli{"Frame broker, camera to shared memory and MJPEG"};
+  UFrameBroker broker;
+  cli.add_option("-d,--device", broker.device, "Camera device (default /dev/video0)");
+  cli.add_option("-W,--width", broker.width, "Image width (default 820)");
+  cli.add_option("-H,--height", broker.height, "Image height (default 616)");
+  cli.add_option("-s,--shm", broker.shmName, "Shared memory name (default /robobot_frames)");
+  cli.add_option("-n,--frames", broker.slots, "Frames in shared memory ring (default 4)");
+  cli.add_option("-p,--port", broker.port, "MJPEG server port, 0 is no server (default 7124)");
+  cli.add_option("-q,--quality", broker.quality, "JPEG quality (default 80)");
+  cli.add_option("--stat", broker.statInterval, "Statistics interval in seconds (0 = none, default 10)");
+  CLI11_PARSE(cli, argc, argv);
+  //
+  signal(SIGINT, signalHandler);
+  signal(SIGTERM, signalHandler);
+  if (broker.open())
+    broker.run();
+  broker.close();
+  printf("# UFrameBroker:: ended\n");
+  return 0;
+}
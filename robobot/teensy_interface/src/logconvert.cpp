@@ -0,0 +1,265 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+/**
+ * Convert a binary logfile (log_all.ulog, see ulogger.h)
+ * to the text logfiles (log_t0_encoder.txt etc.) or to CSV files, e.g.:
+ *   logconvert log_2025_03_02_154030/log_all.ulog
+ * saves the text logfiles in the same directory as the binary logfile.
+ *   logconvert log_all.ulog --csv -b 10 -e 20 -c encoder -o /tmp
+ * saves CSV files with 10 seconds of data (from 10 to 20 seconds
+ * after the log started) for channels with 'encoder' in the name.
+ * The chunk index is used to read only the chunks in the time range. */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <CLI/CLI.hpp>
+#include "ulogformat.h"
+
+/**
+ * Find all blocks, using the index at the end of the file,
+ * or (if there is no index) by reading all block headers.
+ * \returns false if no blocks */
+bool readIndex(FILE * f, std::vector<ULogIndexEntry> & index)
+{
+  ULogTrailer tr;
+  ULogBlock b;
+  index.clear();
+  if (fseek(f, -(long)sizeof(tr), SEEK_END) == 0 and
+      fread(&tr, sizeof(tr), 1, f) == 1 and
+      memcmp(tr.magic, ULOG_INDEX_MAGIC, sizeof(tr.magic)) == 0 and
+      fseek(f, tr.indexOffset, SEEK_SET) == 0 and
+      fread(&b, sizeof(b), 1, f) == 1 and
+      b.type == ULOG_BLOCK_INDEX and
+      b.size == b.count * sizeof(ULogIndexEntry))
+  {
+    index.resize(b.count);
+    if (fread(index.data(), sizeof(ULogIndexEntry), b.count, f) == b.count)
+      return not index.empty();
+    index.clear();
+  }
+  // no index, probably not terminated normally
+  printf("# logconvert:: no index, reading block headers\n");
+  fseek(f, 0, SEEK_END);
+  long fileSize = ftell(f);
+  long pos = sizeof(ULOG_MAGIC);
+  while (fseek(f, pos, SEEK_SET) == 0 and fread(&b, sizeof(b), 1, f) == 1)
+  {
+    if (b.type < ULOG_BLOCK_DEF or b.type > ULOG_BLOCK_INDEX or
+        pos + long(sizeof(b) + b.size) > fileSize)
+      break; // not a block or last block is incomplete
+    ULogIndexEntry e;
+    e.offset = pos;
+    e.firstTime_us = b.firstTime_us;
+    e.lastTime_us = b.lastTime_us;
+    e.count = b.count;
+    e.channel = b.channel;
+    e.type = b.type;
+    pos += sizeof(b) + b.size;
+    if (b.type != ULOG_BLOCK_INDEX)
+      index.push_back(e);
+  }
+  return not index.empty();
+}
+
+/**
+ * Read block payload (decompressed)
+ * \returns false if not possible */
+bool readBlock(FILE * f, const ULogIndexEntry & e, ULogBlock & b, std::vector<uint8_t> & raw)
+{
+  std::vector<uint8_t> data;
+  if (fseek(f, e.offset, SEEK_SET) != 0 or fread(&b, sizeof(b), 1, f) != 1)
+    return false;
+  data.resize(b.size);
+  if (fread(data.data(), 1, b.size, f) != b.size)
+    return false;
+  if (b.compress == ULOG_COMPRESS_NONE)
+  {
+    raw.swap(data);
+    return true;
+  }
+  return ulogDecompress(data.data(), data.size(), raw, b.rawSize);
+}
+
+int main(int argc, char ** argv)
+{
+  CLI::App cli{"Convert binary robobot log to text or CSV logfiles"};
+  std::string inFile;
+  cli.add_option("logfile", inFile, "Binary logfile (log_all.ulog)")->required();
+  std::string outPath;
+  cli.add_option("-o,--out", outPath, "Directory for converted logfiles (default is same as logfile)");
+  bool csv = false;
+  cli.add_flag("--csv", csv, "Save as CSV files (default is the usual text logfiles)");
+  double begin = 0;
+  cli.add_option("-b,--begin", begin, "Start of time range (seconds after log start)");
+  double end = -1;
+  cli.add_option("-e,--end", end, "End of time range (seconds after log start), default is end of log");
+  std::string only;
+  cli.add_option("-c,--channel", only, "Only channels with this in the name, e.g. 'encoder'");
+  bool list = false;
+  cli.add_flag("-l,--list", list, "List channels and time range (no conversion)");
+  CLI11_PARSE(cli, argc, argv);
+  //
+  if (outPath.empty())
+  { // same path as binary logfile
+    size_t n = inFile.rfind('/');
+    if (n != std::string::npos)
+      outPath = inFile.substr(0, n + 1);
+  }
+  else if (outPath.back() != '/')
+    outPath += "/";
+  FILE * f = fopen(inFile.c_str(), "r");
+  if (f == nullptr)
+  {
+    printf("# logconvert:: failed to open %s\n", inFile.c_str());
+    return 1;
+  }
+  char magic[sizeof(ULOG_MAGIC)];
+  if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) or
+      memcmp(magic, ULOG_MAGIC, sizeof(magic)) != 0)
+  {
+    printf("# logconvert:: %s is not a binary robobot log (or an old version)\n", inFile.c_str());
+    fclose(f);
+    return 1;
+  }
+  std::vector<ULogIndexEntry> index;
+  if (not readIndex(f, index))
+  {
+    printf("# logconvert:: no data in %s\n", inFile.c_str());
+    fclose(f);
+    return 1;
+  }
+  // time range
+  int64_t t0 = INT64_MAX;
+  int64_t t1 = 0;
+  for (const ULogIndexEntry & e : index)
+  {
+    if (e.type == ULOG_BLOCK_CHUNK)
+    {
+      t0 = std::min(t0, e.firstTime_us);
+      t1 = std::max(t1, e.lastTime_us);
+    }
+  }
+  int64_t from = t0 + int64_t(begin * 1e6);
+  int64_t to = INT64_MAX;
+  if (end >= 0)
+    to = t0 + int64_t(end * 1e6);
+  // channel definitions
+  std::vector<ULogChannel> channels(0x10000);
+  std::vector<FILE *> files(0x10000, nullptr);
+  std::vector<int> recCnt(0x10000, 0);
+  std::vector<uint8_t> raw;
+  ULogBlock b;
+  for (const ULogIndexEntry & e : index)
+  {
+    if (e.type != ULOG_BLOCK_DEF)
+      continue;
+    if (not readBlock(f, e, b, raw) or
+        not channels[e.channel].setDefinition((const char *)raw.data(), raw.size()))
+    {
+      printf("# logconvert:: bad channel definition for channel %d\n", e.channel);
+      continue;
+    }
+    if (not only.empty() and channels[e.channel].name.find(only) == std::string::npos)
+      channels[e.channel].name.clear();
+  }
+  if (list)
+  {
+    printf("# logconvert:: log duration %.3f sec\n", double(t1 - t0) / 1e6);
+    for (const ULogIndexEntry & e : index)
+    {
+      if (e.type == ULOG_BLOCK_CHUNK)
+        recCnt[e.channel] += e.count;
+    }
+    for (int ch = 0; ch < (int)channels.size(); ch++)
+    {
+      if (not channels[ch].name.empty())
+        printf("%3d %-30s %8d records\n", ch, channels[ch].name.c_str(), recCnt[ch]);
+    }
+    fclose(f);
+    return 0;
+  }
+  // convert chunks in time range
+  const int MSL = 2000;
+  char s[MSL];
+  int fileCnt = 0;
+  int chunkCnt = 0;
+  int total = 0;
+  ULogChunk chunk;
+  for (const ULogIndexEntry & e : index)
+  {
+    ULogChannel & lc = channels[e.channel];
+    if (e.type != ULOG_BLOCK_CHUNK or lc.name.empty())
+      continue;
+    if (e.lastTime_us < from or e.firstTime_us > to)
+      continue; // not in time range
+    if (not readBlock(f, e, b, raw) or
+        not chunk.decode(raw.data(), raw.size(), e.channel, b.firstTime_us))
+    {
+      printf("# logconvert:: bad chunk for %s (at %lu)\n", lc.name.c_str(), (unsigned long)e.offset);
+      continue;
+    }
+    chunkCnt++;
+    FILE *& lf = files[e.channel];
+    if (lf == nullptr)
+    { // first data for channel
+      std::string fn = outPath + lc.name + (csv ? ".csv" : ".txt");
+      lf = fopen(fn.c_str(), "w");
+      if (lf == nullptr)
+      {
+        printf("# logconvert:: failed to open %s\n", fn.c_str());
+        lc.name.clear();
+        continue;
+      }
+      if (csv)
+        fprintf(lf, "%s", lc.csvHeader().c_str());
+      else
+        fprintf(lf, "%s", lc.header.c_str());
+      fileCnt++;
+    }
+    uint32_t pos = 0;
+    for (const ULogRecord * r = chunk.next(pos); r != nullptr; r = chunk.next(pos))
+    {
+      if (r->time_us < from or r->time_us > to)
+        continue;
+      int n;
+      if (csv)
+        n = lc.formatCsv(r, s, MSL);
+      else
+        n = lc.format(r, s, MSL);
+      fwrite(s, 1, n, lf);
+      total++;
+    }
+  }
+  for (FILE * lf : files)
+  {
+    if (lf != nullptr)
+      fclose(lf);
+  }
+  fclose(f);
+  printf("# logconvert:: converted %d records (from %d chunks) into %d logfiles\n", total, chunkCnt, fileCnt);
+  return 0;
+}
@@ -0,0 +1,313 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <math.h>
+#include "mfusion.h"
+#include "sencoder.h"
+#include "simu.h"
+#include "uservice.h"
+#include "umqtt.h"
+#include "ulogger.h"
+
+// create value
+MFusion fusion;
+
+
+void MFusion::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("fusion"))
+  { // no data yet, so generate some default values
+    ini["fusion"]["use"] = "true";
+    ini["fusion"]["log"] = "true";
+    ini["fusion"]["print"] = "false";
+    ini["fusion"]["teensy"] = "0"; // Teensy with encoders and IMU
+    // noise as standard deviation
+    ini["fusion"]["vel_std"] = "0.02";       // wheel velocity (m/s)
+    ini["fusion"]["gyro_std"] = "0.01";      // gyro turnrate (rad/s)
+    ini["fusion"]["odo_turn_std"] = "0.1";   // odometry turnrate (rad/s)
+    ini["fusion"]["bias_std"] = "0.001";     // gyro bias drift (rad/s per sqrt(s))
+    ini["fusion"]["gate"] = "3.0";           // reject odometry turnrate (slip) above this (std)
+    ini["fusion"]["max_gyro_age"] = "0.05";  // use odometry turnrate if gyro is older (sec)
+    ini["fusion"]["publish_interval_ms"] = "0"; // 0 is every update
+  }
+  tn = strtol(ini["fusion"]["teensy"].c_str(), nullptr, 10);
+  if (tn < 0 or tn >= service.teensyCnt)
+    tn = 0;
+  wheelbase = strtof(ini["mixer"]["wheelbase"].c_str(), nullptr);
+  if (wheelbase < 0.005)
+    wheelbase = 0.22;
+  velStd = strtof(ini["fusion"]["vel_std"].c_str(), nullptr);
+  gyroStd = strtof(ini["fusion"]["gyro_std"].c_str(), nullptr);
+  odoTurnStd = strtof(ini["fusion"]["odo_turn_std"].c_str(), nullptr);
+  biasStd = strtof(ini["fusion"]["bias_std"].c_str(), nullptr);
+  gate = strtof(ini["fusion"]["gate"].c_str(), nullptr);
+  maxGyroAge = strtof(ini["fusion"]["max_gyro_age"].c_str(), nullptr);
+  publishInterval = strtof(ini["fusion"]["publish_interval_ms"].c_str(), nullptr) / 1000.0;
+  reset(0, 0, 0);
+  // MQTT
+  topic = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "fpose";
+  //
+  if (ini["fusion"]["use"] == "true")
+  {
+    toConsole = ini["fusion"]["print"] == "true";
+    if (ini["fusion"]["log"] == "true" and logCh < 0)
+    { // open logfile
+      logCh = logger.addChannel("log_fusion", "%.4f %.4f %.5f %.5f %.4f %.4f %.3g %.3g %.3g %.3g %d %d");
+      logger.addHeader(logCh, "%% Fused pose (odometry and gyro) logfile\n");
+      logger.addHeader(logCh, "%% 1 \tTime (sec) of Teensy sample\n");
+      logger.addHeader(logCh, "%% 2,3 \tX, Y position (m)\n");
+      logger.addHeader(logCh, "%% 4 \tHeading (rad)\n");
+      logger.addHeader(logCh, "%% 5 \tGyro bias (rad/s)\n");
+      logger.addHeader(logCh, "%% 6 \tVelocity (m/s)\n");
+      logger.addHeader(logCh, "%% 7 \tTurnrate (rad/s)\n");
+      logger.addHeader(logCh, "%% 8-11 \tVariance of x, y, h, b\n");
+      logger.addHeader(logCh, "%% 12 \tUpdate count\n");
+      logger.addHeader(logCh, "%% 13 \tRejected odometry turnrate count (wheel slip)\n");
+    }
+    if (th1 == nullptr)
+      th1 = new std::thread(runObj, this);
+  }
+}
+
+bool MFusion::decode(const char* msg, const char* params, UTime&)
+{
+  bool used = true;
+  const char * p1 = params;
+  if (strcmp(msg, "fusion") == 0)
+  { // like: 'fusion reset 0 0 0'
+    while (isspace(*p1))
+      p1++;
+    if (strncmp(p1, "reset", 5) == 0)
+    {
+      p1 += 5;
+      for (int i = 0; i < 3; i++)
+        resetPose[i] = strtof(p1, (char**)&p1);
+      resetRequest = true;
+    }
+  }
+  else
+    used = false;
+  return used;
+}
+
+void MFusion::reset(float x, float y, float h)
+{
+  s[0] = x;
+  s[1] = y;
+  s[2] = h;
+  // keep the bias estimate
+  for (int i = 0; i < NS; i++)
+    for (int j = 0; j < NS; j++)
+      if (i != 3 or j != 3)
+        P[i][j] = 0;
+  if (P[3][3] == 0)
+    P[3][3] = 0.01 * 0.01;
+}
+
+void MFusion::predict(float v, float w, float dt, bool gyroUsed)
+{
+  if (gyroUsed)
+    w -= s[3];
+  float hm = s[2] + w * dt / 2.0;
+  float c = cosf(hm);
+  float sn = sinf(hm);
+  s[0] += v * dt * c;
+  s[1] += v * dt * sn;
+  s[2] += w * dt;
+  if (s[2] > M_PI)
+    s[2] -= 2.0 * M_PI;
+  else if (s[2] < -M_PI)
+    s[2] += 2.0 * M_PI;
+  vel = v;
+  turnrate = w;
+  // Jacobian of state update
+  float F[NS][NS] = {{1, 0, -v * dt * sn, 0},
+                     {0, 1,  v * dt * c,  0},
+                     {0, 0,  1,           0},
+                     {0, 0,  0,           1}};
+  if (gyroUsed)
+  { // heading depends on bias
+    F[0][3] = v * dt * sn * dt / 2.0;
+    F[1][3] = -v * dt * c * dt / 2.0;
+    F[2][3] = -dt;
+  }
+  // P = F P F'
+  float FP[NS][NS];
+  for (int i = 0; i < NS; i++)
+    for (int j = 0; j < NS; j++)
+    {
+      float sum = 0;
+      for (int k = 0; k < NS; k++)
+        sum += F[i][k] * P[k][j];
+      FP[i][j] = sum;
+    }
+  for (int i = 0; i < NS; i++)
+    for (int j = 0; j < NS; j++)
+    {
+      float sum = 0;
+      for (int k = 0; k < NS; k++)
+        sum += FP[i][k] * F[j][k];
+      P[i][j] = sum;
+    }
+  // process noise from velocity, turnrate and bias drift
+  float gv[NS] = {dt * c, dt * sn, 0, 0};
+  float gw[NS] = {-v * dt * sn * dt / 2.0f, v * dt * c * dt / 2.0f, dt, 0};
+  float qv = velStd * velStd;
+  float qw;
+  if (gyroUsed)
+    qw = gyroStd * gyroStd;
+  else
+    qw = odoTurnStd * odoTurnStd;
+  for (int i = 0; i < NS; i++)
+    for (int j = 0; j < NS; j++)
+      P[i][j] += gv[i] * qv * gv[j] + gw[i] * qw * gw[j];
+  P[3][3] += biasStd * biasStd * dt;
+}
+
+bool MFusion::correct(float wOdo, float wGyro)
+{ // measurement is odometry turnrate, expected as gyro minus bias,
+  // so H = [0 0 0 -1]
+  float innovation = wOdo - (wGyro - s[3]);
+  float S = P[3][3] + odoTurnStd * odoTurnStd + gyroStd * gyroStd;
+  if (innovation * innovation > gate * gate * S)
+  { // likely wheel slip
+    rejectCnt++;
+    return false;
+  }
+  float K[NS];
+  for (int i = 0; i < NS; i++)
+    K[i] = -P[i][3] / S;
+  for (int i = 0; i < NS; i++)
+    s[i] += K[i] * innovation;
+  // P = (I - K H) P, with H = [0 0 0 -1]
+  float p3[NS];
+  for (int j = 0; j < NS; j++)
+    p3[j] = P[3][j];
+  for (int i = 0; i < NS; i++)
+    for (int j = 0; j < NS; j++)
+      P[i][j] += K[i] * p3[j];
+  // keep symmetric
+  for (int i = 0; i < NS; i++)
+    for (int j = i + 1; j < NS; j++)
+    {
+      float m = (P[i][j] + P[j][i]) / 2.0;
+      P[i][j] = m;
+      P[j][i] = m;
+    }
+  return true;
+}
+
+void MFusion::run()
+{
+  SEncoder::Data ed;
+  SImu::Data id;
+  int encVersion = 0;
+  int velCnt = 0;
+  UTime lastSample;
+  bool first = true;
+  UTime t;
+  while (not service.stop)
+  { // update at the wheel velocity rate
+    if (not encoder[tn].snapshot.waitForUpdate(encVersion, 0.1))
+      continue;
+    encVersion = encoder[tn].snapshot.read(ed);
+    if (ed.updateVelCnt == velCnt)
+      continue;
+    velCnt = ed.updateVelCnt;
+    if (resetRequest)
+    {
+      reset(resetPose[0], resetPose[1], resetPose[2]);
+      resetRequest = false;
+    }
+    float dt = ed.encVelSampleTime - lastSample;
+    lastSample = ed.encVelSampleTime;
+    if (first or dt <= 0 or dt > 0.2)
+    { // first or missing samples, just restart from here
+      first = false;
+      continue;
+    }
+    float v = (ed.vel[0] + ed.vel[1]) / 2.0;
+    float wOdo = (ed.vel[1] - ed.vel[0]) / wheelbase;
+    imu[tn].snapshot.read(id);
+    bool gyroUsed = id.updateGyroCnt > 0 and
+                    fabsf(ed.encVelSampleTime - id.gyroSampleTime) < maxGyroAge;
+    if (gyroUsed)
+    { // gyro is in deg/s
+      float wGyro = id.gyro[2] * M_PI / 180.0;
+      predict(v, wGyro, dt, true);
+      correct(wOdo, wGyro);
+    }
+    else
+      predict(v, wOdo, dt, false);
+    updateCnt++;
+    Data d;
+    for (int i = 0; i < 3; i++)
+      d.pose[i] = s[i];
+    d.bias = s[3];
+    d.velocity = vel;
+    d.turnrate = turnrate;
+    memcpy(d.cov, P, sizeof(d.cov));
+    d.sampleTime = ed.encVelSampleTime;
+    d.updateCnt = updateCnt;
+    snapshot.write(d);
+    t.now();
+    latency.add(t - ed.encVelTime);
+    toLog(ed.encVelSampleTime);
+  }
+}
+
+void MFusion::toLog(UTime & t)
+{
+  if (service.stop)
+    return;
+  if (logCh >= 0 and not service.stop_logging)
+  {
+    logger.log(logCh, t, s[0], s[1], s[2], s[3], vel, turnrate,
+               P[0][0], P[1][1], P[2][2], P[3][3], updateCnt, rejectCnt);
+  }
+  if (publishInterval <= 0 or published.getTimePassed() >= publishInterval)
+  { // x y h v w bias, and covariance of x, y and h (6 values)
+    published.now();
+    const int MSL = 200;
+    char m[MSL];
+    snprintf(m, MSL, "%.4f %.4f %.5f %.4f %.4f %.5f %.3g %.3g %.3g %.3g %.3g %.3g\n",
+             s[0], s[1], s[2], vel, turnrate, s[3],
+             P[0][0], P[0][1], P[0][2], P[1][1], P[1][2], P[2][2]);
+    mqtt.publish(topic.c_str(), m, t);
+  }
+  if (toConsole)
+    printf("%% MFusion: %lu.%04ld %.3f %.3f %.4f bias %.5f (rejected %d)\n",
+           t.getSec(), t.getMicrosec()/100, s[0], s[1], s[2], s[3], rejectCnt);
+}
+
+void MFusion::terminate()
+{
+  if (th1 != nullptr)
+  {
+    th1->join();
+  }
+  // logfile is closed by the logger
+}
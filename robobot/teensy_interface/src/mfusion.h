@@ -0,0 +1,139 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef MFUSION_H
+#define MFUSION_H
+
+#include <thread>
+#include <atomic>
+
+#include "utime.h"
+#include "useqlock.h"
+#include "uhistogram.h"
+
+/**
+ * Pose estimator fusing wheel velocity (Teensy 'vel') and gyro z,
+ * using an extended Kalman filter with the state
+ *   x, y (m), heading h (rad) and gyro bias b (rad/s).
+ * The heading is integrated from the gyro, and the gyro bias is
+ * estimated from the odometry turnrate, so heading drift is removed
+ * without the wheel slip of pure odometry.
+ * Time is the Teensy sample time (converted to host clock).
+ * The update step uses fixed size arrays only (no allocation).
+ * */
+class MFusion
+{
+public:
+  /** setup and initialize parameters */
+  void setup();
+  /**
+   * Decode messages, 'fusion reset [x y h]' sets the pose
+   * \returns true if used */
+  bool decode(const char* msg, const char * params, UTime & msgTime);
+  /**
+   * thread to do updates, when new velocity data is available */
+  void run();
+  /**
+   * close down */
+  void terminate();
+  /**
+   * Consistent set of fused values, see 'snapshot' */
+  struct Data
+  {
+    float pose[3]; /// x, y, h
+    float bias;    /// gyro bias (rad/s)
+    float velocity; /// (m/s)
+    float turnrate; /// (rad/s)
+    float cov[4][4];
+    /// Teensy sample time (host clock)
+    UTime sampleTime;
+    int updateCnt;
+  };
+  /**
+   * Latest fused pose for other threads.
+   * Use snapshot.waitForUpdate() to wait for new data */
+  USeqLock<Data> snapshot;
+  /// time from velocity message is received until fused pose is available
+  UHistogram latency;
+
+private:
+  static void runObj(MFusion * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  static const int NS = 4;
+  /**
+   * Prediction, move the state dt seconds
+   * \param v is the linear velocity (m/s)
+   * \param w is the turnrate (rad/s), gyro with bias or from odometry
+   * \param dt is the time step (sec)
+   * \param gyroUsed is true if w is from the gyro (bias is then subtracted) */
+  void predict(float v, float w, float dt, bool gyroUsed);
+  /**
+   * Correction of gyro bias from odometry turnrate
+   * \param wOdo is the odometry turnrate (rad/s)
+   * \param wGyro is the gyro turnrate (rad/s) including bias
+   * \returns false if rejected (likely wheel slip) */
+  bool correct(float wOdo, float wGyro);
+  /** set pose and reset covariance */
+  void reset(float x, float y, float h);
+  /** save and publish */
+  void toLog(UTime & t);
+  std::thread * th1 = nullptr;
+  /// Teensy with encoder and IMU
+  int tn = 0;
+  /// state x, y, h, b and covariance
+  float s[NS] = {0};
+  float P[NS][NS] = {{0}};
+  /// reset requested (from MQTT thread)
+  std::atomic<bool> resetRequest{false};
+  float resetPose[3] = {0};
+  /// last velocity and turnrate (bias removed)
+  float vel = 0;
+  float turnrate = 0;
+  /// parameters
+  float wheelbase = 0.22;
+  float velStd = 0.02;     // m/s
+  float gyroStd = 0.01;    // rad/s
+  float odoTurnStd = 0.1;  // rad/s
+  float biasStd = 0.001;   // rad/s per sqrt(sec)
+  float gate = 3.0;        // innovation limit in standard deviations
+  float maxGyroAge = 0.05; // sec
+  /// statistics
+  int updateCnt = 0;
+  int rejectCnt = 0;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
+  bool toConsole = false;
+  /// MQTT
+  std::string topic;
+  float publishInterval = 0;
+  UTime published;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern MFusion fusion;
+
+#endif
@@ -35,6 +35,7 @@
 #include "cmixer.h"
 #include "cservo.h"
 #include "mjoy.h"
+#include "ulogger.h"
 
 // #define JS_EVENT_BUTTON         0x01    /* button pressed/released */
 // #define JS_EVENT_AXIS           0x02    /* joystick moved */
@@ -116,42 +117,32 @@ void MJoy::setup()
   //
   // start read thread
   toConsole = ini["Joy_use"]["print"] == "true";
-  if (ini["Joy_use"]["log"] == "true" and logfileD == nullptr)
+  if (ini["Joy_use"]["log"] == "true" and logD < 0)
   { // open logfile
     if (drive_control)
     {
-      std::string fn = service.logPath + "log_joy_drive.txt";
-      logfileD = fopen(fn.c_str(), "w");
-      fprintf(logfileD, "%% Manual drive control\n");
-      fprintf(logfileD, "%% Button fast %d\n", buttonFast);
-      fprintf(logfileD, "%% Axis vel %d\n", axisVel);
-      fprintf(logfileD, "%% Axis turn %d\n", axisTurn);
-      fprintf(logfileD, "%% Axis servo %d\n", axisServo);
-      fprintf(logfileD, "%% Slow factor %g\n", slowFactor);
-      fprintf(logfileD, "%% Max velocity (m/s) %g\n", maxVel);
-      fprintf(logfileD, "%% Max turnrate (rad/s) %g\n", maxTurn);
-      fprintf(logfileD, "%% 1 \tTime (sec)\n");
-      fprintf(logfileD, "%% 2 \tManual mode (else automatic)\n");
-      fprintf(logfileD, "%% 3 \tLinear velocity (m/s)\n");
-      fprintf(logfileD, "%% 4 \tTurn curvature value (rad/m)\n");
-      fprintf(logfileD, "%% 5 \tYaw velocity (rad/s) - only id yaw control accept from drive joypad\n");
+      logD = logger.addChannel("log_joy_drive", "%d %g %g %g %g");
+      logger.addHeader(logD, "%% Manual drive control\n");
+      logger.addHeader(logD, "%% Button fast %d\n", buttonFast);
+      logger.addHeader(logD, "%% Axis vel %d\n", axisVel);
+      logger.addHeader(logD, "%% Axis turn %d\n", axisTurn);
+      logger.addHeader(logD, "%% Axis servo %d\n", axisServo);
+      logger.addHeader(logD, "%% Slow factor %g\n", slowFactor);
+      logger.addHeader(logD, "%% Max velocity (m/s) %g\n", maxVel);
+      logger.addHeader(logD, "%% Max turnrate (rad/s) %g\n", maxTurn);
+      logger.addHeader(logD, "%% 1 \tTime (sec)\n");
+      logger.addHeader(logD, "%% 2 \tManual mode (else automatic)\n");
+      logger.addHeader(logD, "%% 3 \tLinear velocity (m/s)\n");
+      logger.addHeader(logD, "%% 4 \tTurn curvature value (rad/m)\n");
+      logger.addHeader(logD, "%% 5 \tYaw velocity (rad/s) - only id yaw control accept from drive joypad\n");
     }
   }
-  // start listen thread
-  if (th1 == nullptr)
-    th1 = new std::thread(runObj, this);
 }
 
 void MJoy::terminate()
 {
   // printf("# joy terminate\n");
-  if (th1 != nullptr)
-    th1->join();
-  if (logfileD != nullptr)
-  {
-    fclose(logfileD);
-    logfileD = nullptr;
-  }
+  // drive logfile is closed by the logger
   if (logfileC != nullptr)
   {
     fclose(logfileC);
@@ -159,53 +150,35 @@ void MJoy::terminate()
   }
 }
 
-void MJoy::run()
-{
-  UTime t;
-  t.now();
-  sleep(3);
-  // bool automaticModeOld = false;
-  int lastUpdate = joyLogi.updateCnt;
-  while (not service.stop)
-  { // handling gamepad events
-    // Device is present
-    if (joyLogi.updateCnt != lastUpdate)
-    { //Detect manual override toggling
-      lastUpdate = joyLogi.updateCnt;
-      // mode change
-      if (manual and joyLogi.getButton(BUTTON_AUTO) == 1)
-      {
-        printf("# SJoy:: shift to auto mode (button 'start' pressed)\n");
-        manual = false;
-      }
-      if (not manual and joyLogi.getButton(BUTTON_MANUAL) == 1)
-      {
-        printf("# SJoy:: shift to manual mode (button 'back' pressed)\n");
-        manual = true;
-      }
-      //
-      updTime.now();
-      if (manual)
-      { // we are in manual mode, so
-        // generate robot control from gamepad
-        if (drive_control)
-        {
-          isFast = joyLogi.getButton(buttonFast) == 1;
-          joyControlDrive();
-        }
-        joyControlServo();
-        // if (crane_control)
-        // {
-        //   joyControlCrane();
-        // }
-        updateCnt++;
-      }
-      toLog();
+void MJoy::update(UTime & t)
+{ // called by the gamepad thread with a complete set of values
+  //Detect manual override toggling
+  if (manual and joyLogi.getButton(BUTTON_AUTO) == 1)
+  {
+    printf("# SJoy:: shift to auto mode (button 'start' pressed)\n");
+    manual = false;
+  }
+  if (not manual and joyLogi.getButton(BUTTON_MANUAL) == 1)
+  {
+    printf("# SJoy:: shift to manual mode (button 'back' pressed)\n");
+    manual = true;
+  }
+  //
+  updTime = t;
+  if (manual)
+  { // we are in manual mode, so
+    // generate robot control from gamepad
+    if (drive_control)
+    {
+      isFast = joyLogi.getButton(buttonFast) == 1;
+      joyControlDrive();
+      // tell the mixer now
+      mixer.setManual(velocity, turnValue);
     }
-    else
-      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    joyControlServo();
+    updateCnt++;
   }
-  // printf("# Joy run finished\n");
+  toLog();
 }
 
 
@@ -309,16 +282,16 @@ void MJoy::toLog()
   {
     if (drive_control)
     {
-      if (logfileD != nullptr and not service.stop_logging)
+      if (logD >= 0 and not service.stop_logging)
       { // save all axis and buttons
-        fprintf(logfileD, "%lu.%04ld %d %g %g %g %g\n", updTime.getSec(), updTime.getMicrosec()/100,
-                manual, velocity, turnValue, servoPosition, yawVelocity
+        logger.log(logD, updTime,
+                manual.load(), velocity, turnValue, servoPosition, yawVelocity
         );
       }
       if (toConsole)
       { // save all axis and buttons
         printf("# Joy Drive: %lu.%04ld %d %g %g %g %g\n", updTime.getSec(), updTime.getMicrosec()/100,
-                manual, velocity, turnValue, servoPosition, yawVelocity
+                manual.load(), velocity, turnValue, servoPosition, yawVelocity
         );
       }
     }
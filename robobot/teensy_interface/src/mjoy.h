@@ -23,11 +23,13 @@
 
 #pragma once
 
-#include <thread>
+#include <atomic>
 #include "utime.h"
 
 /**
- * Class to allow manual control using a Ligitech gamepad
+ * Class to allow manual control using a Ligitech gamepad.
+ * Updated by the gamepad thread (see sjoylogitech.h) for every
+ * complete gamepad report, in manual mode the mixer is told directly.
  */
 class MJoy
 {
@@ -35,8 +37,9 @@ public:
   /** setup and request data */
   void setup();
   /**
-   * regular update tick */
-  void run();
+   * New gamepad values (called by the gamepad thread)
+   * \param t is the time of the gamepad report */
+  void update(UTime & t);
   /**
    * terminate */
   void terminate();
@@ -70,19 +73,13 @@ public:
 
 private:
   /// private stuff
-  static void runObj(MJoy * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
-  }
   void toLog();
-  std::thread * th1;
   bool toConsole = false;
-  FILE * logfileD = nullptr; // drive
+  int logD = -1; // drive (log channel, see ulogger.h)
   FILE * logfileC = nullptr; // crane
   //
   // device
-  bool manual = false;
+  std::atomic<bool> manual{false};
   // drive values
   bool drive_control = true;    // bool calculate crane control values
   int buttonFast;// on gamepad
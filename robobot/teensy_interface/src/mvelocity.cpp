@@ -33,6 +33,10 @@
 #include "uservice.h"
 #include "cmixer.h"
 #include "umqtt.h"
+#include "ulogger.h"
+#include "urealtime.h"
+#include "uconfig.h"
+#include "cpipeline.h"
 
 // create value
 MVelocity mvel[NUM_TEENSY_MAX];
@@ -70,16 +74,20 @@ void MVelocity::setup(int teensyNumber)
   // find sample time in seconds
   sampleTime = strtof(encSampleTime, nullptr) * 0.001;
   toConsole = ini[ini_section]["print"] == "true";
-  if (ini[ini_section]["log"] == "true" and logfile == nullptr)
+  if (ini[ini_section]["log"] == "true" and logCh < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_encoder_velocity.txt";
-    logfile = fopen(fn.c_str(), "w");
-    fprintf(logfile, "%% Pose and velocity (%s) for Teensy %d\n", fn.c_str(), tn);
-    fprintf(logfile, "%% 1 \tTime (sec)\n");
-    fprintf(logfile, "%% 2-3 \tVelocity motor 1..2 (m/s or rad/s) m/s if use Teensy, else rad/sec motor vel, see robot.ini\n");
-    fprintf(logfile, "%% 4-5 \tUpdate number (encoder, velocity) - mostly debug\n");
+    std::string fn = "log_t" + std::to_string(tn) + "_encoder_velocity";
+    logCh = logger.addChannel(fn, "%.4f %.4f %d %d");
+    fn = service.logPath + fn + ".txt";
+    logger.addHeader(logCh, "%% Pose and velocity (%s) for Teensy %d\n", fn.c_str(), tn);
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2-3 \tVelocity motor 1..2 (m/s or rad/s) m/s if use Teensy, else rad/sec motor vel, see robot.ini\n");
+    logger.addHeader(logCh, "%% 4-5 \tUpdate number (encoder, velocity) - mostly debug\n");
   }
-  if (th1 == nullptr)
+  for (int e = 0; e < SRobot::MAX_MOTORS; e++)
+    encTimeLast[e].now();
+  // else run by the control pipeline
+  if (th1 == nullptr and not pipeline.use)
     th1 = new std::thread(runObj, this);
 }
 
@@ -97,112 +105,118 @@ void MVelocity::terminate()
 void MVelocity::run()
 {
 //   printf("# MVelocity::run started\n");
-  int loop = 0;
-  int64_t encLast[SRobot::MAX_MOTORS] = {0};
-  UTime t("now"); // time of update
-  UTime encTimeLast[SRobot::MAX_MOTORS];
-  for (int e = 0; e < SRobot::MAX_MOTORS; e++)
-    encTimeLast[e].now();
+  realtime.configure("velocity", tn);
+  SEncoder::Data ed; // encoder values
+  Data vd;
+  int encVersion = 0;
+  while (not service.stop)
+  { // wait for an update - encoder or velocity
+    if (not encoder[tn].snapshot.waitForUpdate(encVersion, 0.1))
+      continue;
+    encVersion = encoder[tn].snapshot.read(ed);
+    step(ed, vd);
+  }
+}
+
+bool MVelocity::step(const SEncoder::Data & ed, Data & vd)
+{
   float dd[SRobot::MAX_MOTORS]; // motor moved since last update
-  int encup; // pos update
-  int encuv; // velocity update
+  int encup = ed.updatePosCnt; // pos update
+  int encuv = ed.updateVelCnt; // velocity update
   bool updated = false;
-  while (not service.stop)
-  { // there is an update - encoder or velocity
-    encup = encoder[tn].updatePosCnt;
-    encuv = encoder[tn].updateVelCnt;
-    if (encup != oldEncUpdate and not useTeensyVelEstimate)
-    { // new encoder update - this actually calculates
-      // the motor velocity, and not the wheel velocity
-      int64_t enc[SRobot::MAX_MOTORS]; // shorthand value
-      for (int i = 0; i < SRobot::MAX_MOTORS; i++)
-      { // get value
-        enc[i] = encoder[tn].enc[i];
-        if ( encup < 2)
-        { // first two updates take last value as current
-          for (int e = 0; e < SRobot::MAX_MOTORS; e++)
-            encLast[e] = enc[e]; // left
-        }
+  if (encup != oldEncUpdate and not useTeensyVelEstimate)
+  { // new encoder update - this actually calculates
+    // the motor velocity, and not the wheel velocity
+    int64_t enc[SRobot::MAX_MOTORS]; // shorthand value
+    for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+    { // get value
+      enc[i] = ed.enc[i];
+    }
+    if ( encup < 2)
+    { // first two updates take last value as current
+      for (int e = 0; e < SRobot::MAX_MOTORS; e++)
+        encLast[e] = enc[e];
+    }
+    UTime t = ed.encTime; // time of update
+    srcTime = ed.encTime;
+    // 'enc' has no Teensy time, so use the time it was read
+    srcSampleTime = ed.encTime;
+    float dtt = 1.0; // in seconds - for turnrate
+    float dt[SRobot::MAX_MOTORS];
+    int64_t de[SRobot::MAX_MOTORS];
+    for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+    { // find movement in time and distance for each wheel
+      dt[i] = t - encTimeLast[i]; // time
+      if (dt[i] < dtt)
+      { // the minimum update time (the other wheel may be stationary)
+        dtt = dt[i];
       }
-      t = encoder[tn].encTime;
-      float dtt = 1.0; // in seconds - for turnrate
-      float dt[SRobot::MAX_MOTORS];
-      int64_t de[SRobot::MAX_MOTORS];
-      for (int i = 0; i < SRobot::MAX_MOTORS; i++)
-      { // find movement in time and distance for each wheel
-        dt[i] = t - encTimeLast[i]; // time
-        if (dt[i] < dtt)
-        { // the minimum update time (the other wheel may be stationary)
-          dtt = dt[i];
-        }
-        de[i] = enc[i] - encLast[i];
-        if (llabs(de[i]) > 1000)
-        { // given up in calculating folding around MAXINT,
-          // so one sample of zero change should be OK.
-          de[i] = 0;
-        }
-        // distance traveled since last
-        dd[i] = float(de[i]) * radPerTick; // encoder ticks
-        if (enc[i] != encLast[i])
-        { // wheel has moved since last update
-          encLast[i] = enc[i];
-          encTimeLast[i] = t;
-          motorVel[i] = dd[i]/dt[i] * motorScale[i];
-          updated = true;
-        }
-        else if (fabsf(motorVel[i]) > 0.001)
-        { // no tick change since last update
-          // update (reduce) velocity waiting for next tick
-          motorVel[i] = copysignf(1.0, motorVel[i]) * radPerTick/dt[i] * motorScale[i];
-          updated = true;
-        }
+      de[i] = enc[i] - encLast[i];
+      if (llabs(de[i]) > 1000)
+      { // given up in calculating folding around MAXINT,
+        // so one sample of zero change should be OK.
+        de[i] = 0;
       }
-      if (updated)
-      { // publish and log if there is a change only
-        // maybe fixed rate would be better?
-        updateCnt++;
-        velTime.now();
+      // distance traveled since last
+      dd[i] = float(de[i]) * radPerTick; // encoder ticks
+      if (enc[i] != encLast[i])
+      { // wheel has moved since last update
+        encLast[i] = enc[i];
+        encTimeLast[i] = t;
+        motorVel[i] = dd[i]/dt[i] * motorScale[i];
+        updated = true;
       }
-      oldEncUpdate = encup;
-    }
-    else if (encuv != oldEncVelUpdate and useTeensyVelEstimate)
-    { // use wheel velocity already calculated by the Teensy
-      for (int i = 0; i < SRobot::MAX_MOTORS; i++)
-      { // get value
-        motorVel[i] = encoder[tn].vel[i] * motorScale[i]; // m/s
+      else if (fabsf(motorVel[i]) > 0.001)
+      { // no tick change since last update
+        // update (reduce) velocity waiting for next tick
+        motorVel[i] = copysignf(1.0, motorVel[i]) * radPerTick/dt[i] * motorScale[i];
+        updated = true;
       }
-      velTime = encoder[tn].encVelTime;
-      updateCnt++;
-      oldEncVelUpdate = encuv;
-      updated = true;
     }
-//     else if (tn == 0)
-//       printf("# MVelocity:: tn=%d, loop %d, updCnt %d, encup %d, encuv %d, old=%d, usev %d, usevel = '%s'\n", tn, loop,
-//              updateCnt, encup, encuv, oldEncUpdate, useTeensyVelEstimate,
-//              ini[ini_section]["useTeensyVel"].c_str());
     if (updated)
-    { // finished making a new pose
-      if (ini["mqtt"]["use"] == "true")
-      {
-        const int MSL = 100;
-        char s[MSL];
-        snprintf(s, MSL, "%.3f %.3f\n",
-                motorVel[0], motorVel[1]);
-        UTime t("now");
-        // topic robobot/drive/T0/mvel
-        mqtt.publish(topicVel.c_str(), s, t);
-      }
-      toLog();
-      updated = false;
+    { // publish and log if there is a change only
+      // maybe fixed rate would be better?
+      updateCnt++;
+      velTime.now();
     }
-    // just wait a bit (1ms)
-    usleep(1000);
-    loop++;
+    oldEncUpdate = encup;
   }
-  if (logfile != nullptr)
-  {
-    fclose(logfile);
+  else if (encuv != oldEncVelUpdate and useTeensyVelEstimate)
+  { // use wheel velocity already calculated by the Teensy
+    for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+    { // get value
+      motorVel[i] = ed.vel[i] * motorScale[i]; // m/s
+    }
+    velTime = ed.encVelTime;
+    srcTime = ed.encVelTime;
+    srcSampleTime = ed.encVelSampleTime;
+    updateCnt++;
+    oldEncVelUpdate = encuv;
+    updated = true;
   }
+  if (updated)
+  { // finished making a new velocity
+    for (int i = 0; i < SRobot::MAX_MOTORS; i++)
+      vd.motorVel[i] = motorVel[i];
+    vd.velTime = velTime;
+    vd.updateCnt = updateCnt;
+    vd.sampleTime = srcSampleTime;
+    vd.updTime.now();
+    snapshot.write(vd);
+    latency.add(vd.updTime - srcTime);
+    if (config.get()->mqtt.use)
+    {
+      const int MSL = 100;
+      char s[MSL];
+      snprintf(s, MSL, "%.3f %.3f\n",
+              motorVel[0], motorVel[1]);
+      UTime t("now");
+      // topic robobot/drive/T0/mvel
+      mqtt.publish(topicVel.c_str(), s, t);
+    }
+    toLog();
+  }
+  return updated;
 }
 
 
@@ -210,12 +224,9 @@ void MVelocity::toLog()
 {
   if (not service.stop)
   {
-    if (logfile != nullptr and not service.stop_logging)
+    if (logCh >= 0 and not service.stop_logging)
     { // log_pose
-      fprintf(logfile, "%lu.%04ld %.4f %.4f %d %d\n",
-              velTime.getSec(), velTime.getMicrosec()/100,
-              motorVel[0], motorVel[1], oldEncUpdate, oldEncVelUpdate
-              );
+      logger.log(logCh, velTime, motorVel[0], motorVel[1], oldEncUpdate, oldEncVelUpdate);
     }
     if (toConsole)
     { // print_pose
@@ -27,6 +27,8 @@
 #include "sencoder.h"
 #include "utime.h"
 #include "thread"
+#include "useqlock.h"
+#include "uhistogram.h"
 
 using namespace std;
 
@@ -45,8 +47,10 @@ public:
   /** setup and request data */
   void setup(int teensyNumber);
   /**
-   * thread to do updates, when new data is available */
+   * thread to do updates, when new data is available
+   * (not used if the control pipeline is used, see cpipeline.h) */
   void run();
+
   /**
    * terminate */
   void terminate();
@@ -71,6 +75,31 @@ public:
   int updateCnt = 0;
   int oldEncUpdate = 0;
   int oldEncVelUpdate = 0;
+  /**
+   * Consistent set of velocity values, see 'snapshot' */
+  struct Data
+  {
+    float motorVel[SRobot::MAX_MOTORS];
+    UTime velTime;
+    int updateCnt;
+    /// time this update was made available
+    UTime updTime;
+    /// time of the Teensy sample this velocity is based on
+    UTime sampleTime;
+  };
+  /**
+   * Latest motor velocity for other threads (e.g. motor control).
+   * Use snapshot.waitForUpdate() to wait for new data */
+  USeqLock<Data> snapshot;
+  /**
+   * Calculate velocity from one encoder sample
+   * (velocity stage of the control pipeline)
+   * \param ed is the encoder sample
+   * \param vd is set to the new velocity, if there is one
+   * \returns true if there is a new velocity */
+  bool step(const SEncoder::Data & ed, Data & vd);
+  /// time from encoder message is received until velocity is available
+  UHistogram latency;
 
 private:
   /// private stuff
@@ -92,11 +121,18 @@ private:
   bool firstEnc = true;
   /// Debug print
   bool toConsole = false;
-  /// Logfile - most details
-  FILE * logfile = nullptr;
+  /// Logfile - most details (log channel, see ulogger.h)
+  int logCh = -1;
   std::thread * th1;
   // source data iteration
   int encoderUpdateCnt = 0;
+  /// encoder value and time at last tick change
+  int64_t encLast[SRobot::MAX_MOTORS] = {0};
+  UTime encTimeLast[SRobot::MAX_MOTORS];
+  /// time the encoder message was received
+  UTime srcTime;
+  /// time of the Teensy sample (host clock)
+  UTime srcSampleTime;
 };
 
 /**
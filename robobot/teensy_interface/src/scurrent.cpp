@@ -33,6 +33,7 @@
 #include "cmixer.h"
 #include "umqtt.h"
 #include "srobot.h"
+#include "ulogger.h"
 
 // create value
 SCurrent current[NUM_TEENSY_MAX];
@@ -55,6 +56,10 @@ void SCurrent::setup(int teensy_number)
   // mqtt
   toConsole = ini[ini_section]["print"] == "true";
   //
+  // messages from Teensy
+  teensy[tn].addKey("mca", [this](const char * params, UTime & msgTime){ decodeMca(params, msgTime); });
+  teensy[tn].addKey("sca", [this](const char * params, UTime & msgTime){ decodeSca(params, msgTime); });
+  teensy[tn].addBinKey(UBIN_MCA, [this](const void * data, UTime & msgTime){ applyMca(*(const UBinMca *)data, msgTime); });
   int mpt = strtol(ini[ini_section]["interval_ms"].c_str(), nullptr, 10);
   if (mpt > 0)
   {
@@ -63,56 +68,56 @@ void SCurrent::setup(int teensy_number)
   }
   //printf("# cmotor:: debug 5\n");
   // initialize logfile
-  if (ini[ini_section]["log"] == "true" and logfile == nullptr)
+  if (ini[ini_section]["log"] == "true" and logCh < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + to_string(tn) + "_motor_current.txt";
-    logfile = fopen(fn.c_str(), "w");
-    fprintf(logfile, "%% Motor current for all motors (Teensy %d)\n", tn);
-    fprintf(logfile, "%% 1 \tTime (sec)\n");
-    fprintf(logfile, "%% 2-5 \tVoltage current (from Teensy) 1,2,(3,4) (Amps)\n");
-    fprintf(logfile, "%% 6 \tBoard current (Amps) (low pass filtered)\n");
-    fprintf(logfile, "%% 7 \tBoard current (Amps) (not filtered)\n");
+    logCh = logger.addChannel("log_t" + to_string(tn) + "_motor_current", "%.3f %.3f %.3f %.3f %.2f %.2f");
+    logger.addHeader(logCh, "%% Motor current for all motors (Teensy %d)\n", tn);
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2-5 \tVoltage current (from Teensy) 1,2,(3,4) (Amps)\n");
+    logger.addHeader(logCh, "%% 6 \tBoard current (Amps) (low pass filtered)\n");
+    logger.addHeader(logCh, "%% 7 \tBoard current (Amps) (not filtered)\n");
   }
 }
 
 
 void SCurrent::terminate()
-{
-  if (logfile != nullptr)
-    fclose(logfile);
+{ // logfile is closed by the logger
 }
 
-bool SCurrent::decode(const char* msg, UTime & msgTime)
-{
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "mca ", 4) == 0)
-  { // motor current
-    p1 += 4;
-    for (int i = 0; i < 5; i++)
-      current[i] = strtof(p1, (char**)&p1);
-    // save to log_encoder_pose
-    toLog(msgTime);
-  }
-  else if (strncmp(p1, "sca ", 4) == 0)
-  { // motor current
-    p1 += 4;
-    supplyCurrent = strtof(p1, (char**)&p1);
-    // save to log_encoder_pose
-    toLog(msgTime);
-  }
-  else
-    used = false;
-  return used;
+void SCurrent::decodeMca(const char* params, UTime & msgTime)
+{ // motor current, like: mca 0.123 0.123 33
+  const char * p1 = params;
+  for (int i = 0; i < 5; i++)
+    current[i] = strtof(p1, (char**)&p1);
+  // save to log_encoder_pose
+  toLog(msgTime);
+}
+
+void SCurrent::applyMca(const UBinMca & m, UTime & msgTime)
+{ // binary version of 'mca' - same values as the text parse
+  current[0] = m.current[0];
+  current[1] = m.current[1];
+  // number of samples in average
+  current[2] = m.cnt;
+  current[3] = 0;
+  current[4] = 0;
+  // save to log_encoder_pose
+  toLog(msgTime);
+}
+
+void SCurrent::decodeSca(const char* params, UTime & msgTime)
+{ // supply current
+  const char * p1 = params;
+  supplyCurrent = strtof(p1, (char**)&p1);
+  // save to log_encoder_pose
+  toLog(msgTime);
 }
 
 void SCurrent::toLog(UTime & updt)
 {
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    fprintf(logfile, "%lu.%04ld %.3f %.3f %.3f %.3f %.2f %.2f\n",
-            updt.getSec(), updt.getMicrosec()/100,
-            current[0], current[1], current[2], current[3], robot[tn].supplyCurrent, supplyCurrent);
+    logger.log(logCh, updt, current[0], current[1], current[2], current[3], robot[tn].supplyCurrent, supplyCurrent);
   }
 }
 
@@ -36,8 +36,12 @@ public:
   /** setup and request data */
   void setup(int teensy_number);
   /**
-   * Decode messages from Teensy */
-  bool decode(const char* msg, UTime & msgTime);
+   * Decode 'mca' and 'sca' messages from Teensy
+   * \param params is the message after the key */
+  void decodeMca(const char* params, UTime & msgTime);
+  void decodeSca(const char* params, UTime & msgTime);
+  /** use decoded (or binary) 'mca' message */
+  void applyMca(const UBinMca & m, UTime & msgTime);
   /**
    * terminate */
   void terminate();
@@ -60,7 +64,8 @@ private:
   /// private stuff
   void logfileLeadText(FILE * f, const char * ms);
   // support variables
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
   bool toConsole;
   // mqtt
   std::string topicMotv;
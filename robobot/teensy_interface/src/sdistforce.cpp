@@ -33,6 +33,8 @@
 #include "steensy.h"
 #include "uservice.h"
 #include "umqtt.h"
+#include "ulogger.h"
+#include "uconfig.h"
 // create value
 SDistForce distforce[NUM_TEENSY_MAX];
 
@@ -52,43 +54,36 @@ void SDistForce::setup(int teensy_number)
   // reset encoder and pose
   topicDist = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/dist";
   topicForce = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/force";
+  // messages from Teensy
+  teensy[tn].addKey("ir", [this](const char * params, UTime & msgTime){ decodeIr(params, msgTime); });
+  teensy[tn].addBinKey(UBIN_IR, [this](const void * data, UTime & msgTime){ applyIr(*(const UBinIr *)data, msgTime); });
   // use values and subscribe to source data
   // subscripe to ir distance that include raw AD values too
   std::string s = "sub ird " + ini[ini_section]["interval_ird_ms"] + "\n";
   teensy[tn].send(s.c_str());
   /// other debug feature
   toConsole = ini[ini_section]["print"] == "true";
-  if (ini[ini_section]["log_dist"] == "true" and logfileDist == nullptr)
+  if (ini[ini_section]["log_dist"] == "true" and logDist < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_dist.txt";
-    logfileDist = fopen(fn.c_str(), "w");
-    fprintf(logfileDist, "%% IR distance logfile\n");
-    fprintf(logfileDist, "%% 1 \tTime (sec)\n");
-    fprintf(logfileDist, "%% 2-3 \tDistance sensor 1 and 2 (meter)\n");
-    fprintf(logfileDist, "%% 4-5 \tRaw AD value for sensor 1 and 2\n");
-    fprintf(logfileDist, "%% 6 \tSensor power on (1=on)\n");
+    logDist = logger.addChannel("log_t" + std::to_string(tn) + "_dist", "%g %g %u %u %d");
+    logger.addHeader(logDist, "%% IR distance logfile\n");
+    logger.addHeader(logDist, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logDist, "%% 2-3 \tDistance sensor 1 and 2 (meter)\n");
+    logger.addHeader(logDist, "%% 4-5 \tRaw AD value for sensor 1 and 2\n");
+    logger.addHeader(logDist, "%% 6 \tSensor power on (1=on)\n");
   }
-  if (ini[ini_section]["log_force"] == "true" and logfileForce == nullptr)
+  if (ini[ini_section]["log_force"] == "true" and logForce < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_force.txt";
-    logfileForce = fopen(fn.c_str(), "w");
-    fprintf(logfileForce, "%% force (using distance sensor input) logfile\n");
-    fprintf(logfileForce, "%% 1 \tTime (sec)\n");
-    fprintf(logfileForce, "%% 2-3 \testimated force (1 and 2)\n");
-    fprintf(logfileForce, "%% 4-5 \tRaw AD values (1 and 2)\n");
+    logForce = logger.addChannel("log_t" + std::to_string(tn) + "_force", "%g %g %u %u");
+    logger.addHeader(logForce, "%% force (using distance sensor input) logfile\n");
+    logger.addHeader(logForce, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logForce, "%% 2-3 \testimated force (1 and 2)\n");
+    logger.addHeader(logForce, "%% 4-5 \tRaw AD values (1 and 2)\n");
   }
 }
 
 void SDistForce::terminate()
-{
-  if (logfileDist != nullptr)
-  {
-    fclose(logfileDist);
-  }
-  if (logfileForce != nullptr)
-  {
-    fclose(logfileForce);
-  }
+{ // logfiles are closed by the logger
 }
 
 void SDistForce::calculateForce()
@@ -119,36 +114,38 @@ void SDistForce::calculateForce()
 }
 
 
-bool SDistForce::decode(const char* msg, UTime & msgTime)
-{
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "ir ", 3) == 0)
+void SDistForce::decodeIr(const char* params, UTime & msgTime)
+{ // like: ir 0.123 0.123 1234 1234 15000 15000 15000 15000 1
+  const char * p1 = params;
+  UBinIr m;
+  /*double teensyTime = strtod(p1, (char**)&p1); */
+  m.distance[0] = strtof(p1, (char**)&p1);
+  m.distance[1] = strtof(p1, (char**)&p1);
+  for (int i = 0; i < 2; i++)
+    m.raw[i] = strtoll(p1, (char**)&p1, 10);
+  for (int i = 0; i < 2; i++)
   {
-    if (strlen(p1) > 3)
-      p1 += 3;
-    else
-      return false;
-    updTime = msgTime;
-    /*double teensyTime = strtod(p1, (char**)&p1); */
-    distance[0] = strtof(p1, (char**)&p1);
-    distance[1] = strtof(p1, (char**)&p1);
-    // forceAD[0] = strtoll(p1, (char**)&p1, 10);
-    // forceAD[1] = strtoll(p1, (char**)&p1, 10);
-    // sensorOn = strtoll(p1, (char**)&p1, 10);
-    //
-    if (ini[ini_section]["force"] == "true")
-      calculateForce();
-    // notify users of a new update
-    updateCnt++;
-    // save to log
-    logTime = updTime;
-    toLogDist();
-    toLogForce();
+    m.cal13cm[i] = strtoll(p1, (char**)&p1, 10);
+    m.cal50cm[i] = strtoll(p1, (char**)&p1, 10);
   }
-  else
-    used = false;
-  return used;
+  m.used = strtol(p1, (char**)&p1, 10);
+  applyIr(m, msgTime);
+}
+
+void SDistForce::applyIr(const UBinIr & m, UTime & msgTime)
+{
+  updTime = msgTime;
+  distance[0] = m.distance[0];
+  distance[1] = m.distance[1];
+  //
+  if (config.get()->distforce[tn].force)
+    calculateForce();
+  // notify users of a new update
+  updateCnt++;
+  // save to log
+  logTime = updTime;
+  toLogDist();
+  toLogForce();
 }
 
 
@@ -156,13 +153,11 @@ void SDistForce::toLogDist()
 {
   if (not service.stop)
   {
-    if (logfileDist != nullptr and not service.stop_logging)
+    if (logDist >= 0 and not service.stop_logging)
     {
-      fprintf(logfileDist,"%lu.%04ld %g %g %u %u %d\n",
-              logTime.getSec(), logTime.getMicrosec()/100,
-              distance[0], distance[1], forceAD[0], forceAD[1], sensorOn);
+      logger.log(logDist, logTime, distance[0], distance[1], forceAD[0], forceAD[1], sensorOn);
     }
-    if (toConsole and not (ini["mqtt"]["use"] == "true"))
+    if (toConsole and not config.get()->mqtt.use)
     {
       printf("%lu.%04ld %g %g  %u %u %d\n",
               logTime.getSec(), logTime.getMicrosec()/100,
@@ -175,13 +170,11 @@ void SDistForce::toLogForce()
 {
   if (not service.stop)
   {
-    if (logfileForce != nullptr and not service.stop_logging)
+    if (logForce >= 0 and not service.stop_logging)
     {
-      fprintf(logfileForce,"%lu.%04ld %g %g %u %u\n",
-              logTime.getSec(), logTime.getMicrosec()/100,
-              force[0], force[1], forceAD[0], forceAD[1]);
+      logger.log(logForce, logTime, force[0], force[1], forceAD[0], forceAD[1]);
     }
-    if (toConsole and (ini["mqtt"]["use"] == "true"))
+    if (toConsole and config.get()->mqtt.use)
     {
       printf("%lu.%04ld %g %g %u %u\n",
               logTime.getSec(), logTime.getMicrosec()/100,
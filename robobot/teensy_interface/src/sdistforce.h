@@ -53,9 +53,11 @@ public:
   /**
    * regular update tick */
   void tick();
-  /** decode an unpacked incoming messages
-   * \returns true if the message us used */
-  bool decode(const char * msg, UTime & msgTime);
+  /** decode 'ir' message from Teensy
+   * \param params is the message after the key */
+  void decodeIr(const char * params, UTime & msgTime);
+  /** use decoded (or binary) 'ir' message */
+  void applyIr(const UBinIr & m, UTime & msgTime);
   /**
    * terminate */
   void terminate();
@@ -76,8 +78,9 @@ private:
   void toLogDist();
   void toLogForce();
   bool toConsole = false;
-  FILE * logfileDist = nullptr;
-  FILE * logfileForce = nullptr;
+  /// log channels (see ulogger.h)
+  int logDist = -1;
+  int logForce = -1;
   //   std::condition_variable_any nd; // new data service
   // MQTT
   /// topic string for encoder position
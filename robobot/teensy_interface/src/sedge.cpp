@@ -40,6 +40,7 @@
 #include "sedge.h"
 #include "uservice.h"
 #include "umqtt.h"
+#include "ulogger.h"
 
 // create the class with received info
 SEdge edge[NUM_TEENSY_MAX];
@@ -59,6 +60,11 @@ void SEdge::setup(int teensyNumber)
   }
   toConsole = ini[ini_section]["print"] == "true";
   // int rate = strtol(ini[ini_section]["interval_ms"].c_str(), nullptr, 10);
+  // messages from Teensy
+  teensy[tn].addKey("liv", [this](const char * params, UTime & msgTime){ decodeLiv(params, msgTime); });
+  teensy[tn].addKey("livn", [this](const char * params, UTime & msgTime){ decodeLivn(params, msgTime); });
+  teensy[tn].addBinKey(UBIN_LIV, [this](const void * data, UTime & msgTime){ applyLiv(*(const UBinLiv *)data, msgTime); });
+  teensy[tn].addBinKey(UBIN_LIVN, [this](const void * data, UTime & msgTime){ applyLivn(*(const UBinLiv *)data, msgTime); });
   std::string ss = "sub liv " + ini[ini_section]["interval_liv_ms"];
   teensy[tn].send(ss.c_str());
   ss = "sub livn " + ini[ini_section]["interval_livn_ms"];
@@ -66,84 +72,83 @@ void SEdge::setup(int teensyNumber)
   // MQTT topic name
   topic = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/";
   // logfile
-  if (ini[ini_section]["log"] == "true" and logfileAD == nullptr)
+  if (ini[ini_section]["log"] == "true" and logAD < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_edge_liv.txt";
-    logfileAD = fopen(fn.c_str(), "w");
-    fprintf(logfileAD, "%% Edge\n");
-    fprintf(logfileAD, "%% 1 \tTime (sec)\n");
-    fprintf(logfileAD, "%% 2-10 \tsensor AD value (0..4196), sensor 0 is left, AD=0 is no reflection\n");
+    logAD = logger.addChannel("log_t" + std::to_string(tn) + "_edge_liv", "%d %d %d %d %d %d %d %d", 3);
+    logger.addHeader(logAD, "%% Edge\n");
+    logger.addHeader(logAD, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logAD, "%% 2-10 \tsensor AD value (0..4196), sensor 0 is left, AD=0 is no reflection\n");
   }
-  if (ini[ini_section]["log"] == "true" and logfileN == nullptr)
+  if (ini[ini_section]["log"] == "true" and logN < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_edge_livn.txt";
-    logfileN = fopen(fn.c_str(), "w");
-    fprintf(logfileN, "%% Edge\n");
-    fprintf(logfileN, "%% 1 \tTime (sec)\n");
-    fprintf(logfileN, "%% 2-10 \tsensor notmalized value (0..1000), sensor 0 is left, 0 is no reflection, 1000 is calibrated white\n");
+    logN = logger.addChannel("log_t" + std::to_string(tn) + "_edge_livn", "%d %d %d %d %d %d %d %d", 3);
+    logger.addHeader(logN, "%% Edge\n");
+    logger.addHeader(logN, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logN, "%% 2-10 \tsensor notmalized value (0..1000), sensor 0 is left, 0 is no reflection, 1000 is calibrated white\n");
   }
 }
 
 void SEdge::terminate()
-{
-  if (logfileN != nullptr)
-  {
-    fclose(logfileN);
-    logfileN = nullptr;
-  }
-  if (logfileAD != nullptr)
+{ // logfiles are closed by the logger
+}
+
+
+void SEdge::decodeLiv(const char* params, UTime & msgTime)
+{ // like: liv %ld %ld %ld %ld %ld %ld %ld %ld %d\r\n
+  const char * p1 = params;
+  UBinLiv m;
+  // get data
+  for (int i = 0; i < 8; i++)
   {
-    fclose(logfileAD);
-    logfileAD = nullptr;
+    m.v[i] = strtol(p1, (char **)&p1, 10);
   }
+  m.cnt = strtol(p1, (char **)&p1, 10);
+  applyLiv(m, msgTime);
 }
 
+void SEdge::applyLiv(const UBinLiv & m, UTime & msgTime)
+{
+  updTime = msgTime;
+  for (int i = 0; i < 8; i++)
+    ad[i] = m.v[i];
+  toLogEnc();
+}
 
-bool SEdge::decode(const char* msg, UTime & msgTime)
-{ // like: liv %ld %ld %ld %ld %ld %ld %ld %ld\r\n
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "liv ", 4) == 0)
-  { // decode pose message
-    // advance to first parameter
-    if (strlen(p1) > 5)
-      p1 += 4;
-    else
-      return false;
-    // forward to mqtt
-    updTime = msgTime;
-    // get data
-    for (int i = 0; i < 8; i++)
-    {
-      ad[i] = strtol(p1, (char **)&p1, 10);
-    }
-    toLogEnc();
+void SEdge::decodeLivn(const char* params, UTime & msgTime)
+{ // normalized values, like: livn %d %d %d %d %d %d %d %d %d\r\n
+  const char * p1 = params;
+  UBinLiv m;
+  // get data
+  for (int i = 0; i < 8; i++)
+  {
+    m.v[i] = strtol(p1, (char **)&p1, 10);
   }
-  else if (strncmp(p1, "livn ", 5) == 0)
-  { // just publish - normalized values
-    p1 += 5;
-    // get data
-    for (int i = 0; i < 8; i++)
-    {
-      adn[i] = strtol(p1, (char **)&p1, 10);
-    }
-    updTime = msgTime;
-    toLogNormalized();
+  m.cnt = strtol(p1, (char **)&p1, 10);
+  applyLivn(m, msgTime);
+}
+
+void SEdge::applyLivn(const UBinLiv & m, UTime & msgTime)
+{
+  Data d;
+  for (int i = 0; i < 8; i++)
+  {
+    adn[i] = m.v[i];
+    d.adn[i] = m.v[i];
   }
-  else
-    used = false;
-  return used;
+  updTime = msgTime;
+  d.updTime = msgTime;
+  d.updateCnt = ++livnCnt;
+  snapshot.write(d);
+  toLogNormalized();
 }
 
 void SEdge::toLogEnc()
 { // data is already locked
   if (service.stop)
     return;
-  if (logfileAD != nullptr and not service.stop_logging)
+  if (logAD >= 0 and not service.stop_logging)
   {
-    fprintf(logfileAD, "%lu.%03ld %d %d %d %d %d %d %d %d\n",
-            updTime.getSec(), updTime.getMillisec(),
-            ad[0], ad[1], ad[2], ad[3], ad[4], ad[5], ad[6], ad[7]);
+    logger.log(logAD, updTime, ad[0], ad[1], ad[2], ad[3], ad[4], ad[5], ad[6], ad[7]);
   }
   if (toConsole)
     printf("%lu.%03ld %d %d %d %d %d %d %d %d\n",
@@ -155,11 +160,9 @@ void SEdge::toLogNormalized()
 { // data is already locked
   if (service.stop)
     return;
-  if (logfileN != nullptr and not service.stop_logging)
+  if (logN >= 0 and not service.stop_logging)
   {
-    fprintf(logfileN, "%lu.%03ld %d %d %d %d %d %d %d %d\n",
-            updTime.getSec(), updTime.getMillisec(),
-            adn[0], adn[1], adn[2], adn[3], adn[4], adn[5], adn[6], adn[7]);
+    logger.log(logN, updTime, adn[0], adn[1], adn[2], adn[3], adn[4], adn[5], adn[6], adn[7]);
   }
   if (toConsole)
     printf("%lu.%03ld %d %d %d %d %d %d %d %d\n",
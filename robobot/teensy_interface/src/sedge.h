@@ -24,6 +24,7 @@
 #pragma once
 
 #include "steensy.h"
+#include "useqlock.h"
 
 using namespace std;
 
@@ -36,9 +37,13 @@ public:
   int tn = 0;
   /** setup and request data */
   void setup(int teensyNumber);
-  /** decode an unpacked incoming messages
-   * \returns true if the message us used */
-  bool decode(const char * msg, UTime & msgTime);
+  /** decode 'liv' and 'livn' messages from Teensy
+   * \param params is the message after the key */
+  void decodeLiv(const char * params, UTime & msgTime);
+  void decodeLivn(const char * params, UTime & msgTime);
+  /** use decoded (or binary) 'liv' and 'livn' messages */
+  void applyLiv(const UBinLiv & m, UTime & msgTime);
+  void applyLivn(const UBinLiv & m, UTime & msgTime);
   /**
    * runs the thread  */
   void run();
@@ -53,6 +58,19 @@ public:
   int ad[8];
   // line sensor normalized values
   int adn[8];
+  /**
+   * Consistent set of normalized values, see 'snapshot' */
+  struct Data
+  {
+    int adn[8];
+    /// time the 'livn' message was received
+    UTime updTime;
+    int updateCnt;
+  };
+  /**
+   * Latest normalized line sensor values for other threads (e.g. line follow).
+   * Use snapshot.waitForUpdate() to wait for new data */
+  USeqLock<Data> snapshot;
 
 private:
   /**
@@ -64,8 +82,10 @@ private:
   std::string tnGroup;  // teensy group in ini-file
   /// Log flags
   bool toConsole = false;
-  FILE * logfileAD = nullptr;
-  FILE * logfileN = nullptr;
+  /// log channels (see ulogger.h)
+  int logAD = -1;
+  int logN = -1;
+  int livnCnt = 0;
   /// MQTT
   std::string topic;
 
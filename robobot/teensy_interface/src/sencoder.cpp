@@ -28,6 +28,7 @@
 #include "steensy.h"
 #include "uservice.h"
 #include "umqtt.h"
+#include "ulogger.h"
 // create value
 SEncoder encoder[NUM_TEENSY_MAX];
 
@@ -50,6 +51,13 @@ void SEncoder::setup(int teensy_number)
   topicEnc = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/enc";
   topicEncVel = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/vel";
   topicPose = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/pose";
+  // messages from Teensy
+  teensy[tn].addKey("enc", [this](const char * params, UTime & msgTime){ decodeEnc(params, msgTime); });
+  teensy[tn].addKey("vel", [this](const char * params, UTime & msgTime){ decodeVel(params, msgTime); });
+  teensy[tn].addKey("pose", [this](const char * params, UTime & msgTime){ decodePose(params, msgTime); });
+  teensy[tn].addBinKey(UBIN_ENC, [this](const void * data, UTime & msgTime){ applyEnc(*(const UBinEnc *)data, msgTime); });
+  teensy[tn].addBinKey(UBIN_VEL, [this](const void * data, UTime & msgTime){ applyVel(*(const UBinVel *)data, msgTime); });
+  teensy[tn].addBinKey(UBIN_POSE, [this](const void * data, UTime & msgTime){ applyPose(*(const UBinPose *)data, msgTime); });
   // use values and subscribe to source data
   /// subscripe to encoder count data
   std::string s = "sub pose " + ini[ini_section]["interval_pose_ms"] + "\n";
@@ -72,112 +80,135 @@ void SEncoder::setup(int teensy_number)
       s = "encrev 0\n";
     teensy[tn].send(s.c_str());
   }
-  if (ini[ini_section]["log_enc"] == "true" and logfileEnc == nullptr)
+  if (ini[ini_section]["log_enc"] == "true" and logEnc < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_encoder.txt";
-    logfileEnc = fopen(fn.c_str(), "w");
-    fprintf(logfileEnc, "%% Encoder logfile\n");
-    fprintf(logfileEnc, "%% 1 \tTime (sec)\n");
-    fprintf(logfileEnc, "%% 2-3 \tencoder position m1, m2 (ticks)\n");
-    fprintf(logfileEnc, "%% 4-5 \tencoder velocity v1, v2 (rad/sec for motor before gear)\n");
-    fprintf(logfileEnc, "%% 6 \tencoder posion update count\n");
-    fprintf(logfileEnc, "%% 7 \tencoder velocity update count\n");
+    logEnc = logger.addChannel("log_t" + std::to_string(tn) + "_encoder", "%lu %lu %g %g %d %d");
+    logger.addHeader(logEnc, "%% Encoder logfile\n");
+    logger.addHeader(logEnc, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logEnc, "%% 2-3 \tencoder position m1, m2 (ticks)\n");
+    logger.addHeader(logEnc, "%% 4-5 \tencoder velocity v1, v2 (rad/sec for motor before gear)\n");
+    logger.addHeader(logEnc, "%% 6 \tencoder posion update count\n");
+    logger.addHeader(logEnc, "%% 7 \tencoder velocity update count\n");
   }
-  if (ini[ini_section]["log_pose"] == "true" and logfilePose == nullptr)
+  if (ini[ini_section]["log_pose"] == "true" and logPose < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_pose.txt";
-    logfilePose = fopen(fn.c_str(), "w");
-    fprintf(logfilePose, "%% Pose logfile\n");
-    fprintf(logfilePose, "%% 1 \tTime (sec)\n");
-    fprintf(logfilePose, "%% 2,3 \tX, Y position (m)\n");
-    fprintf(logfilePose, "%% 4 \tHeading in radians (m)\n");
-    fprintf(logfilePose, "%% 5 \tTilt angle, if calculated (rad)\n");
+    logPose = logger.addChannel("log_t" + std::to_string(tn) + "_pose", "%.3f %.3f %.4f %.4f");
+    logger.addHeader(logPose, "%% Pose logfile\n");
+    logger.addHeader(logPose, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logPose, "%% 2,3 \tX, Y position (m)\n");
+    logger.addHeader(logPose, "%% 4 \tHeading in radians (m)\n");
+    logger.addHeader(logPose, "%% 5 \tTilt angle, if calculated (rad)\n");
   }
-  // allow Teensy to process subscriptions
-  usleep(23000);
 }
 
 void SEncoder::terminate()
+{ // logfiles are closed by the logger
+}
+
+void SEncoder::decodeEnc(const char* params, UTime & msgTime)
+{ // like: enc 1234 5678
+  const char * p1 = params;
+  UBinEnc m;
+  m.enc[0] = strtoll(p1, (char**)&p1, 10);
+  m.enc[1] = strtoll(p1, (char**)&p1, 10);
+  applyEnc(m, msgTime);
+}
+
+void SEncoder::applyEnc(const UBinEnc & m, UTime & msgTime)
 {
-  if (logfileEnc != nullptr)
-  {
-    fclose(logfileEnc);
-  }
-  if (logfilePose != nullptr)
-  {
-    fclose(logfilePose);
-  }
+  encTime = msgTime;
+  enc[0] = m.enc[0];
+  enc[1] = m.enc[1];
+  // notify users of a new update
+  updatePosCnt++;
+  publish();
+  // save to log_encoder_pose
+  logTime = msgTime;
+  toLogEnc();
+  // save new value as old value
+  encLast[0] = enc[0];
+  encLast[1] = enc[1];
+}
+
+void SEncoder::decodeVel(const char* params, UTime & msgTime)
+{ // like: vel 12.3456 0.123 0.123 0.0000 0.123 9
+  const char * p1 = params;
+  UBinVel m;
+  m.time = strtod(p1, (char**)&p1);
+  m.wheelVel[0] = strtof(p1, (char**)&p1);
+  m.wheelVel[1] = strtof(p1, (char**)&p1);
+  m.turnrate = strtof(p1, (char**)&p1);
+  m.velocity = strtof(p1, (char**)&p1);
+  m.cnt = strtol(p1, (char**)&p1, 10);
+  applyVel(m, msgTime);
+}
+
+void SEncoder::applyVel(const UBinVel & m, UTime & msgTime)
+{ // Teensy calculated velocity of wheels (m/s)
+  encVelTime = msgTime;
+  teensy[tn].clockSample(m.time, msgTime);
+  encVelSampleTime = teensy[tn].teensyToHost(m.time);
+  vel[0] = m.wheelVel[0];
+  vel[1] = m.wheelVel[1];
+  // notify users of a new update
+  updateVelCnt++;
+  publish();
+  // logged in the velocity module
+  // after potential additional gear
+}
+
+void SEncoder::decodePose(const char* params, UTime & msgTime)
+{ // like: pose 12.3456 0.123 0.123 0.1234 0.0000
+  const char * p1 = params;
+  UBinPose m;
+  m.time = strtod(p1, (char**)&p1);
+  for (int i = 0; i < 4; i++)
+    m.pose[i] = strtof(p1, (char**)&p1);
+  applyPose(m, msgTime);
 }
 
-bool SEncoder::decode(const char* msg, UTime & msgTime)
+void SEncoder::applyPose(const UBinPose & m, UTime & msgTime)
 {
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "enc ", 4) == 0)
-  {
-    if (strlen(p1) > 4)
-      p1 += 4;
-    else
-      return false;
-    encTime = msgTime;
-    /*double teensyTime =*/ strtod(p1, (char**)&p1);
-    enc[0] = strtoll(p1, (char**)&p1, 10);
-    enc[1] = strtoll(p1, (char**)&p1, 10);
-    // notify users of a new update
-    updatePosCnt++;
-    // save to log_encoder_pose
-    logTime = msgTime;
-    toLogEnc();
-    // save new value as old value
-    encLast[0] = enc[0];
-    encLast[1] = enc[1];
-  }
-  else if (strncmp(p1, "vel ", 4) == 0)
-  { // Teensy calculated velocity of wheels (m/s)
-    if (strlen(p1) > 4)
-      p1 += 4;
-    else
-      return false;
-    encVelTime = msgTime;
-    /*double teensyTime =*/ strtod(p1, (char**)&p1);
-    vel[0] = strtof(p1, (char**)&p1);
-    vel[1] = strtof(p1, (char**)&p1);
-    // notify users of a new update
-    updateVelCnt++;
-    // logged in the velocity module
-    // after potential additional gear
-  }
-  else if (strncmp(p1, "pose ", 5) == 0)
+  poseTime = msgTime;
+  teensy[tn].clockSample(m.time, msgTime);
+  for (int i = 0; i < 4; i++)
+    pose[i] = m.pose[i];
+  // notify users of a new update
+  updatePoseCnt++;
+  publish();
+  // save to log_encoder_pose
+  logTime = msgTime;
+  toLogPose();
+}
+
+void SEncoder::publish()
+{
+  Data d;
+  for (int i = 0; i < SRobot::MAX_MOTORS; i++)
   {
-    if (strlen(p1) > 5)
-      p1 += 5;
-    else
-      return false;
-    poseTime = msgTime;
-    /*double teensyTime =*/ strtod(p1, (char**)&p1);
-    for (int i = 0; i < 4; i++)
-      pose[i] = strtof(p1, (char**)&p1);
-    // notify users of a new update
-    updatePoseCnt++;
-    // save to log_encoder_pose
-    logTime = msgTime;
-    toLogPose();
+    d.enc[i] = enc[i];
+    d.vel[i] = vel[i];
   }
-  else
-    used = false;
-  return used;
+  for (int i = 0; i < 4; i++)
+    d.pose[i] = pose[i];
+  d.encTime = encTime;
+  d.encVelTime = encVelTime;
+  d.encVelSampleTime = encVelSampleTime;
+  d.poseTime = poseTime;
+  d.updatePosCnt = updatePosCnt;
+  d.updateVelCnt = updateVelCnt;
+  d.updatePoseCnt = updatePoseCnt;
+  snapshot.write(d);
 }
 
 void SEncoder::toLogEnc()
 {
   if (not service.stop)
   {
-    if (logfileEnc != nullptr and not service.stop_logging)
+    if (logEnc >= 0 and not service.stop_logging)
     {
-      fprintf(logfileEnc,"%lu.%04ld %lu %lu %g %g %d %d\n",
-              logTime.getSec(), logTime.getMicrosec()/100,
-              (unsigned long int)enc[0], (unsigned long int)enc[1],
-              vel[0], vel[1], updatePosCnt, updateVelCnt);
+      logger.log(logEnc, logTime, enc[0], enc[1],
+                 vel[0], vel[1], updatePosCnt, updateVelCnt);
     }
     if (toConsole)
     {
@@ -193,11 +224,9 @@ void SEncoder::toLogPose()
 {
   if (not service.stop)
   {
-    if (logfilePose != nullptr and not service.stop_logging)
+    if (logPose >= 0 and not service.stop_logging)
     {
-      fprintf(logfilePose,"%lu.%04ld %.3f %.3f %.4f %.4f\n",
-              logTime.getSec(), logTime.getMicrosec()/100,
-              pose[0], pose[1], pose[2], pose[3]);
+      logger.log(logPose, logTime, pose[0], pose[1], pose[2], pose[3]);
     }
     if (toConsole)
     {
@@ -38,6 +38,7 @@
 #include "utime.h"
 #include "steensy.h"
 #include "srobot.h"
+#include "useqlock.h"
 
 using namespace std;
 
@@ -53,15 +54,42 @@ public:
   /**
    * regular update tick */
   void tick();
-  /** decode an unpacked incoming messages
-   * \returns true if the message us used */
-  bool decode(const char * msg, UTime & msgTime);
+  /** decode 'enc', 'vel' and 'pose' messages from Teensy
+   * \param params is the message after the key */
+  void decodeEnc(const char * params, UTime & msgTime);
+  void decodeVel(const char * params, UTime & msgTime);
+  void decodePose(const char * params, UTime & msgTime);
+  /** use decoded (or binary) 'enc', 'vel' and 'pose' messages */
+  void applyEnc(const UBinEnc & m, UTime & msgTime);
+  void applyVel(const UBinVel & m, UTime & msgTime);
+  void applyPose(const UBinPose & m, UTime & msgTime);
   /**
    * terminate */
   void terminate();
   /**
    * terminate */
   void flush();
+  /**
+   * Consistent set of encoder values, see 'snapshot' */
+  struct Data
+  {
+    int64_t enc[SRobot::MAX_MOTORS]; /// ticks
+    float vel[SRobot::MAX_MOTORS]; /// from Teensy
+    float pose[4]; /// x, y, h, tilt
+    UTime encTime;
+    UTime encVelTime;
+    /// Teensy sample time of velocity (host clock)
+    UTime encVelSampleTime;
+    UTime poseTime;
+    int updatePosCnt;
+    int updateVelCnt;
+    int updatePoseCnt;
+  };
+  /**
+   * Latest values for other threads, updated for every
+   * 'enc', 'vel' and 'pose' message.
+   * Use snapshot.waitForUpdate() to wait for new data */
+  USeqLock<Data> snapshot;
 
 public:
 //   mutex dataLock; // ensure consistency
@@ -70,6 +98,7 @@ public:
   int updatePoseCnt = 0;
   UTime encTime, encTimeLast;
   UTime encVelTime;
+  UTime encVelSampleTime;
   UTime logTime;
   int64_t enc[SRobot::MAX_MOTORS] = {0}; /// ticks
   float vel[SRobot::MAX_MOTORS] = {0}; /// rad/s
@@ -79,12 +108,15 @@ private:
   std::string ini_section;
   void toLogEnc();
   void toLogPose();
+  /** copy values to snapshot */
+  void publish();
   int64_t encLast[SRobot::MAX_MOTORS] = {0};
   bool firstEnc = true;
   bool encoder_reversed = true;
   bool toConsole = false;
-  FILE * logfileEnc = nullptr;
-  FILE * logfilePose = nullptr;
+  /// log channels (see ulogger.h)
+  int logEnc = -1;
+  int logPose = -1;
   //   std::condition_variable_any nd; // new data service
   // MQTT
   /// topic string for encoder position
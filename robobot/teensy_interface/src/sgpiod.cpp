@@ -28,9 +28,13 @@
 #include <chrono>
 #include <thread>
 #include <iostream>
+#include <poll.h>
 #include "uservice.h"
 #include "sgpiod.h"
 #include "srobot.h"
+#include "ulogger.h"
+#include "urealtime.h"
+#include "uconfig.h"
 
 // inspired from https://github.com/brgl/libgpiod/blob/master/bindings/cxx/gpiod.hpp
 #include "gpiod.h"
@@ -52,7 +56,14 @@ void SGpiod::setup()
     ini["gpio"]["print"] = "false";
     ini["gpio"]["use"] = "false";
   }
-  if (chip != nullptr)
+  if (not ini["gpio"].has("mode"))
+  { // 'event' uses edge events from the kernel, 'poll' reads all pins every ms
+    ini["gpio"]["mode"] = "event";
+    ini["gpio"]["debounce_ms"] = "5";
+  }
+  eventMode = ini["gpio"]["mode"] != "poll";
+  debounce = strtof(ini["gpio"]["debounce_ms"].c_str(), nullptr) / 1000.0;
+  if (chip == nullptr)
   {
     if (ini["gpio"]["use"] == "true")
       chip = gpiod_chip_open_by_name(chipname);
@@ -111,8 +122,14 @@ void SGpiod::setup()
           err = -1;
           while (err == -1)
           {
-            err = gpiod_line_request_input(pins[i], "raubase_in");
-            if (err == -1)
+            if (eventMode)
+            { // input with edge events (and pull-down)
+              err = gpiod_line_request_both_edges_events_flags(pins[i], "raubase_in",
+                                                               GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_DOWN);
+              if (err == -1)
+                usleep(3333);
+            }
+            else if ((err = gpiod_line_request_input(pins[i], "raubase_in")) == -1)
               usleep(3333);
             else
             {
@@ -140,21 +157,20 @@ void SGpiod::setup()
   toConsole = ini["gpio"]["print"] == "true";
   if (chip != nullptr)
   {
-    if (ini["gpio"]["log"] == "true" and logfile == nullptr)
+    if (ini["gpio"]["log"] == "true" and logCh < 0)
     { // open logfile
-      std::string fn = service.logPath + "log_gpio.txt";
-      logfile = fopen(fn.c_str(), "w");
-      fprintf(logfile, "%% gpio logfile\n");
-      fprintf(logfile, "%% pins_out %s\n", ini["gpio"]["pins_out"].c_str());
-      fprintf(logfile, "%% 1 \tTime (sec)\n");
-  //     fprintf(logfile, "%% 2 \tPin %d (start)\n", pinNumber[0]);
-      fprintf(logfile, "%% 2 \tPin %2d (stop)\n", pinNumber[0]);
-      fprintf(logfile, "%% 3 \tPin %d\n", pinNumber[1]);
-      fprintf(logfile, "%% 4 \tPin %d\n", pinNumber[2]);
-      fprintf(logfile, "%% 5 \tPin %d\n", pinNumber[3]);
-      fprintf(logfile, "%% 6 \tPin %d\n", pinNumber[4]);
-      fprintf(logfile, "%% 7 \tPin %d\n", pinNumber[5]);
-      fprintf(logfile, "%% 8 \tPin %d\n", pinNumber[6]);
+      logCh = logger.addChannel("log_gpio", "%d %d %d %d %d %d %d");
+      logger.addHeader(logCh, "%% gpio logfile\n");
+      logger.addHeader(logCh, "%% pins_out %s\n", ini["gpio"]["pins_out"].c_str());
+      logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+  //     logger.addHeader(logCh, "%% 2 \tPin %d (start)\n", pinNumber[0]);
+      logger.addHeader(logCh, "%% 2 \tPin %2d (stop)\n", pinNumber[0]);
+      logger.addHeader(logCh, "%% 3 \tPin %d\n", pinNumber[1]);
+      logger.addHeader(logCh, "%% 4 \tPin %d\n", pinNumber[2]);
+      logger.addHeader(logCh, "%% 5 \tPin %d\n", pinNumber[3]);
+      logger.addHeader(logCh, "%% 6 \tPin %d\n", pinNumber[4]);
+      logger.addHeader(logCh, "%% 7 \tPin %d\n", pinNumber[5]);
+      logger.addHeader(logCh, "%% 8 \tPin %d\n", pinNumber[6]);
     }
     if (not service.stop and th1 == nullptr)
       // start listen to the keyboard
@@ -166,10 +182,7 @@ void SGpiod::terminate()
 {
   if (th1 != nullptr)
     th1->join();
-  if (logfile != nullptr)
-  {
-    fclose(logfile);
-  }
+  // logfile is closed by the logger
   try
   {
     if (chip != nullptr)
@@ -236,13 +249,121 @@ void SGpiod::setPin(const int pin, bool value)
 
 
 void SGpiod::run()
+{
+  realtime.configure("gpio");
+  if (eventMode)
+    runEvents();
+  else
+    runPoll();
+}
+
+void SGpiod::runEvents()
+{
+  bool pv[MAX_PINS] = {false};
+  // edge not yet accepted (debounce)
+  bool pending[MAX_PINS] = {false};
+  bool pendingValue[MAX_PINS] = {false};
+  UTime edgeTime[MAX_PINS];
+  struct pollfd pfd[MAX_PINS];
+  int pfdPin[MAX_PINS];
+  int pfdCnt = 0;
+  for (int i = 0; i < MAX_PINS; i++)
+  {
+    if (out_pinuse[i])
+      continue;
+    pfd[pfdCnt].fd = gpiod_line_event_get_fd(pins[i]);
+    pfd[pfdCnt].events = POLLIN;
+    pfdPin[pfdCnt] = i;
+    if (pfd[pfdCnt].fd >= 0)
+      pfdCnt++;
+  }
+  // start values
+  for (int i = 0; i < MAX_PINS; i++)
+  {
+    in_pin_value[i] = readPin(pinNumber[i]);
+    pv[i] = in_pin_value[i] == 1;
+  }
+  UTime start("now");
+  UTime t = start;
+  toLog(pv, t);
+  while (not service.stop and chip != nullptr)
+  { // wait for an edge, for a pending debounce or to check for stop
+    int timeout = 100;
+    for (int i = 0; i < MAX_PINS; i++)
+    {
+      if (pending[i])
+      {
+        int ms = int((debounce - edgeTime[i].getTimePassed()) * 1000) + 1;
+        if (ms < timeout)
+          timeout = ms < 0 ? 0 : ms;
+      }
+    }
+    int e = poll(pfd, pfdCnt, timeout);
+    if (e < 0 and errno != EINTR)
+    {
+      perror("# SGpiod::runEvents: poll failed");
+      break;
+    }
+    for (int k = 0; k < pfdCnt and e > 0; k++)
+    {
+      if ((pfd[k].revents & POLLIN) == 0)
+        continue;
+      int i = pfdPin[k];
+      struct gpiod_line_event ev;
+      if (gpiod_line_event_read(pins[i], &ev) != 0)
+        continue;
+      // kernel timestamp, monotonic on newer kernels (else wall clock)
+      int64_t ns = int64_t(ev.ts.tv_sec) * 1000000000LL + ev.ts.tv_nsec;
+      if (llabs(UTime::nowNs() - ns) < 10000000000LL)
+        edgeTime[i].setNs(ns);
+      else
+        edgeTime[i].setTime(ev.ts.tv_sec, ev.ts.tv_nsec / 1000);
+      pendingValue[i] = ev.event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+      pending[i] = true;
+    }
+    // accept values that are stable for the debounce time
+    bool changed = false;
+    bool stopSwitchPressed = false;
+    for (int i = 0; i < MAX_PINS; i++)
+    {
+      if (not pending[i] or edgeTime[i].getTimePassed() < debounce)
+        continue;
+      pending[i] = false;
+      if (pendingValue[i] == pv[i])
+        // bounced back
+        continue;
+      pv[i] = pendingValue[i];
+      t = edgeTime[i];
+      changed = true;
+      {
+        std::lock_guard<std::mutex> lock(valueLock);
+        in_pin_value[i] = pv[i];
+      }
+      if (i == 0 and pv[i] and start.getTimePassed() > 0.1 and
+          config.get()->gpio.stopOnStop)
+      { // stop switch (not a power-on event in the first 100ms)
+        stopSwitchPressed = true;
+      }
+    }
+    if (changed)
+    {
+      valueChanged.notify_all();
+      toLog(pv, t);
+    }
+    // terminate app
+    if (stopSwitchPressed)
+      service.stopNow("stop_switch");
+  }
+}
+
+void SGpiod::runPoll()
 {
   bool pv[MAX_PINS] = {false};
   bool changed = true;
   int loop = 0;
   bool stopSwitchPressed = false;
-  auto sampleTime =  1ms;
-  auto loopTime = std::chrono::steady_clock::now() + sampleTime;
+  UPeriodic period;
+  period.start("gpio", 0.001);
   while (not service.stop and chip != nullptr)
   {
     loop++;
@@ -263,14 +384,17 @@ void SGpiod::run()
         // debug end
         if (i == 0 and
             pv[i]==1 and
-            ini["gpio"]["stop_on_stop"] == "true")
+            config.get()->gpio.stopOnStop)
         { // stop switch
           stopSwitchPressed = true;
         }
       }
     }
     if (changed or loop %20 == 0)
-      toLog(pv);
+    {
+      UTime t("now");
+      toLog(pv, t);
+    }
     // terminate app
     if (stopSwitchPressed)
     {
@@ -278,14 +402,30 @@ void SGpiod::run()
       stopSwitchPressed = false;
     }
     //
-    std::this_thread::sleep_until(loopTime);
-    loopTime += sampleTime;
+    period.wait();
   }
 }
 
 int SGpiod::wait4Pin(int pin, uint timeout_ms, int wait4Value)
 {
   int value = -1;
+  int idx = getPinIndex(pin);
+  if (eventMode and idx >= 0 and not out_pinuse[idx] and th1 != nullptr)
+  { // wait for the event thread to see the value
+    std::unique_lock<std::mutex> lock(valueLock);
+    auto isValue = [&](){ return in_pin_value[idx] == wait4Value or service.stop; };
+    bool ok;
+    if (timeout_ms == 0)
+    {
+      valueChanged.wait(lock, isValue);
+      ok = true;
+    }
+    else
+      ok = valueChanged.wait_for(lock, std::chrono::milliseconds(timeout_ms), isValue);
+    if (ok and in_pin_value[idx] == wait4Value)
+      value = wait4Value;
+    return value;
+  }
   UTime t("now");
   while (true and chip != nullptr)
   {
@@ -304,16 +444,13 @@ int SGpiod::wait4Pin(int pin, uint timeout_ms, int wait4Value)
   return value;
 }
 
-void SGpiod::toLog(bool pv[])
+void SGpiod::toLog(bool pv[], UTime & t)
 { // pv is pin-value
   if (service.stop)
     return;
-  UTime t("now");
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    fprintf(logfile,"%lu.%04ld %d %d %d %d %d %d %d\n",
-            t.getSec(), t.getMicrosec()/100,
-            pv[0], pv[1], pv[2], pv[3], pv[4], pv[5], pv[6]);
+    logger.log(logCh, t, pv[0], pv[1], pv[2], pv[3], pv[4], pv[5], pv[6]);
   }
   if (toConsole)
   {
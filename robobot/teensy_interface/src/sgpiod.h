@@ -25,11 +25,15 @@
 #define SGPIOD_H
 
 #include <gpiod.h>
+#include <mutex>
+#include <condition_variable>
 #include "utime.h"
 
 
 /**
  * Class to help access to GPIO pins on the Raspberry
+ * Input pins are monitored using edge events from the kernel
+ * (robot.ini [gpio] mode=event), or by reading all pins every ms (mode=poll).
  *
  * Requires that gpiod and libgpiod-dev are installed
  */
@@ -54,13 +58,19 @@ public:
   /**
    * Wait for pin to be high or low
    * \param pin - pin to wait for
-   * \param timeout - value in ms, 0= wait forever
+   * \param timeout - value in ms (0 = wait forever in event mode)
    * \param wait4Value 1 (default), 0 wait for pin to be low.
    * \return the pin value or -1 on timeout. */
   int wait4Pin(int pin, uint timeout_ms, int wait4Value = 1);
   /**
   * to listen to pins */
   void run();
+  /**
+   * Listen to pins using edge events */
+  void runEvents();
+  /**
+   * Listen to pins by reading all pins every ms */
+  void runPoll();
 
 protected:
   int getPinIndex(int pinNumber);
@@ -77,9 +87,17 @@ private:
   int in_pin_value[MAX_PINS] = {-1};
   bool out_pinuse[MAX_PINS] = {false};
   bool isOK = false;
+  /// use edge events (else poll)
+  bool eventMode = true;
+  /// an edge must be stable for this time (sec) to be accepted
+  float debounce = 0.005;
+  /// signals a new (debounced) pin value in event mode
+  std::mutex valueLock;
+  std::condition_variable valueChanged;
   // logfile
   bool toConsole = false;
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
 
 private:
   static void runObj(SGpiod * obj)
@@ -89,8 +107,9 @@ private:
   }
   /**
    * Save pin values to log when there is a change
-   * \param pv is an array of current pin values */
-  void toLog(bool pv[]);
+   * \param pv is an array of current pin values
+   * \param t is the time of the change */
+  void toLog(bool pv[], UTime & t);
   //
   std::thread * th1;
 };
@@ -27,6 +27,7 @@
 #include <inttypes.h>
 #include "simu.h"
 #include "steensy.h"
+#include "ulogger.h"
 #include "uservice.h"
 #include <stdlib.h>
 #include "umqtt.h"
@@ -57,6 +58,11 @@ void SImu::setup(int teensyNumber)
     // ini[ini2]["print_gyro"] = "false";
     // ini[ini2]["print_acc"] = "false";
   }
+  // messages from Teensy
+  teensy[tn].addKey("acc", [this](const char * params, UTime & msgTime){ decodeAcc(params, msgTime); });
+  teensy[tn].addKey("gyro", [this](const char * params, UTime & msgTime){ decodeGyro(params, msgTime); });
+  teensy[tn].addBinKey(UBIN_ACC, [this](const void * data, UTime & msgTime){ applyAcc(*(const UBinImu *)data, msgTime); });
+  teensy[tn].addBinKey(UBIN_GYRO, [this](const void * data, UTime & msgTime){ applyGyro(*(const UBinImu *)data, msgTime); });
   // use values and subscribe to source data
   // like teensy[x].send("sub pose 4\n");
   std::string s = "sub gyro " + ini[ini1]["interval_gyro_ms"] + "\n";
@@ -72,20 +78,18 @@ void SImu::setup(int teensyNumber)
   //
   toConsoleGyro[0] = ini[ini1]["print_gyro"] == "true";
   toConsoleAcc[0] = ini[ini1]["print_acc"] == "true";
-  if (ini[ini1]["log"] == "true")
+  if (ini[ini1]["log"] == "true" and logGyro[0] < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + to_string(tn) + "_gyro_1.txt";
-    logfileGyro[0] = fopen(fn.c_str(), "w");
-    fprintf(logfileGyro[0], "%% Gyro logfile (IMU1)\n");
-    fprintf(logfileGyro[0], "%% 1 \tTime (sec)\n");
-    fprintf(logfileGyro[0], "%% 2-4 \tGyro (x,y,z)\n");
-    fprintf(logfileGyro[0], "%% Gyro offset %g %g %g\n", gyroOffset[0][0], gyroOffset[0][1], gyroOffset[0][2]);
+    logGyro[0] = logger.addChannel("log_t" + to_string(tn) + "_gyro_1", "%.4f %.4f %.4f");
+    logger.addHeader(logGyro[0], "%% Gyro logfile (IMU1)\n");
+    logger.addHeader(logGyro[0], "%% 1 \tTime (sec)\n");
+    logger.addHeader(logGyro[0], "%% 2-4 \tGyro (x,y,z)\n");
+    logger.addHeader(logGyro[0], "%% Gyro offset %g %g %g\n", gyroOffset[0][0], gyroOffset[0][1], gyroOffset[0][2]);
     //
-    fn = service.logPath + "log_t" + to_string(tn) + "_acc_1.txt";
-    logfileAcc[0] = fopen(fn.c_str(), "w");
-    fprintf(logfileAcc[0], "%% Accelerometer logfile (IMU1)\n");
-    fprintf(logfileAcc[0], "%% 1 \tTime (sec)\n");
-    fprintf(logfileAcc[0], "%% 2-4 \tAccelerometer (x,y,z)\n");
+    logAcc[0] = logger.addChannel("log_t" + to_string(tn) + "_acc_1", "%.4f %.4f %.4f");
+    logger.addHeader(logAcc[0], "%% Accelerometer logfile (IMU1)\n");
+    logger.addHeader(logAcc[0], "%% 1 \tTime (sec)\n");
+    logger.addHeader(logAcc[0], "%% 2-4 \tAccelerometer (x,y,z)\n");
   }
   // other IMU
   if (ini[ini2]["use"] == "true")
@@ -101,112 +105,116 @@ void SImu::setup(int teensyNumber)
     gyroOffset[1][2] = strtof(p1, (char**)&p1);
     toConsoleGyro[1] = ini[ini2]["print_gyro"] == "true";
     toConsoleAcc[1] = ini[ini2]["print_acc"] == "true";
-    if (ini[ini2]["log"] == "true" and logfileGyro[1] == nullptr)
+    if (ini[ini2]["log"] == "true" and logGyro[1] < 0)
     { // open logfile
-      std::string fn = service.logPath + "log_t" + to_string(tn) + "_gyro_2.txt";
-      logfileGyro[1] = fopen(fn.c_str(), "w");
-      fprintf(logfileGyro[1], "%% Gyro logfile (IMU2)\n");
-      fprintf(logfileGyro[1], "%% 1 \tTime (sec)\n");
-      fprintf(logfileGyro[1], "%% 2-4 \tGyro (x,y,z)\n");
-      fprintf(logfileGyro[1], "%% Gyro offset %g %g %g\n", gyroOffset[1][0], gyroOffset[1][1], gyroOffset[1][2]);
+      logGyro[1] = logger.addChannel("log_t" + to_string(tn) + "_gyro_2", "%.4f %.4f %.4f");
+      logger.addHeader(logGyro[1], "%% Gyro logfile (IMU2)\n");
+      logger.addHeader(logGyro[1], "%% 1 \tTime (sec)\n");
+      logger.addHeader(logGyro[1], "%% 2-4 \tGyro (x,y,z)\n");
+      logger.addHeader(logGyro[1], "%% Gyro offset %g %g %g\n", gyroOffset[1][0], gyroOffset[1][1], gyroOffset[1][2]);
       //
-      fn = service.logPath + "log_t" + to_string(tn) + "_acc_2.txt";
-      logfileAcc[1] = fopen(fn.c_str(), "w");
-      fprintf(logfileAcc[1], "%% Accelerometer logfile (IMU2)\n");
-      fprintf(logfileAcc[1], "%% 1 \tTime (sec)\n");
-      fprintf(logfileAcc[1], "%% 2-4 \tAccelerometer (x,y,z)\n");
+      logAcc[1] = logger.addChannel("log_t" + to_string(tn) + "_acc_2", "%.4f %.4f %.4f");
+      logger.addHeader(logAcc[1], "%% Accelerometer logfile (IMU2)\n");
+      logger.addHeader(logAcc[1], "%% 1 \tTime (sec)\n");
+      logger.addHeader(logAcc[1], "%% 2-4 \tAccelerometer (x,y,z)\n");
     }
   }
 }
 
 void SImu::terminate()
+{ // logfiles are closed by the logger
+}
+
+void SImu::decodeAcc(const char* params, UTime & msgTime)
+{ // like: acc 0.1 0.1 9.8 12.345
+  const char * p1 = params;
+  UBinImu a;
+  for (int i = 0; i < 3; i++)
+    a.v[i] = strtof(p1, (char**)&p1);
+  a.time = strtod(p1, (char**)&p1);
+  applyAcc(a, msgTime);
+}
+
+void SImu::applyAcc(const UBinImu & a, UTime & msgTime)
+{
+  // IMU 1 (pt. one only)
+  int m = 0;
+  updTimeAcc[m] = msgTime;
+  for (int i = 0; i < 3; i++)
+    acc[m][i] = a.v[i];
+  updateAccCnt[m]++;
+  publish();
+  // save to log
+  toLog(true, m);
+}
+
+void SImu::publish()
 {
-  for (int m = 0; m < 2; m++)
+  Data d;
+  for (int i = 0; i < 3; i++)
   {
-    if (logfileAcc[m] != nullptr)
-    {
-      fclose(logfileAcc[m]);
-      logfileAcc[m] = nullptr;
-    }
-    if (logfileGyro[m] != nullptr)
-    {
-      fclose(logfileGyro[m]);
-      logfileGyro[m] = nullptr;
-    }
+    d.gyro[i] = gyro[0][i];
+    d.acc[i] = acc[0][i];
   }
+  d.updTimeGyro = updTimeGyro[0];
+  d.updTimeAcc = updTimeAcc[0];
+  d.gyroSampleTime = gyroSampleTime;
+  d.updateGyroCnt = updateGyroCnt[0];
+  d.updateAccCnt = updateAccCnt[0];
+  snapshot.write(d);
+}
+
+void SImu::decodeGyro(const char* params, UTime & msgTime)
+{ // like: gyro 0.1 0.1 0.1 12.345
+  const char * p1 = params;
+  // get x,y and z values
+  UBinImu g;
+  for (int i = 0; i < 3; i++)
+    g.v[i] = strtof(p1, (char**)&p1);
+  g.time = strtod(p1, (char**)&p1);
+  applyGyro(g, msgTime);
 }
 
-bool SImu::decode(const char* msg, UTime & msgTime)
+void SImu::applyGyro(const UBinImu & gm, UTime & msgTime)
 {
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "acc ", 4) == 0)
+  float g[3] = {gm.v[0], gm.v[1], gm.v[2]};
+  // IMU number (there is one gyro only)
+  int m = 0;
+  updTimeGyro[m] = msgTime;
+  gyroSampleTime = teensy[tn].teensyToHost(gm.time);
+  for (int i = 0; i < 3; i++)
   {
-    if (strlen(p1) > 4)
-      p1 += 4;
-    else
-      return false;
-    float a[3];
-    for (int i = 0; i < 3; i++)
-      a[i] = strtof(p1, (char**)&p1);
-    // IMU 1 (pt. one only)
-    int m = 0;
-    updTimeAcc[m] = msgTime;
-    for (int i = 0; i < 3; i++)
-      acc[m][i] = a[i];
-    updateAccCnt[m]++;
-    // save to log
-    toLog(true, m);
+    gyro[m][i] = g[i] - gyroOffset[m][i];
   }
-  else if (strncmp(p1, "gyro ", 5) == 0)
-  {
-    if (strlen(p1) > 5)
-      p1 += 5;
-    else
-      return false;
-    // get x,y and z values
-    float g[3];
-    for (int i = 0; i < 3; i++)
-      g[i] = strtof(p1, (char**)&p1);
-    // IMU number (there is one gyro only)
-    int m = 0;
-    updTimeGyro[m] = msgTime;
-    for (int i = 0; i < 3; i++)
+  // notify users of a new update
+  updateGyroCnt[m]++;
+  publish();
+   // save to log (if requested)
+  toLog(false, m);
+  //
+  if (inCalibration[m])
+  { // Gyro calibration can be handled ambulant
+    for (int j = 0; j < 3; j++)
+      calibSum[m][j] = g[j];
+    calibCount[m]++;
+    printf("# gyro %d, %d : %g %g %g\n", m, calibCount[m], calibSum[m][0]/float(calibCount[m]), calibSum[m][1]/float(calibCount[m]), calibSum[m][2]/float(calibCount[m]));
+    if (calibCount[m] >= calibCountMax)
     {
-      gyro[m][i] = g[i] - gyroOffset[m][i];
-    }
-    // notify users of a new update
-    updateGyroCnt[m]++;
-     // save to log (if requested)
-    toLog(false, m);
-    //
-    if (inCalibration[m])
-    { // Gyro calibration can be handled ambulant
       for (int j = 0; j < 3; j++)
-        calibSum[m][j] = g[j];
-      calibCount[m]++;
-      printf("# gyro %d, %d : %g %g %g\n", m, calibCount[m], calibSum[m][0]/float(calibCount[m]), calibSum[m][1]/float(calibCount[m]), calibSum[m][2]/float(calibCount[m]));
-      if (calibCount[m] >= calibCountMax)
-      {
-        for (int j = 0; j < 3; j++)
-          gyroOffset[m][j] = calibSum[m][j]/calibCount[m];
-        // implement new values
-        const int MSL = 100;
-        char s[MSL];
-        snprintf(s, MSL, "%g %g %g", gyroOffset[m][0], gyroOffset[m][1], gyroOffset[m][2]);
-        if (m == 0)
-          ini[ini1]["gyro_offset"] = s;
-        else
-          ini[ini2]["gyro_offset"] = s;
-        inCalibration[m] = false;
-        //
-        printf("# gyro %d calibration finished: %s\n", m, s);
-      }
+        gyroOffset[m][j] = calibSum[m][j]/calibCount[m];
+      // implement new values
+      const int MSL = 100;
+      char s[MSL];
+      snprintf(s, MSL, "%g %g %g", gyroOffset[m][0], gyroOffset[m][1], gyroOffset[m][2]);
+      if (m == 0)
+        ini[ini1]["gyro_offset"] = s;
+      else
+        ini[ini2]["gyro_offset"] = s;
+      inCalibration[m] = false;
+      //
+      printf("# gyro %d calibration finished: %s\n", m, s);
     }
   }
-  else
-    used = false;
-  return used;
 }
 
 void SImu::toLog(bool accChanged, int imuIdx)
@@ -216,10 +224,9 @@ void SImu::toLog(bool accChanged, int imuIdx)
   int m = imuIdx;
   if (accChanged)
   { // accelerometer
-    if (logfileAcc[m] != nullptr and not service.stop_logging)
+    if (logAcc[m] >= 0 and not service.stop_logging)
     {
-      fprintf(logfileAcc[m],"%lu.%04ld %.4f %.4f %.4f\n", updTimeAcc[m].getSec(), updTimeAcc[m].getMicrosec()/100,
-              acc[m][0], acc[m][1], acc[m][2]);
+      logger.log(logAcc[m], updTimeAcc[m], acc[m][0], acc[m][1], acc[m][2]);
     }
     if (toConsoleAcc[m])
     {
@@ -229,10 +236,9 @@ void SImu::toLog(bool accChanged, int imuIdx)
   }
   else
   { // gyro data
-    if (logfileGyro[m] != nullptr and not service.stop_logging)
+    if (logGyro[m] >= 0 and not service.stop_logging)
     {
-      fprintf(logfileGyro[m],"%lu.%04ld %.4f %.4f %.4f\n", updTimeGyro[m].getSec(), updTimeGyro[m].getMicrosec()/100,
-              gyro[m][0], gyro[m][1], gyro[m][2]);
+      logger.log(logGyro[m], updTimeGyro[m], gyro[m][0], gyro[m][1], gyro[m][2]);
     }
     if (toConsoleGyro[m])
     {
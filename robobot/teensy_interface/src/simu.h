@@ -26,6 +26,7 @@
 
 #include "utime.h"
 #include "steensy.h"
+#include "useqlock.h"
 
 using namespace std;
 
@@ -41,15 +42,37 @@ public:
   /**
    * regular update tick */
 //   void tick();
-  /** decode an unpacked incoming messages
-   * \returns true if the message us used */
-  bool decode(const char * msg, UTime & msgTime);
+  /** decode 'acc' and 'gyro' messages from Teensy
+   * \param params is the message after the key */
+  void decodeAcc(const char * params, UTime & msgTime);
+  void decodeGyro(const char * params, UTime & msgTime);
+  /** use decoded (or binary) 'acc' and 'gyro' messages */
+  void applyAcc(const UBinImu & a, UTime & msgTime);
+  void applyGyro(const UBinImu & g, UTime & msgTime);
   /**
    * terminate */
   void terminate();
   /**
    * start calibration of gyro offset */
   void calibrateGyro();
+  /**
+   * Consistent set of IMU values (first IMU), see 'snapshot' */
+  struct Data
+  {
+    float gyro[3]; /// with offset removed
+    float acc[3];
+    UTime updTimeGyro;
+    UTime updTimeAcc;
+    /// Teensy sample time of gyro (host clock)
+    UTime gyroSampleTime;
+    int updateGyroCnt;
+    int updateAccCnt;
+  };
+  /**
+   * Latest values for other threads, updated for every
+   * 'acc' and 'gyro' message.
+   * Use snapshot.waitForUpdate() to wait for new data */
+  USeqLock<Data> snapshot;
 
 public:
 //   mutex dataLock; // ensure consistency
@@ -57,6 +80,7 @@ public:
   int updateGyroCnt[2] = {0}; // gyro updates
   UTime updTimeGyro[2];
   UTime updTimeAcc[2];
+  UTime gyroSampleTime;
   float gyro[2][3] = {{0}};
   float gyroOffset[2][3] = {{0}};
   float acc[2][3] = {{0}};
@@ -67,9 +91,12 @@ private:
   /** save to logfile (and/or console)
    * \param accChanged if new data is from accelerometer, else it is gyro */
   void toLog(bool accChanged, int imuIdx);
+  /** copy values to snapshot */
+  void publish();
   //
-  FILE * logfileGyro[2] = {nullptr};
-  FILE * logfileAcc[2] = {nullptr};
+  /// log channels (see ulogger.h)
+  int logGyro[2] = {-1, -1};
+  int logAcc[2] = {-1, -1};
   bool toConsoleAcc[2] = {false};
   bool toConsoleGyro[2] = {false};
   // calibration values for calibration
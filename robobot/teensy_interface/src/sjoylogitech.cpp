@@ -24,22 +24,21 @@
 
 #include <sys/ioctl.h>
 #include <signal.h>
-#include <linux/joystick.h>
+#include <linux/input.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
 #include <string>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include "sjoylogitech.h"
 #include "uservice.h"
+#include "ulogger.h"
 // #include "cmixer.h"
 // #include "cservo.h"
 #include "mjoy.h"
 
-#define JS_EVENT_BUTTON         0x01    /* button pressed/released */
-#define JS_EVENT_AXIS           0x02    /* joystick moved */
-#define JS_EVENT_INIT           0x80    /* initial state of device */
-
 // create value
 SJoyLogitech joyLogi;
 
@@ -49,6 +48,7 @@ void SJoyLogitech::setup()
   { // no data yet, so generate some default values
     ini["Joy_Logitech"]["log"] = "true";
     ini["Joy_Logitech"]["print"] = "false";
+    // joystick device (the matching /dev/input/eventX is used) or event device
     ini["Joy_Logitech"]["device"] = "/dev/input/js0";
   }
   // Linux device
@@ -61,19 +61,24 @@ void SJoyLogitech::setup()
 //     mixer.setManualOverride(true);
     // start read thread
     toConsole = ini["Joy_Logitech"]["print"] == "true";
-    if (ini["Joy_Logitech"]["log"] == "true" and logfile == nullptr)
+    if (ini["Joy_Logitech"]["log"] == "true" and logCh < 0)
     { // open logfile
-      std::string fn = service.logPath + "log_joy_logitech.txt";
-      logfile = fopen(fn.c_str(), "w");
-      fprintf(logfile, "%% Logitech gamepad interface logfile\n");
-      fprintf(logfile, "%% Device %s\n", joyDevice.c_str());
-      fprintf(logfile, "%% Device type %s\n", deviceName.c_str());
-      fprintf(logfile, "%% Button count %d\n", number_of_buttons);
-      fprintf(logfile, "%% Axis count %d\n", number_of_axes);
-      fprintf(logfile, "%% 1 \tTime (sec)\n");
-      fprintf(logfile, "%% 2 \tmanual mode (else automatic)\n");
-      fprintf(logfile, "%% 3-%d \tButtons pressed\n", number_of_buttons + 2);
-      fprintf(logfile, "%% %d-%d \tAxis value\n", number_of_buttons + 3, number_of_axes + number_of_buttons + 2);
+      std::string fmt = "%d ";
+      for (int i = 0; i < number_of_buttons; i++)
+        fmt += " %d";
+      fmt += " ";
+      for (int i = 0; i < number_of_axes; i++)
+        fmt += " %d";
+      logCh = logger.addChannel("log_joy_logitech", fmt.c_str());
+      logger.addHeader(logCh, "%% Logitech gamepad interface logfile\n");
+      logger.addHeader(logCh, "%% Device %s\n", joyDevice.c_str());
+      logger.addHeader(logCh, "%% Device type %s\n", deviceName.c_str());
+      logger.addHeader(logCh, "%% Button count %d\n", number_of_buttons);
+      logger.addHeader(logCh, "%% Axis count %d\n", number_of_axes);
+      logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+      logger.addHeader(logCh, "%% 2 \tmanual mode (else automatic)\n");
+      logger.addHeader(logCh, "%% 3-%d \tButtons pressed\n", number_of_buttons + 2);
+      logger.addHeader(logCh, "%% %d-%d \tAxis value\n", number_of_buttons + 3, number_of_axes + number_of_buttons + 2);
     }
     // start listen thread
     if (th1 == nullptr)
@@ -86,36 +91,38 @@ void SJoyLogitech::terminate()
 {
   if (th1 != nullptr)
     th1->join();
-  if (logfile != nullptr)
-  {
-    fclose(logfile);
-    logfile = nullptr;
-  }
+  // logfile is closed by the logger
 }
 
 void SJoyLogitech::run()
 {
-  UTime t;
-  t.now();
   std::this_thread::sleep_for(std::chrono::milliseconds(800));
+  // start values
+  getState();
+  UTime t("now");
+  publish(t);
+  struct pollfd pfd;
+  pfd.fd = jDev;
+  pfd.events = POLLIN;
   while (not service.stop and joyRunning)
   { // handling gamepad events
-    // Device is present
-    bool gotEvent = getNewJsData();
-    if (gotEvent)
-    { // set time and update count
-      updTime.now();
-      updateCnt++;
-      //
-      if (t.getTimePassed() > 0.01 or gotButton or true)
-      { // don't save too fast, but all button presses
-        gotButton = false;
-        t.now();
-        toLog();
-      }
+    // wait for events (or check for stop)
+    int e = poll(&pfd, 1, 100);
+    if (e < 0 and errno != EINTR)
+    {
+      perror("# SJoyLogitech::run: poll failed");
+      break;
+    }
+    if (e <= 0)
+      continue;
+    bool isOK = true;
+    if (pfd.revents & POLLIN)
+      isOK = readEvents();
+    if (not isOK or (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+    {
+      printf("# SJoyLogitech::run: lost gamepad (%s)\n", joyDevice.c_str());
+      break;
     }
-    else
-      std::this_thread::sleep_for(std::chrono::milliseconds(2));
   }
   if (joyRunning)
   { // close device nicely
@@ -126,107 +133,221 @@ void SJoyLogitech::run()
   }
 }
 
+std::string SJoyLogitech::eventDevice(std::string dev)
+{
+  size_t n = dev.rfind("/js");
+  if (n == std::string::npos)
+    return dev;
+  // e.g. /sys/class/input/js0/device/event5
+  std::string sysDir = "/sys/class/input" + dev.substr(n) + "/device";
+  std::string result = dev;
+  DIR * dir = opendir(sysDir.c_str());
+  if (dir != nullptr)
+  {
+    struct dirent * de;
+    while ((de = readdir(dir)) != nullptr)
+    {
+      if (strncmp(de->d_name, "event", 5) == 0)
+      {
+        result = std::string("/dev/input/") + de->d_name;
+        break;
+      }
+    }
+    closedir(dir);
+  }
+  return result;
+}
+
 bool SJoyLogitech::initJoy()
 {
-  jDev = open (joyDevice.c_str(), O_RDWR | O_NONBLOCK);
+  std::string dev = eventDevice(joyDevice);
+  jDev = open(dev.c_str(), O_RDONLY | O_NONBLOCK);
   if (jDev >= 0)
-  { // Joystic device found
-    //Query and print the joystick name
+  { // gamepad device found
+    joyDevice = dev;
+    //Query and print the gamepad name
     char name[128] = "no device found";
-    if (ioctl(jDev, JSIOCGNAME(sizeof(name)), name) < 0)
+    if (ioctl(jDev, EVIOCGNAME(sizeof(name)), name) < 0)
       strncpy(name, "Unknown", sizeof(name));
     //
     deviceName = name;
     ini["Joy_Logitech"]["device_type"] = deviceName;
-    //Query and print number of axes and buttons
-    ioctl (jDev, JSIOCGAXES, &number_of_axes);
-    ioctl (jDev, JSIOCGBUTTONS, &number_of_buttons);
-//     printf("Registrered %d axes and %d buttons on joystick\n",number_of_axes, number_of_buttons);
+    // event times on the same clock as UTime
+    int clk = CLOCK_MONOTONIC;
+    if (ioctl(jDev, EVIOCSCLOCKID, &clk) < 0)
+      perror("# SJoyLogitech::initJoy: failed to set event clock");
+    // number buttons and axes as the joystick (js) driver
+    unsigned long keyBits[MAX_KEYS / (8 * sizeof(long))] = {0};
+    unsigned long absBits[MAX_ABS / (8 * sizeof(long))] = {0};
+    ioctl(jDev, EVIOCGBIT(EV_KEY, sizeof(keyBits)), keyBits);
+    ioctl(jDev, EVIOCGBIT(EV_ABS, sizeof(absBits)), absBits);
+    auto isSet = [](unsigned long bits[], int i)
+    {
+      const int BPL = 8 * sizeof(long);
+      return (bits[i / BPL] >> (i % BPL)) & 1;
+    };
+    for (int i = 0; i < MAX_KEYS; i++)
+      buttonIdx[i] = -1;
+    for (int i = 0; i < MAX_ABS; i++)
+      axisIdx[i] = -1;
+    number_of_buttons = 0;
+    // buttons from BTN_MISC first, then the keys below
+    for (int k = 0; k < MAX_KEYS; k++)
+    {
+      int i = (k + BTN_MISC) % MAX_KEYS;
+      if (isSet(keyBits, i) and number_of_buttons < 16)
+        buttonIdx[i] = number_of_buttons++;
+    }
+    number_of_axes = 0;
+    for (int i = 0; i < MAX_ABS; i++)
+    {
+      if (isSet(absBits, i) and number_of_axes < 16)
+      {
+        struct input_absinfo ai;
+        int a = number_of_axes;
+        axisIdx[i] = number_of_axes++;
+        axisCode[a] = i;
+        if (ioctl(jDev, EVIOCGABS(i), &ai) == 0 and ai.maximum != ai.minimum)
+        { // as the js driver correction
+          axisCorr[a][0] = (ai.maximum + ai.minimum) / 2 - ai.flat;
+          axisCorr[a][1] = (ai.maximum + ai.minimum) / 2 + ai.flat;
+          int t = (ai.maximum - ai.minimum) / 2 - 2 * ai.flat;
+          axisCorr[a][2] = t != 0 ? (1 << 29) / t : 0;
+        }
+        else
+          // no scaling
+          axisCorr[a][2] = -1;
+      }
+    }
   }
   return jDev >= 0;
 }
 
-bool SJoyLogitech::getNewJsData()
+int SJoyLogitech::axisValue(int idx, int value)
 {
-  struct js_event jse;
-  bool lostConnection = false;
-  bool isOK = false;
-  // read full struct or nothing
-  int bytes = read(jDev, &jse, sizeof(jse));
-  // detect errors
-  if (bytes == -1)
-  { // error - an error occurred while reading
-    switch (errno)
-    { // may be an error, or just nothing send (buffer full)
-      case EAGAIN:
-        //not all send - just continue
-        usleep(100);
-        break;
-      default:
-        perror("UJoy::getNewJsData (other error device error): ");
-        lostConnection = true;
-        break;
-    }
-  }
-  if (lostConnection)
+  const int * c = axisCorr[idx];
+  if (c[2] < 0)
+    return value;
+  int64_t v;
+  if (value < c[0])
+    v = (int64_t(c[2]) * (value - c[0])) >> 14;
+  else if (value > c[1])
+    v = (int64_t(c[2]) * (value - c[1])) >> 14;
+  else
+    v = 0;
+  if (v > 32767)
+    v = 32767;
+  else if (v < -32767)
+    v = -32767;
+  return int(v);
+}
+
+void SJoyLogitech::getState()
+{
+  unsigned long keyState[MAX_KEYS / (8 * sizeof(long))] = {0};
+  const int BPL = 8 * sizeof(long);
+  if (ioctl(jDev, EVIOCGKEY(sizeof(keyState)), keyState) >= 0)
   {
-    joyRunning = false;
-    if (jDev >= 0)
-    {
-      close(jDev);
-      jDev = -1;
-    }
-    printf("UJoy::run: getNewJsData close\n");
+    for (int i = 0; i < MAX_KEYS; i++)
+      if (buttonIdx[i] >= 0)
+        pending.button[buttonIdx[i]] = (keyState[i / BPL] >> (i % BPL)) & 1;
   }
-  if (joyRunning and bytes > 0)
+  for (int a = 0; a < number_of_axes; a++)
   {
-    if (bytes != sizeof(jse) and bytes > 0)
-    { // size error
-      printf("JOY control : Unexpected byte count from joystick:%d - continues\n", bytes);
+    struct input_absinfo ai;
+    if (ioctl(jDev, EVIOCGABS(axisCode[a]), &ai) == 0)
+      pending.axis[a] = axisValue(a, ai.value);
+  }
+}
+
+bool SJoyLogitech::readEvents()
+{
+  const int MEV = 64;
+  struct input_event ev[MEV];
+  bool isOK = true;
+  while (true)
+  { // read all pending events
+    int bytes = read(jDev, ev, sizeof(ev));
+    if (bytes < 0)
+    {
+      if (errno != EAGAIN and errno != EINTR)
+      { // device error (e.g. disconnected)
+        perror("# SJoyLogitech::readEvents: device error");
+        isOK = false;
+      }
+      break;
     }
-    else
-    { //Proper joystick package has been received
-      //Joystick package parser
-      isOK = true;
-      jse.type &= ~JS_EVENT_INIT; /* ignore synthetic events */
-      switch(jse.type) {
-        // changed axis position
-        case JS_EVENT_AXIS:
-          if (jse.number < 16) {
-            joyValues.axis[jse.number] = jse.value;
+    int n = bytes / sizeof(struct input_event);
+    for (int i = 0; i < n; i++)
+    {
+      const struct input_event & e = ev[i];
+      switch (e.type)
+      {
+        case EV_KEY:
+          if (not dropped and e.code < MAX_KEYS and buttonIdx[e.code] >= 0)
+          {
+            pending.button[buttonIdx[e.code]] = e.value != 0;
+            gotButton = true;
           }
           break;
-        // changed button state
-        case JS_EVENT_BUTTON:
-          if (jse.number < 16) {
-            joyValues.button[jse.number] = jse.value;
-            gotButton = true;
+        case EV_ABS:
+          if (not dropped and e.code < MAX_ABS and axisIdx[e.code] >= 0)
+            pending.axis[axisIdx[e.code]] = axisValue(axisIdx[e.code], e.value);
+          break;
+        case EV_SYN:
+          if (e.code == SYN_DROPPED)
+            // kernel buffer overrun, ignore until next report
+            dropped = true;
+          else if (e.code == SYN_REPORT)
+          { // a complete set of changes
+            if (dropped)
+            { // get the full state instead
+              getState();
+              dropped = false;
+            }
+            UTime t;
+            t.setNs(int64_t(e.input_event_sec) * 1000000000LL + int64_t(e.input_event_usec) * 1000);
+            publish(t);
           }
           break;
         default:
-          printf("UJoy::getNewJsData : got bad data (event=%d, time=%d) - ignores\n", jse.type, jse.time);
-          isOK = false;
           break;
       }
     }
+    if (bytes < int(sizeof(ev)))
+      // no more for now
+      break;
   }
   return isOK;
 }
 
+void SJoyLogitech::publish(UTime & t)
+{
+  joyValues = pending;
+  snapshot.write(joyValues);
+  updTime = t;
+  updateCnt++;
+  gotButton = false;
+  toLog();
+  // mode change and manual control
+  joy.update(updTime);
+}
+
 void SJoyLogitech::toLog()
 {
   if (not service.stop)
   {
-    if (logfile != nullptr and not service.stop_logging)
+    if (logCh >= 0 and not service.stop_logging)
     { // save all axis and buttons
-      fprintf(logfile, "%lu.%04ld %d ", updTime.getSec(), updTime.getMicrosec()/100,
-           joy.manualMode());
-      for (int i = 0; i < number_of_buttons; i++)
-        fprintf(logfile, " %d", joyValues.button[i]);
-      fprintf(logfile, " ");
-      for (int i = 0; i < number_of_axes; i++)
-        fprintf(logfile, " %d", joyValues.axis[i]);
-      fprintf(logfile, "\n");
+      const int MVL = 1 + 16 + 16;
+      double v[MVL];
+      int n = 0;
+      v[n++] = joy.manualMode();
+      for (int i = 0; i < number_of_buttons and n < MVL; i++)
+        v[n++] = joyValues.button[i];
+      for (int i = 0; i < number_of_axes and n < MVL; i++)
+        v[n++] = joyValues.axis[i];
+      logger.logValues(logCh, updTime, v, n);
     }
     if (toConsole)
     { // print to console
@@ -26,9 +26,16 @@
 
 #include <thread>
 #include "utime.h"
+#include "useqlock.h"
 
 /**
- * Class to allow manual control using a Ligitech gamepad
+ * Class to allow manual control using a Ligitech gamepad.
+ * Reads the evdev device (/dev/input/eventX) for the gamepad,
+ * if robot.ini device is a joystick device (/dev/input/jsX), then the
+ * matching event device is used.
+ * The thread sleeps in poll() and reads all pending events at once.
+ * Values are published for every complete report (SYN_REPORT),
+ * numbered and scaled as the joystick (js) device.
  */
 class SJoyLogitech
 {
@@ -42,6 +49,9 @@ public:
    * terminate */
   void terminate();
 
+  /**
+   * Axis and button values, for the gamepad thread
+   * (and MJoy::update()), other threads should use 'snapshot' */
   int getAxis(int axis)
   {
     if (axis >= 0 and axis < number_of_axes)
@@ -81,6 +91,9 @@ public:
   };
   struct jVal joyValues;
   int number_of_axes = 8, number_of_buttons = 11;
+  /**
+   * Latest complete set of values for other threads */
+  USeqLock<jVal> snapshot;
 
 private:
   /// private stuff
@@ -92,7 +105,8 @@ private:
   void toLog();
   std::thread * th1;
   bool toConsole = false;
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
   //
   // device
   // int buttonFast;// on gamepad
@@ -107,13 +121,37 @@ private:
   bool initJoy();
   std::string deviceName = "unknown";
   /**
-   * Get fresh data from joystick
-   * \return false if device disappeared of received other than event data */
-  bool getNewJsData();
-  void joyControl();
+   * Find the event device for a joystick device (using /sys/class/input)
+   * \returns the event device name, or 'dev' if not a joystick device */
+  std::string eventDevice(std::string dev);
+  /**
+   * Read all pending events and publish complete reports
+   * \return false if device disappeared */
+  bool readEvents();
+  /**
+   * Get all values from the device (at start and when events are dropped) */
+  void getState();
+  /**
+   * Make pending values available (joyValues, snapshot and MJoy)
+   * \param t is the time of the report */
+  void publish(UTime & t);
+  /** scale axis value as the js device does (+/-32767) */
+  int axisValue(int idx, int value);
   //
   std::string joyDevice = "/dev/input/js0";
   int jDev = -1;  ///File descriptors
+  /// values being updated until next SYN_REPORT
+  struct jVal pending;
+  /// events are dropped until next SYN_REPORT
+  bool dropped = false;
+  /// event code to button or axis number (js numbering), -1 is not used
+  static const int MAX_KEYS = 0x300;
+  static const int MAX_ABS = 0x40;
+  short buttonIdx[MAX_KEYS];
+  short axisIdx[MAX_ABS];
+  int axisCode[16] = {0};
+  /// axis scaling (center-flat, center+flat, scale)
+  int axisCorr[16][3] = {{0}};
   /// are we running in fast mode = 1.0, otherwise a bit slower with this factor
   // float velScale, turnScale, servoScale;
   // float maxVel, maxTurn;
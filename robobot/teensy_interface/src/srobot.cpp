@@ -40,6 +40,8 @@
 #include "srobot.h"
 #include "uservice.h"
 #include "umqtt.h"
+#include "ulogger.h"
+#include "uconfig.h"
 
 // create the class with received info
 SRobot robot[NUM_TEENSY_MAX];
@@ -64,25 +66,28 @@ void SRobot::setup(int teensyNumber)
   batteryScale = strtod(ini[ini_section]["batteryCalibrate"].c_str(), nullptr);
   string ss = "batcal " + to_string(batteryScale) + "\n";
   teensy[tn].send(ss.c_str());
+  // messages from Teensy
+  teensy[tn].addKey("hbt", [this](const char * params, UTime & msgTime){ decodeHbt(params, msgTime); });
+  teensy[tn].addKey("power", [this](const char * params, UTime &){ decodePower(params); });
+  teensy[tn].addBinKey(UBIN_HBT, [this](const void * data, UTime & msgTime){ applyHbt(*(const UBinHbt *)data, msgTime); });
   teensy[tn].send("sub hbt 500\n");
   // topic names
   topicHbt = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/hbt";
-  if (ini[ini_section]["log"] == "true" and logfile == nullptr)
+  if (ini[ini_section]["log"] == "true" and logCh < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_t" + std::to_string(tn) + "_hbt.txt";
-    logfile = fopen(fn.c_str(), "w");
-    fprintf(logfile, "%% Heartbeat logfile\n");
-    fprintf(logfile, "%% 1 \tTime (sec)\n");
-    fprintf(logfile, "%% 2 \tRobot name index\n");
-    fprintf(logfile, "%% 3 \tVersion\n");
-    fprintf(logfile, "%% 4 \tState (0 = control is external to Teensy)\n");
-    fprintf(logfile, "%% 5 \tBattery voltage (V)\n");
-    fprintf(logfile, "%% 6 \tTeensy load (%%)\n");
-    fprintf(logfile, "%% 7 \tBoard supply current (A)\n");
-    fprintf(logfile, "%% 8 \tUsed battery capacity (Wh) (never reset properly)\n");
-    fprintf(logfile, "%% 9 \tShutdown request.\n");
-    fprintf(logfile, "%% 10 \tCPU temperature (Raspberry).\n");
-    // fprintf(logfile, "%% 11 \tIP4 adresses.\n");
+    logCh = logger.addChannel("log_t" + std::to_string(tn) + "_hbt", "%d %d %d %.2f %.1f %.2f %.3f %d %.1f");
+    logger.addHeader(logCh, "%% Heartbeat logfile\n");
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2 \tRobot name index\n");
+    logger.addHeader(logCh, "%% 3 \tVersion\n");
+    logger.addHeader(logCh, "%% 4 \tState (0 = control is external to Teensy)\n");
+    logger.addHeader(logCh, "%% 5 \tBattery voltage (V)\n");
+    logger.addHeader(logCh, "%% 6 \tTeensy load (%%)\n");
+    logger.addHeader(logCh, "%% 7 \tBoard supply current (A)\n");
+    logger.addHeader(logCh, "%% 8 \tUsed battery capacity (Wh) (never reset properly)\n");
+    logger.addHeader(logCh, "%% 9 \tShutdown request.\n");
+    logger.addHeader(logCh, "%% 10 \tCPU temperature (Raspberry).\n");
+    // logger.addHeader(logCh, "%% 11 \tIP4 adresses.\n");
   }
   if (th1 == nullptr)
     th1 = new std::thread(runObj, this);
@@ -93,19 +98,14 @@ void SRobot::setup(int teensyNumber)
 
 void SRobot::terminate()
 {
-  if (logfile != nullptr)
-  {
-    dataLock.lock();
-    fclose(logfile);
-    logfile = nullptr;
-    dataLock.unlock();
-  }
+  // logfile is closed by the logger
   if (th1 != nullptr)
     th1->join();
+  config.setIni(ini_section, "batteryUsedWh", std::to_string(batteryUsedWh));
 }
 
 
-bool SRobot::decode(const char* msg, UTime & msgTime)
+void SRobot::decodeHbt(const char* params, UTime & msgTime)
 { // like: regbot:hbt 37708.7329 74 1430 5.01 0 6 1 1
   /* hbt 1 : time in seconds, updated every sample time
   *     2 : device ID (probably 1)
@@ -117,89 +117,104 @@ bool SRobot::decode(const char* msg, UTime & msgTime)
   *     8 : Battery capacity
   *     9 : Shutdown request
   */
-  bool used = true;
-  const char * p1 = msg;
-  if (strncmp(p1, "hbt ", 4) == 0)
+  const char * p1 = params;
+  if (strlen(p1) > 1)
   { // decode HBT message
-    // advance to first parameter
-    if (strlen(p1) > 5)
-      p1 += 4;
-    else
-      return false;
-    // get data
-    dataLock.lock();
+    UBinHbt m;
     // time in seconds from Teensy
-    double tt = strtof64(p1, (char**)&p1);
-    teensyTime = tt;
-    int x = strtol(p1, (char**)&p1, 10); // index (robot number)
-    if (x != idx)
-    { // set robot number into ini-file
-      idx = x;
-      ini[tnGroup]["idx"] = to_string(idx);
-      // also ask for the new name
-      teensy[tn].send("idi\n", true);
+    m.time = strtod(p1, (char**)&p1);
+    m.deviceID = strtol(p1, (char**)&p1, 10); // index (robot number)
+    m.revision = strtol(p1, (char**)&p1, 10); // index (from SVN)
+    m.batteryVoltage = strtof(p1, (char**)&p1); // y
+    m.state = strtol(p1, (char**)&p1, 10); // control state 0=no control, 1=RC, 2=auto (if exist)
+    m.hwType = strtol(p1, (char**)&p1, 10); // hardware type
+    m.load = strtof(p1, (char**)&p1); // Teensy load in %
+    m.supplyCurrent = strtof(p1, (char**)&p1); // supply current
+    m.batLowCnt = strtol(p1, (char**)&p1, 10); // Request from Teensy to shut down (off button or low battery_low_cnt)
+    applyHbt(m, msgTime);
+  }
+}
+
+void SRobot::applyHbt(const UBinHbt & m, UTime & msgTime)
+{
+  // get data
+  dataLock.lock();
+  // time in seconds from Teensy
+  teensyTime = m.time;
+  if (m.deviceID != idx)
+  { // set robot number into ini-file
+    idx = m.deviceID;
+    config.setIni(tnGroup, "idx", to_string(idx));
+    // also ask for the new name
+    teensy[tn].send("idi\n", true);
 //       printf("# SRobot::decode: asked for new name (idi -> dname)\n");
+  }
+  if (m.revision != version)
+  {
+    version = m.revision;
+    config.setIni(ini_section, "regbot_version", to_string(version));
+  }
+  batteryVoltage = m.batteryVoltage;
+  controlState = m.state;
+  //
+  if (m.hwType != type)
+  {
+    type = m.hwType;
+    config.setIni(tnGroup, "hardware", std::to_string(type));
+  }
+  //
+  load = m.load;
+  supplyCurrent = m.supplyCurrent;
+  float dt = msgTime - hbtTime;
+  if (dt < 2.0)
+  { // when battery is fully charged, the used capacity is reset.
+    // beeing charged, but not full, is unknown.
+    if (batteryVoltage > fullyChargedVoltage)
+      batteryUsedWh = 0;
+    if (batteryVoltage > 6.0)
+    { // we are not on USB power, so trust supply current
+      float usedWs = supplyCurrent * batteryVoltage * dt;
+      batteryUsedWh += usedWs / 3600.0;
     }
-    int rv = strtol(p1, (char**)&p1, 10); // index (from SVN)
-    if (rv != version)
+  }
+  shutdown_count = m.batLowCnt;
+  //
+  hbtTime = msgTime;
+  // save to log if file is open
+  toLog();
+  dataLock.unlock();
+  if (shutdown_count > 100)
+  { // from keyboard or from Teensy when low on power - counts to 20000 (20 seconds), then cut power
+    const int MSL = 100;
+    char s[MSL];
+    // the message as text (may be received as binary)
+    snprintf(s, MSL, "%.4f %d %d %.2f %d %d %.1f %.2f %d\n",
+             m.time, m.deviceID, m.revision, m.batteryVoltage, m.state,
+             m.hwType, m.load, m.supplyCurrent, m.batLowCnt);
+    if (not ini[ini_section].has("shutdown_file"))
+      ini[ini_section]["shutdown_file"] = "shutdown.now";
+    FILE * shutdown = fopen(ini[ini_section]["shutdown_file"].c_str(), "a"); // "a" for append
+    if (shutdown != nullptr)
     {
-      version = rv;
-      ini[ini_section]["regbot_version"] = to_string(rv);
-    }
-    batteryVoltage = strtof(p1, (char**)&p1); // y
-    controlState = strtol(p1, (char**)&p1, 10); // control state 0=no control, 1=RC, 2=auto (if exist)
-    //
-    type = strtol(p1, (char**)&p1, 10); // hardware type
-    ini[tnGroup]["hardware"] = std::to_string(type);
-    //
-    load = strtof(p1, (char**)&p1); // Teensy load in %
-    supplyCurrent = strtof(p1, (char**)&p1); // supply current
-    float dt = msgTime - hbtTime;
-    if (dt < 2.0)
-    { // when battery is fully charged, the used capacity is reset.
-      // beeing charged, but not full, is unknown.
-      if (batteryVoltage > fullyChargedVoltage)
-        batteryUsedWh = 0;
-      if (batteryVoltage > 6.0)
-      { // we are not on USB power, so trust supply current
-        float usedWs = supplyCurrent * batteryVoltage * dt;
-        batteryUsedWh += usedWs / 3600.0;
-        ini[ini_section]["batteryUsedWh"] = std::to_string(batteryUsedWh);
-      }
+      char st[MSL];
+      fprintf(shutdown, "# URobot:: received this 'hbt' with power-off bit set: hbt %s", s);
+      fprintf(shutdown, "Shutdown at %lu.%03ld (%s)\n", hbtTime.getSec(), hbtTime.getMillisec(), hbtTime.getDateTimeAsString(st));
+      fclose(shutdown);
     }
-    shutdown_count = strtol(p1, (char**)&p1, 10); // Request from Teensy to shut down (off button or low battery_low_cnt)
-    //
-    hbtTime = msgTime;
-    // save to log if file is open
-    toLog();
-    dataLock.unlock();
-    if (shutdown_count > 100)
-    { // from keyboard or from Teensy when low on power - counts to 20000 (20 seconds), then cut power
-      if (not ini[ini_section].has("shutdown_file"))
-        ini[ini_section]["shutdown_file"] = "shutdown.now";
-      FILE * shutdown = fopen(ini[ini_section]["shutdown_file"].c_str(), "a"); // "a" for append
-      if (shutdown != nullptr)
-      {
-        const int MSL = 100;
-        char s[MSL];
-        fprintf(shutdown, "# URobot:: received this 'hbt' with power-off bit set: %s", msg);
-        fprintf(shutdown, "Shutdown at %lu.%03ld (%s)\n", hbtTime.getSec(), hbtTime.getMillisec(), hbtTime.getDateTimeAsString(s));
-        fclose(shutdown);
-      }
-      printf("# URobot:: received a 'hbt' with power-off count %d/10000 from: %s", shutdown_count, msg);
-      if (shutdown_count > 1000)
-      {
-        service.stopNow("request from Teensy hbt");
-      }
+    printf("# URobot:: received a 'hbt' with power-off count %d/10000 from: hbt %s", shutdown_count, s);
+    if (shutdown_count > 1000)
+    {
+      service.stopNow("request from Teensy hbt");
     }
   }
-  else if (strncmp(p1, "power off", 9) == 0)
+}
+
+void SRobot::decodePower(const char* params)
+{ // like: power off
+  if (strncmp(params, "off", 3) == 0)
   { // power off button pressed
     service.power_off_request(true, "Teensy (battery)");
   }
-  else
-    used = false;
-  return used;
 }
 
 
@@ -207,23 +222,26 @@ void SRobot::toLog()
 { // data is already locked
   if (service.stop)
     return;
-  const int MSL = 200;
-  char s[MSL];
-  char st[MSL];
-  snprintf(st, MSL, "%lu.%04ld", hbtTime.getSec(), hbtTime.getMicrosec()/100);
-  snprintf(s, MSL, "%d %d %d %.2f %.1f %.2f %.3f %d %.1f\n",
-           idx, version, controlState, batteryVoltage,
-           load, supplyCurrent, batteryUsedWh, shutdown_count, cpuTemp);
   // if (ini["mqtt"]["use"] == "true")
   // {
   //   mqtt.publish(topicHbt.c_str(), s, hbtTime);
   // }
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    fprintf(logfile, "%s %s", st, s);
+    logger.log(logCh, hbtTime, idx, version, controlState, batteryVoltage,
+               load, supplyCurrent, batteryUsedWh, shutdown_count, cpuTemp);
   }
   if (toConsole)
+  {
+    const int MSL = 200;
+    char s[MSL];
+    char st[MSL];
+    snprintf(st, MSL, "%lu.%04ld", hbtTime.getSec(), hbtTime.getMicrosec()/100);
+    snprintf(s, MSL, "%d %d %d %.2f %.1f %.2f %.3f %d %.1f\n",
+            idx, version, controlState, batteryVoltage,
+            load, supplyCurrent, batteryUsedWh, shutdown_count, cpuTemp);
     printf("# state %s %s", st, s);
+  }
 }
 
 void SRobot::run()
@@ -267,6 +285,8 @@ void SRobot::run()
         }
       }
     }
+    // used battery capacity is saved in robot.ini
+    config.setIni(ini_section, "batteryUsedWh", std::to_string(batteryUsedWh));
     sleep(1);
     loop++;
   }
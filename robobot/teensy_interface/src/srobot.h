@@ -36,9 +36,13 @@ public:
   int tn = 0;
   /** setup and request data */
   void setup(int teensyNumber);
-  /** decode an unpacked incoming messages
-   * \returns true if the message us used */
-  bool decode(const char * msg, UTime & msgTime);
+  /** decode 'hbt' message from Teensy
+   * \param params is the message after the key */
+  void decodeHbt(const char * params, UTime & msgTime);
+  /** use decoded (or binary) 'hbt' message */
+  void applyHbt(const UBinHbt & m, UTime & msgTime);
+  /** decode 'power' message from Teensy (power off button) */
+  void decodePower(const char * params);
   /**
    * runs the thread  */
   void run();
@@ -107,7 +111,8 @@ private:
   std::string tnGroup;  // teensy group in ini-file
   /// Log flags
   bool toConsole = false;
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
   /// MQTT
   std::string topicHbt;
   UTime lastHbt;
@@ -33,27 +33,38 @@
 #include <math.h>
 #include <string.h>
 #include <termios.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
 
 #include "steensy.h"
+#include "uteensyio.h"
 #include "uservice.h"
 // #include "sstate.h"
 #include "sencoder.h"
 #include "umqtt.h"
+#include "ulogger.h"
 
 // using namespace std;
 
 STeensy teensy[NUM_TEENSY_MAX];
 
 
-bool UOutQueue::setMessage(const char* message)
+bool UOutQueue::setMessage(const char* message, int seqNum)
 { // add a '!' to request confirmation of this message
-  msg[3] = '!';
+  // and a sequence number (if used) to match the confirm
+  seq = seqNum;
+  int h = 1;
+  if (seq >= 0)
+    h = snprintf(&msg[3], 8, "!%d:", seq);
+  else
+    msg[3] = '!';
   len = strnlen(message, MML);
-  bool isOK = len + 5 < MML;
+  bool isOK = len + h + 4 < MML;
   if (isOK)
   {
-    strncpy(&msg[4], message, len);
-    len += 4;
+    strncpy(&msg[3 + h], message, len);
+    len += 3 + h;
     if (msg[len-1] != '\n')
     { // add a \n if it is not there
       msg[len++] = '\n';
@@ -93,11 +104,28 @@ void STeensy::setup(int teensyNumber)
     ini[ini_section]["log"] = "true";
     ini[ini_section]["print"] = "false";
     ini[ini_section]["confirm_timeout"] = "0.04";
+    ini[ini_section]["confirm_window"] = "8";
     ini[ini_section]["encrev"] = "true";
+    ini[ini_section]["stat_interval"] = "10";
+    ini[ini_section]["binary"] = "false";
+  }
+  if (not ini[ini_section].has("binary"))
+  { // telemetry as binary frames, needs Teensy firmware with 'bin' command
+    ini[ini_section]["binary"] = "false";
+  }
+  if (not ini[ini_section].has("confirm_window"))
+  { // max messages waiting for confirm, 1 for Teensy firmware without sequence numbers
+    ini[ini_section]["confirm_window"] = "8";
+  }
+  if (not ini[ini_section].has("stat_interval"))
+  { // receive statistics interval (sec) for logfile, 0 = no statistics
+    ini[ini_section]["stat_interval"] = "10";
   }
   topicBase = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "T" + std::to_string(tn) + "/";
-  topicDName = topicBase + "dname";
   topicHelp = topicBase + "info";
+  topicLog = topicBase + "log";
+  // robot name is handled here
+  addKey("dname", [this](const char * params, UTime &){ decodeDname(params); });
   if (ini[ini_section]["use"] != "true")
   {
     printf("# STeensy::setup: open to Teensy %d disabled\n", tn);
@@ -113,17 +141,23 @@ void STeensy::setup(int teensyNumber)
   encoderReversed = ini[ini_section]["encrev"] != "false";
   if (confirmTimeout < 0.01)
     confirmTimeout = 0.02;
+  confirmWindow = strtol(ini[ini_section]["confirm_window"].c_str(), nullptr, 10);
+  if (confirmWindow < 1)
+    confirmWindow = 1;
+  binaryMode = ini[ini_section]["binary"] == "true";
+  statInterval = strtof(ini[ini_section]["stat_interval"].c_str(), nullptr);
   //
-  if (ini[ini_section]["log"] == "true")
+  if (ini[ini_section]["log"] == "true" and logIo < 0)
   { // open log file and write the header - else no logging
-    std::string fn = service.logPath + "log_t" + to_string(tn) + "_teensy_io.txt";
-    logfile = fopen(fn.c_str(), "w");
-    fprintf(logfile, "%% teensy communication to/from Teensy\n");
-    fprintf(logfile, "%% 1 \tTime (sec) from system\n");
-    fprintf(logfile, "%% 2 \t(Tx) Send to Teensy\n");
-    fprintf(logfile, "%%   \t(Rx) Received from Teensy\n");
-    fprintf(logfile, "%%   \t(Qu N) Put in queue to Teensy, now queue size N\n");
-    fprintf(logfile, "%% 3 \tMessage string queued, send or received\n");
+    logIo = logger.addChannel("log_t" + to_string(tn) + "_teensy_io", "");
+    logger.addHeader(logIo, "%% teensy communication to/from Teensy\n");
+    logger.addHeader(logIo, "%% 1 \tTime (sec) from system\n");
+    logger.addHeader(logIo, "%% 2 \t(Tx) Send to Teensy\n");
+    logger.addHeader(logIo, "%%   \t(Rx) Received from Teensy\n");
+    logger.addHeader(logIo, "%%   \t(Qu N) Put in queue to Teensy, now queue size N\n");
+    logger.addHeader(logIo, "%%   \t(Rxb) Received binary frame from Teensy (shown as text)\n");
+    logger.addHeader(logIo, "%% 3 \tMessage string queued, send or received\n");
+    logger.addHeader(logIo, "%%   \t(## rx stat) syscalls/s, lines/s, mean and max line latency (ms)\n");
   }
   // tell the Teensy its type-name - should be "robobot"
   // as this will change the function of Teensy to not do all the Regbot stuff.
@@ -155,8 +189,24 @@ void STeensy::setup(int teensyNumber)
     // save to Regbot flash
     send("eew\n");
   }
-  // start thread and open teensy connection
-  th1 = new std::thread(runObj, this);
+  // commands from MQTT and other threads
+  cmdQueue.init(64);
+  // wake-up for the receive thread, when messages are queued
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd < 0)
+    perror("# STeensy::setup: eventfd failed (queue is handled at poll timeout only)");
+  if (not replayFile.empty())
+  { // no Teensy, messages are read from a logfile
+    replaying = true;
+    teensyConnectionOpen = true;
+    th1 = new std::thread(runReplayObj, this);
+  }
+  else
+  { // the I/O loop opens the Teensy connection
+    rxCnt = 0;
+    statTime.now();
+    teensyIo.add(this);
+  }
   // allow thread to open connection
   UTime t("now");
   while (not teensyConnectionOpen and t.getTimePassed() < 10.0)
@@ -170,6 +220,9 @@ void STeensy::setup(int teensyNumber)
 
 void STeensy::terminate()
 { // wait for last message to be processed
+  if (binaryMode)
+    // back to text for other users of the Teensy
+    send("bin 0\n", true);
   send("leave\n", true);
   send("disp stopped\n", true);
   // wait until output queue is empty
@@ -178,28 +231,31 @@ void STeensy::terminate()
     usleep(1000);
   stopUSB = true;
   if (th1 != nullptr)
-  {
+  { // replay thread
     th1->join();
-//     printf("# STeensy:: read thread closed\n");
   }
-  // close logfile if open
-  if (logfile != nullptr)
+  else
+  { // the I/O loop closes the connection
+    t.now();
+    while ((teensyConnectionOpen or usbport >= 0) and t.getTimePassed() < 1)
+      usleep(1000);
+  }
+  if (wakeFd >= 0)
   {
-    dataLock.lock();
-    fclose(logfile);
-    logfile = nullptr;
-    dataLock.unlock(); // ensure consistency
+    close(wakeFd);
+    wakeFd = -1;
   }
+  // logfile is closed by the logger
 }
 
 /**
   * send a string to the serial port (Teensy) */
-bool STeensy::send(const char* message, bool direct)
+bool STeensy::send(const char* message, bool direct, UTime * sentAt)
 {
   bool sendOK = false;
   if (direct)
   {
-    sendOK = sendDirect(message);
+    sendOK = sendDirect(message, sentAt);
   }
   else
   { // using queue is default
@@ -211,17 +267,77 @@ bool STeensy::send(const char* message, bool direct)
   return sendOK;
 }
 
-void STeensy::sendToQueue(const char* message)
+void STeensy::sendToQueue(const char* message, bool wake)
 {
   // debug
 //   if (strncmp(message, "sub enc", 7) == 0)
 //     printf("# STeensy 'sub enc' just before queue %s", message);
   // debug end
-  outQueue.push(UOutQueue(message));
+  queueLock.lock();
+  if (confirmWindow > 1)
+  { // confirm is matched by sequence number
+    outQueue.push_back(UOutQueue(message, nextSeq));
+    nextSeq = (nextSeq + 1) % 1000;
+  }
+  else
+    outQueue.push_back(UOutQueue(message));
   dataLock.lock(); // ensure consistency
   toLogQu();
 //   printf("# STeensy::sendToQueue: added '%s' tx-queue, now size %d\n", outQueue.back().msg, (int)outQueue.size());
   dataLock.unlock();
+  queueLock.unlock();
+  if (wake and wakeFd >= 0)
+  { // wake up receive thread to send the message now
+    uint64_t one = 1;
+    int m = write(wakeFd, &one, sizeof(one));
+    (void)m;
+  }
+}
+
+bool STeensy::sendCommand(const char* key, const char* params)
+{
+  if (not initialized or disabled)
+    return false;
+  int nk = strlen(key);
+  int np = strlen(params);
+  // leave space for CRC, sequence number and '\n'
+  if (nk + np + 12 > UOutQueue::MML)
+  {
+    printf("# STeensy::sendCommand: command '%s' too long (%d chars), dropped\n", key, nk + np + 1);
+    cmdDropCnt++;
+    return false;
+  }
+  uint64_t pos;
+  UTeensyCmd * c = cmdQueue.reserve(pos);
+  if (c == nullptr)
+  { // I/O thread is too far behind
+    cmdDropCnt++;
+    return false;
+  }
+  memcpy(c->msg, key, nk);
+  c->msg[nk] = ' ';
+  memcpy(&c->msg[nk + 1], params, np);
+  c->msg[nk + 1 + np] = '\n';
+  c->msg[nk + 2 + np] = '\0';
+  cmdQueue.commit(pos);
+  if (wakeFd >= 0)
+  {
+    uint64_t one = 1;
+    int m = write(wakeFd, &one, sizeof(one));
+    (void)m;
+  }
+  return true;
+}
+
+void STeensy::moveCommands()
+{
+  UTeensyCmd * c = cmdQueue.front();
+  while (c != nullptr)
+  { // already in the I/O thread, so no wake-up
+    sendToQueue(c->msg, false);
+    cmdQueue.pop();
+    c = cmdQueue.front();
+  }
 }
 
 bool STeensy::generateCRC(const char * cmd, char * crc)
@@ -249,7 +365,7 @@ bool STeensy::generateCRC(const char * cmd, char * crc)
   return gotNewline;
 }
 
-bool STeensy::sendDirect(const char* message)
+bool STeensy::sendDirect(const char* message, UTime * sentAt)
 { // this function may be called by more than one thread
   // so make sure that only one send at any one time
   int timeoutMs = 100;
@@ -280,6 +396,10 @@ bool STeensy::sendDirect(const char* message)
       int d = 0;
       int m;
       bool skip = false;
+      UTime txStart("now");
+      if (replaying)
+        // no Teensy, just log
+        d = n;
       while ((d < n) and (t < timeoutMs))
       { // want to send n bytes to usbport within timeout period
         m = write(usbport, &cmd[d], n - d);
@@ -308,18 +428,17 @@ bool STeensy::sendDirect(const char* message)
           d += m;
       }
       sendOK = d == n;
-      dataLock.lock();
-      if (logfile != nullptr and not service.stop_logging)
+      UTime t("now");
+      txHist.add(t - txStart);
+      if (sentAt != nullptr)
+        *sentAt = t;
+      if (logIo >= 0 and not service.stop_logging)
       {
-        UTime t;
-        t.now();
-        fprintf(logfile, "%lu.%04ld Txd %s", t.getSec(), t.getMicrosec()/100, cmd.c_str());
-        if (not gotNewline)
-          fprintf(logfile, "\n");
+        logger.logText(logIo, t, "Txd %s%s", cmd.c_str(), gotNewline ? "" : "\n");
       }
-      dataLock.unlock();
       // include a short break to ensure that Teensy do not get overloaded
-      usleep(500);
+      if (not replaying)
+        usleep(500);
     }
     if (lostConnection)
     {
@@ -348,259 +467,518 @@ void STeensy::closeUSB()
 //     printf("# STeensy::run - no relevant activity, shutting down\n");
 //     printf("# STeensy::run but open=%d, gotAct=%d, lastTime=%f, just=%d, justTime=%g\n",
 //           teensyConnectionOpen, gotActivityRecently, lastRxTime.getTimePassed(), justConnected, justConnectedTime.getTimePassed());
-    // then close the connection (after 100ms)
-    usleep(100000);
-    close(usbport);
-    usbport = -1;
+    // then close the connection (after 100ms, see tick())
+    closeTime.now();
     justConnected = false;
+    connectStep = 0;
     // stop the tx queue and empty any remaining
     confirmSend = false;
-    while (not outQueue.empty())
-      outQueue.pop();
+    queueLock.lock();
+    outQueue.clear();
+    queueLock.unlock();
   }
 }
 
 
 
-/**
-  * receive thread */
-void STeensy::run()
-{ // read thread for REGBOT messages
-  int n = 0;
-  rxCnt = 0;
-  int readIdleLoops = 0;
-  UTime t, terr;
-  t.now();
-  terr.now();
-  const int MTS = 10;
-  UTime tit[MTS];
-  UTime msgTime;
-  float titsum[MTS] = {0};
-  // get robot name
-  tit[9].now();
-  bool ntpUpdate = false;
-  while (not stopUSB)
-  { // handle Teensy connection
-    if ((not ntpUpdate) and
-        (
-          (teensyConnectionOpen and
-            not gotActivityRecently and
-            lastRxTime.getTimePassed() > 10
-          )
-          or
-          ( justConnected and
-            justConnectedTime.getTimePassed() > 20.0
-          )
-        ))
-    { // connection timeout or failed to get connection name within 10 seconds, probably a wrong device
-      // - shut down connection and try another
-      tit[0].now();
-      // close for now
-      printf("# UTeensy:: close for now\n");
+void STeensy::tick()
+{ // called by the I/O loop after every poll
+  // the poll is shared by all Teensy boards
+  statSyscallCnt++;
+  if (usbport >= 0 and not teensyConnectionOpen and closeTime.getTimePassed() > 0.1)
+  { // closed by closeUSB() - now close the port
+    sendLock.lock();
+    close(usbport);
+    usbport = -1;
+    sendLock.unlock();
+  }
+  if (stopUSB)
+  { // terminating
+    if (teensyConnectionOpen)
       closeUSB();
-      // try another device
-//       usbdeviceNum = (usbdeviceNum + 1) % MAX_USB_DEVS;
-      titsum[0] += tit[0].getTimePassed();
-    }
-    else if (not teensyConnectionOpen)
-    { // wait a second (or 2) then try to open the Teensy device
-      tit[1].now();
-//       sleep(1);
-      if (connectErrCnt > 10)
-      {
+    return;
+  }
+  // time is monotonic (see utime.h), so no special handling of NTP updates
+  if ((teensyConnectionOpen and
+        not gotActivityRecently and
+        lastRxTime.getTimePassed() > 10
+      )
+      or
+      ( justConnected and
+        justConnectedTime.getTimePassed() > 20.0
+      ))
+  { // connection timeout or failed to get connection name within 10 seconds, probably a wrong device
+    // - shut down connection and try another
+    printf("# UTeensy:: close for now\n");
+    closeUSB();
+  }
+  else if (not teensyConnectionOpen)
+  { // try to open the Teensy device
+    if (usbport >= 0)
+    { // wait for the port to close
+    }
+    else if (openFailTime.getTimePassed() < 0.3)
+    { // wait a bit before re-connection
+    }
+    else if (connectErrCnt > 10)
+    {
+      if (not service.stopNowRequest)
         printf("# open to %s failed, but enabled in robot.ini - terminating\n", usbDevName.c_str());
-        service.stopNowRequest = true;
-        break;
-      }
-      else if (connectErrCnt == 0)
+      service.stopNowRequest = true;
+    }
+    else
+    {
+      if (connectErrCnt == 0)
         printf("# STeensy:: opening to USB %s\n", usbDevName.c_str());
-      // then try to connect
       openToTeensy();
-      titsum[1] += tit[1].getTimePassed();
     }
-    else
-    { // we are connected
-      //
-      if (justConnected)
-      { // no name is received yet, so try again
-        tit[2].now();
-        // justconnected flag is cleared when receiving a 'dname' message from Teensy
-        send("hbti\n", true); // this may be lost - but no problem
-        send("leave\n", true); // stop any old subscriptions
-        justConnected = false;
-        t.now();
-        titsum[2] += tit[2].getTimePassed();
-        //
-        printf("# STeensy:: just connected \n");
-      }
-      if (gotActivityRecently and lastRxTime.getTimePassed() > 2)
-      { // are loosing data - may be just temporarily
-        gotActivityRecently = false;
-      }
-      // read from USB
-      tit[3].now();
-      //
-      n = read(usbport, &rx[rxCnt], 1);
-      if (n < 0 and errno == EAGAIN)
-      { // no data
-        n = 0;
-      }
-      else if (n < 0)
-      { // other error - close connection
-        perror("Teensy::run port error");
-        usleep(100000);
-        sendLock.lock();
-        // don't close while sending
-        printf("# STeensy:: don't close while sending\n");
-        closeUSB();
-        sendLock.unlock();
-      }
-      titsum[3] += tit[3].getTimePassed();
-      //
-      // got a character - assemble to a text line
-      if (n == 1)
-      { // got a new character
-        tit[4].now(); // timing
-        //
-        if (rxCnt > 0 /*and rx[rxCnt] != '\r'*/)
-        {
-          rxCnt++;
-        }
-        else if (rx[0] == ';')
-        { // first character in a new message
-          msgTime.now();
-          rxCnt = 1;
-        }
-        // check for end of message, i.e. a new-line
-        if (rx[rxCnt-1] == '\n')
-        { // terminate string - end of new line
-          rx[rxCnt] = '\0';
-          // save to logfile if open
-          dataLock.lock();
-          toLogRx(rx, msgTime);
-          dataLock.unlock();
-          // handle this message line
-          if (crcCheck(rx))
-          { // got (at least) one valid message
-            const char * okMsg = &rx[3];
-            // check if this is a confirm message
-            if (strncmp(okMsg, "confirm", 7) == 0)
-            { // release next message
-              confirmSend = true;
-              // printf("# STeensy::run: received a confirm: '%s'\n", rx);
-              messageConfirmed(rx);
-            }
-            else
-            {
-              decode(okMsg, msgTime);
-            }
-          }
-          else
-            printf("# Teenst message discarded (crc-error) %s\n", rx);
-          // set activity timeer
-          gotActivityRecently = true;
-          lastRxTime.now();
-          // reset receive buffer
-          rxCnt = 0;
-          n = 0;
-          gotCnt++;
-        }
-        titsum[4] += tit[4].getTimePassed();
-      }
-      else if (n == 0)
-      {  // no data, so wait a bit
-        tit[5].now();
-        //
-        usleep(1000);
-        readIdleLoops++;
-        titsum[5] += tit[5].getTimePassed();
-      }
-      else
-      { // debug n!= 0 and n!= 1
-        tit[6].now();
-        printf("# Teensy::run: got n=%d chars, when asking for 1!\n", n);
-        fflush(nullptr);
-        titsum[6] += tit[6].getTimePassed();
-      }
-      if (not outQueue.empty())
-      { // got the first confirm
-//         printf("#STeensy:: que not empty\n");
-        tit[7].now();
-        if (not outQueue.front().isSend)
-        { // new message to send
-          sendLock.lock();
-          if (teensyConnectionOpen)
-          { // send queued message to Teensy
-            write(usbport, outQueue.front().msg, outQueue.front().len);
-            outQueue.front().sendAt.now();
-            outQueue.front().isSend = true;
-            outQueue.front().resendCnt++;
-            toLogTx();
-          }
-          sendLock.unlock();
-        }
-        else
-        { // waiting for confirmation - check for too old
-//           printf("# STeensy:: is send - waiting for confirm\n");
-          float dt = outQueue.front().sendAt.getTimePassed();
-          if (dt > confirmTimeout)
-          {
-            // debug
-            const int MSL = 150;
-            char s[MSL];
-            snprintf(s, MSL, "# STeensy[%d]::run: msg retry after %.5f sec (retry=%d, queue=%d):%s", tn,
-                    outQueue.front().sendAt.getTimePassed(),
-                    outQueue.front().resendCnt,
-                    (int)outQueue.size(),
-                    outQueue.front().msg);
-            toLog(s);
-//             printf("%s\n", s);
-            // debug end
-            if (outQueue.front().resendCnt < confirmRetryCntMax)
-            { // just try again
-              outQueue.front().isSend = false;
-              confirmRetryCnt++;
-            }
-            else
-            { // remove from queue
-              outQueue.pop();
-              confirmRetryDump++;
-            }
-          }
-        }
-        titsum[7] += tit[7].getTimePassed();
-      }
-    } // connected
-    ntpUpdate = false;
-    if (fabsf(tit[9].getTimePassed()) > 2.0)
-    { // likely NTP update received
-      titsum[9]+= tit[9].getTimePassed();
-      // don't close connection based on a NPT update
-      ntpUpdate = true;
-      printf("# STeensy[%d]:: time glitch of %.3f sec, %g secs after app start, maybe an NTP update\n", tn, tit[9].getTimePassed(), service.app_time);
-      fflush(nullptr);
-      if (logfile != nullptr and not service.stop_logging)
-      {
-        UTime t;
-        t.now();
-        fprintf(logfile, "%lu.%04ld NTP time glitch of %.3f sec, maybe an NTP update\n", t.getSec(), t.getMicrosec()/100, tit[9].getTimePassed());
-      }
-      if (teensyConnectionOpen)
-      { //teensy time updated, so to avoid connection close
-        lastRxTime.now();
-      }
+  }
+  else
+  { // we are connected
+    if (connectStep > 0)
+    { // initial messages after open, the queue waits for these
+      openSteps();
+      updateRxStat();
+      return;
+    }
+    if (justConnected)
+    { // no name is received yet, so try again
+      // justconnected flag is cleared when receiving a 'dname' message from Teensy
+      send("hbti\n", true); // this may be lost - but no problem
+      send("leave\n", true); // stop any old subscriptions
+      if (binaryMode)
+        // telemetry as binary frames
+        send("bin 1\n");
+      justConnected = false;
+      printf("# STeensy:: just connected \n");
     }
+    if (gotActivityRecently and lastRxTime.getTimePassed() > 2)
+    { // are loosing data - may be just temporarily
+      gotActivityRecently = false;
+    }
+    // send from queue and check for missing confirm
+    serviceQueue();
     if (lastSent.getTimePassed() > 0.9)
     { // make sure the Teensy don't get too bored\n"
       send("alive\n", true);
     }
-    tit[9].now();
   }
-  // printf("# STeensy:: run ended\n");
-  if (teensyConnectionOpen)
+  updateRxStat();
+}
+
+void STeensy::portEvent(short revents)
+{
+  bool portOK = true;
+  if (revents & (POLLERR | POLLHUP | POLLNVAL))
+  { // device is gone
+    printf("# STeensy[%d]::portEvent: port error (poll events=0x%x)\n", tn, revents);
+    portOK = false;
+  }
+  else if (revents & POLLIN)
+  { // read all there is and handle complete lines
+    portOK = receiveData();
+  }
+  if (not portOK)
+  { // close connection (the port is closed by tick() after 100ms)
+    sendLock.lock();
+    // don't close while sending
+    printf("# STeensy:: don't close while sending\n");
     closeUSB();
-}  
+    sendLock.unlock();
+  }
+}
+
+void STeensy::wakeEvent()
+{ // clear wake-up event - queue is handled in tick()
+  uint64_t v;
+  int m = read(wakeFd, &v, sizeof(v));
+  (void)m;
+  statSyscallCnt++;
+}
+
+void STeensy::runReplay()
+{ // replay thread
+  FILE * f = fopen(replayFile.c_str(), "r");
+  if (f == nullptr)
+  {
+    printf("# STeensy[%d]::runReplay: failed to open %s - terminating\n", tn, replayFile.c_str());
+    service.stopNowRequest = true;
+    return;
+  }
+  // wait for all modules to add their message keys
+  while (not service.setupComplete and not stopUSB)
+  {
+    serviceQueue();
+    usleep(1000);
+  }
+  printf("# STeensy[%d]:: replay of %s at speed %g (0 is max)\n", tn, replayFile.c_str(), replaySpeed);
+  const int MSL = MAX_RX_CNT + 100;
+  char s[MSL];
+  double recStart = -1;
+  double recEnd = 0;
+  int lineCnt = 0;
+  int64_t byteCnt = 0;
+  UTime start("now");
+  while (not stopUSB and fgets(s, MSL, f) != nullptr)
+  { // lines like "1740925231.2345 Rx ;45enc 1234 5678\r\n"
+    char * p1;
+    double tr = strtod(s, &p1);
+    if (p1 == s or *p1 != ' ')
+      // header or bad line
+      continue;
+    p1++;
+    bool isBin = strncmp(p1, "Rxb ", 4) == 0;
+    if (not isBin and strncmp(p1, "Rx ", 3) != 0)
+      // not received from Teensy
+      continue;
+    if (recStart < 0)
+    {
+      recStart = tr;
+      start.now();
+    }
+    recEnd = tr;
+    if (replaySpeed > 0)
+    { // wait until it is time for this line, but keep the queue going
+      float dt;
+      while ((dt = (tr - recStart) / replaySpeed - start.getTimePassed()) > 0 and not stopUSB)
+      {
+        usleep(int(fminf(dt, 0.01) * 1e6));
+        serviceQueue();
+      }
+    }
+    UTime msgTime("now");
+    if (isBin)
+    { // binary frame, logged as text (without CRC)
+      decode(&p1[4], msgTime);
+      rxHandled(msgTime);
+    }
+    else
+      handleLine(&p1[3], msgTime);
+    lineCnt++;
+    byteCnt += strlen(p1);
+    serviceQueue();
+  }
+  fclose(f);
+  float dt = start.getTimePassed();
+  printf("# STeensy[%d]:: replay finished: %d lines (%.1f kB) in %.3f sec (recorded %.3f sec)\n",
+         tn, lineCnt, byteCnt / 1000.0, dt, recEnd - recStart);
+  if (dt > 0)
+    printf("# STeensy[%d]:: replay throughput %.0f lines/s, %.1f kB/s\n",
+           tn, lineCnt / dt, byteCnt / 1000.0 / dt);
+  // finished
+  service.stopNowRequest = true;
+  while (not stopUSB)
+  { // messages queued while terminating
+    serviceQueue();
+    usleep(1000);
+  }
+}
+
+bool STeensy::receiveData()
+{ // read all available characters, and split into lines in place
+  // a partial line is moved to the start of the buffer
+  bool hadPartialLine = rxCnt > 0;
+  int n = read(usbport, &rx[rxCnt], MAX_RX_CNT - 1 - rxCnt);
+  statSyscallCnt++;
+  if (n < 0)
+  { // EAGAIN is no data (should not happen after poll)
+    if (errno == EAGAIN or errno == EINTR)
+      return true;
+    perror("Teensy::run port error");
+    return false;
+  }
+  UTime readTime("now");
+  rxCnt += n;
+  rx[rxCnt] = '\0';
+  int lineStart = 0;
+  while (lineStart < rxCnt)
+  {
+    if (rx[lineStart] != ';' and rx[lineStart] != '\0')
+    { // skip anything before the CRC (first character in a message)
+      // or the 0x00 in front of a binary frame
+      while (lineStart < rxCnt and rx[lineStart] != ';' and rx[lineStart] != '\0')
+        lineStart++;
+      if (lineStart >= rxCnt)
+        // no message start - discard
+        break;
+    }
+    // a message continued from the last read has the time of its first part
+    UTime & msgTime = (lineStart == 0 and hadPartialLine) ? rxLineTime : readTime;
+    if (rx[lineStart] == '\0')
+    { // binary frame, ends at next 0x00
+      char * p2 = (char *)memchr(&rx[lineStart + 1], '\0', rxCnt - lineStart - 1);
+      if (p2 == nullptr)
+        // not a full frame yet
+        break;
+      int n = p2 - &rx[lineStart + 1];
+      if (n > 0)
+      { // skip both delimiters
+        handleFrame((uint8_t *)&rx[lineStart + 1], n, msgTime);
+        lineStart = p2 - rx + 1;
+      }
+      else
+        // two 0x00 - the second may be the start of a frame
+        lineStart++;
+      continue;
+    }
+    char * p2 = (char *)memchr(&rx[lineStart], '\n', rxCnt - lineStart);
+    if (p2 == nullptr)
+      // not a full line yet
+      break;
+    // terminate line temporarily after the new-line
+    int lineEnd = p2 - rx + 1;
+    char c = rx[lineEnd];
+    rx[lineEnd] = '\0';
+    handleLine(&rx[lineStart], msgTime);
+    rx[lineEnd] = c;
+    lineStart = lineEnd;
+  }
+  // keep the remaining partial line, if any
+  if (lineStart >= rxCnt)
+    rxCnt = 0;
+  else if (lineStart > 0 or not hadPartialLine)
+  { // new partial line, started in this read
+    rxCnt -= lineStart;
+    memmove(rx, &rx[lineStart], rxCnt);
+    rxLineTime = readTime;
+  }
+  if (rxCnt >= MAX_RX_CNT - 1)
+  { // line too long - discard
+    rx[MAX_RX_CNT - 1] = '\0';
+    printf("# STeensy[%d]::receiveData: no new-line in %d characters, discarded: %s\n", tn, rxCnt, rx);
+    rxCnt = 0;
+  }
+  return true;
+}
+
+void STeensy::handleLine(const char * line, UTime & msgTime)
+{
+  // save to logfile if open
+  dataLock.lock();
+  toLogRx(line, msgTime);
+  dataLock.unlock();
+  // handle this message line
+  if (crcCheck(line))
+  { // got (at least) one valid message
+    const char * okMsg = &line[3];
+    // check if this is a confirm message
+    if (strncmp(okMsg, "confirm", 7) == 0)
+    { // release next message
+      confirmSend = true;
+      // printf("# STeensy::run: received a confirm: '%s'\n", line);
+      messageConfirmed(line);
+    }
+    else
+    {
+      decode(okMsg, msgTime);
+    }
+  }
+  else
+    printf("# Teenst message discarded (crc-error) %s\n", line);
+  rxHandled(msgTime);
+}
+
+void STeensy::handleFrame(const uint8_t * data, int n, UTime & msgTime)
+{
+  uint8_t buf[UBIN_MAX_FRAME];
+  int m = ubinCobsDecode(data, n, buf, UBIN_MAX_FRAME);
+  bool isOK = m >= 3;
+  if (isOK)
+  { // type, payload and CRC
+    uint16_t crc = buf[m - 2] | (buf[m - 1] << 8);
+    isOK = ubinCrc16(buf, m - 2) == crc and ubinPayloadSize(buf[0]) == m - 3;
+  }
+  if (not isOK)
+  {
+    binErrCnt++;
+    if (binErrCnt < 20)
+      printf("# STeensy[%d]::handleFrame: binary frame discarded (%d bytes, COBS, CRC or size error)\n", tn, n);
+    rxHandled(msgTime);
+    return;
+  }
+  int type = buf[0];
+  const uint8_t * payload = &buf[1];
+  // as text for logfile and MQTT
+  const int MSL = 200;
+  char s[MSL];
+  formatBinary(type, payload, s, MSL);
+  dataLock.lock();
+  if (logIo >= 0 and not service.stop_logging and not service.stop)
+    logger.logText(logIo, msgTime, "Rxb %s %s", ubinKeyName(type), s);
+  if (toConsole)
+    printf("%lu.%04ld Rxb %s %s", msgTime.getSec(), msgTime.getMicrosec()/100, ubinKeyName(type), s);
+  dataLock.unlock();
+  UMsgKey * k = binKey[type].load(std::memory_order_acquire);
+  if (k == nullptr)
+  { // not registered, make an entry to cache the topic
+    const char * key = ubinKeyName(type);
+    k = addKeyEntry(key, strlen(key));
+    if (k != nullptr)
+      binKey[type].store(k, std::memory_order_release);
+  }
+  if (k != nullptr)
+  {
+    UBinHandler * h = k->binHandler.load(std::memory_order_acquire);
+    if (h != nullptr)
+      (*h)(payload, msgTime);
+    mqtt.publish(k->topic.c_str(), s, msgTime);
+  }
+  rxHandled(msgTime);
+}
 
+bool STeensy::formatBinary(int type, const void * data, char * s, int MSL)
+{ // same format as the text messages from Teensy
+  bool isOK = true;
+  switch (type)
+  {
+    case UBIN_ENC:
+    {
+      const UBinEnc * m = (const UBinEnc *)data;
+      snprintf(s, MSL, "%u %u\r\n", m->enc[0], m->enc[1]);
+      break;
+    }
+    case UBIN_POSE:
+    {
+      const UBinPose * m = (const UBinPose *)data;
+      snprintf(s, MSL, "%.4f %.3f %.3f %.4f %.4f\n", m->time, m->pose[0], m->pose[1], m->pose[2], m->pose[3]);
+      break;
+    }
+    case UBIN_VEL:
+    {
+      const UBinVel * m = (const UBinVel *)data;
+      snprintf(s, MSL, "%.4f %.3f %.3f %.4f %.3f %d\n", m->time, m->wheelVel[0], m->wheelVel[1],
+               m->turnrate, m->velocity, m->cnt);
+      break;
+    }
+    case UBIN_GYRO:
+    case UBIN_ACC:
+    {
+      const UBinImu * m = (const UBinImu *)data;
+      snprintf(s, MSL, "%f %f %f %.3f\r\n", m->v[0], m->v[1], m->v[2], m->time);
+      break;
+    }
+    case UBIN_LIV:
+    case UBIN_LIVN:
+    {
+      const UBinLiv * m = (const UBinLiv *)data;
+      snprintf(s, MSL, "%d %d %d %d %d %d %d %d %d\r\n", m->v[0], m->v[1], m->v[2], m->v[3],
+               m->v[4], m->v[5], m->v[6], m->v[7], m->cnt);
+      break;
+    }
+    case UBIN_HBT:
+    {
+      const UBinHbt * m = (const UBinHbt *)data;
+      snprintf(s, MSL, "%.4f %d %d %.2f %d %d %.1f %.2f %d\r\n", m->time, m->deviceID, m->revision,
+               m->batteryVoltage, m->state, m->hwType, m->load, m->supplyCurrent, m->batLowCnt);
+      break;
+    }
+    case UBIN_IR:
+    {
+      const UBinIr * m = (const UBinIr *)data;
+      snprintf(s, MSL, "%.3f %.3f %u %u %u %u %u %u %d \r\n", m->distance[0], m->distance[1],
+               m->raw[0], m->raw[1], m->cal13cm[0], m->cal50cm[0], m->cal13cm[1], m->cal50cm[1], m->used);
+      break;
+    }
+    case UBIN_IRD:
+    {
+      const UBinIrd * m = (const UBinIrd *)data;
+      snprintf(s, MSL, "%.3f %.3f %u %u %d\r\n", m->distance[0], m->distance[1], m->raw[0], m->raw[1], m->used);
+      break;
+    }
+    case UBIN_MCA:
+    {
+      const UBinMca * m = (const UBinMca *)data;
+      snprintf(s, MSL, "%.3f %.3f %d\r\n", m->current[0], m->current[1], m->cnt);
+      break;
+    }
+    default:
+      s[0] = '\0';
+      isOK = false;
+      break;
+  }
+  return isOK;
+}
+
+void STeensy::rxHandled(UTime & msgTime)
+{
+  // set activity timeer
+  gotActivityRecently = true;
+  lastRxTime.now();
+  gotCnt++;
+  // latency from read to handled
+  float dt = msgTime.getTimePassed();
+  statLineCnt++;
+  rxHist.add(dt);
+  statLatencySum += dt;
+  if (dt > statLatencyMax)
+    statLatencyMax = dt;
+}
+
+int STeensy::getPollTimeout()
+{ // max wait is also the rate for connection checks
+  float dt = 0.1;
+  queueLock.lock();
+  int n = 0;
+  for (auto it = outQueue.begin(); it != outQueue.end() and n < confirmWindow; it++, n++)
+  {
+    if (it->isSend)
+      // time until confirm timeout
+      dt = fminf(dt, confirmTimeout - it->sendAt.getTimePassed());
+    else
+    { // ready to send
+      dt = 0;
+      break;
+    }
+  }
+  queueLock.unlock();
+  // time until keep-alive is due
+  dt = fminf(dt, 0.9 - lastSent.getTimePassed());
+  if (connectStep > 0)
+    // next step after open
+    dt = fminf(dt, 0.005);
+  if (dt <= 0)
+    return 0;
+  return int(dt * 1000) + 1;
+}
+
+void STeensy::updateRxStat()
+{
+  float dt = statTime.getTimePassed();
+  if (dt < statInterval or statInterval <= 0)
+    return;
+  rxSyscallRate = statSyscallCnt / dt;
+  rxLineRate = statLineCnt / dt;
+  if (statLineCnt > 0)
+    rxLatencyMean = statLatencySum / statLineCnt * 1000;
+  else
+    rxLatencyMean = 0;
+  rxLatencyMax = statLatencyMax * 1000;
+  const int MSL = 200;
+  char s[MSL];
+  snprintf(s, MSL, "rx stat %.1f syscalls/s, %.1f lines/s, latency mean %.3f ms, max %.3f ms\n",
+           rxSyscallRate, rxLineRate, rxLatencyMean, rxLatencyMax);
+  dataLock.lock();
+  toLog(s);
+  dataLock.unlock();
+  statSyscallCnt = 0;
+  statLineCnt = 0;
+  statLatencySum = 0;
+  statLatencyMax = 0;
+  statTime.now();
+}
+
+void STeensy::printRxStat()
+{
+  if (disabled)
+    printf("# Teensy[%d] is disabled\n", tn);
+  else if (statInterval <= 0)
+    printf("# Teensy[%d] rx statistics disabled (stat_interval=0 in robot.ini)\n", tn);
+  else
+    printf("# Teensy[%d] rx (last %.0f s): %.1f syscalls/s, %.1f lines/s, latency mean %.3f ms, max %.3f ms\n",
+           tn, statInterval, rxSyscallRate, rxLineRate, rxLatencyMean, rxLatencyMax);
+  if (cmdDropCnt > 0)
+    printf("# Teensy[%d] dropped %d commands (too long or queue full)\n", tn, cmdDropCnt.load());
+}
 
 
 bool STeensy::crcCheck(const char* msg)
@@ -631,37 +1009,162 @@ bool STeensy::crcCheck(const char* msg)
 
 
 void STeensy::messageConfirmed(const char* confirm)
-{ // got a confirm message
+{ // got a confirm message, like ';NNconfirm !17:' or ';NNconfirm !sub enc 10'
+  // remove the confirmed message from tx queue
+  const char * p1 = &confirm[11];
+  std::lock_guard<std::mutex> lock(queueLock);
+  if (p1[0] == '!' and isdigit(p1[1]))
+  { // may be a sequence number
+    char * p2;
+    int seq = strtol(&p1[1], &p2, 10);
+    if (*p2 == ':')
+    { // find message with this sequence number
+      for (auto it = outQueue.begin(); it != outQueue.end(); it++)
+      {
+        if (it->seq == seq and it->isSend)
+        {
+          if (it->resendCnt == 1)
+            addRtt(it->sendAt.getTimePassed());
+          outQueue.erase(it);
+          break;
+        }
+      }
+      // if not found, then it is a second confirm of a resend message
+      return;
+    }
+  }
   // test for first message in tx queue
   // remove if a match - else ignore
   if (not outQueue.empty())
   {
     if (outQueue.front().isSend)
     { // this message is send, but is it equal
-      bool eq = outQueue.front().compare(&confirm[11]);
+      bool eq = outQueue.front().compare(p1);
       if (eq)
       {
-//         if (outQueue.front().resendCnt > 1)
-//         {
-//           printf("# STeensy::run: Confirm OK after %d retry and %.4fs: send'%s'",
-//                   outQueue.front().resendCnt,
-//                   outQueue.front().queuedAt.getTimePassed(),
-//                   outQueue.front().msg);
-//         }
-        outQueue.pop();
+        if (outQueue.front().resendCnt == 1)
+          addRtt(outQueue.front().sendAt.getTimePassed());
+        outQueue.pop_front();
       }
       else
       { // no match
-        printf("# Teensy[%d]::message queue compare err: '%s' != '%s'\n", tn, &confirm[11], outQueue.front().msg);
+        printf("# Teensy[%d]::message queue compare err: '%s' != '%s'\n", tn, p1, outQueue.front().msg);
         confirmMismatchCnt++;
       }
     }
   }
 }
 
+void STeensy::addRtt(float rtt)
+{ // round trip time of a message that was sent once only
+  rttHist.add(rtt);
+  if (rtt < rttMin)
+    rttMin = rtt;
+}
+
+void STeensy::clockSample(double teensyTime, UTime & msgTime)
+{
+  // monotonic time, so that a wall clock step is not seen as a Teensy delay
+  int64_t d = msgTime.getNs() - int64_t(teensyTime * 1e9);
+  if (d < clockMinNow)
+    clockMinNow = d;
+  if (clockWindowStart.getTimePassed() > 2.0)
+  { // new window, so that a Teensy reboot or a clock drift is followed
+    clockMinLast = clockMinNow;
+    clockMinNow = d;
+    clockWindowStart = msgTime;
+  }
+  // the minimum delay is assumed to be half the round trip time
+  int64_t rttNs = 0;
+  if (rttHist.count() > 0)
+    rttNs = int64_t(rttMin * 1e9);
+  clockOffsetNs = std::min(clockMinNow, clockMinLast) - rttNs / 2;
+  clockOffsetValid = true;
+  sampleHist.add((d - clockOffsetNs) * 1e-9);
+}
+
+UTime STeensy::teensyToHost(double teensyTime)
+{
+  UTime t;
+  if (clockOffsetValid)
+  {
+    t.setNs(int64_t(teensyTime * 1e9) + clockOffsetNs);
+  }
+  else
+    t.now();
+  return t;
+}
+
+void STeensy::serviceQueue()
+{ // send new messages, and resend messages with no confirm
+  moveCommands();
+  // lock order is sendLock then queueLock (as in closeUSB())
+  std::lock_guard<std::mutex> slock(sendLock);
+  std::lock_guard<std::mutex> lock(queueLock);
+  int n = 0;
+  auto it = outQueue.begin();
+  while (it != outQueue.end() and n < confirmWindow)
+  {
+    if (not it->isSend)
+    { // new message (or a resend) to send
+      if (replaying)
+      { // no Teensy to confirm, so log and remove
+        it->sendAt.now();
+        dataLock.lock();
+        toLogTx(*it);
+        dataLock.unlock();
+        it = outQueue.erase(it);
+        continue;
+      }
+      else if (teensyConnectionOpen)
+      { // send queued message to Teensy
+        int m = write(usbport, it->msg, it->len);
+        (void)m;
+        it->sendAt.now();
+        it->isSend = true;
+        it->resendCnt++;
+        dataLock.lock();
+        toLogTx(*it);
+        dataLock.unlock();
+      }
+    }
+    else if (it->sendAt.getTimePassed() > confirmTimeout)
+    { // waiting for confirmation - too old
+      // debug
+      const int MSL = 150;
+      char s[MSL];
+      snprintf(s, MSL, "# STeensy[%d]::run: msg retry after %.5f sec (retry=%d, queue=%d):%s", tn,
+              it->sendAt.getTimePassed(),
+              it->resendCnt,
+              (int)outQueue.size(),
+              it->msg);
+      dataLock.lock();
+      toLog(s);
+      dataLock.unlock();
+      // debug end
+      if (it->resendCnt < confirmRetryCntMax)
+      { // just try again (this message only)
+        it->isSend = false;
+        confirmRetryCnt++;
+        continue;
+      }
+      else
+      { // remove from queue
+        it = outQueue.erase(it);
+        confirmRetryDump++;
+        continue;
+      }
+    }
+    it++;
+    n++;
+  }
+}
+
 
 /**
   * Open the connection.
+  * Makes one try only (does not block the I/O loop),
+  * tick() calls again after a pause.
   * \returns true if successful */
 bool STeensy::openToTeensy()
 {
@@ -675,14 +1178,10 @@ bool STeensy::openToTeensy()
 //     printf("# Teensy::openToTeensy '%s' - opening\n", usbDevName);
     // make reservation
     usbport = -1;
-    while (usbport < 0 and alternativeDevice < 4)
-    {
+    if (alternativeDevice < 4)
+    { // one try, tick() calls again after 0.3 sec, if it failed
       usbport = open(usbDevName.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
-      if (usbport >= 0)
-      {  // all is fine
-        break;
-      }
-      else
+      if (usbport < 0)
       { // open failed
         int e = errno;
         if (connectErrCnt < 5)
@@ -711,8 +1210,10 @@ bool STeensy::openToTeensy()
           usbDevName = ini[ini_section]["device"];
         alternativeDevice++;
         // wait a bit before re-connection
-        usleep(300000);
+        openFailTime.now();
         connectErrCnt++;
+        if (alternativeDevice < 4)
+          return false;
       }
     }
     if (usbport >= 0)
@@ -742,9 +1243,12 @@ bool STeensy::openToTeensy()
         printf("# It seems like Teensy is reconnected (now %s) - reinit connection\n", usbDevName.c_str());
         toLog("# It seems like Teensy is reconnected - reinit connection\n");
         // delete send queue
-        while (not outQueue.empty())
-          outQueue.pop();
-        service.setupTeensyConnection();
+        queueLock.lock();
+        outQueue.clear();
+        queueLock.unlock();
+        // module setup waits for the queue, that is handled by this thread,
+        // so setup is done by the service thread (see UService::run())
+        reconnectSetup = true;
         alternativeDevice = 0;
       }
 //       printf("# STeensy::run - just connected to '%s'\n", usbDevName);
@@ -752,9 +1256,9 @@ bool STeensy::openToTeensy()
       toLog("Connection to USB open\n");
       justConnectedTime.now();
       teensy[tn].send("hbti\n", true);
-      usleep(5000);
-      teensy[tn].send("sub hbt 50\n", true);
-      usleep(50000);
+      // 'sub hbt' and a pause follows (see openSteps())
+      connectStep = 1;
+      connectStepTime.now();
       //         initMessageTypes();
       // assume there is activity - in order not to
       // get an error right away
@@ -765,6 +1269,19 @@ bool STeensy::openToTeensy()
   return teensyConnectionOpen;
 }
 
+void STeensy::openSteps()
+{ // called by tick() until connectStep is 0
+  if (connectStep == 1 and connectStepTime.getTimePassed() > 0.005)
+  { // hbti is send
+    teensy[tn].send("sub hbt 50\n", true);
+    connectStep = 2;
+    connectStepTime.now();
+  }
+  else if (connectStep == 2 and connectStepTime.getTimePassed() > 0.05)
+  { // allow the Teensy to get started
+    connectStep = 0;
+  }
+}
 
 bool STeensy::decode(const char * msg, UTime & msgTime)
 {
@@ -778,58 +1295,141 @@ bool STeensy::decode(const char * msg, UTime & msgTime)
   }
   // debug end
   bool used = true;
-  const char * p1 = msg;
-
-  if (service.decode(msg, msgTime, tn))
-  { // nothing to do here
-  }
-  else if (strncmp(p1, "dname ", 6) == 0)
-  { // got the robot name from Teensy
-    p1 += 6;
-    p1 = strchr(p1, ' ');
-    if (p1 != nullptr and *p1 == ' ')
-    {
-      ini[ini_section]["name"] = ++p1;
-    }
-  }
   if (msg[0] == '#')
   { // service message - just ignored
 //     printf("# UTeensy:: service message from Teensy: %s", msg);
     mqtt.publish(topicHelp.c_str(), msg, msgTime);
   }
-  else if (msg[0] == '%')
+  else if (msg[0] == '%' or isdigit(msg[0]))
   { // service message - just ignored
     //     printf("# UTeensy:: service message from Teensy: %s", msg);
-    mqtt.publish((topicBase + "log").c_str(), msg, msgTime);
-  }
-  else if (isdigit(msg[0]))
-  { // service message - just ignored
-    //     printf("# UTeensy:: service message from Teensy: %s", msg);
-    mqtt.publish((topicBase + "log").c_str(), msg, msgTime);
+    mqtt.publish(topicLog.c_str(), msg, msgTime);
   }
   else
-  { // use message key as sub-topic
+  { // use message key to find handler and MQTT sub-topic
     const char * p1 = msg;
     while (*p1 > ' ')
       p1++;
+    int n = p1 - msg;
     if (*p1 == ' ')
-    {
-      const int MTL = 32;
-      char s[MTL];
-      int n = p1 - msg;
-      if (n > 31)
-        n = 31;
-      strncpy(s, msg, n);
-      s[n] = '\0';
+    { // there is a space after the key, so parameters follow
       p1++;
-      mqtt.publish((topicBase + s).c_str(), p1, msgTime);
+      UMsgKey * k = findKey(msg, n);
+      if (k == nullptr)
+        // not seen before, make an entry to cache the topic
+        k = addKeyEntry(msg, n);
+      if (k != nullptr)
+      {
+        UMsgHandler * h = k->handler.load(std::memory_order_acquire);
+        if (h != nullptr)
+          (*h)(p1, msgTime);
+        mqtt.publish(k->topic.c_str(), p1, msgTime);
+      }
+      else
+      { // key table full (or key too long)
+        const int MTL = 32;
+        char s[MTL];
+        if (n > MTL - 1)
+          n = MTL - 1;
+        strncpy(s, msg, n);
+        s[n] = '\0';
+        mqtt.publish((topicBase + s).c_str(), p1, msgTime);
+      }
     }
     else
+    {
       printf(" STeensy[%d]:: unused Teensy message (maybe Teensy is in interactive mode?): %s", tn, msg);
+      used = false;
+    }
   }
   return used;
 }
 
+void STeensy::decodeDname(const char * params)
+{ // got the robot name from Teensy
+  const char * p1 = strchr(params, ' ');
+  if (p1 != nullptr)
+  {
+    ini[ini_section]["name"] = ++p1;
+  }
+}
+
+bool STeensy::addKey(const char* key, UMsgHandler handler)
+{
+  UMsgKey * k = addKeyEntry(key, strlen(key));
+  if (k == nullptr)
+  {
+    printf("# STeensy[%d]::addKey: failed to add key '%s' (too long or table full)\n", tn, key);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(keyLock);
+  if (k->handler.load() == nullptr)
+  { // the handler is never deleted, as the receive thread may use it
+    k->handler.store(new UMsgHandler(handler), std::memory_order_release);
+  }
+  return true;
+}
+
+bool STeensy::addBinKey(int type, UBinHandler handler)
+{
+  const char * key = ubinKeyName(type);
+  UMsgKey * k = nullptr;
+  if (key != nullptr)
+    k = addKeyEntry(key, strlen(key));
+  if (k == nullptr)
+  {
+    printf("# STeensy[%d]::addBinKey: failed to add binary type %d\n", tn, type);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(keyLock);
+  if (k->binHandler.load() == nullptr)
+  { // the handler is never deleted, as the receive thread may use it
+    k->binHandler.store(new UBinHandler(handler), std::memory_order_release);
+  }
+  binKey[type].store(k, std::memory_order_release);
+  return true;
+}
+
+UMsgKey * STeensy::findKey(const char* key, int n)
+{ // lock-free, as entries are complete before they are added to a list
+  unsigned char c = key[0];
+  if (c >= 128)
+    return nullptr;
+  int i = keyFirst[c].load(std::memory_order_acquire);
+  while (i > 0)
+  {
+    UMsgKey * k = &keys[i - 1];
+    if (k->keyLen == n and strncmp(k->key, key, n) == 0)
+      return k;
+    i = k->next;
+  }
+  return nullptr;
+}
+
+UMsgKey * STeensy::addKeyEntry(const char* key, int n)
+{
+  unsigned char c = key[0];
+  if (n <= 0 or n >= UMsgKey::MKL or c >= 128)
+    return nullptr;
+  std::lock_guard<std::mutex> lock(keyLock);
+  // may have been added by another thread
+  UMsgKey * k = findKey(key, n);
+  if (k == nullptr and keysCnt < MAX_KEYS)
+  {
+    int i = keysCnt;
+    k = &keys[i];
+    strncpy(k->key, key, n);
+    k->key[n] = '\0';
+    k->keyLen = n;
+    k->topic = topicBase + k->key;
+    k->next = keyFirst[c].load();
+    keysCnt = i + 1;
+    // publish to receive thread
+    keyFirst[c].store(i + 1, std::memory_order_release);
+  }
+  return k;
+}
+
 int STeensy::getTeensyCommError(int& retryCnt)
 {
   retryCnt = confirmRetryCnt;
@@ -846,9 +1446,9 @@ void STeensy::toLog(const char* msg)
   UTime t("now");
   if (service.stop)
     return;
-  if (logfile != nullptr and not service.stop_logging)
+  if (logIo >= 0 and not service.stop_logging)
   {
-    fprintf(logfile, "%lu.%04ld ## %s", t.getSec(), t.getMicrosec()/100, msg);
+    logger.logText(logIo, t, "## %s", msg);
   }
   if (toConsole)
   {
@@ -857,37 +1457,34 @@ void STeensy::toLog(const char* msg)
 }
 
 
-void STeensy::toLogRx(const char*, UTime & mt)
+void STeensy::toLogRx(const char * msg, UTime & mt)
 {
   if (service.stop)
     return;
-  if (logfile != nullptr and not service.stop_logging)
+  if (logIo >= 0 and not service.stop_logging)
   {
-    fprintf(logfile, "%lu.%04ld Rx %s", mt.getSec(), mt.getMicrosec()/100, rx);
+    logger.logText(logIo, mt, "Rx %s", msg);
   }
   if (toConsole)
   {
-    printf("%lu.%04ld Rx %s", mt.getSec(), mt.getMicrosec()/100, rx);
+    printf("%lu.%04ld Rx %s", mt.getSec(), mt.getMicrosec()/100, msg);
   }
 }
 
-void STeensy::toLogTx()
+void STeensy::toLogTx(UOutQueue & msg)
 {
   if (service.stop)
     return;
-  if (logfile != nullptr and not service.stop_logging)
+  if (logIo >= 0 and not service.stop_logging)
   {
-    fprintf(logfile, "%lu.%04ld Tx %s",
-            outQueue.front().sendAt.getSec(),
-            outQueue.front().sendAt.getMicrosec()/100,
-            outQueue.front().msg);
+    logger.logText(logIo, msg.sendAt, "Tx %s", msg.msg);
   }
   if (toConsole)
   {
     printf("%lu.%04ld Tx %s",
-            outQueue.front().sendAt.getSec(),
-            outQueue.front().sendAt.getMicrosec()/100,
-            outQueue.front().msg);
+            msg.sendAt.getSec(),
+            msg.sendAt.getMicrosec()/100,
+            msg.msg);
   }
 }
 
@@ -895,13 +1492,11 @@ void STeensy::toLogQu()
 {
   if (service.stop)
     return;
-  if (logfile != nullptr and not service.stop_logging)
+  if (logIo >= 0 and not service.stop_logging)
   {
-    fprintf(logfile, "%lu.%04ld Qu %d %s",
-            outQueue.back().queuedAt.getSec(),
-            outQueue.back().queuedAt.getMicrosec()/100,
-            (int)outQueue.size(),
-            outQueue.back().msg);
+    logger.logText(logIo, outQueue.back().queuedAt, "Qu %d %s",
+                   (int)outQueue.size(),
+                   outQueue.back().msg);
   }
   if (toConsole)
   {
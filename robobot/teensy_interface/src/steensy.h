@@ -27,14 +27,20 @@
 
 #include <stdio.h>
 #include <mutex>
-#include <queue>
+#include <deque>
 #include <thread>
 #include <string.h>
 #include <string>
+#include <atomic>
+#include <functional>
 
 #include "utime.h"
+#include "ubinframe.h"
+#include "uhistogram.h"
+#include "umpscqueue.h"
 
-#define NUM_TEENSY_MAX 1
+/// max number of Teensy boards, the number used is set in robot.ini ([service] teensy_count)
+#define NUM_TEENSY_MAX 4
 
 /**
  * Queue class for messages that require confirmation
@@ -50,18 +56,22 @@ public:
   UTime sendAt;
   int resendCnt;
   int tn = 0;
+  /// sequence number used in confirm, -1 if confirm is by message text
+  int seq = -1;
   /**
-   * Constructor */
-  UOutQueue(const char * msg)
+   * Constructor
+   * \param msg is the message to send
+   * \param seqNum is the sequence number (-1 if not used) */
+  UOutQueue(const char * msg, int seqNum = -1)
   {
-    setMessage(msg);
+    setMessage(msg, seqNum);
     queuedAt.now();
     isSend = false;
     resendCnt = 0;
   }
   /**
-   * set new message */
-  bool setMessage(const char* message);
+   * set new message, as ";NN!cmd" or, with a sequence number, as ";NN!17:cmd" */
+  bool setMessage(const char* message, int seqNum = -1);
   /**
    * Confirm a match */
   bool compare(const char * got)
@@ -72,6 +82,44 @@ public:
   }
 };
 
+/**
+ * Command for the Teensy from another thread (e.g. MQTT),
+ * passed to the I/O thread in a lock-free queue */
+struct UTeensyCmd
+{
+  char msg[UOutQueue::MML];
+};
+
+/**
+ * Handler for a message from Teensy,
+ * params is the message after the key, e.g. "123 456\r\n" for "enc 123 456\r\n" */
+typedef std::function<void (const char * params, UTime & msgTime)> UMsgHandler;
+/**
+ * Handler for a binary message from Teensy,
+ * data is the packed structure for the message type (see ubinframe.h) */
+typedef std::function<void (const void * data, UTime & msgTime)> UBinHandler;
+
+/**
+ * A message key from Teensy (like 'enc' or 'hbt') with
+ * its (optional) handler and the MQTT topic to publish on.
+ * Entries are never changed once added, except that the handler may be
+ * set once (atomically), so the receive thread can look up without locks. */
+class UMsgKey
+{
+public:
+  static const int MKL = 16;
+  char key[MKL];
+  int keyLen = 0;
+  /// MQTT topic for this key (topicBase + key)
+  std::string topic;
+  /// handler, nullptr if message is published only
+  std::atomic<UMsgHandler *> handler = nullptr;
+  /// handler for the binary version of the message (if any)
+  std::atomic<UBinHandler *> binHandler = nullptr;
+  /// next key (index + 1) with same first character, 0 is end of list
+  int next = 0;
+};
+
 
 /**
  * The robot class handles the 
@@ -85,6 +133,9 @@ public:
   int tn = 0; // Teensy number
   /// Is port opened successfully
   bool teensyConnectionOpen = false;
+  /// Teensy is reconnected, so modules need setup,
+  /// done by the service thread (see UService::run())
+  std::atomic<bool> reconnectSetup{false};
   // mission state from hbt 
   int missionState = 0;
   // reference time
@@ -99,6 +150,18 @@ public:
   bool encoderReversed = true;
   // is this Teensy connection disabled (else should be active)
   bool disabled = false;
+  // replay Teensy messages from this logfile (log_t0_teensy_io.txt), set before setup()
+  std::string replayFile;
+  // replay speed factor, 1 is real time, 0 is as fast as possible
+  float replaySpeed = 1.0;
+  /// time from a message is read until it is handled (decode, handlers and MQTT)
+  UHistogram rxHist;
+  /// time from the Teensy sample (using the clock offset) until the message is read
+  UHistogram sampleHist;
+  /// time to write a direct message (e.g. motv) to the port
+  UHistogram txHist;
+  /// round trip time for queued messages (send to confirm)
+  UHistogram rttHist;
 
   
 private:
@@ -121,6 +184,10 @@ private:
   char rx[MAX_RX_CNT];
   // number of characters in rx buffer
   int rxCnt;
+  // time the first part of a (partial) line in rx buffer was read
+  UTime rxLineTime;
+  // event handle to wake up the receive thread, when a message is queued
+  int wakeFd = -1;
   //
   UTime lastTxTime;
   // socket to simulator
@@ -131,10 +198,18 @@ private:
   int sendCnt = 0;
   /** interface just opened */
   bool justConnected = false;
+  /// steps after open (see openSteps()), 0 is done
+  int connectStep = 0;
+  UTime connectStepTime;
+  /// time of last failed open, retry after 0.3 sec
+  UTime openFailTime;
+  /// time of closeUSB(), the port is closed 100ms later (by tick())
+  UTime closeTime;
   bool confirmSend = false;
 //   bool sendDirectFromNowOn = false;
 
-  std::thread * th1;
+  /// replay thread (the Teensy port is handled by the I/O loop)
+  std::thread * th1 = nullptr;
 
   
 public:
@@ -146,18 +221,60 @@ public:
   void terminate();
   /**
    * Send a string to the serial port (Teensy) through the queue.
-   * Anything send through the queue is confirmed and resend 3 times
-   * if no confirm is received. (would take 3 times 30ms)
+   * Anything send through the queue is confirmed and resend
+   * if no confirm is received within the confirm timeout.
+   * Up to confirm_window messages can wait for a confirm at the same time.
    * for streaming use then send directly, setting direct=true)
    * \param message is c_string to send,
    * \param direct for bypassing the default message queue
+   * \param sentAt is set to the time the message is written (if direct)
    * \returns true if send direct and delivered OK */
-  bool send(const char * message, bool direct = false);
+  bool send(const char * message, bool direct = false, UTime * sentAt = nullptr);
+  /**
+   * Update the Teensy clock offset estimate with a message time stamp.
+   * Called (from the receive thread) by modules that decode
+   * messages with a Teensy time, like 'vel' and 'pose'.
+   * The offset is the minimum of (host time - Teensy time) over the
+   * last 2 to 4 seconds, less half the minimum round trip time.
+   * Host time is the monotonic clock, so a wall clock step (NTP)
+   * has no effect on the estimate.
+   * \param teensyTime is the Teensy time (sec) in the message
+   * \param msgTime is the time the message was read */
+  void clockSample(double teensyTime, UTime & msgTime);
+  /**
+   * Convert a Teensy time to host time using the clock offset estimate.
+   * Returns the time now, if no estimate is available yet */
+  UTime teensyToHost(double teensyTime);
+  /** clock offset estimate (monotonic host time - Teensy) in seconds */
+  double getClockOffset()
+  {
+    return clockOffsetNs * 1e-9;
+  }
+  /**
+   * Connection handling, keep-alive, send queue and statistics.
+   * Called by the I/O loop (see uteensyio.h) after every poll. */
+  void tick();
+  /**
+   * Handle poll events for the Teensy port (read or error),
+   * called by the I/O loop */
+  void portEvent(short revents);
+  /**
+   * A message is queued, called by the I/O loop */
+  void wakeEvent();
+  /** port file handle, -1 if not open */
+  int getPortFd()
+  {
+    return usbport;
+  }
+  /** event handle to wake up the I/O loop, -1 if not available */
+  int getWakeFd()
+  {
+    return wakeFd;
+  }
   /**
-   * runs the receive thread 
-   * This run() function is called in a thread after a start() call.
-   * This function will not return until the thread is stopped. */
-  void run();
+   * Time in ms until the queue or keep-alive needs attention,
+   * used as poll timeout */
+  int getPollTimeout();
   /**
   * decode commands potentially for this device */
   bool decode(const char* msg, UTime & msgTime);
@@ -174,20 +291,96 @@ public:
   /**
    * get messages queued, but not send */
   int getTeensyCommQueueSize();
+  /**
+   * Register a handler for a message key from this Teensy, e.g. "enc".
+   * The handler is called from the receive thread with the
+   * parameters after the key.
+   * Registering a key that has a handler already is ignored,
+   * so modules can call this in every setup().
+   * \param key is the message key (first word in message)
+   * \param handler is the function to call for this message
+   * \returns false if key is too long or the key table is full */
+  bool addKey(const char * key, UMsgHandler handler);
+  /**
+   * Register a handler for a binary message type from this Teensy,
+   * used when binary mode is enabled ('binary = true' in robot.ini).
+   * The handler gets the packed structure for this type, see ubinframe.h.
+   * \param type is the message type, e.g. UBIN_POSE
+   * \param handler is the function to call for this message
+   * \returns false if the type is unknown or the key table is full */
+  bool addBinKey(int type, UBinHandler handler);
+  /**
+   * Queue a command from another thread, e.g. an MQTT message.
+   * The command is "key params\n", it is moved to the send queue
+   * by the I/O thread, so the caller is never blocked.
+   * \param key is the Teensy command, e.g. "leds"
+   * \param params is the rest of the command, e.g. "0 0 100"
+   * \returns false if not connected, command is too long or queue is full */
+  bool sendCommand(const char * key, const char * params);
+  /**
+   * print receive statistics (syscalls, lines and latency)
+   * from the last completed statistics period to console */
+  void printRxStat();
 
 private:
   /**
    * queue a message
-   * @param message  */
-  void sendToQueue(const char* message);
+   * @param message
+   * @param wake is true if the I/O thread should be woken up */
+  void sendToQueue(const char* message, bool wake = true);
+  /**
+   * Move commands from other threads (see sendCommand())
+   * to the send queue, called by the I/O thread */
+  void moveCommands();
   /**
    * send this message directly to the Teensy port */
-  bool sendDirect(const char* message);
+  bool sendDirect(const char* message, UTime * sentAt = nullptr);
   /**
    * Check for crc error
    * \param rawMsg is the message preceded by crc
    * \return true if OK */
   bool crcCheck(const char * rawMsg);
+  /**
+   * Read all available data from the Teensy port into the rx buffer
+   * and handle all complete lines.
+   * \returns false if the port failed (and should be closed) */
+  bool receiveData();
+  /**
+   * Handle one received line (CRC check, confirm or decode)
+   * \param line is the zero terminated line, starting with the ';NN' CRC
+   * \param msgTime is the time the first part of the line was read */
+  void handleLine(const char * line, UTime & msgTime);
+  /**
+   * Handle one binary frame (COBS decode, CRC check and decode)
+   * \param data is the frame without the 0x00 delimiters
+   * \param n is the number of bytes in data
+   * \param msgTime is the time the first part of the frame was read */
+  void handleFrame(const uint8_t * data, int n, UTime & msgTime);
+  /**
+   * Format a binary message as text (as in the text protocol,
+   * but without the key), for MQTT and logfile.
+   * \returns false if type is unknown */
+  bool formatBinary(int type, const void * data, char * s, int MSL);
+  /**
+   * Update activity and receive statistics after a line or frame */
+  void rxHandled(UTime & msgTime);
+  /**
+   * Update receive statistics and log them every statInterval seconds */
+  void updateRxStat();
+  /**
+   * Send new (or timed out) messages from the queue,
+   * up to confirmWindow messages may wait for a confirm */
+  void serviceQueue();
+  /**
+   * Find message key in key table
+   * \param key is the message start
+   * \param n is the length of the key
+   * \returns the key entry or nullptr if not found */
+  UMsgKey * findKey(const char * key, int n);
+  /**
+   * Add key to key table (or find the existing entry)
+   * \returns the key entry or nullptr if table is full */
+  UMsgKey * addKeyEntry(const char * key, int n);
   /**
    * is data source active (is device open) */
   virtual bool isActive()
@@ -195,17 +388,26 @@ private:
     return (usbport >= 0) and gotActivityRecently and not justConnected;
   }
 
-  static void runObj(STeensy * obj)
-  { // called, when thread is started
-    // transfer to the class run() function.
-    obj->run();
+  /**
+   * Replay thread, used instead of run(), when a replay file is set.
+   * Received lines ('Rx' and 'Rxb') from the logfile are handled as if
+   * received from the Teensy, with the original timing divided by replaySpeed.
+   * Messages to the Teensy are logged and dropped. */
+  void runReplay();
+  static void runReplayObj(STeensy * obj)
+  {
+    obj->runReplay();
   }
+  /// using replay file (no Teensy)
+  bool replaying = false;
 
 private:
   /**
    * Open the connection.
    * \returns true if successful */
   bool openToTeensy();
+  /** send the initial messages after open, with a pause in between, called by tick() */
+  void openSteps();
   std::string robotName;
   int confirm_timeout_ms = 100;
   /**
@@ -213,6 +415,8 @@ private:
    * Check, and
    * release the next in the queue */
   void messageConfirmed(const char * confirm);
+  /** add round trip time of a confirmed message to statistics */
+  void addRtt(float rtt);
   void closeUSB();
   int connectErrCnt = 0;
   ///
@@ -226,7 +430,16 @@ private:
   UTime lastSent;
   /**
    * uotgoing message queue */
-  std::queue<UOutQueue> outQueue;
+  std::deque<UOutQueue> outQueue;
+  std::mutex queueLock;
+  /// commands from other threads (see sendCommand())
+  UMpscQueue<UTeensyCmd> cmdQueue;
+  /// commands dropped, as too long or queue full
+  std::atomic<int> cmdDropCnt{0};
+  /// max number of messages waiting for confirm, 1 is confirm by message text
+  int confirmWindow = 8;
+  /// next sequence number for a queued message
+  int nextSeq = 0;
   float confirmTimeout = 0.03; // timeout in seconds for writing to Teensy
   // transmission statistics
   int confirmMismatchCnt = 0;
@@ -235,21 +448,59 @@ private:
   int confirmRetryCntMax = 50;
   /// count of dropped messages requiring confirm
   int confirmRetryDump = 0;
+  /// receive statistics for the current period
+  int statSyscallCnt = 0;
+  int statLineCnt = 0;
+  float statLatencySum = 0;
+  float statLatencyMax = 0;
+  UTime statTime;
+  /// statistics period (sec), 0 = no statistics in logfile
+  float statInterval = 10.0;
+  /// receive statistics from last completed period
+  float rxSyscallRate = 0;
+  float rxLineRate = 0;
+  float rxLatencyMean = 0;
+  float rxLatencyMax = 0;
+  /// clock offset (monotonic host - Teensy) estimate (ns), see clockSample()
+  int64_t clockOffsetNs = 0;
+  bool clockOffsetValid = false;
+  /// minimum of (host - Teensy) time (ns) in this and the previous window
+  int64_t clockMinNow = INT64_MAX;
+  int64_t clockMinLast = INT64_MAX;
+  UTime clockWindowStart;
+  /// minimum round trip time for a queued message (sec)
+  float rttMin = 1.0;
   /// save in log with different time + marking
   void toLog(const char * msg);
-  void toLogRx(const char*, UTime& mt);
-  void toLogTx();
+  void toLogRx(const char * msg, UTime& mt);
+  void toLogTx(UOutQueue & msg);
   void toLogQu();
   /// should logged messages be printed on console too.
   bool toConsole = false;
-  /// data io logfile
-  FILE * logfile = nullptr;
+  /// data io log channel (see ulogger.h)
+  int logIo = -1;
   std::mutex dataLock; // ensure consistency
   //
   // MQTT
   std::string topicBase;
-  std::string topicDName;
   std::string topicHelp;
+  std::string topicLog;
+  //
+  // message key table, one list for each first character
+  static const int MAX_KEYS = 64;
+  UMsgKey keys[MAX_KEYS];
+  std::atomic<int> keysCnt = 0;
+  /// first key (index + 1) for each first character, 0 is none
+  std::atomic<int> keyFirst[128] = {};
+  std::mutex keyLock;
+  /// key entry for each binary message type
+  std::atomic<UMsgKey *> binKey[UBIN_TYPES] = {};
+  /// telemetry as binary frames from Teensy
+  bool binaryMode = false;
+  /// binary frames with COBS or CRC error
+  int binErrCnt = 0;
+  /// handle 'dname' (robot name) message
+  void decodeDname(const char * params);
 };
 
 extern STeensy teensy[NUM_TEENSY_MAX];
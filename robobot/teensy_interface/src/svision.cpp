@@ -0,0 +1,309 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+#include <string>
+#include <string.h>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#if CV_VERSION_MAJOR > 4 or (CV_VERSION_MAJOR == 4 and CV_VERSION_MINOR >= 7)
+#include <opencv2/objdetect/aruco_detector.hpp>
+#define USE_ARUCO
+#endif
+#include "svision.h"
+#include "uservice.h"
+#include "umqtt.h"
+#include "ulogger.h"
+
+// create value
+SVision vision;
+
+
+void SVision::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("vision"))
+  { // no data yet, so generate some default values
+    ini["vision"]["use"] = "false"; // camera is often used by the stream server
+    ini["vision"]["log"] = "true";
+    ini["vision"]["print"] = "false";
+    ini["vision"]["; source is 'mjpeg', 'v4l', 'shm' or 'dir'"] = "";
+    ini["vision"]["source"] = "mjpeg";
+    ini["vision"]["url"] = "http://localhost:7123/stream.mjpg";
+    ini["vision"]["device"] = "/dev/video0";
+    ini["vision"]["shm"] = "/robobot_frames"; // from camera_shm.py or frame_broker
+    ini["vision"]["size"] = "820 616"; // for 'v4l' source
+    ini["vision"]["dir"] = "images";
+    ini["vision"]["dir_fps"] = "5";
+    ini["vision"]["dir_loop"] = "false";
+    // ball detection as color range (BGR)
+    ini["vision"]["ball"] = "true";
+    ini["vision"]["ball_low"] = "0 0 150";
+    ini["vision"]["ball_high"] = "80 20 255";
+    ini["vision"]["ball_min_area"] = "500"; // pixels
+    // ArUco codes
+    ini["vision"]["aruco"] = "true";
+    ini["vision"]["aruco_dict"] = "2"; // cv::aruco::DICT_4X4_250
+  }
+  if (not ini["vision"].has("shm"))
+  { // shared memory from camera_shm.py (Pi camera) or frame_broker (USB camera)
+    ini["vision"]["shm"] = "/robobot_frames";
+  }
+  if (ini["vision"]["use"] != "true")
+    return;
+  const char * p1 = ini["vision"]["ball_low"].c_str();
+  for (int i = 0; i < 3; i++)
+    ballLow[i] = strtof(p1, (char**)&p1);
+  p1 = ini["vision"]["ball_high"].c_str();
+  for (int i = 0; i < 3; i++)
+    ballHigh[i] = strtof(p1, (char**)&p1);
+  useBall = ini["vision"]["ball"] == "true";
+  ballMinArea = strtof(ini["vision"]["ball_min_area"].c_str(), nullptr);
+  useAruco = ini["vision"]["aruco"] == "true";
+  arucoDict = strtol(ini["vision"]["aruco_dict"].c_str(), nullptr, 10);
+#ifndef USE_ARUCO
+  if (useAruco)
+    printf("# SVision::setup: ArUco detection needs OpenCV 4.7 or newer (disabled)\n");
+  useAruco = false;
+#endif
+  toConsole = ini["vision"]["print"] == "true";
+  // frame source
+  std::string src = ini["vision"]["source"];
+  if (src == "v4l")
+  {
+    p1 = ini["vision"]["size"].c_str();
+    int w = strtol(p1, (char**)&p1, 10);
+    int h = strtol(p1, (char**)&p1, 10);
+    source = new UFrameSourceV4l(ini["vision"]["device"], w, h);
+  }
+  else if (src == "shm")
+    source = new UFrameSourceShm(ini["vision"]["shm"]);
+  else if (src == "dir")
+  {
+    float fps = strtof(ini["vision"]["dir_fps"].c_str(), nullptr);
+    source = new UFrameSourceDir(ini["vision"]["dir"], fps, ini["vision"]["dir_loop"] == "true");
+  }
+  else
+    source = new UFrameSourceMjpeg(ini["vision"]["url"]);
+  // MQTT
+  topicBall = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "vision/ball";
+  topicAruco = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "vision/aruco";
+  if (ini["vision"]["log"] == "true" and logCh < 0)
+  { // open logfile
+    logCh = logger.addChannel("log_vision", "");
+    logger.addHeader(logCh, "%% Vision detections, source %s\n", source->name.c_str());
+    logger.addHeader(logCh, "%% 1 \tTime (sec) of capture\n");
+    logger.addHeader(logCh, "%% 2 \tDetection type (ball or aruco)\n");
+    logger.addHeader(logCh, "%% 3 \tFrame number\n");
+    logger.addHeader(logCh, "%% 4 \tNumber of detections, then for each\n");
+    logger.addHeader(logCh, "%%    \tball: x y radius (pixels)\n");
+    logger.addHeader(logCh, "%%    \taruco: id x y size (pixels)\n");
+  }
+  thGrab = new std::thread(runGrabObj, this);
+  thDecode = new std::thread(runDecodeObj, this);
+  thDetect = new std::thread(runDetectObj, this);
+}
+
+void SVision::runGrab()
+{
+  UVisionFrame f;
+  bool isOpen = false;
+  while (not service.stop)
+  {
+    if (not isOpen)
+    { // (re)open the source
+      isOpen = source->open();
+      if (not isOpen)
+      {
+        sleep(1);
+        continue;
+      }
+      printf("# SVision::runGrab: using %s\n", source->name.c_str());
+    }
+    if (not source->grab(f))
+    {
+      isOpen = false;
+      continue;
+    }
+    grabCnt++;
+    if (not grabbed.put(f))
+      dropGrabCnt++;
+  }
+  source->close();
+}
+
+void SVision::runDecode()
+{
+  UVisionFrame f;
+  while (not service.stop)
+  {
+    if (not grabbed.take(f, 0.1))
+      continue;
+    if (not f.data.empty())
+    { // decode into the existing image buffer
+      cv::imdecode(f.data, cv::IMREAD_COLOR, &f.img);
+      if (f.img.empty())
+      {
+        decodeErrCnt++;
+        continue;
+      }
+    }
+    decodeCnt++;
+    if (not decoded.put(f))
+      dropDecodeCnt++;
+  }
+}
+
+void SVision::runDetect()
+{
+  UVisionFrame f;
+  while (not service.stop)
+  {
+    if (not decoded.take(f, 0.1))
+      continue;
+    if (useBall)
+      findBalls(f.img, f);
+    if (useAruco)
+      findAruco(f.img, f);
+    detectCnt++;
+    UTime t("now");
+    latency.add(t - f.captureTime);
+  }
+}
+
+int SVision::findBalls(const cv::Mat & img, const UVisionFrame & frame)
+{
+  // buffers are reused for next frame
+  static cv::Mat mask;
+  static std::vector<std::vector<cv::Point>> contours;
+  static const cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(5, 5));
+  cv::inRange(img, ballLow, ballHigh, mask);
+  // remove noise
+  cv::morphologyEx(mask, mask, cv::MORPH_OPEN, kernel);
+  cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+  const int MSL = 500;
+  char s[MSL];
+  const int MBL = 10; // max balls reported
+  int n = 0;
+  char * p = s;
+  for (auto & c : contours)
+  {
+    if (cv::contourArea(c) < ballMinArea)
+      continue;
+    cv::Point2f center;
+    float r;
+    cv::minEnclosingCircle(c, center, r);
+    int m = snprintf(p, MSL - (p - s), " %.0f %.0f %.0f", center.x, center.y, r);
+    p += m;
+    if (++n >= MBL or p - s > MSL - 30)
+      break;
+  }
+  *p = '\0';
+  UTime ct = frame.captureTime;
+  const int MPL = 600;
+  char msg[MPL];
+  snprintf(msg, MPL, "%lu.%06lu %d %d%s\n", ct.getSec(), ct.getMicrosec(), frame.seq, n, s);
+  toLog("ball", msg, ct);
+  mqtt.publish(topicBall.c_str(), msg, ct);
+  return n;
+}
+
+int SVision::findAruco(const cv::Mat & img, const UVisionFrame & frame)
+{
+  int n = 0;
+  const int MSL = 500;
+  char s[MSL];
+  char * p = s;
+#ifdef USE_ARUCO
+  // detect thread only
+  static cv::aruco::ArucoDetector detector(cv::aruco::getPredefinedDictionary(arucoDict),
+                                           cv::aruco::DetectorParameters());
+  static cv::Mat gray;
+  static std::vector<std::vector<cv::Point2f>> corners;
+  static std::vector<int> ids;
+  cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+  detector.detectMarkers(gray, corners, ids);
+  for (int i = 0; i < (int)ids.size(); i++)
+  { // center and average side length
+    cv::Point2f c(0, 0);
+    float side = 0;
+    for (int j = 0; j < 4; j++)
+    {
+      c += corners[i][j];
+      side += cv::norm(corners[i][j] - corners[i][(j + 1) % 4]);
+    }
+    int m = snprintf(p, MSL - (p - s), " %d %.1f %.1f %.1f", ids[i], c.x / 4, c.y / 4, side / 4);
+    p += m;
+    n++;
+    if (p - s > MSL - 40)
+      break;
+  }
+#endif
+  *p = '\0';
+  UTime ct = frame.captureTime;
+  const int MPL = 600;
+  char msg[MPL];
+  snprintf(msg, MPL, "%lu.%06lu %d %d%s\n", ct.getSec(), ct.getMicrosec(), frame.seq, n, s);
+  toLog("aruco", msg, ct);
+  mqtt.publish(topicAruco.c_str(), msg, ct);
+  return n;
+}
+
+void SVision::toLog(const char * what, const char * s, UTime & captureTime)
+{
+  if (service.stop)
+    return;
+  // skip the capture time in the message
+  const char * p1 = strchr(s, ' ');
+  if (p1 == nullptr)
+    p1 = s;
+  if (logCh >= 0 and not service.stop_logging)
+    logger.logText(logCh, captureTime, "%s%s", what, p1);
+  if (toConsole)
+    printf("%% SVision: %s%s", what, p1);
+}
+
+void SVision::printStat()
+{
+  if (source == nullptr)
+    return;
+  printf("# SVision: %s grabbed %d (dropped %d), decoded %d (errors %d, dropped %d), detected %d\n",
+         source->name.c_str(), grabCnt.load(), dropGrabCnt.load(), decodeCnt.load(),
+         decodeErrCnt.load(), dropDecodeCnt.load(), detectCnt.load());
+}
+
+void SVision::terminate()
+{
+  if (thGrab != nullptr)
+    thGrab->join();
+  if (thDecode != nullptr)
+    thDecode->join();
+  if (thDetect != nullptr)
+    thDetect->join();
+  if (source != nullptr)
+  {
+    printStat();
+    delete source;
+    source = nullptr;
+  }
+  // logfile is closed by the logger
+}
@@ -0,0 +1,118 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef SVISION_H
+#define SVISION_H
+
+#include <thread>
+#include <atomic>
+#include <opencv2/core.hpp>
+
+#include "utime.h"
+#include "uhistogram.h"
+#include "uframesource.h"
+
+/**
+ * Vision pipeline, with a thread for each stage:
+ *   grab (from frame source) -> decode (JPEG) -> detect (ball and ArUco).
+ * Each stage uses the newest frame from the stage before,
+ * so frames are dropped, if a stage can not keep up.
+ * Detections are published on MQTT with the capture time.
+ * Source is set in robot.ini [vision]: 'v4l' (camera device),
+ * 'mjpeg' (stream server), 'shm' (camera_shm.py or frame_broker shared memory)
+ * or 'dir' (image files for offline test).
+ * */
+class SVision
+{
+public:
+  /** setup and start pipeline (if used) */
+  void setup();
+  /**
+   * close down */
+  void terminate();
+  /** print pipeline statistics */
+  void printStat();
+  /// time from capture to detections are published
+  UHistogram latency;
+
+private:
+  static void runGrabObj(SVision * obj)
+  {
+    obj->runGrab();
+  }
+  static void runDecodeObj(SVision * obj)
+  {
+    obj->runDecode();
+  }
+  static void runDetectObj(SVision * obj)
+  {
+    obj->runDetect();
+  }
+  /** the 3 stages */
+  void runGrab();
+  void runDecode();
+  void runDetect();
+  /**
+   * Find balls with a color within limits
+   * \returns number of balls found */
+  int findBalls(const cv::Mat & img, const UVisionFrame & frame);
+  /**
+   * Find ArUco codes
+   * \returns number of codes found */
+  int findAruco(const cv::Mat & img, const UVisionFrame & frame);
+  /** save and publish detection */
+  void toLog(const char * what, const char * s, UTime & captureTime);
+  UFrameSource * source = nullptr;
+  std::thread * thGrab = nullptr;
+  std::thread * thDecode = nullptr;
+  std::thread * thDetect = nullptr;
+  /// newest frame between stages
+  UFrameSlot grabbed;
+  UFrameSlot decoded;
+  /// detection settings
+  bool useBall = true;
+  cv::Scalar ballLow;
+  cv::Scalar ballHigh;
+  float ballMinArea = 500;
+  bool useAruco = true;
+  int arucoDict = 2; // DICT_4X4_250
+  /// statistics
+  std::atomic<int> grabCnt{0};
+  std::atomic<int> decodeCnt{0};
+  std::atomic<int> detectCnt{0};
+  std::atomic<int> dropGrabCnt{0};
+  std::atomic<int> dropDecodeCnt{0};
+  std::atomic<int> decodeErrCnt{0};
+  /// log channel (see ulogger.h)
+  int logCh = -1;
+  bool toConsole = false;
+  /// MQTT
+  std::string topicBall;
+  std::string topicAruco;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern SVision vision;
+
+#endif
@@ -0,0 +1,440 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+/**
+ * Benchmark of the host control chain
+ *   Teensy message decode -> velocity -> motor PID -> 'motv' send
+ * using the Teensy simulator (teensy_sim) on a pseudo-terminal, e.g.:
+ *   teensy_bench --rate 2000 --time 10 --cpu-stress 4 --tag $(git rev-parse --short HEAD)
+ * The encoder and velocity messages are subscribed at 'rate' (Hz),
+ * and optional stress threads load the CPU and the disk.
+ * The result is appended as one JSON line to the output file, with
+ * velocity update period, latency histograms, loop jitter,
+ * decode throughput (lines/s) and heap allocations per message,
+ * so that results from different commits can be compared. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <new>
+#include <CLI/CLI.hpp>
+#include "uservice.h"
+#include "uini.h"
+#include "steensy.h"
+#include "mvelocity.h"
+#include "cmotor.h"
+#include "cmixer.h"
+#include "umqtt.h"
+#include "urealtime.h"
+#include "cpipeline.h"
+#include "uhistogram.h"
+#include "utime.h"
+
+/// heap allocations in all threads (see operator new below)
+static std::atomic<int64_t> allocCnt{0};
+
+void * operator new(size_t n)
+{
+  allocCnt.fetch_add(1, std::memory_order_relaxed);
+  void * p = malloc(n == 0 ? 1 : n);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void * operator new[](size_t n)
+{
+  allocCnt.fetch_add(1, std::memory_order_relaxed);
+  void * p = malloc(n == 0 ? 1 : n);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void * p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void * p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void * p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void * p, size_t) noexcept
+{
+  free(p);
+}
+
+/**
+ * Benchmark settings and stress threads */
+class UBench
+{
+public:
+  float rate = 1000;
+  float duration = 10;
+  float warmup = 2;
+  int cpuStress = 0;
+  int ioStress = 0;
+  bool binary = false;
+  bool realtime = false;
+  bool logging = true;
+  /// velocity, mixer and motor in one pipeline thread (else a thread each)
+  bool pipelineUse = true;
+  std::string iniSource = "robot.ini";
+  std::string sim;
+  std::string out = "teensy_bench.jsonl";
+  std::string tag;
+  /**
+   * Make ini-file for the benchmark from iniSource
+   * \returns false if failed */
+  bool makeIni();
+  /**
+   * Start teensy_sim on a pseudo-terminal
+   * \returns false if failed */
+  bool startSim();
+  void stopSim();
+  /** start and stop stress threads */
+  void startStress();
+  void stopStress();
+  /** record velocity update period (thread) */
+  void runPeriod();
+  /**
+   * Run benchmark and write result */
+  void run();
+  //
+  std::string link;
+  std::string iniName;
+  std::string logPath;
+  UHistogram velPeriod;
+  UHistogram velPeriodError;
+
+private:
+  /** append histogram as JSON object (values in ms) */
+  void jsonHist(std::string & s, const char * name, const UHistogram & h, bool last = false);
+  pid_t simPid = -1;
+  std::atomic<bool> stopThreads{false};
+  std::vector<std::thread *> threads;
+};
+
+bool UBench::makeIni()
+{
+  mINI::INIStructure bi;
+  mINI::INIFile src(iniSource);
+  if (not src.read(bi))
+    printf("# UBench:: no %s, using defaults\n", iniSource.c_str());
+  char s[32];
+  snprintf(s, sizeof(s), "%g", 1000.0 / rate);
+  bi["service"]["use_robot_hardware"] = "true";
+  bi["service"]["teensy_count"] = "1";
+  bi["service"]["logpath"] = logPath;
+  bi["service"]["log_service"] = "false";
+  bi["service"]["latency_publish_s"] = "0";
+  bi["teensy0"]["use"] = "true";
+  bi["teensy0"]["device"] = link;
+  bi["teensy0"]["deviceAlt"] = link;
+  bi["teensy0"]["binary"] = binary ? "true" : "false";
+  bi["teensy0"]["stat_interval"] = "0";
+  bi["encoder0"]["interval_pos_ms"] = s;
+  bi["encoder0"]["interval_vel_ms"] = s;
+  bi["mqtt"]["use"] = "false";
+  bi["vision"]["use"] = "false";
+  bi["realtime"]["use"] = realtime ? "true" : "false";
+  bi["pipeline"]["use"] = pipelineUse ? "true" : "false";
+  bi["ini"]["saveConfig"] = "false";
+  mINI::INIFile f(iniName);
+  return f.generate(bi, true);
+}
+
+bool UBench::startSim()
+{
+  unlink(link.c_str());
+  simPid = fork();
+  if (simPid < 0)
+  {
+    perror("# UBench::startSim: fork failed");
+    return false;
+  }
+  if (simPid == 0)
+  { // child, no console output
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0)
+    {
+      dup2(fd, STDOUT_FILENO);
+      close(fd);
+    }
+    execl(sim.c_str(), sim.c_str(), "-l", link.c_str(), "-s", "0", (char*)nullptr);
+    perror("# UBench::startSim: failed to start teensy_sim");
+    _exit(1);
+  }
+  // wait for the pseudo-terminal link
+  UTime t("now");
+  while (access(link.c_str(), F_OK) != 0)
+  {
+    if (t.getTimePassed() > 3.0 or waitpid(simPid, nullptr, WNOHANG) != 0)
+    {
+      printf("# UBench::startSim: no simulator on %s (tried %s)\n", link.c_str(), sim.c_str());
+      return false;
+    }
+    usleep(10000);
+  }
+  return true;
+}
+
+void UBench::stopSim()
+{
+  if (simPid > 0)
+  {
+    kill(simPid, SIGTERM);
+    waitpid(simPid, nullptr, 0);
+    simPid = -1;
+  }
+}
+
+void UBench::startStress()
+{
+  for (int i = 0; i < cpuStress; i++)
+  {
+    threads.push_back(new std::thread([this]()
+    { // busy calculation
+      volatile double v = 1.0;
+      while (not stopThreads)
+      {
+        for (int k = 0; k < 10000; k++)
+          v = sqrt(v + k);
+      }
+    }));
+  }
+  for (int i = 0; i < ioStress; i++)
+  {
+    threads.push_back(new std::thread([this, i]()
+    { // write and sync a file
+      std::string fn = logPath + "stress_" + std::to_string(i) + ".bin";
+      std::vector<char> buf(1 << 20, 'x');
+      while (not stopThreads)
+      {
+        int fd = open(fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+          break;
+        for (int k = 0; k < 16 and not stopThreads; k++)
+        {
+          if (write(fd, buf.data(), buf.size()) < 0)
+            break;
+        }
+        fsync(fd);
+        close(fd);
+      }
+      unlink(fn.c_str());
+    }));
+  }
+}
+
+void UBench::stopStress()
+{
+  stopThreads = true;
+  for (std::thread * t : threads)
+  {
+    t->join();
+    delete t;
+  }
+  threads.clear();
+}
+
+void UBench::runPeriod()
+{ // period between velocity updates (host time)
+  MVelocity::Data d;
+  int version = 0;
+  UTime last;
+  bool first = true;
+  float nominal = 1.0 / rate;
+  while (not stopThreads)
+  {
+    if (not mvel[0].snapshot.waitForUpdate(version, 0.1))
+      continue;
+    version = mvel[0].snapshot.read(d);
+    if (not first)
+    {
+      float dt = d.updTime - last;
+      velPeriod.add(dt);
+      velPeriodError.add(fabsf(dt - nominal));
+    }
+    first = false;
+    last = d.updTime;
+  }
+}
+
+void UBench::jsonHist(std::string & s, const char * name, const UHistogram & h, bool last)
+{
+  const int MSL = 300;
+  char line[MSL];
+  snprintf(line, MSL, "\"%s\":{\"count\":%lld,\"mean\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"p99\":%.4f,\"max\":%.4f}%s",
+           name, (long long)h.count(), h.mean() * 1e3, h.quantile(0.5) * 1e3, h.quantile(0.9) * 1e3,
+           h.quantile(0.99) * 1e3, h.max() * 1e3, last ? "" : ",");
+  s += line;
+}
+
+void UBench::run()
+{
+  // the control chain runs when the wheels should turn
+  mixer.setVelocity(0.2, 0.5, 2);
+  std::thread periodThread([this](){ runPeriod(); });
+  startStress();
+  // warm up, then measure from clean statistics
+  usleep(int(warmup * 1e6));
+  STeensy & tsy = teensy[0];
+  tsy.rxHist.clear();
+  tsy.sampleHist.clear();
+  tsy.txHist.clear();
+  mvel[0].latency.clear();
+  motor[0].latency.clear();
+  motor[0].loopHist.clear();
+  ::realtime.clear();
+  pipeline.clear();
+  velPeriod.clear();
+  velPeriodError.clear();
+  int64_t alloc0 = allocCnt;
+  UTime start("now");
+  while (start.getTimePassed() < duration and not service.stopNowRequest)
+    usleep(50000);
+  float dt = start.getTimePassed();
+  int64_t allocs = allocCnt - alloc0;
+  int64_t lines = tsy.rxHist.count();
+  mixer.setVelocity(0, 0, 2);
+  stopStress();
+  periodThread.join();
+  // result as one JSON line
+  const int MSL = 500;
+  char line[MSL];
+  std::string s = "{";
+  snprintf(line, MSL, "\"tag\":\"%s\",\"time\":%lu,\"rate\":%g,\"duration\":%.3f,"
+           "\"cpu_stress\":%d,\"io_stress\":%d,\"binary\":%s,\"realtime\":%s,\"logging\":%s,\"pipeline\":%s,",
+           tag.c_str(), start.getSec(), rate, dt, cpuStress, ioStress,
+           binary ? "true" : "false", realtime ? "true" : "false", logging ? "true" : "false",
+           pipelineUse ? "true" : "false");
+  s += line;
+  snprintf(line, MSL, "\"rx_lines\":%lld,\"rx_lines_per_s\":%.1f,\"allocs\":%lld,\"allocs_per_msg\":%.3f,"
+           "\"vel_updates_per_s\":%.1f,\"motv_per_s\":%.1f,",
+           (long long)lines, lines / dt, (long long)allocs, lines > 0 ? double(allocs) / lines : 0.0,
+           velPeriod.count() / dt, tsy.txHist.count() / dt);
+  s += line;
+  s += "\"hist_ms\":{";
+  jsonHist(s, "vel_period", velPeriod);
+  jsonHist(s, "vel_period_error", velPeriodError);
+  jsonHist(s, "sample_to_read", tsy.sampleHist);
+  jsonHist(s, "msg_handled", tsy.rxHist);
+  jsonHist(s, "encoder_to_velocity", mvel[0].latency);
+  jsonHist(s, "velocity_to_motor", motor[0].latency);
+  jsonHist(s, "motv_write", tsy.txHist);
+  jsonHist(s, "sample_to_motv", motor[0].loopHist);
+  UPeriodic * loops[10];
+  int n = ::realtime.getLoops(loops, 10);
+  for (int i = 0; i < n; i++)
+  {
+    std::string name = std::string("jitter_") + loops[i]->name;
+    jsonHist(s, name.c_str(), loops[i]->error, i == n - 1);
+  }
+  if (n == 0)
+    s.pop_back();
+  s += "}}\n";
+  printf("%s", s.c_str());
+  FILE * f = fopen(out.c_str(), "a");
+  if (f != nullptr)
+  {
+    fputs(s.c_str(), f);
+    fclose(f);
+    printf("# UBench:: result appended to %s\n", out.c_str());
+  }
+  else
+    perror(("# UBench:: failed to open " + out).c_str());
+}
+
+
+int main(int argc, char ** argv)
+{
+  CLI::App cli{"Benchmark of teensy_interface control chain using teensy_sim"};
+  UBench bench;
+  // simulator is expected next to this executable
+  std::string dir = argv[0];
+  size_t n = dir.rfind('/');
+  bench.sim = (n == std::string::npos ? std::string(".") : dir.substr(0, n)) + "/teensy_sim";
+  cli.add_option("-r,--rate", bench.rate, "Encoder and velocity message rate (Hz), e.g. 1000 to 10000 (default 1000)");
+  cli.add_option("-t,--time", bench.duration, "Measurement time (sec, default 10)");
+  cli.add_option("-w,--warmup", bench.warmup, "Time before measurement starts (sec, default 2)");
+  cli.add_option("-c,--cpu-stress", bench.cpuStress, "Number of CPU load threads (default 0)");
+  cli.add_option("-i,--io-stress", bench.ioStress, "Number of disk write threads (default 0)");
+  cli.add_flag("-b,--binary", bench.binary, "Use binary messages from the Teensy");
+  cli.add_flag("-R,--realtime", bench.realtime, "Enable [realtime] settings from the ini-file");
+  bool threads = false;
+  cli.add_flag("-T,--threads", threads, "Velocity, mixer and motor control in a thread each (not the control pipeline)");
+  bool nolog = false;
+  cli.add_flag("-n,--no-log", nolog, "Do not write logfiles during the benchmark");
+  cli.add_option("--ini", bench.iniSource, "Ini-file with robot settings (default robot.ini)");
+  cli.add_option("--sim", bench.sim, "Teensy simulator executable (default teensy_sim next to this)");
+  cli.add_option("-o,--out", bench.out, "Append result (JSON line) to this file (default teensy_bench.jsonl)");
+  cli.add_option("--tag", bench.tag, "Tag in the result, e.g. the git commit");
+  CLI11_PARSE(cli, argc, argv);
+  bench.pipelineUse = not threads;
+  bench.logging = not nolog;
+  if (bench.rate < 1)
+    bench.rate = 1;
+  std::string id = std::to_string(getpid());
+  bench.link = "/tmp/teensy_bench_" + id;
+  bench.iniName = "/tmp/teensy_bench_" + id + ".ini";
+  bench.logPath = "/tmp/teensy_bench_log_" + id + "/";
+  if (not bench.startSim())
+    return 1;
+  if (not bench.makeIni())
+  {
+    printf("# UBench:: failed to write %s\n", bench.iniName.c_str());
+    bench.stopSim();
+    return 1;
+  }
+  // the interface itself, as daemon (no keyboard)
+  service.iniFileName = bench.iniName;
+  std::vector<char *> args = {argv[0], (char*)"-d"};
+  if (nolog)
+    args.push_back((char*)"-l");
+  service.setup(args.size(), args.data());
+  if (not service.theEnd)
+    bench.run();
+  service.terminate();
+  bench.stopSim();
+  unlink(bench.iniName.c_str());
+  return 0;
+}
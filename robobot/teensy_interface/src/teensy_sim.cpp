@@ -0,0 +1,588 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+/**
+ * Teensy simulator on a pseudo-terminal, for test of teensy_interface
+ * without a robot, e.g.:
+ *   teensy_sim -l /tmp/teensy_sim
+ * and set 'device = /tmp/teensy_sim' in the [teensy0] section of robot.ini.
+ *
+ * Implements the message protocol of the Teensy firmware:
+ * ';NN' CRC, '!' confirm (also with sequence number), 'sub key ms',
+ * 'leave', 'bin 0/1', 'enc0', 'motv' and the data messages
+ * hbt, id (dname), enc, pose, vel, gyro, acc, liv, livn, ir, ird and mca.
+ * The subscription interval may be below 1 ms (e.g. 'sub enc 0.25').
+ * The motor voltage (motv) drives a simple differential-drive model.
+ * Statistics (messages, lost messages and CPU) are printed regularly. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <string>
+#include <CLI/CLI.hpp>
+#include "ubinframe.h"
+
+static bool stopSim = false;
+
+void signalHandler(int /*signum*/)
+{
+  stopSim = true;
+}
+
+/**
+ * Simulated Teensy */
+class UTeensySim
+{
+public:
+  /// robot name (returned in 'dname')
+  std::string name = "sim";
+  /// symbolic link to the pseudo-terminal (if not empty)
+  std::string link;
+  /// statistics interval (sec), 0 is no statistics
+  float statInterval = 5;
+  /// drive model
+  float wheelBase = 0.23;     // m
+  float wheelRadius = 0.09;   // m
+  float gear = 19;
+  int encTicks = 68;          // ticks per motor revolution
+  float velPerVolt = 0.06;    // steady state wheel velocity (m/s) per volt
+  float tau = 0.05;           // motor time constant (sec)
+  /**
+   * Create pseudo-terminal
+   * \returns false if failed */
+  bool open();
+  /** close and remove link */
+  void close();
+  /**
+   * Handle commands and subscriptions until stopped */
+  void run();
+
+private:
+  /// time since start (sec)
+  double now();
+  /** read from pseudo-terminal and handle complete lines */
+  void receive();
+  /** handle one line (with or without CRC) */
+  void handleLine(char * line);
+  /** execute command */
+  void command(const char * cmd);
+  /** send text message, the CRC is added here
+   * \returns false if not send (client not reading) */
+  bool sendText(const char * msg);
+  /** write to client, a partial write is completed by 'flushTx'
+   * \returns false if lost (client not reading) */
+  bool sendRaw(const char * data, int n);
+  /** write rest of a partial write */
+  void flushTx();
+  /** send message for a subscription, binary or text */
+  void sendData(int type);
+  /** update drive model to this time */
+  void updateModel(double t);
+  /** print and reset statistics */
+  void printStat(double t);
+  //
+  int master = -1;
+  int slave = -1;
+  double startTime = 0;
+  bool binary = false;
+  char rx[1000];
+  int rxCnt = 0;
+  /// rest of a partial write
+  std::string txRest;
+  /// subscriptions, index is UBinType, UBIN_NONE is 'id'
+  double interval[UBIN_TYPES] = {0};
+  double nextTime[UBIN_TYPES] = {0};
+  /// drive model state
+  double modelTime = 0;
+  float u[2] = {0};        // motor voltage
+  float wheelVel[2] = {0}; // m/s
+  double encPos[2] = {0};   // ticks
+  float pose[3] = {0};     // x, y, heading
+  /// message counters, also used as 'cnt' in messages
+  int sendCnt[UBIN_TYPES] = {0};
+  int hbtCnt = 0;
+  /// statistics
+  int statSend = 0;
+  int statLost = 0;
+  int statCmd = 0;
+  int statCrcErr = 0;
+  double statTime = 0;
+  double statCpu = 0;
+};
+
+double UTeensySim::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9 - startTime;
+}
+
+bool UTeensySim::open()
+{
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 or grantpt(master) != 0 or unlockpt(master) != 0)
+  {
+    perror("# UTeensySim::open: failed to create pseudo-terminal");
+    return false;
+  }
+  const char * sname = ptsname(master);
+  // keep the slave side open, so a client may close and reopen
+  slave = ::open(sname, O_RDWR | O_NOCTTY);
+  if (slave >= 0)
+  { // raw mode, no echo
+    struct termios options;
+    tcgetattr(slave, &options);
+    cfmakeraw(&options);
+    tcsetattr(slave, TCSANOW, &options);
+  }
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+  if (not link.empty())
+  {
+    unlink(link.c_str());
+    if (symlink(sname, link.c_str()) != 0)
+      perror("# UTeensySim::open: failed to make link");
+  }
+  printf("# UTeensySim:: Teensy simulator on %s%s%s\n", sname,
+         link.empty() ? "" : ", linked from ", link.c_str());
+  startTime = 0;
+  startTime = now();
+  return true;
+}
+
+void UTeensySim::close()
+{
+  if (not link.empty())
+    unlink(link.c_str());
+  if (slave >= 0)
+    ::close(slave);
+  if (master >= 0)
+    ::close(master);
+  master = -1;
+}
+
+void UTeensySim::run()
+{
+  while (not stopSim)
+  { // wait for a command or the next subscription
+    double t = now();
+    double next = t + 0.1;
+    for (int i = 0; i < UBIN_TYPES; i++)
+    {
+      if (interval[i] > 0 and nextTime[i] < next)
+        next = nextTime[i];
+    }
+    struct pollfd pfd;
+    pfd.fd = master;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    double dt = next - t;
+    if (dt < 0)
+      dt = 0;
+    struct timespec ts;
+    ts.tv_sec = int(dt);
+    ts.tv_nsec = int((dt - ts.tv_sec) * 1e9);
+    int e = ppoll(&pfd, 1, &ts, nullptr);
+    if (e > 0 and (pfd.revents & POLLIN))
+      receive();
+    t = now();
+    flushTx();
+    updateModel(t);
+    for (int i = 0; i < UBIN_TYPES; i++)
+    {
+      if (interval[i] > 0 and t >= nextTime[i])
+      {
+        sendData(i);
+        nextTime[i] += interval[i];
+        if (nextTime[i] < t)
+          // too far behind, skip
+          nextTime[i] = t + interval[i];
+      }
+    }
+    if (statInterval > 0 and t - statTime >= statInterval)
+      printStat(t);
+  }
+}
+
+void UTeensySim::receive()
+{
+  int n = read(master, &rx[rxCnt], sizeof(rx) - 1 - rxCnt);
+  if (n <= 0)
+    return;
+  rxCnt += n;
+  rx[rxCnt] = '\0';
+  char * p1 = rx;
+  char * p2;
+  while ((p2 = strpbrk(p1, "\r\n")) != nullptr)
+  {
+    *p2 = '\0';
+    if (p2 > p1)
+      handleLine(p1);
+    p1 = p2 + 1;
+  }
+  rxCnt -= p1 - rx;
+  memmove(rx, p1, rxCnt);
+  if (rxCnt >= (int)sizeof(rx) - 1)
+    // no newline, discard
+    rxCnt = 0;
+}
+
+void UTeensySim::handleLine(char * line)
+{
+  char * msg = line;
+  if (line[0] == ';')
+  { // check CRC, as in the firmware
+    int crc = (line[1] - '0') * 10 + (line[2] - '0');
+    int sum = 0;
+    for (char * p1 = &line[3]; *p1 != '\0'; p1++)
+    {
+      if (*p1 >= ' ')
+        sum += *p1;
+    }
+    if ((sum % 99) + 1 != crc)
+    {
+      statCrcErr++;
+      const int MSL = 300;
+      char s[MSL];
+      snprintf(s, MSL, "# CRC failed (crc=%d, found to be %d) for '%s'\r\n", crc, (sum % 99) + 1, line);
+      sendText(s);
+      return;
+    }
+    msg = &line[3];
+  }
+  // confirm request, like '!sub enc 10' or '!17:sub enc 10'
+  bool confirm = msg[0] == '!';
+  int seqLen = 0;
+  char * cmd = msg;
+  if (confirm)
+  {
+    cmd++;
+    while (isdigit(cmd[seqLen]))
+      seqLen++;
+    if (seqLen > 0 and cmd[seqLen] == ':')
+      cmd += seqLen + 1;
+    else
+      seqLen = 0;
+  }
+  command(cmd);
+  statCmd++;
+  if (confirm)
+  {
+    const int MSL = 250;
+    char s[MSL];
+    if (seqLen > 0)
+      snprintf(s, MSL, "confirm !%.*s:\n", seqLen, &msg[1]);
+    else
+      snprintf(s, MSL, "confirm %s\n", msg);
+    sendText(s);
+  }
+}
+
+void UTeensySim::command(const char * cmd)
+{
+  if (strncmp(cmd, "sub ", 4) == 0)
+  { // like 'sub enc 10' (ms)
+    const char * p1 = &cmd[4];
+    while (*p1 == ' ')
+      p1++;
+    int n = strcspn(p1, " ");
+    std::string key(p1, n);
+    float ms = strtof(&p1[n], nullptr);
+    int type = -1;
+    if (key == "id")
+      type = UBIN_NONE;
+    for (int i = 1; i < UBIN_TYPES; i++)
+    {
+      if (key == ubinKeyName(i))
+        type = i;
+    }
+    if (type >= 0)
+    {
+      interval[type] = ms * 0.001;
+      nextTime[type] = now();
+    }
+  }
+  else if (strncmp(cmd, "motv ", 5) == 0)
+  {
+    const char * p1 = &cmd[5];
+    u[0] = strtof(p1, (char **)&p1);
+    u[1] = strtof(p1, (char **)&p1);
+  }
+  else if (strncmp(cmd, "leave", 5) == 0)
+  { // stop all subscriptions
+    for (int i = 0; i < UBIN_TYPES; i++)
+      interval[i] = 0;
+  }
+  else if (strncmp(cmd, "bin ", 4) == 0)
+    binary = strtol(&cmd[4], nullptr, 10) == 1;
+  else if (strncmp(cmd, "enc0", 4) == 0)
+  { // reset encoder and pose
+    encPos[0] = 0;
+    encPos[1] = 0;
+    pose[0] = 0;
+    pose[1] = 0;
+    pose[2] = 0;
+  }
+  else if (strncmp(cmd, "hbti", 4) == 0)
+    sendData(UBIN_HBT);
+  // anything else (alive, leds, servo ...) is accepted, but ignored
+}
+
+bool UTeensySim::sendText(const char * msg)
+{
+  const int MSL = 400;
+  char s[MSL];
+  int sum = 0;
+  for (const char * p1 = msg; *p1 != '\0'; p1++)
+  {
+    if (*p1 >= ' ')
+      sum += *p1;
+  }
+  int n = snprintf(s, MSL, ";%02d%s", (sum % 99) + 1, msg);
+  if (n >= MSL)
+    n = MSL - 1;
+  return sendRaw(s, n);
+}
+
+bool UTeensySim::sendRaw(const char * data, int n)
+{
+  statSend++;
+  flushTx();
+  if (not txRest.empty())
+  { // buffer full, client is not reading
+    statLost++;
+    return false;
+  }
+  int m = write(master, data, n);
+  if (m < 0)
+  {
+    statLost++;
+    return false;
+  }
+  if (m < n)
+    // keep the rest, so that no message is broken
+    txRest.assign(&data[m], n - m);
+  return true;
+}
+
+void UTeensySim::flushTx()
+{
+  if (not txRest.empty())
+  {
+    int m = write(master, txRest.c_str(), txRest.size());
+    if (m > 0)
+      txRest.erase(0, m);
+  }
+}
+
+void UTeensySim::sendData(int type)
+{
+  float t = now();
+  int cnt = ++sendCnt[type];
+  const int MSL = 200;
+  char s[MSL];
+  union
+  {
+    UBinEnc enc;
+    UBinPose pose;
+    UBinVel vel;
+    UBinImu imu;
+    UBinLiv liv;
+    UBinHbt hbt;
+    UBinIr ir;
+    UBinIrd ird;
+    UBinMca mca;
+  } m;
+  switch (type)
+  {
+    case UBIN_NONE:
+      snprintf(s, MSL, "dname robobot %s\r\n", name.c_str());
+      sendText(s);
+      return;
+    case UBIN_ENC:
+      m.enc.enc[0] = int64_t(encPos[0]);
+      m.enc.enc[1] = int64_t(encPos[1]);
+      snprintf(s, MSL, "enc %u %u\r\n", m.enc.enc[0], m.enc.enc[1]);
+      break;
+    case UBIN_POSE:
+      m.pose.time = t;
+      m.pose.pose[0] = pose[0];
+      m.pose.pose[1] = pose[1];
+      m.pose.pose[2] = pose[2];
+      m.pose.pose[3] = 0;
+      snprintf(s, MSL, "pose %.4f %.3f %.3f %.4f %.4f\n", m.pose.time, m.pose.pose[0], m.pose.pose[1],
+               m.pose.pose[2], m.pose.pose[3]);
+      break;
+    case UBIN_VEL:
+      m.vel.time = t;
+      m.vel.wheelVel[0] = wheelVel[0];
+      m.vel.wheelVel[1] = wheelVel[1];
+      m.vel.turnrate = (wheelVel[1] - wheelVel[0]) / wheelBase;
+      m.vel.velocity = (wheelVel[0] + wheelVel[1]) / 2;
+      m.vel.cnt = cnt;
+      snprintf(s, MSL, "vel %.4f %.3f %.3f %.4f %.3f %d\n", m.vel.time, m.vel.wheelVel[0], m.vel.wheelVel[1],
+               m.vel.turnrate, m.vel.velocity, m.vel.cnt);
+      break;
+    case UBIN_GYRO:
+    case UBIN_ACC:
+      // gyro turnrate (deg/s) around z, acc is gravity only
+      m.imu.v[0] = 0;
+      m.imu.v[1] = 0;
+      if (type == UBIN_GYRO)
+        m.imu.v[2] = (wheelVel[1] - wheelVel[0]) / wheelBase * 180 / M_PI;
+      else
+        m.imu.v[2] = 1.0;
+      m.imu.time = t;
+      snprintf(s, MSL, "%s %f %f %f %.3f\r\n", ubinKeyName(type), m.imu.v[0], m.imu.v[1], m.imu.v[2], m.imu.time);
+      break;
+    case UBIN_LIV:
+    case UBIN_LIVN:
+      // a line under the middle sensors
+      for (int i = 0; i < 8; i++)
+        m.liv.v[i] = (i == 3 or i == 4) ? 800 : 50;
+      m.liv.cnt = cnt;
+      snprintf(s, MSL, "%s %d %d %d %d %d %d %d %d %d\r\n", ubinKeyName(type), m.liv.v[0], m.liv.v[1], m.liv.v[2],
+               m.liv.v[3], m.liv.v[4], m.liv.v[5], m.liv.v[6], m.liv.v[7], m.liv.cnt);
+      break;
+    case UBIN_HBT:
+      m.hbt.time = t;
+      m.hbt.deviceID = 100;
+      m.hbt.revision = 1033;
+      m.hbt.batteryVoltage = 12.0;
+      m.hbt.state = 0;
+      m.hbt.hwType = 8;
+      m.hbt.load = 10.0;
+      m.hbt.supplyCurrent = 0.3 + 0.1 * (fabsf(u[0]) + fabsf(u[1]));
+      m.hbt.batLowCnt = 0;
+      snprintf(s, MSL, "hbt %.4f %d %d %.2f %d %d %.1f %.2f %d\r\n", m.hbt.time, m.hbt.deviceID, m.hbt.revision,
+               m.hbt.batteryVoltage, m.hbt.state, m.hbt.hwType, m.hbt.load, m.hbt.supplyCurrent, m.hbt.batLowCnt);
+      break;
+    case UBIN_IR:
+      m.ir.distance[0] = 0.5;
+      m.ir.distance[1] = 0.8;
+      m.ir.raw[0] = 2000;
+      m.ir.raw[1] = 1500;
+      m.ir.cal13cm[0] = m.ir.cal13cm[1] = 3000;
+      m.ir.cal50cm[0] = m.ir.cal50cm[1] = 2000;
+      m.ir.used = 1;
+      snprintf(s, MSL, "ir %.3f %.3f %u %u %u %u %u %u %d \r\n", m.ir.distance[0], m.ir.distance[1],
+               m.ir.raw[0], m.ir.raw[1], m.ir.cal13cm[0], m.ir.cal50cm[0], m.ir.cal13cm[1], m.ir.cal50cm[1], m.ir.used);
+      break;
+    case UBIN_IRD:
+      m.ird.distance[0] = 0.5;
+      m.ird.distance[1] = 0.8;
+      m.ird.raw[0] = 2000;
+      m.ird.raw[1] = 1500;
+      m.ird.used = 1;
+      snprintf(s, MSL, "ird %.3f %.3f %u %u %d\r\n", m.ird.distance[0], m.ird.distance[1],
+               m.ird.raw[0], m.ird.raw[1], m.ird.used);
+      break;
+    case UBIN_MCA:
+      // current proportional to voltage
+      m.mca.current[0] = 0.1 * u[0];
+      m.mca.current[1] = 0.1 * u[1];
+      m.mca.cnt = cnt;
+      snprintf(s, MSL, "mca %.3f %.3f %d\r\n", m.mca.current[0], m.mca.current[1], m.mca.cnt);
+      break;
+    default:
+      return;
+  }
+  if (binary)
+  {
+    uint8_t frame[UBIN_MAX_FRAME];
+    int n = ubinMakeFrame(type, &m, ubinPayloadSize(type), frame);
+    sendRaw((const char *)frame, n);
+  }
+  else
+    sendText(s);
+}
+
+void UTeensySim::updateModel(double t)
+{ // first order motor model, integrated in steps of max 1 ms
+  float ticksPerMeter = encTicks * gear / (2 * M_PI * wheelRadius);
+  while (modelTime < t)
+  {
+    float dt = fmin(t - modelTime, 0.001);
+    for (int i = 0; i < 2; i++)
+    {
+      wheelVel[i] += (velPerVolt * u[i] - wheelVel[i]) * dt / tau;
+      encPos[i] += wheelVel[i] * dt * ticksPerMeter;
+    }
+    float v = (wheelVel[0] + wheelVel[1]) / 2;
+    float w = (wheelVel[1] - wheelVel[0]) / wheelBase;
+    pose[0] += v * cosf(pose[2]) * dt;
+    pose[1] += v * sinf(pose[2]) * dt;
+    pose[2] += w * dt;
+    modelTime += dt;
+  }
+}
+
+void UTeensySim::printStat(double t)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+  double dt = t - statTime;
+  printf("# UTeensySim:: %.0f msg/s, %d lost (not read by client), %.0f cmd/s, %d CRC errors, CPU %.1f%%\n",
+         statSend / dt, statLost, statCmd / dt, statCrcErr, (cpu - statCpu) / dt * 100);
+  statSend = 0;
+  statLost = 0;
+  statCmd = 0;
+  statCrcErr = 0;
+  statCpu = cpu;
+  statTime = t;
+}
+
+int main(int argc, char ** argv)
+{
+  CLI::App cli{"Teensy simulator on a pseudo-terminal"};
+  UTeensySim sim;
+  cli.add_option("-l,--link", sim.link, "Make a symbolic link to the pseudo-terminal, e.g. /tmp/teensy_sim");
+  cli.add_option("-n,--name", sim.name, "Robot name (default 'sim')");
+  cli.add_option("-s,--stat", sim.statInterval, "Statistics interval in seconds (0 = none, default 5)");
+  cli.add_option("--wheelbase", sim.wheelBase, "Distance between wheels (m)");
+  cli.add_option("--radius", sim.wheelRadius, "Wheel radius (m)");
+  cli.add_option("--gear", sim.gear, "Gear ratio");
+  cli.add_option("--ticks", sim.encTicks, "Encoder ticks per motor revolution");
+  cli.add_option("--vel-per-volt", sim.velPerVolt, "Steady state wheel velocity (m/s) per volt");
+  cli.add_option("--tau", sim.tau, "Motor time constant (sec)");
+  CLI11_PARSE(cli, argc, argv);
+  //
+  signal(SIGINT, signalHandler);
+  signal(SIGTERM, signalHandler);
+  if (not sim.open())
+    return 1;
+  sim.run();
+  sim.close();
+  printf("# UTeensySim:: ended\n");
+  return 0;
+}
@@ -0,0 +1,147 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#include <string>
+#include <string.h>
+#include "uconfig.h"
+#include "uservice.h"
+
+// create value
+UConfig config;
+
+
+void UConfig::setup()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  build();
+}
+
+void UConfig::build()
+{
+  UConfigData * d = new UConfigData();
+  d->mqtt.use = ini["mqtt"]["use"] == "true";
+  d->mqttin.use = ini["mqttin"]["use"] == "true";
+  d->gpio.stopOnStop = ini["gpio"]["stop_on_stop"] == "true";
+  for (int tn = 0; tn < NUM_TEENSY_MAX; tn++)
+  {
+    std::string sec = "distforce" + std::to_string(tn);
+    if (ini.has(sec))
+      d->distforce[tn].force = ini[sec]["force"] == "true";
+  }
+  d->version = ++version;
+  snapshots.push_back(d);
+  current.store(d, std::memory_order_release);
+}
+
+void UConfig::setIni(const std::string& section, const std::string& key, const std::string& value)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  addWrite(section, key, value);
+}
+
+void UConfig::addWrite(const std::string& section, const std::string& key, const std::string& value)
+{
+  for (UIniWrite & w : pending)
+  { // replace an earlier write to the same key
+    if (w.section == section and w.key == key)
+    {
+      w.value = value;
+      return;
+    }
+  }
+  pending.push_back({section, key, value});
+}
+
+void UConfig::flush()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (UIniWrite & w : pending)
+    ini[w.section][w.key] = w.value;
+  pending.clear();
+  if (rebuild)
+  { // new values for the snapshot (from 'config' message)
+    rebuild = false;
+    build();
+    printf("# UConfig::flush: configuration version %d\n", version);
+  }
+}
+
+bool UConfig::decode(const char* msg, const char* params, UTime& msgTime)
+{
+  bool used = true;
+  if (strcmp(msg, "config") == 0)
+  {
+    const int MSL = 200;
+    char s[MSL];
+    strncpy(s, params, MSL - 1);
+    s[MSL - 1] = '\0';
+    char * save = nullptr;
+    const char * cmd = strtok_r(s, " \t\r\n", &save);
+    if (cmd == nullptr)
+      return true;
+    std::lock_guard<std::mutex> guard(lock);
+    if (strcmp(cmd, "reload") == 0)
+    { // read robot.ini again (values not in the file are kept)
+      mINI::INIStructure fromFile;
+      if (service.iniFile != nullptr and service.iniFile->read(fromFile))
+      { // merged into ini by flush(), as other threads use the ini structure
+        for (auto const & sec : fromFile)
+          for (auto const & kv : sec.second)
+            addWrite(sec.first, kv.first, kv.second);
+        rebuild = true;
+        printf("# UConfig::decode: reloaded %s\n", service.iniFileName.c_str());
+      }
+      else
+        printf("# UConfig::decode: failed to read %s\n", service.iniFileName.c_str());
+    }
+    else if (strcmp(cmd, "set") == 0)
+    { // like 'set mqtt use false'
+      const char * sec = strtok_r(nullptr, " \t\r\n", &save);
+      const char * key = strtok_r(nullptr, " \t\r\n", &save);
+      const char * value = strtok_r(nullptr, "\r\n", &save);
+      if (sec != nullptr and key != nullptr)
+      {
+        addWrite(sec, key, value == nullptr ? "" : value);
+        rebuild = true;
+        printf("# UConfig::decode: [%s] %s = %s\n", sec, key, value == nullptr ? "" : value);
+      }
+    }
+    else
+      printf("# UConfig::decode: unknown config command '%s'\n", params);
+  }
+  else
+    used = false;
+  (void)msgTime;
+  return used;
+}
+
+void UConfig::terminate()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  current.store(&defaults, std::memory_order_release);
+  for (UConfigData * d : snapshots)
+    delete d;
+  snapshots.clear();
+}
@@ -0,0 +1,123 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef UCONFIG_H
+#define UCONFIG_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utime.h"
+#include "steensy.h"
+
+/**
+ * Typed values from robot.ini, that are used for every message.
+ * Parsed once, so that no string lookup or compare is needed. */
+struct UConfigData
+{
+  struct Mqtt
+  {
+    bool use = true;
+  } mqtt;
+  struct MqttIn
+  {
+    bool use = true;
+  } mqttin;
+  struct Gpio
+  {
+    bool stopOnStop = true;
+  } gpio;
+  struct DistForce
+  {
+    bool force = true;
+  } distforce[NUM_TEENSY_MAX];
+  /// incremented at every reload
+  int version = 0;
+};
+
+/**
+ * Typed configuration snapshot for hot paths.
+ * Readers get a pointer to the current (read-only) snapshot without locks,
+ * a reload makes a new snapshot and swaps the pointer (old snapshots are
+ * kept until terminate, so a reader may finish using it).
+ * Writes to the ini structure from data threads are deferred and
+ * applied by flush() from the service thread (and before the ini-file is saved).
+ * MQTT 'robobot/cmd/ti/config' (applied by flush() too):
+ *   'reload'                 read robot.ini again
+ *   'set section key value'  set an ini value and update the snapshot
+ * */
+class UConfig
+{
+public:
+  /**
+   * Make snapshot from ini, call when all modules have made their defaults */
+  void setup();
+  /**
+   * Current snapshot, never null */
+  const UConfigData * get() const
+  {
+    return current.load(std::memory_order_acquire);
+  }
+  /**
+   * Set a value in the ini structure, applied by flush().
+   * Intended for values that change while running (e.g. used battery capacity). */
+  void setIni(const std::string & section, const std::string & key, const std::string & value);
+  /**
+   * Apply deferred ini writes, called by service thread */
+  void flush();
+  /**
+   * Decode messages
+   * \returns true if used */
+  bool decode(const char* msg, const char * params, UTime & msgTime);
+  /** release old snapshots */
+  void terminate();
+
+private:
+  /** parse ini into a new snapshot and make it current, call with lock */
+  void build();
+  /** add to pending ini writes, call with lock */
+  void addWrite(const std::string & section, const std::string & key, const std::string & value);
+  UConfigData defaults;
+  std::atomic<const UConfigData *> current{&defaults};
+  /// all snapshots made (released at terminate)
+  std::vector<UConfigData *> snapshots;
+  struct UIniWrite
+  {
+    std::string section;
+    std::string key;
+    std::string value;
+  };
+  std::vector<UIniWrite> pending;
+  /// make a new snapshot at next flush()
+  bool rebuild = false;
+  std::mutex lock;
+  int version = 0;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern UConfig config;
+
+#endif
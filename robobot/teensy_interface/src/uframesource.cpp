@@ -0,0 +1,346 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <filesystem>
+#include <algorithm>
+#include <fstream>
+#include "uframesource.h"
+
+
+///////////////////////////////////////////////////////////
+
+UFrameSourceV4l::UFrameSourceV4l(const std::string & device, int width, int height)
+{
+  name = device;
+  w = width;
+  h = height;
+}
+
+bool UFrameSourceV4l::open()
+{
+  bool isOK = cap.open(name, cv::CAP_V4L2);
+  if (isOK)
+  {
+    if (w > 0 and h > 0)
+    {
+      cap.set(cv::CAP_PROP_FRAME_WIDTH, w);
+      cap.set(cv::CAP_PROP_FRAME_HEIGHT, h);
+    }
+    // keep as few frames as possible in the driver
+    cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+  }
+  else
+    printf("# UFrameSourceV4l::open: failed to open %s\n", name.c_str());
+  return isOK;
+}
+
+bool UFrameSourceV4l::grab(UVisionFrame & frame)
+{
+  bool isOK = cap.read(frame.img);
+  if (isOK)
+  { // already decoded
+    frame.captureTime.now();
+    frame.data.clear();
+    frame.seq = seq++;
+  }
+  else
+    close();
+  return isOK;
+}
+
+void UFrameSourceV4l::close()
+{
+  cap.release();
+}
+
+///////////////////////////////////////////////////////////
+
+UFrameSourceMjpeg::UFrameSourceMjpeg(const std::string & url)
+{ // like http://localhost:7123/stream.mjpg
+  name = url;
+  std::string s = url;
+  if (s.compare(0, 7, "http://") == 0)
+    s = s.substr(7);
+  size_t n = s.find('/');
+  if (n != std::string::npos)
+  {
+    path = s.substr(n);
+    s = s.substr(0, n);
+  }
+  n = s.find(':');
+  if (n != std::string::npos)
+  {
+    port = s.substr(n + 1);
+    s = s.substr(0, n);
+  }
+  host = s;
+  rx.resize(200000);
+}
+
+bool UFrameSourceMjpeg::open()
+{
+  struct addrinfo hints;
+  struct addrinfo * res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+  if (err != 0)
+  {
+    printf("# UFrameSourceMjpeg::open: unknown host %s (%s)\n", host.c_str(), gai_strerror(err));
+    return false;
+  }
+  for (struct addrinfo * a = res; a != nullptr; a = a->ai_next)
+  {
+    sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (sock < 0)
+      continue;
+    if (connect(sock, a->ai_addr, a->ai_addrlen) == 0)
+      break;
+    ::close(sock);
+    sock = -1;
+  }
+  freeaddrinfo(res);
+  if (sock < 0)
+  {
+    printf("# UFrameSourceMjpeg::open: failed to connect to %s:%s\n", host.c_str(), port.c_str());
+    return false;
+  }
+  // do not wait forever for a frame
+  struct timeval tv = {2, 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: keep-alive\r\n\r\n";
+  int n = send(sock, req.c_str(), req.size(), MSG_NOSIGNAL);
+  if (n != (int)req.size())
+  {
+    close();
+    return false;
+  }
+  rxCnt = 0;
+  gotHttpHeader = false;
+  return true;
+}
+
+bool UFrameSourceMjpeg::readMore()
+{
+  if (rxCnt >= (int)rx.size())
+  { // a frame is larger than the buffer
+    rx.resize(rx.size() * 2);
+  }
+  int n = recv(sock, rx.data() + rxCnt, rx.size() - rxCnt, 0);
+  if (n <= 0)
+  {
+    printf("# UFrameSourceMjpeg::readMore: connection to %s lost\n", name.c_str());
+    close();
+    return false;
+  }
+  rxCnt += n;
+  return true;
+}
+
+bool UFrameSourceMjpeg::grab(UVisionFrame & frame)
+{ // each part is like:
+  // --FRAME\r\nContent-Type: image/jpeg\r\nContent-Length: 12345\r\n\r\n<jpeg>\r\n
+  if (sock < 0)
+    return false;
+  const char * hdrEnd = nullptr;
+  const char * cl = nullptr;
+  while (true)
+  { // find part header
+    char * p = rx.data();
+    hdrEnd = (const char*)memmem(p, rxCnt, "\r\n\r\n", 4);
+    if (hdrEnd != nullptr and not gotHttpHeader)
+    { // skip HTTP response header
+      gotHttpHeader = true;
+      int used = hdrEnd + 4 - p;
+      rxCnt -= used;
+      memmove(p, p + used, rxCnt);
+      continue;
+    }
+    if (hdrEnd != nullptr)
+    {
+      cl = (const char*)memmem(p, hdrEnd - p, "Content-Length:", 15);
+      if (cl != nullptr)
+        break;
+      // no length in this header, skip
+      int used = hdrEnd + 4 - p;
+      rxCnt -= used;
+      memmove(p, p + used, rxCnt);
+      continue;
+    }
+    if (not readMore())
+      return false;
+  }
+  // the stream server has no timestamp, so use arrival of header
+  frame.captureTime.now();
+  int len = strtol(cl + 15, nullptr, 10);
+  int start = hdrEnd + 4 - rx.data();
+  while (rxCnt < start + len)
+  {
+    if (start + len > (int)rx.size())
+      rx.resize(start + len + 1000);
+    if (not readMore())
+      return false;
+  }
+  frame.data.assign(rx.data() + start, rx.data() + start + len);
+  frame.seq = seq++;
+  // remove used part
+  int used = start + len;
+  rxCnt -= used;
+  memmove(rx.data(), rx.data() + used, rxCnt);
+  return true;
+}
+
+void UFrameSourceMjpeg::close()
+{
+  if (sock >= 0)
+  {
+    ::close(sock);
+    sock = -1;
+  }
+}
+
+///////////////////////////////////////////////////////////
+
+UFrameSourceDir::UFrameSourceDir(const std::string & dir, float fps, bool loopFiles)
+{
+  name = dir;
+  dirName = dir;
+  if (fps < 0.1)
+    fps = 0.1;
+  interval = 1.0 / fps;
+  loop = loopFiles;
+}
+
+bool UFrameSourceDir::open()
+{
+  if (finished)
+    return false;
+  files.clear();
+  std::error_code ec;
+  for (auto & e : std::filesystem::directory_iterator(dirName, ec))
+  {
+    std::string ext = e.path().extension().string();
+    if (ext == ".jpg" or ext == ".jpeg" or ext == ".png")
+      files.push_back(e.path().string());
+  }
+  std::sort(files.begin(), files.end());
+  next = 0;
+  if (files.empty())
+    printf("# UFrameSourceDir::open: no images (jpg or png) in '%s'\n", dirName.c_str());
+  return not files.empty();
+}
+
+bool UFrameSourceDir::grab(UVisionFrame & frame)
+{
+  if (next >= (int)files.size())
+  {
+    if (not loop or files.empty())
+    { // finished
+      if (not finished)
+        printf("# UFrameSourceDir::grab: used all %d images in '%s'\n", (int)files.size(), dirName.c_str());
+      finished = true;
+      return false;
+    }
+    next = 0;
+  }
+  // keep frame rate
+  float dt = interval - lastGrab.getTimePassed();
+  if (dt > 0)
+    usleep(int(dt * 1e6));
+  lastGrab.now();
+  std::ifstream f(files[next], std::ios::binary);
+  next++;
+  if (not f)
+    return false;
+  f.seekg(0, std::ios::end);
+  int n = f.tellg();
+  f.seekg(0, std::ios::beg);
+  frame.data.resize(n);
+  f.read((char*)frame.data.data(), n);
+  frame.captureTime.now();
+  frame.seq = seq++;
+  return true;
+}
+
+void UFrameSourceDir::close()
+{
+  files.clear();
+}
+
+///////////////////////////////////////////////////////////
+
+UFrameSourceShm::UFrameSourceShm(const std::string & shmName)
+{
+  name = shmName;
+}
+
+bool UFrameSourceShm::open()
+{
+  bool isOK = ring.attach(name);
+  if (isOK)
+    lastN = ring.latest();
+  return isOK;
+}
+
+bool UFrameSourceShm::grab(UVisionFrame & frame)
+{
+  if (not ring.isOpen())
+    return false;
+  UTime t("now");
+  while (t.getTimePassed() < 2.0)
+  {
+    uint64_t n = ring.latest();
+    if (n == lastN)
+    { // wait for next frame
+      usleep(2000);
+      continue;
+    }
+    const uint8_t * p = ring.frame(n, frame.captureTime);
+    if (p == nullptr)
+      continue;
+    // copy, as the frame is used by other threads after the slot may be reused
+    cv::Mat img(ring.height(), ring.width(), CV_8UC3, (void *)p);
+    img.copyTo(frame.img);
+    if (not ring.isValid(n))
+      // overwritten while copying
+      continue;
+    frame.data.clear();
+    frame.seq = n;
+    lastN = n;
+    return true;
+  }
+  // no frames, the broker may be restarted
+  close();
+  return false;
+}
+
+void UFrameSourceShm::close()
+{
+  ring.close();
+}
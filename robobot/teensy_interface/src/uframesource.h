@@ -0,0 +1,202 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef UFRAMESOURCE_H
+#define UFRAMESOURCE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "utime.h"
+#include "ushmframes.h"
+
+/**
+ * One camera frame, either encoded (JPEG or PNG) or decoded.
+ * The buffers are reused, so after the first frames
+ * the pipeline does not allocate memory.
+ * */
+class UVisionFrame
+{
+public:
+  /// encoded image, empty if source delivers decoded images
+  std::vector<uchar> data;
+  /// decoded image (BGR)
+  cv::Mat img;
+  /// time of capture (or arrival, if source has no timestamp)
+  UTime captureTime;
+  /// frame number from source
+  int seq = 0;
+};
+
+/**
+ * Newest frame between two pipeline stages.
+ * If the consumer is too slow, an unused frame is replaced
+ * (dropped), so the consumer always gets the newest frame.
+ * Frames are swapped, not copied.
+ * */
+class UFrameSlot
+{
+public:
+  /**
+   * Put frame into slot, the frame gets the buffers of the old frame
+   * \returns false if an unused frame was dropped */
+  bool put(UVisionFrame & frame)
+  {
+    bool dropped;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      dropped = full;
+      std::swap(frame, slot);
+      full = true;
+    }
+    newFrame.notify_one();
+    return not dropped;
+  }
+  /**
+   * Get the newest frame (swapped with this frame)
+   * \param timeout_sec is the max wait time
+   * \returns false if no new frame */
+  bool take(UVisionFrame & frame, float timeout_sec)
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (not newFrame.wait_for(lock, std::chrono::duration<float>(timeout_sec), [this]{ return full; }))
+      return false;
+    std::swap(frame, slot);
+    full = false;
+    return true;
+  }
+
+private:
+  UVisionFrame slot;
+  bool full = false;
+  std::mutex mtx;
+  std::condition_variable newFrame;
+};
+
+/**
+ * Source of camera frames
+ * */
+class UFrameSource
+{
+public:
+  virtual ~UFrameSource() {}
+  /**
+   * Open the source
+   * \returns true if open */
+  virtual bool open() = 0;
+  /**
+   * Get next frame (blocking until a frame is available)
+   * \returns false on error (source is then closed) */
+  virtual bool grab(UVisionFrame & frame) = 0;
+  /** close the source */
+  virtual void close() = 0;
+  /** source name for messages */
+  std::string name;
+};
+
+/**
+ * Camera device using V4L2 (through OpenCV), frames are decoded
+ * */
+class UFrameSourceV4l : public UFrameSource
+{
+public:
+  UFrameSourceV4l(const std::string & device, int width, int height);
+  bool open() override;
+  bool grab(UVisionFrame & frame) override;
+  void close() override;
+private:
+  cv::VideoCapture cap;
+  int w, h;
+  int seq = 0;
+};
+
+/**
+ * MJPEG over HTTP, e.g. the stream server
+ * 'http://localhost:7123/stream.mjpg', frames are JPEG
+ * */
+class UFrameSourceMjpeg : public UFrameSource
+{
+public:
+  UFrameSourceMjpeg(const std::string & url);
+  bool open() override;
+  bool grab(UVisionFrame & frame) override;
+  void close() override;
+private:
+  /** read more data from socket into rx buffer
+   * \returns false on error or connection closed */
+  bool readMore();
+  std::string host;
+  std::string port = "80";
+  std::string path = "/";
+  int sock = -1;
+  /// received data not used yet
+  std::vector<char> rx;
+  int rxCnt = 0;
+  bool gotHttpHeader = false;
+  int seq = 0;
+};
+
+/**
+ * Directory of image files (jpg or png) for offline tests,
+ * files are used in name order at a fixed frame rate
+ * */
+class UFrameSourceDir : public UFrameSource
+{
+public:
+  UFrameSourceDir(const std::string & dir, float fps, bool loop);
+  bool open() override;
+  bool grab(UVisionFrame & frame) override;
+  void close() override;
+private:
+  std::string dirName;
+  std::vector<std::string> files;
+  int next = 0;
+  float interval;
+  bool loop;
+  /// all files are used (and no loop)
+  bool finished = false;
+  UTime lastGrab;
+  int seq = 0;
+};
+
+/**
+ * Frames (BGR) from the shared memory ring (camera_shm.py or frame_broker),
+ * each frame is copied, as it is passed on to other threads
+ * */
+class UFrameSourceShm : public UFrameSource
+{
+public:
+  UFrameSourceShm(const std::string & shmName);
+  bool open() override;
+  bool grab(UVisionFrame & frame) override;
+  void close() override;
+private:
+  UShmFrames ring;
+  uint64_t lastN = 0;
+};
+
+#endif
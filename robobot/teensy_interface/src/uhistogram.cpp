@@ -0,0 +1,138 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#include <stdio.h>
+#include "uhistogram.h"
+
+
+int UHistogram::binOf(uint64_t us)
+{
+  if (us < 8)
+    return us;
+  int octave = 63 - __builtin_clzll(us);
+  int bin = (octave - 2) * 8 + ((us >> (octave - 3)) & 7);
+  if (bin >= BINS)
+    bin = BINS - 1;
+  return bin;
+}
+
+uint64_t UHistogram::binLow(int bin)
+{
+  if (bin < 8)
+    return bin;
+  int octave = bin / 8 + 2;
+  return (uint64_t(8 + bin % 8)) << (octave - 3);
+}
+
+void UHistogram::add(float sec)
+{
+  if (sec < 0)
+    sec = 0;
+  int64_t us = int64_t(sec * 1e6);
+  bins[binOf(us)].fetch_add(1, std::memory_order_relaxed);
+  cnt.fetch_add(1, std::memory_order_relaxed);
+  sumUs.fetch_add(us, std::memory_order_relaxed);
+  int64_t m = maxUs.load(std::memory_order_relaxed);
+  while (us > m and not maxUs.compare_exchange_weak(m, us, std::memory_order_relaxed))
+  {} // m is updated by compare_exchange
+}
+
+void UHistogram::clear()
+{
+  for (int i = 0; i < BINS; i++)
+    bins[i] = 0;
+  cnt = 0;
+  sumUs = 0;
+  maxUs = 0;
+}
+
+float UHistogram::mean() const
+{
+  int64_t n = count();
+  if (n == 0)
+    return 0;
+  return sumUs.load(std::memory_order_relaxed) * 1e-6 / n;
+}
+
+float UHistogram::quantile(float q) const
+{
+  int64_t n = count();
+  if (n == 0)
+    return 0;
+  int64_t lim = int64_t(q * n);
+  int64_t sum = 0;
+  for (int i = 0; i < BINS; i++)
+  {
+    sum += bins[i].load(std::memory_order_relaxed);
+    if (sum > lim)
+    { // upper limit of this bin, but not above max
+      float v = binLow(i + 1) * 1e-6;
+      if (v > max())
+        v = max();
+      return v;
+    }
+  }
+  return max();
+}
+
+void UHistogram::print(const char * name) const
+{
+  printf("#   %-24s %9lld %8.3f %8.3f %8.3f %8.3f %8.3f\n", name, (long long)count(),
+         mean() * 1000, quantile(0.5) * 1000, quantile(0.9) * 1000,
+         quantile(0.99) * 1000, max() * 1000);
+}
+
+const char * UHistogram::format(const char * name, char * s, int MSL) const
+{
+  snprintf(s, MSL, "%s %lld %.3f %.3f %.3f %.3f %.3f\n", name, (long long)count(),
+           mean() * 1000, quantile(0.5) * 1000, quantile(0.9) * 1000,
+           quantile(0.99) * 1000, max() * 1000);
+  return s;
+}
+
+void UHistogram::printBins(const char * name) const
+{
+  int64_t n = count();
+  printf("# %s histogram (%lld values)\n", name, (long long)n);
+  if (n == 0)
+    return;
+  // sum for each doubling of time
+  for (int i = 0; i < BINS; i += 8)
+  {
+    int64_t s = 0;
+    for (int j = i; j < i + 8; j++)
+      s += bins[j].load(std::memory_order_relaxed);
+    if (s == 0)
+      continue;
+    const int MBL = 41;
+    char bar[MBL];
+    int b = s * (MBL - 1) / n;
+    for (int j = 0; j < b; j++)
+      bar[j] = '#';
+    bar[b] = '\0';
+    printf("#   %10.3f - %10.3f ms %9lld %5.1f%% %s\n",
+           binLow(i) * 1e-3, binLow(i + 8) * 1e-3, (long long)s, 100.0 * s / n, bar);
+  }
+}
@@ -0,0 +1,86 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+
+
+#ifndef UHISTOGRAM_H
+#define UHISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Latency histogram with logarithmic bins
+ * (8 bins for each doubling of the time, i.e. 12.5% resolution)
+ * from 1 microsecond to about 2 hours.
+ * add() may be called from any thread, no locks are used. */
+class UHistogram
+{
+public:
+  /**
+   * Add a value
+   * \param sec is the latency (or duration) in seconds */
+  void add(float sec);
+  /**
+   * Remove all values */
+  void clear();
+  /** number of values */
+  int64_t count() const
+  {
+    return cnt.load(std::memory_order_relaxed);
+  }
+  /** mean value in seconds */
+  float mean() const;
+  /** max value in seconds */
+  float max() const
+  {
+    return maxUs.load(std::memory_order_relaxed) * 1e-6;
+  }
+  /**
+   * Value (upper bin limit, seconds) where this part of the values are below
+   * \param q is the part, e.g. 0.99 for the 99th percentile */
+  float quantile(float q) const;
+  /**
+   * Print one line to console with count, mean, percentiles and max (ms) */
+  void print(const char * name) const;
+  /**
+   * Format one line as "name count mean p50 p90 p99 max\n" (ms), e.g. for MQTT
+   * \returns s */
+  const char * format(const char * name, char * s, int MSL) const;
+  /**
+   * Print the histogram to console, one line for each doubling of time */
+  void printBins(const char * name) const;
+
+private:
+  static const int BINS = 256;
+  /** bin for this value (microseconds) */
+  static int binOf(uint64_t us);
+  /** lowest value (microseconds) in this bin */
+  static uint64_t binLow(int bin);
+  std::atomic<uint32_t> bins[BINS] = {};
+  std::atomic<int64_t> cnt{0};
+  std::atomic<int64_t> sumUs{0};
+  std::atomic<int64_t> maxUs{0};
+};
+
+#endif
@@ -0,0 +1,558 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+#include "ulogformat.h"
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+
+void ULogChannel::setFormat(const char * format)
+{
+  valueFormat = format;
+  cols.clear();
+  tail.clear();
+  std::string lit;
+  const char * p1 = format;
+  while (*p1 != '\0')
+  {
+    if (*p1 != '%')
+    {
+      lit += *p1++;
+      continue;
+    }
+    if (p1[1] == '%')
+    { // literal '%'
+      lit += "%%";
+      p1 += 2;
+      continue;
+    }
+    // a conversion, get flags, width and precision
+    std::string spec = "%";
+    p1++;
+    while (*p1 != '\0' and strchr("-+ #0123456789.*", *p1) != nullptr)
+      spec += *p1++;
+    // skip length modifiers, these are decided here
+    while (*p1 != '\0' and strchr("hlLqjzt", *p1) != nullptr)
+      p1++;
+    if (*p1 == '\0')
+      break;
+    Column c;
+    c.isInt = strchr("diouxXc", *p1) != nullptr;
+    if (c.isInt)
+      spec += "ll";
+    spec += *p1++;
+    c.conv = spec;
+    c.format = lit + spec;
+    cols.push_back(c);
+    lit.clear();
+  }
+  // remaining literal text is printed as is
+  for (size_t i = 0; i < lit.size(); i++)
+  {
+    if (lit[i] == '%' and i + 1 < lit.size() and lit[i + 1] == '%')
+      i++;
+    tail += lit[i];
+  }
+}
+
+int ULogChannel::format(const ULogRecord * rec, char * buf, int bufLen) const
+{
+  int n = 0;
+  auto add = [&n, bufLen](int m)
+  { // add, but not beyond buffer end
+    if (m > 0)
+      n += m;
+    if (n >= bufLen)
+      n = bufLen - 1;
+  };
+  if (bufLen <= 0)
+    return 0;
+  buf[0] = '\0';
+  if (rec->kind == ULOG_HEADER)
+  { // header lines as is
+    add(snprintf(buf, bufLen, "%.*s", (int)rec->count, rec->text()));
+    return n;
+  }
+  // timestamp with 3 or 4 decimals, as in the original logfiles
+  int dec = timeDecimals;
+  long div = 1;
+  for (int i = dec; i < 6; i++)
+    div *= 10;
+  unsigned long sec = rec->time_us / 1000000;
+  long frac = (rec->time_us % 1000000) / div;
+  add(snprintf(buf, bufLen, "%lu.%0*ld", sec, dec, frac));
+  if (rec->kind == ULOG_TEXT)
+  { // text line (includes the newline)
+    add(snprintf(&buf[n], bufLen - n, " %.*s", (int)rec->count, rec->text()));
+  }
+  else if (rec->kind == ULOG_VALUES)
+  {
+    const double * v = rec->values();
+    add(snprintf(&buf[n], bufLen - n, " "));
+    for (int i = 0; i < (int)cols.size() and i < (int)rec->count; i++)
+    {
+      if (cols[i].isInt)
+        add(snprintf(&buf[n], bufLen - n, cols[i].format.c_str(), (long long)v[i]));
+      else
+        add(snprintf(&buf[n], bufLen - n, cols[i].format.c_str(), v[i]));
+    }
+    add(snprintf(&buf[n], bufLen - n, "%s\n", tail.c_str()));
+  }
+  return n;
+}
+
+int ULogChannel::formatCsv(const ULogRecord * rec, char * buf, int bufLen) const
+{
+  int n = 0;
+  auto add = [&n, bufLen](int m)
+  { // add, but not beyond buffer end
+    if (m > 0)
+      n += m;
+    if (n >= bufLen)
+      n = bufLen - 1;
+  };
+  if (bufLen <= 0)
+    return 0;
+  buf[0] = '\0';
+  if (rec->kind != ULOG_VALUES and rec->kind != ULOG_TEXT)
+    return 0;
+  add(snprintf(buf, bufLen, "%lld.%06lld", (long long)(rec->time_us / 1000000), (long long)(rec->time_us % 1000000)));
+  if (rec->kind == ULOG_TEXT)
+  { // quoted text, without newline
+    std::string t = "\"";
+    for (int i = 0; i < (int)rec->count; i++)
+    {
+      char c = rec->text()[i];
+      if (c == '"')
+        t += "\"\"";
+      else if (c != '\n' and c != '\r')
+        t += c;
+    }
+    t += "\"";
+    add(snprintf(&buf[n], bufLen - n, ",%s", t.c_str()));
+  }
+  else
+  {
+    const double * v = rec->values();
+    for (int i = 0; i < (int)rec->count; i++)
+    {
+      add(snprintf(&buf[n], bufLen - n, ","));
+      if (i >= (int)cols.size())
+        add(snprintf(&buf[n], bufLen - n, "%g", v[i]));
+      else if (cols[i].isInt)
+        add(snprintf(&buf[n], bufLen - n, cols[i].conv.c_str(), (long long)v[i]));
+      else
+        add(snprintf(&buf[n], bufLen - n, cols[i].conv.c_str(), v[i]));
+    }
+  }
+  add(snprintf(&buf[n], bufLen - n, "\n"));
+  return n;
+}
+
+std::string ULogChannel::csvHeader() const
+{ // column 1 is time, the rest is values (or text)
+  int nCols = 1 + (isText() ? 1 : cols.size());
+  std::vector<std::string> names(nCols + 1);
+  names[1] = "time";
+  // use column descriptions, like "% 2-3 \tencoder position m1, m2 (ticks)"
+  const char * p1 = header.c_str();
+  while (*p1 != '\0')
+  {
+    const char * eol = strchr(p1, '\n');
+    if (eol == nullptr)
+      eol = p1 + strlen(p1);
+    std::string line(p1, eol - p1);
+    p1 = (*eol == '\n') ? eol + 1 : eol;
+    const char * p2 = line.c_str();
+    if (*p2 != '%')
+      continue;
+    p2++;
+    while (*p2 == ' ')
+      p2++;
+    if (not isdigit(*p2))
+      continue;
+    // column numbers, like '2', '2-3' or '4,5,6'
+    std::vector<int> nums;
+    char * p3;
+    nums.push_back(strtol(p2, &p3, 10));
+    while (*p3 == '-' or *p3 == ',')
+    {
+      bool range = *p3 == '-';
+      int b = strtol(p3 + 1, &p3, 10);
+      for (int k = range ? nums.back() + 1 : b; k <= b; k++)
+        nums.push_back(k);
+    }
+    std::string desc = p3;
+    // trim whitespace
+    size_t a = desc.find_first_not_of(" \t");
+    size_t b = desc.find_last_not_of(" \t\r");
+    if (a == std::string::npos)
+      continue;
+    desc = desc.substr(a, b - a + 1);
+    for (int k = 0; k < (int)nums.size(); k++)
+    {
+      int c = nums[k];
+      if (c < 2 or c > nCols)
+        continue;
+      if (nums.size() > 1)
+        names[c] = desc + " [" + std::to_string(k + 1) + "]";
+      else
+        names[c] = desc;
+    }
+  }
+  std::string s;
+  for (int c = 1; c <= nCols; c++)
+  {
+    if (names[c].empty())
+      names[c] = "c" + std::to_string(c);
+    std::string q;
+    for (char ch : names[c])
+    {
+      if (ch == '"')
+        q += "\"\"";
+      else
+        q += ch;
+    }
+    if (c > 1)
+      s += ",";
+    s += "\"" + q + "\"";
+  }
+  return s + "\n";
+}
+
+std::string ULogChannel::definition() const
+{
+  return name + "\n" + std::to_string(timeDecimals) + "\n" + valueFormat + "\n" + header;
+}
+
+bool ULogChannel::setDefinition(const char * def, int n)
+{
+  std::string s(def, n);
+  size_t n1 = s.find('\n');
+  if (n1 == std::string::npos)
+    return false;
+  size_t n2 = s.find('\n', n1 + 1);
+  if (n2 == std::string::npos)
+    return false;
+  size_t n3 = s.find('\n', n2 + 1);
+  if (n3 == std::string::npos)
+    n3 = s.size();
+  name = s.substr(0, n1);
+  timeDecimals = strtol(s.substr(n1 + 1, n2 - n1 - 1).c_str(), nullptr, 10);
+  if (timeDecimals < 0 or timeDecimals > 6)
+    timeDecimals = 4;
+  setFormat(s.substr(n2 + 1, n3 - n2 - 1).c_str());
+  if (n3 < s.size())
+    header = s.substr(n3 + 1);
+  else
+    header.clear();
+  return not name.empty();
+}
+
+/////////////////////////////////////////////////////////////
+
+namespace
+{
+  void putVarint(std::vector<uint8_t> & out, uint64_t v)
+  {
+    while (v >= 0x80)
+    {
+      out.push_back(uint8_t(v) | 0x80);
+      v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+  }
+
+  void putZigzag(std::vector<uint8_t> & out, int64_t v)
+  {
+    putVarint(out, (uint64_t(v) << 1) ^ uint64_t(v >> 63));
+  }
+
+  /**
+   * Reader for a block payload, all get functions
+   * return 0 (and set 'bad') if beyond the end */
+  class UPayload
+  {
+  public:
+    UPayload(const uint8_t * data, int n)
+      : p(data), end(data + n)
+    {}
+    uint64_t varint()
+    {
+      uint64_t v = 0;
+      for (int s = 0; s < 64; s += 7)
+      {
+        if (p >= end)
+          break;
+        uint8_t b = *p++;
+        v |= uint64_t(b & 0x7f) << s;
+        if ((b & 0x80) == 0)
+          return v;
+      }
+      bad = true;
+      return 0;
+    }
+    int64_t zigzag()
+    {
+      uint64_t v = varint();
+      return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+    bool get(void * dst, int n)
+    {
+      if (p + n > end)
+      {
+        bad = true;
+        return false;
+      }
+      memcpy(dst, p, n);
+      p += n;
+      return true;
+    }
+  public:
+    const uint8_t * p;
+    const uint8_t * end;
+    bool bad = false;
+  };
+}
+
+void ULogChunk::add(const ULogRecord * rec)
+{
+  if (cnt == 0)
+    firstTime_us = rec->time_us;
+  lastTime_us = rec->time_us;
+  const uint8_t * r = (const uint8_t *)rec;
+  recs.insert(recs.end(), r, r + rec->size);
+  cnt++;
+}
+
+void ULogChunk::clear()
+{
+  recs.clear();
+  cnt = 0;
+}
+
+const ULogRecord * ULogChunk::next(uint32_t & pos) const
+{
+  if (pos + sizeof(ULogRecord) > recs.size())
+    return nullptr;
+  const ULogRecord * r = (const ULogRecord *)&recs[pos];
+  pos += r->size;
+  return r;
+}
+
+void ULogChunk::encode(std::vector<uint8_t> & out) const
+{
+  out.clear();
+  std::vector<const ULogRecord *> rs;
+  uint32_t pos = 0;
+  int maxCols = 0;
+  for (const ULogRecord * r = next(pos); r != nullptr; r = next(pos))
+  {
+    rs.push_back(r);
+    if (r->kind == ULOG_VALUES and (int)r->count > maxCols)
+      maxCols = r->count;
+  }
+  putVarint(out, rs.size());
+  for (const ULogRecord * r : rs)
+  { // kind and count
+    out.push_back(r->kind);
+    putVarint(out, r->count);
+  }
+  int64_t t = firstTime_us;
+  for (const ULogRecord * r : rs)
+  { // time differences
+    putZigzag(out, r->time_us - t);
+    t = r->time_us;
+  }
+  for (int c = 0; c < maxCols; c++)
+  { // find smallest lossless type for this column
+    bool isInt = true;
+    bool isFloat = true;
+    for (const ULogRecord * r : rs)
+    {
+      if (r->kind != ULOG_VALUES or (int)r->count <= c)
+        continue;
+      double v = r->values()[c];
+      if (isInt and (v != floor(v) or fabs(v) > 1e18))
+        isInt = false;
+      if (isFloat and double(float(v)) != v and not isnan(v))
+        isFloat = false;
+    }
+    int64_t last = 0;
+    out.push_back(isInt ? 1 : (isFloat ? 4 : 8));
+    for (const ULogRecord * r : rs)
+    {
+      if (r->kind != ULOG_VALUES or (int)r->count <= c)
+        continue;
+      double v = r->values()[c];
+      if (isInt)
+      {
+        putZigzag(out, int64_t(v) - last);
+        last = int64_t(v);
+      }
+      else if (isFloat)
+      {
+        float f = v;
+        const uint8_t * b = (const uint8_t *)&f;
+        out.insert(out.end(), b, b + sizeof(f));
+      }
+      else
+      {
+        const uint8_t * b = (const uint8_t *)&v;
+        out.insert(out.end(), b, b + sizeof(v));
+      }
+    }
+  }
+  for (const ULogRecord * r : rs)
+  { // text
+    if (r->kind != ULOG_VALUES)
+      out.insert(out.end(), (const uint8_t *)r->text(), (const uint8_t *)r->text() + r->count);
+  }
+}
+
+bool ULogChunk::decode(const uint8_t * data, int n, int channel, int64_t firstTime)
+{
+  clear();
+  UPayload in(data, n);
+  int recCnt = in.varint();
+  if (recCnt < 0 or recCnt > n)
+    return false;
+  std::vector<uint8_t> kind(recCnt);
+  std::vector<uint32_t> count(recCnt);
+  std::vector<uint32_t> at(recCnt);
+  int maxCols = 0;
+  // make records with space for values or text
+  for (int i = 0; i < recCnt and not in.bad; i++)
+  {
+    in.get(&kind[i], 1);
+    count[i] = in.varint();
+    if (count[i] > uint32_t(n) * 8)
+      return false;
+    int bytes = count[i];
+    if (kind[i] == ULOG_VALUES)
+    {
+      bytes *= sizeof(double);
+      if ((int)count[i] > maxCols)
+        maxCols = count[i];
+    }
+    uint32_t size = ulogRecordSize(bytes);
+    at[i] = recs.size();
+    recs.resize(recs.size() + size, 0);
+    ULogRecord * r = (ULogRecord *)&recs[at[i]];
+    r->size = size;
+    r->channel = channel;
+    r->kind = kind[i];
+    r->count = count[i];
+  }
+  int64_t t = firstTime;
+  for (int i = 0; i < recCnt and not in.bad; i++)
+  {
+    t += in.zigzag();
+    ((ULogRecord *)&recs[at[i]])->time_us = t;
+  }
+  for (int c = 0; c < maxCols and not in.bad; c++)
+  {
+    uint8_t type = 0;
+    in.get(&type, 1);
+    int64_t last = 0;
+    for (int i = 0; i < recCnt and not in.bad; i++)
+    {
+      if (kind[i] != ULOG_VALUES or (int)count[i] <= c)
+        continue;
+      double * v = (double *)&recs[at[i] + sizeof(ULogRecord)];
+      if (type == 1)
+      {
+        last += in.zigzag();
+        v[c] = last;
+      }
+      else if (type == 4)
+      {
+        float f = 0;
+        in.get(&f, sizeof(f));
+        v[c] = f;
+      }
+      else if (type == 8)
+        in.get(&v[c], sizeof(double));
+      else
+        return false;
+    }
+  }
+  for (int i = 0; i < recCnt and not in.bad; i++)
+  {
+    if (kind[i] != ULOG_VALUES)
+      in.get(&recs[at[i] + sizeof(ULogRecord)], count[i]);
+  }
+  if (in.bad)
+  {
+    clear();
+    return false;
+  }
+  cnt = recCnt;
+  if (recCnt > 0)
+  {
+    firstTime_us = ((ULogRecord *)&recs[at[0]])->time_us;
+    lastTime_us = t;
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////
+
+bool ulogCompress(const std::vector<uint8_t> & raw, std::vector<uint8_t> & out, int level)
+{
+#ifdef USE_ZSTD
+  out.resize(ZSTD_compressBound(raw.size()));
+  size_t n = ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), level);
+  if (ZSTD_isError(n) or n >= raw.size())
+    return false;
+  out.resize(n);
+  return true;
+#else
+  (void)raw;
+  (void)out;
+  (void)level;
+  return false;
+#endif
+}
+
+bool ulogDecompress(const uint8_t * data, int n, std::vector<uint8_t> & raw, int rawSize)
+{
+#ifdef USE_ZSTD
+  raw.resize(rawSize);
+  size_t m = ZSTD_decompress(raw.data(), rawSize, data, n);
+  return not ZSTD_isError(m) and int(m) == rawSize;
+#else
+  (void)data;
+  (void)n;
+  (void)raw;
+  (void)rawSize;
+  return false;
+#endif
+}
@@ -0,0 +1,254 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+
+#ifndef ULOGFORMAT_H
+#define ULOGFORMAT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Log record kinds */
+enum ULogKind
+{
+  ULOG_VALUES = 0, // 'count' values (double)
+  ULOG_TEXT,       // 'count' characters, a line after the timestamp
+  ULOG_HEADER,     // 'count' characters, header lines (without timestamp)
+  ULOG_DEF,        // 'count' characters, channel definition (binary logfile only)
+  ULOG_PAD         // unused space (ring buffer only)
+};
+
+/**
+ * Log record as saved in the log ring buffers and in a binary logfile.
+ * The record header is followed by 'count' doubles (ULOG_VALUES)
+ * or 'count' characters (all other kinds).
+ * The size is always a multiple of 8 bytes. */
+struct ULogRecord
+{
+  uint32_t size;    // bytes in record, including this header
+  uint16_t channel; // log channel (logfile) number
+  uint16_t kind;    // ULogKind
+  uint32_t count;   // number of values or characters
+  uint32_t reserved;
+  int64_t time_us;  // time in microseconds since 1 jan 1970
+  //
+  const double * values() const
+  {
+    return (const double *)(this + 1);
+  }
+  const char * text() const
+  {
+    return (const char *)(this + 1);
+  }
+};
+
+/**
+ * Record size (rounded up to 8 bytes) for a payload of this size */
+inline uint32_t ulogRecordSize(int payloadBytes)
+{
+  return (sizeof(ULogRecord) + payloadBytes + 7) & ~7;
+}
+
+/**
+ * Binary logfile (log_all.ulog):
+ * ULOG_MAGIC, then a number of blocks (ULogBlock header and payload),
+ * and at the end an index block and a ULogTrailer.
+ * A channel definition block (ULOG_BLOCK_DEF) comes before
+ * the first chunk of the channel.
+ * Without the index (e.g. after a crash) the blocks can be found by
+ * reading the block headers only. */
+static const char ULOG_MAGIC[8] = "ULOG02\n";
+static const char ULOG_INDEX_MAGIC[8] = "ULOGIDX";
+
+/**
+ * Block types in a binary logfile */
+enum ULogBlockType
+{
+  ULOG_BLOCK_DEF = 1, // channel definition (see ULogChannel::definition())
+  ULOG_BLOCK_CHUNK,   // records for one channel (see ULogChunk)
+  ULOG_BLOCK_INDEX    // ULogIndexEntry for all other blocks
+};
+
+/**
+ * Compression of block payload */
+enum ULogCompress
+{
+  ULOG_COMPRESS_NONE = 0,
+  ULOG_COMPRESS_ZSTD
+};
+
+/**
+ * Block header in a binary logfile */
+struct ULogBlock
+{
+  uint32_t size;     // payload bytes in file (after this header)
+  uint32_t rawSize;  // payload bytes after decompression
+  uint16_t channel;  // log channel
+  uint8_t type;      // ULogBlockType
+  uint8_t compress;  // ULogCompress
+  uint32_t count;    // number of records (or index entries)
+  int64_t firstTime_us; // time of first record
+  int64_t lastTime_us;  // time of last record
+};
+
+/**
+ * Index entry, one for each block (except the index) */
+struct ULogIndexEntry
+{
+  uint64_t offset;   // file position of block header
+  int64_t firstTime_us;
+  int64_t lastTime_us;
+  uint32_t count;
+  uint16_t channel;
+  uint16_t type;     // ULogBlockType
+};
+
+/**
+ * Last bytes in a binary logfile */
+struct ULogTrailer
+{
+  uint64_t indexOffset; // file position of index block header
+  char magic[8];        // ULOG_INDEX_MAGIC
+};
+
+/**
+ * Compress a block payload (zstd, if available in this build)
+ * \returns false if not compressed (then use the raw payload) */
+bool ulogCompress(const std::vector<uint8_t> & raw, std::vector<uint8_t> & out, int level);
+/**
+ * Decompress a block payload
+ * \returns false if not possible */
+bool ulogDecompress(const uint8_t * data, int n, std::vector<uint8_t> & raw, int rawSize);
+
+/**
+ * A number of records for one channel, saved as one block.
+ * The block payload is columnar:
+ * - for each record: kind (byte) and count (varint)
+ * - for each record: time since previous record (zigzag varint, microseconds),
+ *   the first is relative to the block firstTime_us.
+ * - for each value column: a type byte and the values of all value records
+ *   that have this column. The type is the smallest lossless type for all values
+ *   in the chunk: 1 = integer (zigzag varint difference to the previous value),
+ *   4 = float or 8 = double.
+ * - the characters of all text and header records.
+ * */
+class ULogChunk
+{
+public:
+  /** add a copy of this record */
+  void add(const ULogRecord * rec);
+  void clear();
+  int count() const
+  {
+    return cnt;
+  }
+  /** bytes used by records (as ULogRecord) */
+  int bytes() const
+  {
+    return recs.size();
+  }
+  /**
+   * Encode records as block payload (not compressed) */
+  void encode(std::vector<uint8_t> & out) const;
+  /**
+   * Decode a block payload (not compressed) to records
+   * \returns false if payload is invalid */
+  bool decode(const uint8_t * data, int n, int channel, int64_t firstTime_us);
+  /**
+   * Get records in order, start with pos = 0.
+   * \returns nullptr when there is no more */
+  const ULogRecord * next(uint32_t & pos) const;
+
+public:
+  int64_t firstTime_us = 0;
+  int64_t lastTime_us = 0;
+
+private:
+  /// records as ULogRecord
+  std::vector<uint8_t> recs;
+  int cnt = 0;
+};
+
+/**
+ * Description of one log channel, i.e. one text logfile.
+ * The value format is the printf format used for the values after
+ * the timestamp, like "%lu %lu %g %g %d %d".
+ * An empty format is a text channel. */
+class ULogChannel
+{
+public:
+  /// logfile name (without path and .txt)
+  std::string name;
+  /// header lines (each starting with '%'), when known
+  std::string header;
+  /// number of decimals in the timestamp (3 or 4)
+  int timeDecimals = 4;
+  /**
+   * Set value format (the part after the timestamp) */
+  void setFormat(const char * valueFormat);
+  std::string getFormat() const
+  {
+    return valueFormat;
+  }
+  bool isText() const
+  {
+    return valueFormat.empty();
+  }
+  /**
+   * Format a value, text or header record as one (or more) text lines.
+   * \returns number of characters in buf */
+  int format(const ULogRecord * rec, char * buf, int bufLen) const;
+  /**
+   * Format a value or text record as one CSV line
+   * (time in seconds and values, or time and quoted text).
+   * Header records are not formatted (use csvHeader()).
+   * \returns number of characters in buf */
+  int formatCsv(const ULogRecord * rec, char * buf, int bufLen) const;
+  /**
+   * CSV line with column names, taken from the header lines like
+   * "% 2-3 \tencoder position m1, m2 (ticks)" */
+  std::string csvHeader() const;
+  /**
+   * Channel definition as text: "name\ndecimals\nformat\nheader lines" (for a binary log) */
+  std::string definition() const;
+  /**
+   * Set channel from definition
+   * \returns false if definition is invalid */
+  bool setDefinition(const char * def, int n);
+
+private:
+  struct Column
+  {
+    std::string format; // literal text before and conversion for this value
+    std::string conv;   // conversion only
+    bool isInt;          // conversion is an integer conversion
+  };
+  std::string valueFormat;
+  std::vector<Column> cols;
+  /// literal text after the last conversion
+  std::string tail;
+};
+
+#endif
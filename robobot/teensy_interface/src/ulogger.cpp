@@ -0,0 +1,456 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include "ulogger.h"
+#include "uservice.h"
+
+// create value
+ULogger logger;
+
+/**
+ * Single producer, single consumer ring buffer of log records.
+ * The producer is the thread that logs, the consumer is the writer thread.
+ * A record is never split at the end of the buffer, the space
+ * at the end is then skipped (a pad record, if there is room for a header). */
+class ULogRing
+{
+public:
+  ULogRing(int bytes)
+  {
+    size = (bytes + 7) & ~7;
+    buf = (uint8_t *)aligned_alloc(8, size);
+  }
+  /**
+   * Get space for a record of this size
+   * \returns pointer to record, or nullptr if no space */
+  ULogRecord * reserve(uint32_t recSize)
+  {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    uint64_t t = tail.load(std::memory_order_acquire);
+    uint32_t pos = h % size;
+    uint32_t pad = 0;
+    if (pos + recSize > size)
+      pad = size - pos;
+    if (h + pad + recSize - t > size)
+      return nullptr;
+    if (pad >= sizeof(ULogRecord))
+    { // mark space at the end as unused
+      ULogRecord * r = (ULogRecord *)&buf[pos];
+      r->size = pad;
+      r->kind = ULOG_PAD;
+    }
+    reserved = pad + recSize;
+    return (ULogRecord *)&buf[(h + pad) % size];
+  }
+  /**
+   * Make the reserved record available to the writer */
+  void commit()
+  {
+    head.store(head.load(std::memory_order_relaxed) + reserved, std::memory_order_release);
+  }
+  /** bytes in use */
+  uint64_t used()
+  {
+    return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed);
+  }
+  /**
+   * Get records up to the current head (writer thread only)
+   * \param recs is where the records are added
+   * \returns the new tail position, to be released after use */
+  uint64_t collect(std::vector<const ULogRecord*> & recs)
+  {
+    uint64_t h = head.load(std::memory_order_acquire);
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    while (t < h)
+    {
+      uint32_t pos = t % size;
+      if (size - pos < sizeof(ULogRecord))
+      { // too little space for a header at the end
+        t += size - pos;
+        continue;
+      }
+      const ULogRecord * r = (const ULogRecord *)&buf[pos];
+      if (r->kind != ULOG_PAD)
+        recs.push_back(r);
+      t += r->size;
+    }
+    return t;
+  }
+  /**
+   * Records up to here are used, and space can be reused */
+  void release(uint64_t t)
+  {
+    tail.store(t, std::memory_order_release);
+  }
+
+public:
+  std::atomic<int> dropped{0};
+
+private:
+  uint8_t * buf;
+  uint32_t size;
+  uint32_t reserved = 0;
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+};
+
+/// ring buffer for this thread
+static thread_local ULogRing * threadRing = nullptr;
+
+
+void ULogger::setup()
+{ // ensure default values
+  if (not ini.has(ini_section))
+  { // no data yet, so generate some default values
+    ini[ini_section]["binary"] = "false";
+    ini[ini_section]["interval_ms"] = "50";
+    ini[ini_section]["ring_kb"] = "256";
+  }
+  if (not ini[ini_section].has("chunk_kb"))
+  { // binary logfile chunks
+    ini[ini_section]["chunk_kb"] = "64";
+    ini[ini_section]["chunk_ms"] = "2000";
+    ini[ini_section]["compress_level"] = "0";
+  }
+  binary = ini[ini_section]["binary"] == "true";
+  interval_ms = strtol(ini[ini_section]["interval_ms"].c_str(), nullptr, 10);
+  if (interval_ms < 1)
+    interval_ms = 1;
+  ringSize = strtol(ini[ini_section]["ring_kb"].c_str(), nullptr, 10) * 1024;
+  if (ringSize < 16 * 1024)
+    ringSize = 16 * 1024;
+  chunkBytes = strtol(ini[ini_section]["chunk_kb"].c_str(), nullptr, 10) * 1024;
+  if (chunkBytes < 1024)
+    chunkBytes = 1024;
+  chunk_ms = strtol(ini[ini_section]["chunk_ms"].c_str(), nullptr, 10);
+  compressLevel = strtol(ini[ini_section]["compress_level"].c_str(), nullptr, 10);
+#ifndef USE_ZSTD
+  if (binary and compressLevel > 0)
+  {
+    printf("# ULogger::setup: compression not available (no zstd) - saves uncompressed\n");
+    compressLevel = 0;
+  }
+#endif
+  if (binary and binFile == nullptr)
+  { // all channels in one file
+    std::string fn = service.logPath + "log_all.ulog";
+    binFile = fopen(fn.c_str(), "w");
+    if (binFile != nullptr)
+      fwrite(ULOG_MAGIC, 1, sizeof(ULOG_MAGIC), binFile);
+    else
+      printf("# ULogger::setup: failed to open %s\n", fn.c_str());
+  }
+  if (th1 == nullptr)
+    th1 = new std::thread(runObj, this);
+}
+
+void ULogger::terminate()
+{
+  if (th1 != nullptr)
+  {
+    stopWriter = true;
+    wake.notify_all();
+    th1->join();
+    th1 = nullptr;
+  }
+  // writer is stopped, so files can be closed
+  for (int i = 0; i < MAX_CHANNELS; i++)
+  {
+    if (files[i] != nullptr)
+    {
+      fclose(files[i]);
+      files[i] = nullptr;
+    }
+  }
+  if (binFile != nullptr)
+    closeBinary();
+  if (droppedCnt > 0)
+    printf("# ULogger:: saved %lld log records, dropped %d (ring buffer full)\n", (long long)savedCnt, droppedCnt);
+}
+
+int ULogger::addChannel(const std::string & name, const char * valueFormat, int timeDecimals)
+{
+  std::lock_guard<std::mutex> lock(channelLock);
+  int n = channelsCnt;
+  if (n >= MAX_CHANNELS)
+  {
+    printf("# ULogger::addChannel: no space for %s (max %d channels)\n", name.c_str(), MAX_CHANNELS);
+    return -1;
+  }
+  channels[n].name = name;
+  channels[n].timeDecimals = timeDecimals;
+  channels[n].setFormat(valueFormat);
+  // now the writer may use it
+  channelsCnt = n + 1;
+  return n;
+}
+
+ULogRing * ULogger::getRing()
+{
+  if (threadRing == nullptr)
+  { // first log from this thread
+    threadRing = new ULogRing(ringSize);
+    std::lock_guard<std::mutex> lock(ringLock);
+    rings.push_back(threadRing);
+  }
+  return threadRing;
+}
+
+void ULogger::addRecord(int channel, int kind, UTime & t, const void * data, int bytes, int count)
+{
+  if (channel < 0 or channel >= channelsCnt)
+    return;
+  ULogRing * ring = getRing();
+  uint32_t recSize = ulogRecordSize(bytes);
+  ULogRecord * r = ring->reserve(recSize);
+  if (r == nullptr)
+  { // writer is behind, so drop
+    ring->dropped++;
+    wake.notify_one();
+    return;
+  }
+  r->size = recSize;
+  r->channel = channel;
+  r->kind = kind;
+  r->count = count;
+  r->reserved = 0;
+  r->time_us = t.getWallUs();
+  memcpy((void *)(r + 1), data, bytes);
+  ring->commit();
+  if (ring->used() > uint64_t(ringSize / 2))
+    wake.notify_one();
+}
+
+void ULogger::logValues(int channel, UTime & t, const double * values, int n)
+{
+  addRecord(channel, ULOG_VALUES, t, values, n * sizeof(double), n);
+}
+
+void ULogger::logText(int channel, UTime & t, const char * format, ...)
+{
+  const int MSL = 1000;
+  char s[MSL];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(s, MSL, format, args);
+  va_end(args);
+  if (n >= MSL)
+    n = MSL - 1;
+  if (n > 0)
+    addRecord(channel, ULOG_TEXT, t, s, n, n);
+}
+
+void ULogger::addHeader(int channel, const char * format, ...)
+{
+  const int MSL = 1000;
+  char s[MSL];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(s, MSL, format, args);
+  va_end(args);
+  if (n >= MSL)
+    n = MSL - 1;
+  UTime t("now");
+  if (n > 0)
+    addRecord(channel, ULOG_HEADER, t, s, n, n);
+}
+
+void ULogger::run()
+{
+  while (not stopWriter)
+  {
+    { // wait for next batch (or a ring more than half full)
+      std::unique_lock<std::mutex> lock(wakeLock);
+      wake.wait_for(lock, std::chrono::milliseconds(interval_ms));
+    }
+    flush();
+  }
+  // save the rest
+  flush();
+}
+
+void ULogger::flush()
+{
+  std::vector<ULogRing*> rs;
+  {
+    std::lock_guard<std::mutex> lock(ringLock);
+    rs = rings;
+  }
+  std::vector<const ULogRecord*> recs;
+  std::vector<uint64_t> tails(rs.size());
+  int dropped = 0;
+  for (int i = 0; i < (int)rs.size(); i++)
+  {
+    tails[i] = rs[i]->collect(recs);
+    dropped += rs[i]->dropped;
+  }
+  // header for new channels first, then the rest in time order (from all threads)
+  auto rest = std::stable_partition(recs.begin(), recs.end(),
+                   [this](const ULogRecord * a){ return a->kind == ULOG_HEADER and not started[a->channel]; });
+  std::stable_sort(rest, recs.end(),
+                   [](const ULogRecord * a, const ULogRecord * b){ return a->time_us < b->time_us; });
+  for (const ULogRecord * r : recs)
+    saveRecord(r);
+  if (binFile != nullptr)
+  { // save chunks with old records
+    UTime t("now");
+    int64_t now_us = t.getWallUs();
+    for (int ch = 0; ch < channelsCnt; ch++)
+    {
+      if (chunks[ch].count() > 0 and now_us - chunks[ch].firstTime_us > int64_t(chunk_ms) * 1000)
+        saveChunk(ch);
+    }
+  }
+  if (not recs.empty())
+  { // make it visible on disk
+    if (binFile != nullptr)
+      fflush(binFile);
+    else
+      fflush(nullptr);
+  }
+  // space can now be reused
+  for (int i = 0; i < (int)rs.size(); i++)
+    rs[i]->release(tails[i]);
+  savedCnt += recs.size();
+  droppedCnt = dropped;
+  if (dropped != droppedReported)
+  {
+    printf("# ULogger:: %d log records dropped (ring buffer full)\n", dropped - droppedReported);
+    droppedReported = dropped;
+  }
+}
+
+void ULogger::saveRecord(const ULogRecord * rec)
+{
+  int ch = rec->channel;
+  if (binary)
+  {
+    if (binFile == nullptr)
+      return;
+    if (not started[ch])
+    {
+      if (rec->kind == ULOG_HEADER)
+      { // header lines before first record are part of the definition
+        channels[ch].header.append(rec->text(), rec->count);
+        return;
+      }
+      saveDefinition(ch, rec->time_us);
+    }
+    chunks[ch].add(rec);
+    if (chunks[ch].bytes() >= chunkBytes)
+      saveChunk(ch);
+  }
+  else
+  {
+    if (files[ch] == nullptr)
+    { // open on first use
+      if (started[ch])
+        return; // failed to open
+      std::string fn = service.logPath + channels[ch].name + ".txt";
+      files[ch] = fopen(fn.c_str(), "w");
+      started[ch] = true;
+      if (files[ch] == nullptr)
+      {
+        printf("# ULogger::saveRecord: failed to open %s\n", fn.c_str());
+        return;
+      }
+    }
+    const int MSL = 2000;
+    char s[MSL];
+    int n = channels[ch].format(rec, s, MSL);
+    fwrite(s, 1, n, files[ch]);
+  }
+}
+
+void ULogger::saveDefinition(int ch, int64_t time_us)
+{
+  std::string def = channels[ch].definition();
+  std::vector<uint8_t> d(def.begin(), def.end());
+  saveBlock(ULOG_BLOCK_DEF, ch, d, 0, time_us, time_us);
+  started[ch] = true;
+}
+
+void ULogger::saveChunk(int ch)
+{
+  std::vector<uint8_t> raw;
+  chunks[ch].encode(raw);
+  saveBlock(ULOG_BLOCK_CHUNK, ch, raw, chunks[ch].count(),
+            chunks[ch].firstTime_us, chunks[ch].lastTime_us);
+  chunks[ch].clear();
+}
+
+void ULogger::saveBlock(int type, int ch, const std::vector<uint8_t> & raw, int count,
+                        int64_t firstTime_us, int64_t lastTime_us)
+{
+  ULogBlock b;
+  b.rawSize = raw.size();
+  b.channel = ch;
+  b.type = type;
+  b.compress = ULOG_COMPRESS_NONE;
+  b.count = count;
+  b.firstTime_us = firstTime_us;
+  b.lastTime_us = lastTime_us;
+  std::vector<uint8_t> packed;
+  const std::vector<uint8_t> * data = &raw;
+  if (compressLevel > 0 and type == ULOG_BLOCK_CHUNK and ulogCompress(raw, packed, compressLevel))
+  {
+    b.compress = ULOG_COMPRESS_ZSTD;
+    data = &packed;
+  }
+  b.size = data->size();
+  ULogIndexEntry e;
+  e.offset = ftell(binFile);
+  e.firstTime_us = firstTime_us;
+  e.lastTime_us = lastTime_us;
+  e.count = count;
+  e.channel = ch;
+  e.type = type;
+  fwrite(&b, sizeof(b), 1, binFile);
+  fwrite(data->data(), 1, data->size(), binFile);
+  if (type != ULOG_BLOCK_INDEX)
+    index.push_back(e);
+}
+
+void ULogger::closeBinary()
+{ // writer thread is stopped
+  for (int ch = 0; ch < channelsCnt; ch++)
+  {
+    if (not started[ch] and not channels[ch].header.empty())
+      saveDefinition(ch, 0);
+    if (chunks[ch].count() > 0)
+      saveChunk(ch);
+  }
+  ULogTrailer tr;
+  tr.indexOffset = ftell(binFile);
+  memcpy(tr.magic, ULOG_INDEX_MAGIC, sizeof(tr.magic));
+  const uint8_t * ix = (const uint8_t *)index.data();
+  std::vector<uint8_t> d(ix, ix + index.size() * sizeof(ULogIndexEntry));
+  saveBlock(ULOG_BLOCK_INDEX, 0, d, index.size(), 0, 0);
+  fwrite(&tr, sizeof(tr), 1, binFile);
+  fclose(binFile);
+  binFile = nullptr;
+}
@@ -0,0 +1,159 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+
+#ifndef ULOGGER_H
+#define ULOGGER_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "utime.h"
+#include "ulogformat.h"
+
+class ULogRing;
+
+/**
+ * Central logger for all logfiles.
+ * A module adds a channel (a logfile) and its header,
+ * and then logs values or text lines for the channel.
+ * Logging just adds a record to a ring buffer for the calling thread
+ * (no locks and no disk access), and a writer thread
+ * saves the records in batches.
+ * If a ring buffer is full, the record is dropped (and counted).
+ *
+ * The writer saves either the usual text logfiles (log_t0_encoder.txt etc.),
+ * or one binary logfile (log_all.ulog), that can be converted
+ * to the text logfiles (or CSV) by 'logconvert'.
+ * The binary logfile has the records of each channel in chunks
+ * (see ULogChunk in ulogformat.h), optionally compressed,
+ * and an index of all chunks at the end.
+ * */
+class ULogger
+{
+public:
+  /** setup and start writer thread, must be called when log path is available */
+  void setup();
+  /**
+   * terminate - save remaining records and close files */
+  void terminate();
+  /**
+   * Add a log channel (logfile)
+   * \param name is the logfile name without path and '.txt', e.g. "log_t0_encoder".
+   * \param valueFormat is the printf format of the values after the timestamp,
+   *        e.g. "%lu %lu %g %g %d %d". Use "" for a text channel.
+   * \param timeDecimals is the number of decimals in the timestamp (3 or 4)
+   * \returns channel number */
+  int addChannel(const std::string & name, const char * valueFormat, int timeDecimals = 4);
+  /**
+   * Add header lines to channel (one or more lines, each starting with '%') */
+  void addHeader(int channel, const char * format, ...) __attribute__((format(printf, 3, 4)));
+  /**
+   * Log a set of values (any number type) for a value channel, e.g.
+   * logger.log(logCh, t, enc[0], enc[1], vel[0], vel[1]) */
+  template <class... V>
+  void log(int channel, UTime & t, V... values)
+  {
+    double v[] = {double(values)...};
+    logValues(channel, t, v, sizeof...(V));
+  }
+  void logValues(int channel, UTime & t, const double * values, int n);
+  /**
+   * Log a text line (should end with a newline) for a text channel */
+  void logText(int channel, UTime & t, const char * format, ...) __attribute__((format(printf, 4, 5)));
+  /**
+   * Writer thread */
+  void run();
+
+public:
+  static const int MAX_CHANNELS = 128;
+  /// records dropped, as a ring buffer were full
+  int droppedCnt = 0;
+  /// records saved
+  int64_t savedCnt = 0;
+
+private:
+  static void runObj(ULogger * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  /** get ring buffer for this thread (create if needed) */
+  ULogRing * getRing();
+  /** add record to ring buffer of this thread */
+  void addRecord(int channel, int kind, UTime & t, const void * data, int bytes, int count);
+  /** save all records in ring buffers */
+  void flush();
+  /** save one record to file */
+  void saveRecord(const ULogRecord * rec);
+  /** binary logfile: save definition (with header lines) for channel */
+  void saveDefinition(int ch, int64_t time_us);
+  /** binary logfile: save pending records for channel */
+  void saveChunk(int ch);
+  /** binary logfile: save a block and add it to the index */
+  void saveBlock(int type, int ch, const std::vector<uint8_t> & raw, int count,
+                 int64_t firstTime_us, int64_t lastTime_us);
+  /** binary logfile: save the rest, the index and close */
+  void closeBinary();
+  //
+  ULogChannel channels[MAX_CHANNELS];
+  FILE * files[MAX_CHANNELS] = {nullptr};
+  /// file opened (text) or definition saved (binary)
+  bool started[MAX_CHANNELS] = {false};
+  std::atomic<int> channelsCnt{0};
+  std::mutex channelLock;
+  /// ring buffers, one for each thread that logs
+  std::vector<ULogRing*> rings;
+  std::mutex ringLock;
+  int ringSize = 256 * 1024;
+  /// write to one binary file
+  bool binary = false;
+  FILE * binFile = nullptr;
+  /// pending records for each channel (binary logfile)
+  ULogChunk chunks[MAX_CHANNELS];
+  /// save a chunk when this size is reached (bytes as records)
+  int chunkBytes = 64 * 1024;
+  /// or when the oldest record is this old (ms)
+  int chunk_ms = 2000;
+  /// zstd compression level, 0 is no compression
+  int compressLevel = 0;
+  /// all saved blocks
+  std::vector<ULogIndexEntry> index;
+  /// writer thread
+  std::thread * th1 = nullptr;
+  std::atomic<bool> stopWriter{false};
+  std::mutex wakeLock;
+  std::condition_variable wake;
+  int interval_ms = 50;
+  int droppedReported = 0;
+  std::string ini_section = "logger";
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern ULogger logger;
+
+#endif
@@ -0,0 +1,128 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef UMPSCQUEUE_H
+#define UMPSCQUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Bounded lock-free queue for many producer threads and one consumer thread.
+ * Each cell has a sequence number, that tells if it is free (for the producer)
+ * or filled (for the consumer), so no locks are needed.
+ * T should be a plain structure, it is copied in and out of the queue.
+ * */
+template <class T>
+class UMpscQueue
+{
+public:
+  ~UMpscQueue()
+  {
+    delete [] cells;
+  }
+  /**
+   * Allocate the queue, must be called before use
+   * \param size is rounded up to a power of 2 */
+  void init(int size)
+  {
+    int n = 2;
+    while (n < size)
+      n *= 2;
+    cells = new Cell[n];
+    mask = n - 1;
+    for (int i = 0; i < n; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  /**
+   * Get a cell to fill (any thread)
+   * \param pos is set to the cell position, used in commit()
+   * \returns pointer to the value, or nullptr if the queue is full */
+  T * reserve(uint64_t & pos)
+  {
+    pos = enqPos.load(std::memory_order_relaxed);
+    while (true)
+    {
+      Cell * c = &cells[pos & mask];
+      uint64_t s = c->seq.load(std::memory_order_acquire);
+      int64_t d = int64_t(s) - int64_t(pos);
+      if (d == 0)
+      { // free, try to take it
+        if (enqPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          return &c->value;
+        // pos is updated by compare_exchange
+      }
+      else if (d < 0)
+        // full
+        return nullptr;
+      else
+        // taken by another producer
+        pos = enqPos.load(std::memory_order_relaxed);
+    }
+  }
+  /**
+   * Make a reserved cell available to the consumer
+   * \param pos is the position from reserve() */
+  void commit(uint64_t pos)
+  {
+    cells[pos & mask].seq.store(pos + 1, std::memory_order_release);
+  }
+  /**
+   * Get the oldest value (consumer thread only)
+   * \returns pointer to the value, or nullptr if the queue is empty */
+  T * front()
+  {
+    uint64_t pos = deqPos.load(std::memory_order_relaxed);
+    Cell * c = &cells[pos & mask];
+    if (c->seq.load(std::memory_order_acquire) != pos + 1)
+      return nullptr;
+    return &c->value;
+  }
+  /**
+   * Release the value from front() (consumer thread only) */
+  void pop()
+  {
+    uint64_t pos = deqPos.load(std::memory_order_relaxed);
+    cells[pos & mask].seq.store(pos + mask + 1, std::memory_order_release);
+    deqPos.store(pos + 1, std::memory_order_relaxed);
+  }
+  /** number of values in the queue (approximate) */
+  int depth()
+  {
+    return int(enqPos.load(std::memory_order_relaxed) - deqPos.load(std::memory_order_relaxed));
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<uint64_t> seq;
+    T value;
+  };
+  Cell * cells = nullptr;
+  uint64_t mask = 0;
+  std::atomic<uint64_t> enqPos{0};
+  /// changed by the consumer only
+  std::atomic<uint64_t> deqPos{0};
+};
+
+#endif
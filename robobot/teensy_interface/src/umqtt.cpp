@@ -25,11 +25,14 @@
 #include <string>
 #include <string.h>
 #include <unistd.h>
+#include <math.h>
 #include <chrono>
 #include <thread>
 #include <iostream>
 #include "uservice.h"
 #include "umqtt.h"
+#include "ulogger.h"
+#include "uconfig.h"
 
 using namespace std::chrono;
 
@@ -57,24 +60,42 @@ void UMqtt::setup()
     ini["mqtt"]["print"] = "false";
     ini["mqtt"]["use"] = "true";
   }
+  if (not ini["mqtt"].has("queue_size"))
+  { // publish queue and topics where only the newest value is needed
+    ini["mqtt"]["queue_size"] = "256";
+    ini["mqtt"]["coalesce"] = "pose vel mvel enc fpose";
+    ini["mqtt"]["min_interval_ms"] = "0";
+  }
+  // coalesced topics, e.g. 'robobot/drive/T0/pose' is coalesced if 'pose' is in list
+  coalesceKeys.clear();
+  const char * p1 = ini["mqtt"]["coalesce"].c_str();
+  while (*p1 != '\0')
+  {
+    while (*p1 == ' ')
+      p1++;
+    int n = strcspn(p1, " ");
+    if (n > 0)
+      coalesceKeys.push_back(std::string(p1, n));
+    p1 += n;
+  }
+  minInterval = strtof(ini["mqtt"]["min_interval_ms"].c_str(), nullptr) / 1000.0;
   if (ini["mqtt"]["print"] == "true")
   // logfiles
   toConsole = ini["mqtt"]["print"] == "true";
-  if (ini["mqtt"]["log"] == "true" and logfile == nullptr)
+  if (ini["mqtt"]["log"] == "true" and logCh < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_mqtt.txt";
-    logfile = fopen(fn.c_str(), "w");
-    fprintf(logfile, "%% mqtt logfile, enabled=%s\n", ini["mqtt"]["use"].c_str());
-    fprintf(logfile, "%% broker=%s\n", ini["mqtt"]["broker"].c_str());
-    fprintf(logfile, "%% context=%s\n", ini["mqtt"]["context"].c_str());
-    fprintf(logfile, "%% client id=%s\n", ini["mqtt"]["clientid"].c_str());
-    fprintf(logfile, "%% system=%s (top level ID)\n", ini["mqtt"]["system"].c_str());
-    fprintf(logfile, "%% function=%s (next level name)\n", ini["mqtt"]["function"].c_str());
-    fprintf(logfile, "%% 1 \tTime (sec)\n");
-    fprintf(logfile, "%% 2 \tQuality of service 0=max once, 1=at least once, 2=once, S=subscribe\n");
-    // fprintf(logfile, "%% 3 \tTx = published, Rx = received, Su = subscribe\n");
-    fprintf(logfile, "%% 3 \t'Topic'\n");
-    fprintf(logfile, "%% 4 \tMessage / payload\n");
+    logCh = logger.addChannel("log_mqtt", "");
+    logger.addHeader(logCh, "%% mqtt logfile, enabled=%s\n", ini["mqtt"]["use"].c_str());
+    logger.addHeader(logCh, "%% broker=%s\n", ini["mqtt"]["broker"].c_str());
+    logger.addHeader(logCh, "%% context=%s\n", ini["mqtt"]["context"].c_str());
+    logger.addHeader(logCh, "%% client id=%s\n", ini["mqtt"]["clientid"].c_str());
+    logger.addHeader(logCh, "%% system=%s (top level ID)\n", ini["mqtt"]["system"].c_str());
+    logger.addHeader(logCh, "%% function=%s (next level name)\n", ini["mqtt"]["function"].c_str());
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2 \tQuality of service 0=max once, 1=at least once, 2=once, S=subscribe\n");
+    // logger.addHeader(logCh, "%% 3 \tTx = published, Rx = received, Su = subscribe\n");
+    logger.addHeader(logCh, "%% 3 \t'Topic'\n");
+    logger.addHeader(logCh, "%% 4 \tMessage / payload\n");
   }
   // MQTT
   if (ini["mqtt"]["use"] == "true" and not connected)
@@ -123,13 +144,10 @@ void UMqtt::setup()
         printf("# UMqtt:: Failed to connect, return code %d\n", rc);
   //       rc = EXIT_FAILURE;
   //       goto destroy_exit;
-        if (logfile != nullptr and not service.stop_logging)
+        if (logCh >= 0 and not service.stop_logging)
         {
-          logLock.lock();
           UTime t("now");
-          fprintf(logfile,"%lu.%04ld Failed (%d) to connect to to MQTT server\n",
-                  t.getSec(), t.getMicrosec()/100, rc);
-          logLock.unlock();
+          logger.logText(logCh, t, "Failed (%d) to connect to to MQTT server\n", rc);
         }
       }
     }
@@ -142,9 +160,14 @@ void UMqtt::setup()
     }
     //end MQTT
 
-    // if (isOK and not service.stop)
-    //   // start listen to the keyboard
-    //   th1 = new std::thread(runObj, this);
+    if (isOK and th1 == nullptr)
+    { // start sender thread
+      int n = strtol(ini["mqtt"]["queue_size"].c_str(), nullptr, 10);
+      if (n < 16)
+        n = 16;
+      queue.init(n);
+      th1 = new std::thread(runObj, this);
+    }
     connected = isOK;
   }
   else
@@ -154,11 +177,14 @@ void UMqtt::setup()
 void UMqtt::terminate()
 {
   if (th1 != nullptr)
+  { // publish the rest of the queue
+    stopSender = true;
+    wakeSender();
     th1->join();
-  if (logfile != nullptr)
-  {
-    fclose(logfile);
+    th1 = nullptr;
+    printStat();
   }
+  // logfile is closed by the logger
   if (client != nullptr)
   {
     int rc = MQTTClient_disconnect(client, 10000);
@@ -175,47 +201,22 @@ void UMqtt::terminate()
 bool UMqtt::subscribe ( const char* topic, int qos )
 {
   MQTTClient_subscribe(client, topic, qos);
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    logLock.lock();
     UTime t("now");
-    fprintf(logfile, "%lu.%04ld S %d %s\n",
-    t.getSec(), t.getMicrosec()/100,
-            qos, topic);
-    logLock.unlock();
+    logger.logText(logCh, t, "S %d %s\n", qos, topic);
   }
   return true;
 }
 
 
-// void UMqtt::run()
-// {
-//   int loop = 0;
-//   auto sampleTime =  1ms;
-//   auto loopTime = std::chrono::steady_clock::now() + sampleTime;
-//   printf("# MQtt thread started\n");
-//   while (not service.stop)
-//   {
-//     loop++;
-//     //
-//     std::this_thread::sleep_until(loopTime);
-//     loopTime += sampleTime;
-//   }
-//   printf("# MQtt terminated\n");
-// }
-
-
 void UMqtt::toLogRx(const char* context, const char* topic, char * message, int qos, UTime t, bool /*used*/)
 { // pv is pin-value
   if (service.stop)
     return;
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    logLock.lock();
-    fprintf(logfile,"%lu.%04ld Rx %d %s %s %s\n",
-            t.getSec(), t.getMicrosec()/100,
-            qos, context, topic, message);
-    logLock.unlock();
+    logger.logText(logCh, t, "Rx %d %s %s %s\n", qos, context, topic, message);
   }
   if (toConsole)
   {
@@ -271,8 +272,8 @@ void UMqtt::connlost(void */*context*/, char *cause)
 
 bool UMqtt::publish(const char * topic, const char * payload, UTime & msgTime, int qos)
 {
-  if (ini["mqtt"]["use"] != "true")
-    // MQTT disabled in robot.ini
+  if (not config.get()->mqtt.use)
+    // MQTT disabled in robot.ini (or by 'config set mqtt use false')
     return false;
   if (not connected)
   {  printf("# publish, but not connected; a %s\n", topic);
@@ -282,7 +283,187 @@ bool UMqtt::publish(const char * topic, const char * payload, UTime & msgTime, i
   if (strlen(topic) < 5)
     // no topic
     return false;
-  mqttPublishLock.lock();  //
+  int ti = getTopic(topic);
+  if (ti < 0)
+  { // topic too long or cache full
+    dropCnt++;
+    return false;
+  }
+  UMqttTopic & tp = topics[ti];
+  if (tp.coalesce and qos == 0)
+  { // keep the newest value only
+    while (tp.lock.test_and_set(std::memory_order_acquire))
+    {} // another thread is updating this topic
+    if (tp.pending)
+      coalesceCnt++;
+    strncpy(tp.latest, payload, UMqttMsg::MPL - 1);
+    tp.latest[UMqttMsg::MPL - 1] = '\0';
+    tp.msgTime = msgTime;
+    tp.queuedAt.now();
+    tp.pending = true;
+    tp.lock.clear(std::memory_order_release);
+    coalescePending = true;
+  }
+  else
+  { // add to queue
+    uint64_t pos;
+    UMqttMsg * m = queue.reserve(pos);
+    if (m == nullptr)
+    { // sender is too far behind
+      dropCnt++;
+      return false;
+    }
+    m->topic = ti;
+    m->qos = qos;
+    m->msgTime = msgTime;
+    m->queuedAt.now();
+    strncpy(m->payload, payload, UMqttMsg::MPL - 1);
+    m->payload[UMqttMsg::MPL - 1] = '\0';
+    queue.commit(pos);
+    int d = queue.depth();
+    int dm = queueDepthMax.load(std::memory_order_relaxed);
+    while (d > dm and not queueDepthMax.compare_exchange_weak(dm, d, std::memory_order_relaxed))
+    {} // dm is updated by compare_exchange
+  }
+  wakeSender();
+  return true;
+}
+
+int UMqtt::getTopic(const char * topic)
+{ // FNV-1a hash of topic
+  uint32_t h = 2166136261u;
+  int n = 0;
+  for (const char * p1 = topic; *p1 != '\0'; p1++, n++)
+    h = (h ^ uint8_t(*p1)) * 16777619u;
+  if (n >= UMqttTopic::MTL)
+    return -1;
+  for (int i = 0; i < MAX_TOPICS; i++)
+  {
+    int idx = (h + i) % MAX_TOPICS;
+    UMqttTopic & t = topics[idx];
+    if (not t.used.load(std::memory_order_acquire))
+    { // not found, so add
+      std::lock_guard<std::mutex> lock(topicLock);
+      if (t.used.load(std::memory_order_relaxed))
+      { // added by another thread in the meantime
+        if (strcmp(t.topic, topic) == 0)
+          return idx;
+        continue;
+      }
+      strncpy(t.topic, topic, UMqttTopic::MTL);
+      const char * key = strrchr(topic, '/');
+      key = (key == nullptr) ? topic : key + 1;
+      t.coalesce = false;
+      for (auto & k : coalesceKeys)
+      {
+        if (k == key)
+          t.coalesce = true;
+      }
+      t.used.store(true, std::memory_order_release);
+      return idx;
+    }
+    if (strcmp(t.topic, topic) == 0)
+      return idx;
+  }
+  return -1;
+}
+
+void UMqtt::wakeSender()
+{ // the message is committed to the queue (a store) before this load,
+  // the fence keeps that order (pairs with the fence in run())
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (senderWaiting.load())
+  {
+    std::lock_guard<std::mutex> lock(wakeLock);
+    wake.notify_one();
+  }
+}
+
+void UMqtt::run()
+{ // sender thread
+  const int MSL = UMqttMsg::MPL;
+  char s[MSL];
+  // a coalesced topic is waiting for its min interval
+  bool rateLimited = false;
+  while (true)
+  {
+    UMqttMsg * m;
+    while ((m = queue.front()) != nullptr)
+    { // publish all queued messages
+      sendToBroker(topics[m->topic].topic, m->payload, m->msgTime, m->qos);
+      queueHist.add(m->queuedAt.getTimePassed());
+      queue.pop();
+    }
+    // newest value of coalesced topics
+    float next = 0.1;
+    if (coalescePending.exchange(false) or rateLimited)
+    {
+      rateLimited = false;
+      for (int i = 0; i < MAX_TOPICS; i++)
+      {
+        UMqttTopic & t = topics[i];
+        if (not t.used.load(std::memory_order_acquire) or not t.coalesce)
+          continue;
+        float dt = t.lastSent.getTimePassed();
+        if (minInterval > 0 and dt < minInterval)
+        { // rate limited, check again later
+          while (t.lock.test_and_set(std::memory_order_acquire))
+          {}
+          bool pending = t.pending;
+          t.lock.clear(std::memory_order_release);
+          if (pending)
+          {
+            rateLimited = true;
+            next = fminf(next, minInterval - dt);
+          }
+          continue;
+        }
+        while (t.lock.test_and_set(std::memory_order_acquire))
+        {}
+        bool pending = t.pending;
+        UTime msgTime = t.msgTime;
+        UTime queuedAt = t.queuedAt;
+        if (pending)
+          // latest is always zero terminated (same size as s)
+          memcpy(s, t.latest, MSL);
+        t.pending = false;
+        t.lock.clear(std::memory_order_release);
+        if (pending)
+        {
+          sendToBroker(t.topic, s, msgTime, 0);
+          queueHist.add(queuedAt.getTimePassed());
+          t.lastSent.now();
+        }
+      }
+    }
+    if (stopSender and queue.front() == nullptr)
+      break;
+    // wait for more
+    std::unique_lock<std::mutex> lock(wakeLock);
+    senderWaiting = true;
+    // queue is tested after senderWaiting is set (see wakeSender())
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (queue.front() == nullptr and not coalescePending.load() and not stopSender)
+      wake.wait_for(lock, std::chrono::microseconds(int(next * 1e6)));
+    senderWaiting = false;
+  }
+}
+
+void UMqtt::printStat()
+{
+  printf("# UMqtt:: published %lld, coalesced %lld, dropped %d, max queue %d\n",
+         (long long)sentCnt, (long long)coalesceCnt.load(), dropCnt.load(), queueDepthMax.load());
+  if (logCh >= 0)
+  {
+    UTime t("now");
+    logger.logText(logCh, t, "published %lld, coalesced %lld, dropped %d, max queue %d\n",
+                   (long long)sentCnt, (long long)coalesceCnt.load(), dropCnt.load(), queueDepthMax.load());
+  }
+}
+
+bool UMqtt::sendToBroker(const char * topic, const char * payload, UTime & msgTime, int qos)
+{
+  UTime pubStart("now");
   //const auto mtime{system_clock::now()};
   //auto ms_since_epoch = duration_cast<milliseconds>(mtime.time_since_epoch());
   // time since 1 January 1970 in seconds from system clock
@@ -307,14 +488,11 @@ bool UMqtt::publish(const char * topic, const char * payload, UTime & msgTime, i
   }
   if (rc != MQTTCLIENT_SUCCESS)
   {
-    if (logfile != nullptr and not service.stop_logging)
+    if (logCh >= 0 and not service.stop_logging)
     {
-      logLock.lock();
       UTime t("now");
-      fprintf(logfile,"%lu.%04ld Fail to publish (%d, %d) %d, topic '%s', payload: %s",
-              t.getSec(), t.getMicrosec()/100, rc, publish_error,
+      logger.logText(logCh, t, "Fail to publish (%d, %d) %d, topic '%s', payload: %s", rc, publish_error,
               qos, topic, s);
-      logLock.unlock();
     }
     publish_error++;
     if (publish_error > 200)
@@ -324,14 +502,10 @@ bool UMqtt::publish(const char * topic, const char * payload, UTime & msgTime, i
   else
   { // wait for message to be delivered (for quality services only).
     //
-    if (logfile != nullptr and not service.stop_logging)
+    if (logCh >= 0 and not service.stop_logging)
     {
-      logLock.lock();
       UTime t("now");
-      fprintf(logfile,"%lu.%04ld %d '%s' %s",
-              t.getSec(), t.getMicrosec()/100,
-              qos, topic, s);
-      logLock.unlock();
+      logger.logText(logCh, t, "%d '%s' %s", qos, topic, s);
     }
     // printf("Waiting for publication of '%s' "
     // "on topic '%s' for client with ClientID: '%s'\n",
@@ -345,7 +519,8 @@ bool UMqtt::publish(const char * topic, const char * payload, UTime & msgTime, i
       #endif
     }
   }
-  mqttPublishLock.unlock();
-  return true;
+  sentCnt++;
+  pubHist.add(pubStart.getTimePassed());
+  return rc == MQTTCLIENT_SUCCESS;
 }
 
@@ -24,9 +24,52 @@
 #ifndef UMQTT_H
 #define UMQTT_H
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <condition_variable>
 #include "MQTTClient.h"
 
 #include "utime.h"
+#include "uhistogram.h"
+#include "umpscqueue.h"
+
+/**
+ * A message waiting to be published */
+class UMqttMsg
+{
+public:
+  static const int MPL = 2000;
+  /// index to topic cache
+  int topic;
+  int qos;
+  UTime msgTime;
+  UTime queuedAt;
+  char payload[MPL];
+};
+
+/**
+ * Topic cache entry, with the newest value, if the topic is coalesced.
+ * An entry is not changed once used is set. */
+class UMqttTopic
+{
+public:
+  static const int MTL = 128;
+  char topic[MTL];
+  std::atomic<bool> used = false;
+  /// keep newest value only (if not send yet)
+  bool coalesce = false;
+  /// newest value for a coalesced topic, protected by 'lock'
+  std::atomic_flag lock = ATOMIC_FLAG_INIT;
+  bool pending = false;
+  UTime msgTime;
+  UTime queuedAt;
+  char latest[UMqttMsg::MPL];
+  /// used by the sender thread only
+  UTime lastSent;
+};
 
 
 /**
@@ -51,13 +94,15 @@ public:
    * terminate */
   void terminate();
   /**
-  * to listen to subscribed messages */
-  // void run();
-  /**
-   * Publish a message
+   * Publish a message.
+   * The message is queued (no locks) and published by the sender thread,
+   * so the calling thread is not delayed by the broker.
+   * For a coalesced topic (see 'coalesce' in robot.ini) only the newest
+   * value is kept until it is published, and at most every 'min_interval_ms'.
    * \param something like robobot/drive/yaw
    * \param payload a string with parameters in clear text
    * \param qos quality of service: 0: at most once (fast), 1: at least once (resend if fail), 2: exactly once
+   * \returns false if not connected or the queue is full
    */
   bool publish(const char * topic, const char * payload, UTime & msgTime, int qos = 0);
   /**
@@ -67,11 +112,27 @@ public:
   bool subscribe(const char * topic, int qos);
 
   bool connected = false;
+  /// time used by the broker client to publish a message
+  UHistogram pubHist;
+  /// time from publish() is called until the message is published
+  UHistogram queueHist;
+  /// messages published
+  int64_t sentCnt = 0;
+  /// messages dropped, as the queue (or topic cache) is full
+  std::atomic<int> dropCnt{0};
+  /// messages replaced by a newer value (coalesced topics)
+  std::atomic<int64_t> coalesceCnt{0};
+  /// max number of messages in queue
+  std::atomic<int> queueDepthMax{0};
+  /**
+   * Print publish statistics to console */
+  void printStat();
 
 private:
   // logfile
   bool toConsole = false;
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
 
   // void decodeIncomming(const char * topic, const char * payload, UTime t);
 
@@ -82,25 +143,49 @@ private:
   MQTTClient_deliveryToken token;
   MQTTClient_deliveryToken deliveredtoken;
   //
-  std::mutex mqttPublishLock;
-  std::mutex logLock;
+  /// message queue for the sender thread
+  UMpscQueue<UMqttMsg> queue;
+  /// topic cache
+  static const int MAX_TOPICS = 128;
+  UMqttTopic topics[MAX_TOPICS];
+  std::mutex topicLock;
+  /// topic names (last part) to coalesce and min interval (sec)
+  std::vector<std::string> coalesceKeys;
+  float minInterval = 0;
+  /// a coalesced topic has a new value
+  std::atomic<bool> coalescePending{false};
+  /// sender thread
+  std::atomic<bool> senderWaiting{false};
+  std::atomic<bool> stopSender{false};
+  std::mutex wakeLock;
+  std::condition_variable wake;
+  /**
+   * Find topic in topic cache, add if not found
+   * \returns index or -1 if the cache is full */
+  int getTopic(const char * topic);
+  /** wake up the sender thread (if waiting) */
+  void wakeSender();
+  /** publish a message to the broker (sender thread) */
+  bool sendToBroker(const char * topic, const char * payload, UTime & msgTime, int qos);
+  /** sender thread */
+  void run();
+  static void runObj(UMqtt * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
   //
   static void delivered(void */*context*/, MQTTClient_deliveryToken dt);
   static int msgarrvd(void */*context*/, char *topicName, int /*topicLen*/, MQTTClient_message *message);
   static void connlost(void */*context*/, char *cause);
   int publish_error = 0;
 
-  // static void runObj(UMqtt * obj)
-  // { // called, when thread is started
-  //     // transfer to the class run() function.
-  //     obj->run();
-  // }
   /**
    * Save pin values to log when there is a change
    * \param pv is an array of current pin values */
   void toLogRx(const char * context, const char * topic, char * message, int qos, UTime t, bool used);
   //
-  std::thread * th1;
+  std::thread * th1 = nullptr;
 };
 
 /**
@@ -30,6 +30,8 @@
 #include <iostream>
 #include "uservice.h"
 #include "umqttin.h"
+#include "ulogger.h"
+#include "uconfig.h"
 
 using namespace std::chrono;
 
@@ -59,21 +61,20 @@ void UMqttIn::setup()
   if (ini["mqttin"]["print"] == "true")
   // logfiles
   toConsole = ini["mqttin"]["print"] == "true";
-  if (ini["mqttin"]["log"] == "true" and logfile == nullptr)
+  if (ini["mqttin"]["log"] == "true" and logCh < 0)
   { // open logfile
-    std::string fn = service.logPath + "log_mqtt_in.txt";
-    logfile = fopen(fn.c_str(), "w");
-    fprintf(logfile, "%% mqtt logfile, enabled=%s\n", ini["mqttin"]["use"].c_str());
-    fprintf(logfile, "%% broker=%s\n", ini["mqttin"]["broker"].c_str());
-    fprintf(logfile, "%% context=%s\n", ini["mqttin"]["context"].c_str());
-    fprintf(logfile, "%% client id=%s\n", ini["mqttin"]["clientid"].c_str());
-    fprintf(logfile, "%% system=%s (top level ID)\n", ini["mqttin"]["system"].c_str());
-    fprintf(logfile, "%% function=%s (next level name)\n", ini["mqttin"]["function"].c_str());
-    fprintf(logfile, "%% 1 \tTime (sec)\n");
-    fprintf(logfile, "%% 2 \tQuality of service 0=max once, 1=at least once, 2=once, S=subscribe\n");
-    // fprintf(logfile, "%% 3 \tTx = published, Rx = received, Su = subscribe\n");
-    fprintf(logfile, "%% 3 \t'Topic'\n");
-    fprintf(logfile, "%% 4 \tMessage / payload\n");
+    logCh = logger.addChannel("log_mqtt_in", "");
+    logger.addHeader(logCh, "%% mqtt logfile, enabled=%s\n", ini["mqttin"]["use"].c_str());
+    logger.addHeader(logCh, "%% broker=%s\n", ini["mqttin"]["broker"].c_str());
+    logger.addHeader(logCh, "%% context=%s\n", ini["mqttin"]["context"].c_str());
+    logger.addHeader(logCh, "%% client id=%s\n", ini["mqttin"]["clientid"].c_str());
+    logger.addHeader(logCh, "%% system=%s (top level ID)\n", ini["mqttin"]["system"].c_str());
+    logger.addHeader(logCh, "%% function=%s (next level name)\n", ini["mqttin"]["function"].c_str());
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2 \tQuality of service 0=max once, 1=at least once, 2=once, S=subscribe\n");
+    // logger.addHeader(logCh, "%% 3 \tTx = published, Rx = received, Su = subscribe\n");
+    logger.addHeader(logCh, "%% 3 \t'Topic'\n");
+    logger.addHeader(logCh, "%% 4 \tMessage / payload\n");
   }
   // MQTT
   if (ini["mqttin"]["use"] == "true" and not connected)
@@ -122,13 +123,10 @@ void UMqttIn::setup()
         printf("# UMqttIn:: Failed to connect, return code %d\n", rc);
   //       rc = EXIT_FAILURE;
   //       goto destroy_exit;
-        if (logfile != nullptr and not service.stop_logging)
+        if (logCh >= 0 and not service.stop_logging)
         {
-          logLock.lock();
           UTime t("now");
-          fprintf(logfile,"%lu.%04ld Failed (%d) to connect to to MQTT server\n",
-                  t.getSec(), t.getMicrosec()/100, rc);
-          logLock.unlock();
+          logger.logText(logCh, t, "Failed (%d) to connect to to MQTT server\n", rc);
         }
       }
     }
@@ -153,10 +151,7 @@ void UMqttIn::terminate()
 {
   if (th1 != nullptr)
     th1->join();
-  if (logfile != nullptr)
-  {
-    fclose(logfile);
-  }
+  // logfile is closed by the logger
   if (client != nullptr)
   {
     int rc = MQTTClient_disconnect(client, 10000);
@@ -173,14 +168,10 @@ void UMqttIn::terminate()
 bool UMqttIn::subscribe ( const char* topic, int qos )
 {
   MQTTClient_subscribe(client, topic, qos);
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    logLock.lock();
     UTime t("now");
-    fprintf(logfile, "%lu.%04ld S %d %s\n",
-    t.getSec(), t.getMicrosec()/100,
-            qos, topic);
-    logLock.unlock();
+    logger.logText(logCh, t, "S %d %s\n", qos, topic);
   }
   return true;
 }
@@ -189,13 +180,9 @@ void UMqttIn::toLogRx(const char* context, const char* topic, char * message, in
 { // pv is pin-value
   if (service.stop)
     return;
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    logLock.lock();
-    fprintf(logfile,"%lu.%04ld %d %s %s %s\n",
-            t.getSec(), t.getMicrosec()/100,
-            qos, context, topic, message);
-    logLock.unlock();
+    logger.logText(logCh, t, "%d %s %s %s\n", qos, context, topic, message);
   }
   if (toConsole)
   {
@@ -224,14 +211,13 @@ int UMqttIn::msgarrvd(void *context, char *topicName, int /*topicLen*/, MQTTClie
   }
   //
   UTime t("now");
-  const int MSL = 200;
-  char s[MSL];
-  int n = 200;
-  if (message->payloadlen > MSL - 1)
-    n = MSL-1;
-  else
-    n = message->payloadlen;
-  strncpy(s, (char*)message->payload, n);
+  // the payload is not zero terminated, so copy to a buffer,
+  // that grows to the largest payload (called from the Paho thread only)
+  int n = message->payloadlen;
+  if (n + 1 > (int)mqttin.rxBuf.size())
+    mqttin.rxBuf.resize(n + 1);
+  char * s = mqttin.rxBuf.data();
+  memcpy(s, message->payload, n);
   s[n] = '\0';
   bool used = service.mqttDecode(topicName, s, t);
   mqttin.toLogRx((char*)context, topicName, s, message->qos, t, used);
@@ -251,7 +237,7 @@ void UMqttIn::connlost(void */*context*/, char *cause)
 
 bool UMqttIn::publish(const char * topic, const char * payload, UTime & msgTime, int qos)
 {
-  if (ini["mqttin"]["use"] != "true")
+  if (not config.get()->mqttin.use)
     // MQTT disabled in robot.ini
     return false;
   if (not connected)
@@ -285,14 +271,11 @@ bool UMqttIn::publish(const char * topic, const char * payload, UTime & msgTime,
   }
   if (rc != MQTTCLIENT_SUCCESS)
   {
-    if (logfile != nullptr and not service.stop_logging)
+    if (logCh >= 0 and not service.stop_logging)
     {
-      logLock.lock();
       UTime t("now");
-      fprintf(logfile,"%lu.%04ld Fail to publish (%d, %d) %d, topic '%s', payload: %s",
-              t.getSec(), t.getMicrosec()/100, rc, publish_error,
+      logger.logText(logCh, t, "Fail to publish (%d, %d) %d, topic '%s', payload: %s", rc, publish_error,
               qos, topic, s);
-      logLock.unlock();
     }
     publish_error++;
     if (publish_error > 200)
@@ -302,14 +285,10 @@ bool UMqttIn::publish(const char * topic, const char * payload, UTime & msgTime,
   else
   { // wait for message to be delivered (for quality services only).
     //
-    if (logfile != nullptr and not service.stop_logging)
+    if (logCh >= 0 and not service.stop_logging)
     {
-      logLock.lock();
       UTime t("now");
-      fprintf(logfile,"%lu.%04ld %d '%s' %s",
-              t.getSec(), t.getMicrosec()/100,
-              qos, topic, s);
-      logLock.unlock();
+      logger.logText(logCh, t, "%d '%s' %s", qos, topic, s);
     }
     // printf("Waiting for publication of '%s' "
     // "on topic '%s' for client with ClientID: '%s'\n",
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <vector>
 #include "MQTTClient.h"
 
 #include "utime.h"
@@ -70,7 +71,8 @@ public:
 private:
   // logfile
   bool toConsole = false;
-  FILE * logfile = nullptr;
+  /// log channel (see ulogger.h)
+  int logCh = -1;
 
   // void decodeIncomming(const char * topic, const char * payload, UTime t);
 
@@ -82,12 +84,13 @@ private:
   MQTTClient_deliveryToken deliveredtoken;
   //
   std::mutex mqttPublishLock;
-  std::mutex logLock;
   //
   static void delivered(void */*context*/, MQTTClient_deliveryToken dt);
   static int msgarrvd(void */*context*/, char *topicName, int /*topicLen*/, MQTTClient_message *message);
   static void connlost(void */*context*/, char *cause);
   int publish_error = 0;
+  /// received payload (zero terminated), grows to the largest payload
+  std::vector<char> rxBuf;
 
   // static void runObj(UMqttIn * obj)
   // { // called, when thread is started
@@ -27,6 +27,7 @@
 #include <math.h>
 #include "upid.h"
 #include "uservice.h"
+#include "ulogger.h"
 
 
 // PID controller class:
@@ -75,25 +76,25 @@ void UPID::setup(float sTime,
   //
 }
 
-void UPID::logPIDparams(FILE* logfile, bool andColumns)
+void UPID::logPIDparams(int logCh, bool andColumns)
 {
-  fprintf(logfile, "%% PID parameters\n");
-  fprintf(logfile, "%% \tKp = %g\n", kp);
-  fprintf(logfile, "%% \ttau_d = %g, alpha = %g (use lead=%d)\n", taud, alpha, useLead);
-  fprintf(logfile, "%% \ttau_i = %g (used=%d)\n", taui, useIntegrator);
-  fprintf(logfile, "%% \tfeed forward = %g\n", ffp);
-  fprintf(logfile, "%% \tsample time = %.1f ms\n", sampleTime*1000.0);
-  fprintf(logfile, "%% \t(derived values: le0=%g, le1=%g, lu1=%g, ie=%g)\n", le0, le1, lu1, ie);
+  logger.addHeader(logCh, "%% PID parameters\n");
+  logger.addHeader(logCh, "%% \tKp = %g\n", kp);
+  logger.addHeader(logCh, "%% \ttau_d = %g, alpha = %g (use lead=%d)\n", taud, alpha, useLead);
+  logger.addHeader(logCh, "%% \ttau_i = %g (used=%d)\n", taui, useIntegrator);
+  logger.addHeader(logCh, "%% \tfeed forward = %g\n", ffp);
+  logger.addHeader(logCh, "%% \tsample time = %.1f ms\n", sampleTime*1000.0);
+  logger.addHeader(logCh, "%% \t(derived values: le0=%g, le1=%g, lu1=%g, ie=%g)\n", le0, le1, lu1, ie);
   if (andColumns)
   { // column description
-    fprintf(logfile, "%% 1 \tTime (sec)\n");
-    fprintf(logfile, "%% 2 \tReference for desired value\n");
-    fprintf(logfile, "%% 3 \tMeasured value\n");
-    fprintf(logfile, "%% 4 \tValue after Kp\n");
-    fprintf(logfile, "%% 5 \tValue after Lead\n");
-    fprintf(logfile, "%% 6 \tIntegrator value\n");
-    fprintf(logfile, "%% 7 \tAfter controller (u)\n");
-    fprintf(logfile, "%% 8 \tIs output limited (1=limited)\n");
+    logger.addHeader(logCh, "%% 1 \tTime (sec)\n");
+    logger.addHeader(logCh, "%% 2 \tReference for desired value\n");
+    logger.addHeader(logCh, "%% 3 \tMeasured value\n");
+    logger.addHeader(logCh, "%% 4 \tValue after Kp\n");
+    logger.addHeader(logCh, "%% 5 \tValue after Lead\n");
+    logger.addHeader(logCh, "%% 6 \tIntegrator value\n");
+    logger.addHeader(logCh, "%% 7 \tAfter controller (u)\n");
+    logger.addHeader(logCh, "%% 8 \tIs output limited (1=limited)\n");
   }
 }
 
@@ -186,18 +187,16 @@ void UPID::resetHistory()
 }
 
 
-void UPID::saveToLog(FILE* logfile, UTime t)
+void UPID::saveToLog(int logCh, UTime t)
 {// log_pose
-  if (logfile != nullptr and not service.stop_logging)
+  if (logCh >= 0 and not service.stop_logging)
   {
-    fprintf(logfile, "%lu.%04ld %.3f %.3f %.3f %.3f %.3f %.3f %d\n",
-            t.getSec(), t.getMicrosec()/100,
-            r, m,
-            ep1,
-            up1,
-            ui1,
-            u,
-            limited
+    logger.log(logCh, t, r, m,
+               ep1,
+               up1,
+               ui1,
+               u,
+               limited
     );
   }
   if (toConsole)
@@ -53,14 +53,14 @@ public:
    * reset the control history */
   void resetHistory();
   /**
-   * save PID parameters to this logfile */
-  void logPIDparams(FILE * logfile, bool andColumns);
+   * save PID parameters to this log channel (see ulogger.h) */
+  void logPIDparams(int logCh, bool andColumns);
   /**
    * Sage the current control values to this logfile
-   * \param logfile is a valid file handle
+   * \param logCh is the log channel (see ulogger.h), or -1 for no logfile
    * \param t is the time where the values are valid
    * */
-  void saveToLog(FILE * logfile, UTime t);
+  void saveToLog(int logCh, UTime t);
   /**
    * reference and measurement may be in radians
    * ensure correct folding of angles. */
@@ -0,0 +1,268 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#include <string>
+#include <string.h>
+#include <pthread.h>
+#include <alloca.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "urealtime.h"
+#include "uservice.h"
+
+// create value
+URealtime realtime;
+
+
+UPeriodic::~UPeriodic()
+{
+  if (registered)
+    realtime.remove(this);
+}
+
+void UPeriodic::start(const char* name, float period, bool wakeable)
+{
+  this->wakeable = wakeable;
+  woken = false;
+  strncpy(this->name, name, sizeof(this->name) - 1);
+  periodNs = long(period * 1e9);
+  if (periodNs < 1000)
+    periodNs = 1000;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  if (not registered)
+  {
+    realtime.add(this);
+    registered = true;
+  }
+  wait();
+}
+
+bool UPeriodic::wait()
+{
+  if (not woken)
+  { // last wait ended at period end
+    next.tv_nsec += periodNs;
+    while (next.tv_nsec >= 1000000000)
+    {
+      next.tv_nsec -= 1000000000;
+      next.tv_sec++;
+    }
+  }
+  woken = false;
+  if (wakeable)
+  { // steady_clock is CLOCK_MONOTONIC
+    std::chrono::steady_clock::time_point end{std::chrono::seconds(next.tv_sec) +
+                                              std::chrono::nanoseconds(next.tv_nsec)};
+    std::unique_lock<std::mutex> lock(wakeLock);
+    if (wakeCv.wait_until(lock, end, [this]{ return wakeRequest; }))
+    { // woken before period end
+      wakeRequest = false;
+      woken = true;
+      return false;
+    }
+  }
+  else
+  {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR)
+      ;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t errNs = (now.tv_sec - next.tv_sec) * 1000000000LL + (now.tv_nsec - next.tv_nsec);
+  error.add(errNs * 1e-9);
+  int64_t us = errNs / 1000;
+  int64_t m = minUs.load(std::memory_order_relaxed);
+  while (us < m and not minUs.compare_exchange_weak(m, us, std::memory_order_relaxed))
+    ;
+  if (errNs > periodNs)
+  { // lost one or more periods, restart schedule from now
+    overruns++;
+    next = now;
+  }
+  return true;
+}
+
+void UPeriodic::wake()
+{
+  if (not wakeable)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(wakeLock);
+    wakeRequest = true;
+  }
+  wakeCv.notify_one();
+}
+
+void UPeriodic::clear()
+{
+  error.clear();
+  minUs = INT64_MAX;
+  overruns = 0;
+}
+
+const char * UPeriodic::format(char* s, int MSL) const
+{
+  int64_t m = minUs.load(std::memory_order_relaxed);
+  if (error.count() == 0)
+    m = 0;
+  snprintf(s, MSL, "%s %lld %.3f %.3f %.3f %.3f %d\n",
+           name, (long long)error.count(), m * 1e-3, error.mean() * 1e3,
+           error.quantile(0.99) * 1e3, error.max() * 1e3, overruns.load());
+  return s;
+}
+
+
+void URealtime::setup()
+{ // ensure there is default values in ini-file
+  if (not ini.has("realtime"))
+  { // no data yet, so generate some default values
+    ini["realtime"]["use"] = "false";
+    ini["realtime"]["mlockall"] = "true";
+    ini["realtime"]["stack_prefault_kb"] = "256";
+    // per thread: SCHED_FIFO priority (1..99, 0 is normal scheduling)
+    // and CPU to run on (-1 is any)
+    ini["realtime"]["teensy_io"] = "85 3";
+    ini["realtime"]["velocity"] = "80 3";
+    ini["realtime"]["motor"] = "80 3";
+    ini["realtime"]["mixer"] = "75 3";
+    ini["realtime"]["gpio"] = "50 -1";
+  }
+  if (not ini["realtime"].has("pipeline"))
+    // control pipeline (velocity, mixer and motor in one thread)
+    ini["realtime"]["pipeline"] = "80 3";
+  use = ini["realtime"]["use"] == "true";
+  if (not use)
+    return;
+  stackPrefault = strtol(ini["realtime"]["stack_prefault_kb"].c_str(), nullptr, 10) * 1024;
+  if (ini["realtime"]["mlockall"] == "true")
+  { // no page faults in control loops
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+      perror("# URealtime::setup: mlockall failed (needs CAP_IPC_LOCK or ulimit -l)");
+  }
+}
+
+void URealtime::configure(const char* key, int index)
+{
+  std::string name = std::string("ti_") + key;
+  if (index >= 0)
+    name += std::to_string(index);
+  // thread name (max 15 characters) is shown by top -H and ps -L
+  pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+  if (not use or not ini["realtime"].has(key))
+    return;
+  const char * p1 = ini["realtime"][key].c_str();
+  int prio = strtol(p1, (char**)&p1, 10);
+  int cpu = strtol(p1, (char**)&p1, 10);
+  if (cpu >= 0)
+  {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    int e = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+    if (e != 0)
+      printf("# URealtime::configure: %s failed to set CPU %d: %s\n", name.c_str(), cpu, strerror(e));
+  }
+  if (prio > 0)
+  {
+    struct sched_param sp;
+    sp.sched_priority = prio;
+    int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (e != 0)
+      printf("# URealtime::configure: %s failed to set SCHED_FIFO priority %d: %s\n", name.c_str(), prio, strerror(e));
+  }
+  if (stackPrefault > 0)
+  { // touch the stack, so that it is mapped (and locked) now
+    volatile char * stack = (volatile char *)alloca(stackPrefault);
+    for (int i = 0; i < stackPrefault; i += 1024)
+      stack[i] = 0;
+  }
+  printf("# URealtime::configure: %s priority %d, CPU %d\n", name.c_str(), prio, cpu);
+}
+
+void URealtime::add(UPeriodic* loop)
+{
+  std::lock_guard<std::mutex> lock(loopLock);
+  if (loopsCnt < MAX_LOOPS)
+    loops[loopsCnt++] = loop;
+}
+
+void URealtime::remove(UPeriodic* loop)
+{
+  std::lock_guard<std::mutex> lock(loopLock);
+  for (int i = 0; i < loopsCnt; i++)
+  {
+    if (loops[i] == loop)
+    {
+      loops[i] = loops[--loopsCnt];
+      break;
+    }
+  }
+}
+
+int URealtime::getLoops(UPeriodic* list[], int maxCnt)
+{
+  std::lock_guard<std::mutex> lock(loopLock);
+  int n = 0;
+  for (int i = 0; i < loopsCnt and n < maxCnt; i++)
+    list[n++] = loops[i];
+  return n;
+}
+
+void URealtime::clear()
+{
+  std::lock_guard<std::mutex> lock(loopLock);
+  for (int i = 0; i < loopsCnt; i++)
+    loops[i]->clear();
+}
+
+void URealtime::print()
+{
+  printf("# Loop jitter (ms)               count      min     mean      p99      max  overruns\n");
+  std::lock_guard<std::mutex> lock(loopLock);
+  for (int i = 0; i < loopsCnt; i++)
+  {
+    UPeriodic * p = loops[i];
+    int64_t m = p->minUs.load();
+    if (p->error.count() == 0)
+      m = 0;
+    printf("#   %-26s %8lld %8.3f %8.3f %8.3f %8.3f %9d\n", p->name, (long long)p->error.count(),
+           m * 1e-3, p->error.mean() * 1e3, p->error.quantile(0.99) * 1e3,
+           p->error.max() * 1e3, p->overruns.load());
+  }
+}
+
+const char * URealtime::format(char* s, int MSL)
+{
+  const int MLL = 150;
+  char line[MLL];
+  std::lock_guard<std::mutex> lock(loopLock);
+  for (int i = 0; i < loopsCnt; i++)
+  {
+    loops[i]->format(line, MLL);
+    strncat(s, "jitter/", MSL - strlen(s) - 1);
+    strncat(s, line, MSL - strlen(s) - 1);
+  }
+  return s;
+}
@@ -0,0 +1,143 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef UREALTIME_H
+#define UREALTIME_H
+
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <time.h>
+#include "uhistogram.h"
+
+/**
+ * Periodic loop timing using absolute wake-up times
+ * (clock_nanosleep with TIMER_ABSTIME on CLOCK_MONOTONIC),
+ * so that processing time and wake-up latency do not add up.
+ * The wake-up error (actual minus scheduled time) is collected
+ * for the jitter report.
+ * Use:
+ *   UPeriodic loop;
+ *   loop.start("mixer", 0.001);
+ *   while (...) { ...; loop.wait(); }
+ * A loop started as wakeable can be woken early by another thread
+ * (wake()), e.g. for new manual input, without moving the schedule.
+ * */
+class UPeriodic
+{
+public:
+  ~UPeriodic();
+  /**
+   * Start the period from now, and add to the jitter report
+   * \param name is used in the report
+   * \param period is the period time in seconds
+   * \param wakeable allows wake() from other threads */
+  void start(const char * name, float period, bool wakeable = false);
+  /**
+   * Sleep until the start of next period (or wake()).
+   * If more than one period is lost, then the schedule is restarted from now
+   * \returns false if woken before the period ended */
+  bool wait();
+  /**
+   * Let wait() return now (if wakeable), the next wait()
+   * continues to the same period end */
+  void wake();
+  /** clear statistics */
+  void clear();
+  /**
+   * Format one line as "name count min mean p99 max overruns\n" (ms)
+   * \returns s */
+  const char * format(char * s, int MSL) const;
+  /** report name */
+  char name[32] = {'\0'};
+  /** wake-up error */
+  UHistogram error;
+  /** smallest wake-up error (microseconds) */
+  std::atomic<int64_t> minUs{INT64_MAX};
+  /** number of lost periods */
+  std::atomic<int> overruns{0};
+
+private:
+  struct timespec next;
+  long periodNs = 1000000;
+  bool registered = false;
+  // wake-up from other threads
+  bool wakeable = false;
+  bool woken = false;
+  bool wakeRequest = false;
+  std::mutex wakeLock;
+  std::condition_variable wakeCv;
+};
+
+/**
+ * Real-time settings for the control threads (robot.ini [realtime]).
+ * If enabled, then memory is locked (mlockall), and each control thread
+ * gets a scheduling priority (SCHED_FIFO) and CPU affinity from robot.ini
+ * when it calls configure() at start of its run() function.
+ * */
+class URealtime
+{
+public:
+  /**
+   * Setup and lock memory, call before the threads are started */
+  void setup();
+  /**
+   * Set priority and CPU affinity for the calling thread, and
+   * pre-fault its stack.
+   * \param key is the robot.ini key for this thread (e.g. 'mixer')
+   * \param index is added to the thread name (e.g. Teensy number), -1 is none */
+  void configure(const char * key, int index = -1);
+  /**
+   * Add or remove a periodic loop from the jitter report */
+  void add(UPeriodic * loop);
+  void remove(UPeriodic * loop);
+  /**
+   * Get the periodic loops (e.g. for a benchmark report)
+   * \returns number of loops copied to list */
+  int getLoops(UPeriodic * list[], int maxCnt);
+  /** clear statistics for all loops */
+  void clear();
+  /**
+   * Print jitter report to console */
+  void print();
+  /**
+   * Append jitter report lines to s (like UHistogram::format)
+   * \returns s */
+  const char * format(char * s, int MSL);
+  /// real-time mode is enabled
+  bool use = false;
+
+private:
+  /// stack size (bytes) to pre-fault for each thread
+  int stackPrefault = 0;
+  static const int MAX_LOOPS = 20;
+  UPeriodic * loops[MAX_LOOPS] = {nullptr};
+  int loopsCnt = 0;
+  std::mutex loopLock;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern URealtime realtime;
+
+#endif
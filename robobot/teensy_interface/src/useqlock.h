@@ -0,0 +1,111 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+
+#ifndef USEQLOCK_H
+#define USEQLOCK_H
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+/**
+ * Versioned snapshot of a data structure, that is written by one thread
+ * (typically the Teensy receive thread) and read by any number of threads.
+ * Reading never blocks the writer, and a reader always gets a
+ * consistent copy (all fields from the same update).
+ * A reader may also wait (without polling) for the next update.
+ *
+ * T should be a plain structure (numbers, arrays and UTime only).
+ * */
+template <class T>
+class USeqLock
+{
+public:
+  /**
+   * Publish a new value, must be called from one (writer) thread only */
+  void write(const T & value)
+  {
+    unsigned int s = seq.load(std::memory_order_relaxed);
+    // odd sequence number means write in progress
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    data = value;
+    seq.store(s + 2, std::memory_order_seq_cst);
+    if (waiting.load() > 0)
+    { // someone is waiting for this update
+      std::lock_guard<std::mutex> lock(waitLock);
+      updated.notify_all();
+    }
+  }
+  /**
+   * Get a consistent copy of the latest value
+   * \param value is where the copy is placed
+   * \returns the version (update count) of this value */
+  int read(T & value) const
+  {
+    unsigned int s1, s2;
+    do
+    {
+      s1 = seq.load(std::memory_order_acquire);
+      value = data;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      s2 = seq.load(std::memory_order_relaxed);
+    } while ((s1 & 1) or s1 != s2);
+    return s1 / 2;
+  }
+  /**
+   * Version (update count) of the latest value */
+  int version() const
+  {
+    return seq.load() / 2;
+  }
+  /**
+   * Wait for a value newer than this version
+   * \param since is the version already used
+   * \param timeout_sec is the maximum wait time
+   * \returns true if there is a newer version, false on timeout */
+  bool waitForUpdate(int since, float timeout_sec)
+  {
+    if (version() != since)
+      return true;
+    std::unique_lock<std::mutex> lock(waitLock);
+    waiting++;
+    bool isNew = updated.wait_for(lock, std::chrono::duration<float>(timeout_sec),
+                                  [this, since]{ return version() != since; });
+    waiting--;
+    return isNew;
+  }
+
+private:
+  /// sequence number, incremented twice for every write
+  std::atomic<unsigned int> seq{0};
+  /// number of threads in waitForUpdate()
+  std::atomic<int> waiting{0};
+  T data{};
+  std::mutex waitLock;
+  std::condition_variable updated;
+};
+
+#endif
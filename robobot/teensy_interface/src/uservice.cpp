@@ -35,6 +35,9 @@
 #include "uini.h"
 #include "cmotor.h"
 #include "cmixer.h"
+#include "clinefollow.h"
+#include "ctrajectory.h"
+#include "mfusion.h"
 #include "cservo.h"
 #include "mjoy.h"
 #include "mvelocity.h"
@@ -46,10 +49,16 @@
 #include "simu.h"
 #include "sjoylogitech.h"
 #include "srobot.h"
+#include "svision.h"
 #include "steensy.h"
+#include "uteensyio.h"
 #include "umqtt.h"
 #include "umqttin.h"
 #include "uservice.h"
+#include "ulogger.h"
+#include "urealtime.h"
+#include "cpipeline.h"
+#include "uconfig.h"
 
 #define REV "$Id: uservice.cpp 1167 2025-03-02 15:40:30Z jcan $"
 // define the service class
@@ -102,6 +111,11 @@ bool UService::setup(int argc,char **argv)
   // rename feature
   int regbotHardware{-1};
   cli.add_option("-H,--hardware", regbotHardware, "Set robot hardware type (most likely 8) use with --interface.");
+  // replay
+  std::string replayFile;
+  cli.add_option("-r,--replay", replayFile, "Replay Teensy messages from logfile (log_t0_teensy_io.txt) instead of using the Teensy");
+  float replaySpeed = 1.0;
+  cli.add_option("-s,--speed", replaySpeed, "Replay speed, e.g. 10 is 10 times real time, 0 is as fast as possible (default 1)");
   //
   // Parse for command line options
   cli.allow_windows_style_options();
@@ -124,7 +138,29 @@ bool UService::setup(int argc,char **argv)
     ini["service"]["max_logging_minutes"] = "60.0";
     ini["service"]["log_service"] = "true";
   }
+  if (not ini["service"].has("latency_publish_s"))
+  { // latency statistics on MQTT, 0 is not published
+    ini["service"]["latency_publish_s"] = "10";
+  }
+  latencyInterval = strtof(ini["service"]["latency_publish_s"].c_str(), nullptr);
+  if (not ini["service"].has("teensy_count"))
+  { // number of Teensy boards, each with a [teensyN] section
+    ini["service"]["teensy_count"] = "1";
+  }
+  teensyCnt = strtol(ini["service"]["teensy_count"].c_str(), nullptr, 10);
+  if (teensyCnt < 1 or teensyCnt > NUM_TEENSY_MAX)
+  {
+    printf("# UService:: teensy_count=%d is not in range [1..%d], using 1\n", teensyCnt, NUM_TEENSY_MAX);
+    teensyCnt = 1;
+  }
   bool teensyConnect = ini["service"]["use_robot_hardware"] == "true";
+  if (not replayFile.empty())
+  { // Teensy 0 messages from logfile, no robot hardware is used
+    teensy[0].replayFile = replayFile;
+    teensy[0].replaySpeed = replaySpeed;
+    teensyConnect = true;
+    replay = true;
+  }
   if (ini["service"].has("max_logging_minutes"))
     maxLogMinutes = strtod(ini["service"]["max_logging_minutes"].c_str(), nullptr);
   // Check for selected values
@@ -134,19 +170,19 @@ bool UService::setup(int argc,char **argv)
     theEnd = true;
   }
   // gyro
-  if (calibGyro and regbotInterface >=0 and regbotInterface < NUM_TEENSY_MAX)
+  if (calibGyro and regbotInterface >=0 and regbotInterface < teensyCnt)
   {
     if (teensyConnect)
       imu[regbotInterface].calibrateGyro();
     cliAction = true;
   }
   // rename
-  if (regbotNumber >= 0 and regbotNumber <= 150 and regbotInterface >=0 and regbotInterface < NUM_TEENSY_MAX)
+  if (regbotNumber >= 0 and regbotNumber <= 150 and regbotInterface >=0 and regbotInterface < teensyCnt)
   { // save this number to the Teensy (Robobot) and exit
     teensy[regbotInterface].saveRegbotNumber = regbotNumber;
     cliAction = true;
   }
-  if (regbotHardware >= 5 and regbotHardware <= 15 and regbotInterface >=0 and regbotInterface < NUM_TEENSY_MAX)
+  if (regbotHardware >= 5 and regbotHardware <= 15 and regbotInterface >=0 and regbotInterface < teensyCnt)
   { // save this number to the Teensy (Robobot) and exit
     teensy[regbotInterface].regbotHardware = regbotHardware;
     cliAction = true;
@@ -157,6 +193,7 @@ bool UService::setup(int argc,char **argv)
     theEnd = true;
   }
   topicMaster = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "master";
+  topicLatency = ini["mqtt"]["system"] + ini["mqtt"]["function"] + "latency";
   //
   //
   // for setup timing
@@ -199,6 +236,12 @@ bool UService::setup(int argc,char **argv)
       fprintf(logfile, "%% 1 \tTime (sec)\n");
       fprintf(logfile, "%% 2 \tMessage\n");
     }
+    // memory lock and thread priorities, before threads are started
+    realtime.setup();
+    // before the control modules, that may not need own threads
+    pipeline.setup();
+    // buffered logging for all modules
+    logger.setup();
     // mqtt
     mqtt.setup();
     mqttin.setup();
@@ -206,12 +249,13 @@ bool UService::setup(int argc,char **argv)
     // teensy interface
     if (teensyConnect)
     { // open the main data source
-      for (int tn = 0; tn < NUM_TEENSY_MAX; tn++)
+      for (int tn = 0; tn < teensyCnt; tn++)
       { // these primary interfaces are related to a Teensy
         teensy[tn].setup(tn);
       }
       setupTeensyConnection();
-      gpio.setup();
+      if (not replay)
+        gpio.setup();
     }
     else
     {
@@ -222,9 +266,17 @@ bool UService::setup(int argc,char **argv)
     // setup of all that do not directly interact with the robot
     // drive control loop
     mixer.setup();
+    linefollow.setup();
+    traj.setup();
+    fusion.setup();
+    vision.setup();
     // manuel control from joypad
     joyLogi.setup();
     joy.setup();
+    // typed values for hot paths, when all defaults are in place
+    config.setup();
+    // control pipeline, when all its modules are set up
+    pipeline.start();
     setupComplete = true;
     // allow threads to start
     usleep(2000);
@@ -233,7 +285,7 @@ bool UService::setup(int argc,char **argv)
   // Regbot (Teensy) need to accept settings before continue
   if (not theEnd and teensyConnect)
   { // wait for all settings to be accepted
-    for (int tn = 0; tn < NUM_TEENSY_MAX; tn++)
+    for (int tn = 0; tn < teensyCnt; tn++)
     {
       if (teensy[tn].teensyConnectionOpen)
       {
@@ -295,57 +347,46 @@ bool UService::setup(int argc,char **argv)
   return theEnd;
 }
 
-void UService::setupTeensyConnection()
+void UService::setupTeensyConnection(int board)
 {
-  for (int tn = 0; tn < NUM_TEENSY_MAX; tn++)
+  for (int tn = 0; tn < teensyCnt; tn++)
   { // these primary interfaces are related to a Teensy
+    if (board >= 0 and tn != board)
+      continue;
     // teensy[tn].setup(tn);
     robot[tn].setup(tn);
     //
     // wait for base setup to finish
     if (teensy[tn].teensyConnectionOpen)
     { // wait for initial setup
-      usleep(10000);
       UTime t("now");
       while (teensy[tn].getTeensyCommQueueSize() > 0 and t.getTimePassed() < 7.0)
-        usleep(10000);
+        usleep(1000);
       if (t.getTimePassed() >= 7.0)
         printf("# UService::setup - waited %g sec for initial Teensy setup\n", t.getTimePassed());
     }
     // setup and initialize all modules
     encoder[tn].setup(tn);
-    usleep(3000);
     imu[tn].setup(tn);
-    usleep(3000);
     servo[tn].setup(tn);
-    usleep(3000);
     mvel[tn].setup(tn);
-    usleep(3000);
     motor[tn].setup(tn);  // after mvel, as mvel makes sample time
-    usleep(3000);
     current[tn].setup(tn);
-    usleep(3000);
     distforce[tn].setup(tn);
-    usleep(3000);
     edge[tn].setup(tn);
-    usleep(30000);
   }
 }
 
 bool UService::mqttDecode(const char* topic, const char * payload, UTime& msgTime)
 { // message received from MQTT channel
   bool used = true;
-  const int MSL = 100;
-  char s[MSL];
-  if (strncmp(topic, "robobot/cmd/T0/", 15) == 0)
-  { // message to the Teensy , pass on
+  if (strncmp(topic, "robobot/cmd/T", 13) == 0 and isdigit(topic[13]) and topic[14] == '/')
+  { // message to a Teensy, like robobot/cmd/T0/leds, pass on
+    int tn = topic[13] - '0';
     const char * p1 = &topic[15];
-    std::snprintf(s, MSL, "%s %s\n", p1, payload);
-    bool ok = teensy[0].send(s);
-    if (not ok or true)
-    {
-      printf("# UService::mqttDecode: got '%s' '%s', send (queued) to T0 as '%s'", topic, payload, s);
-    }
+    bool ok = tn < teensyCnt and teensy[tn].sendCommand(p1, payload);
+    if (not ok)
+      printf("# UService::mqttDecode: got '%s' '%s', not queued for T%d\n", topic, payload, tn);
   }
   else if (strncmp(topic, "robobot/cmd/shutdown", 19) == 0)
   {
@@ -363,10 +404,31 @@ bool UService::mqttDecode(const char* topic, const char * payload, UTime& msgTim
     // printf("# pre  %lu.%04ld Interface command: %s %s\n", msgTime.getSec(), msgTime.getMicrosec()/100, topic, payload);
     // decode message to this interface
     if (mixer.decode(p1, payload, msgTime))
-    {
+    { // a drive order from MQTT overrules line follow (stopped by the mixer) and trajectory
+      traj.clear(true);
       if (logfile != nullptr)
         fprintf(logfile, "%lu.%04ld Mixer order: %s %s\n", msgTime.getSec(), msgTime.getMicrosec()/100, topic, payload);
     }
+    else if (linefollow.decode(p1, payload, msgTime))
+    {
+      if (logfile != nullptr)
+        fprintf(logfile, "%lu.%04ld Line follow order: %s %s\n", msgTime.getSec(), msgTime.getMicrosec()/100, topic, payload);
+    }
+    else if (traj.decode(p1, payload, msgTime))
+    {
+      if (logfile != nullptr)
+        fprintf(logfile, "%lu.%04ld Trajectory order: %s %s\n", msgTime.getSec(), msgTime.getMicrosec()/100, topic, payload);
+    }
+    else if (config.decode(p1, payload, msgTime))
+    {
+      if (logfile != nullptr)
+        fprintf(logfile, "%lu.%04ld Config order: %s %s\n", msgTime.getSec(), msgTime.getMicrosec()/100, topic, payload);
+    }
+    else if (fusion.decode(p1, payload, msgTime))
+    {
+      if (logfile != nullptr)
+        fprintf(logfile, "%lu.%04ld Fusion order: %s %s\n", msgTime.getSec(), msgTime.getMicrosec()/100, topic, payload);
+    }
     else if (strncmp(p1, "log", 3) == 0)
     { // start or stop logging
       int v = strtol(payload, nullptr, 10);
@@ -425,7 +487,7 @@ bool UService::mqttDecode(const char* topic, const char * payload, UTime& msgTim
                     masterAliveErr, payload, masterAliveID);
         }
         // inform about who is master
-        if (ini["mqtt"]["use"] == "true")
+        if (config.get()->mqtt.use)
         { // send master ID back to master and to false newcomers
           mqtt.publish(topicMaster.c_str(), masterAliveID, msgTime);
         }
@@ -451,27 +513,6 @@ bool UService::mqttDecode(const char* topic, const char * payload, UTime& msgTim
   return used;
 }
 
-
-bool UService::decode(const char* msg, UTime& msgTime, int tn)
-{ // decode messages from Teensy
-  bool used = true;
-  if      (robot[tn].decode(msg, msgTime)) {}
-  else if (encoder[tn].decode(msg, msgTime)) {}
-  else if (imu[tn].decode(msg, msgTime)) {}
-  else if (servo[tn].decode(msg, msgTime)) {}
-  // else if (as5147[tn].decode(msg, msgTime)) {}
-  else if (motor[tn].decode(msg, msgTime)) {}
-  else if (current[tn].decode(msg, msgTime)) {}
-  else if (distforce[tn].decode(msg, msgTime)) {}
-  else if (edge[tn].decode(msg, msgTime)) {}
-  //
-  // add other Teensy data users here
-  //
-  else
-    used = false;
-  return used;
-}
-
 void UService::stopNow(const char * who)
 { // request a terminate and exit
   printf("# UService:: %s say stop now\n", who);
@@ -489,18 +530,24 @@ void UService::terminate()
   }
   terminating = true;
   printf("# --------- terminating -----------\n");
-  for (int tn = 0; tn < NUM_TEENSY_MAX; tn++)
+  for (int tn = 0; tn < teensyCnt; tn++)
   { // stop any motor activity
     teensy[tn].send("stop\n");
   }
+  printLatency();
   stop = true; // stop all threads, when finished current activity
   // wait 100ms to allow most threads to stop
   usleep(100000);
   joy.terminate();
   joyLogi.terminate();
   gpio.terminate();
+  linefollow.terminate();
+  traj.terminate();
+  fusion.terminate();
+  vision.terminate();
+  pipeline.terminate();
   mixer.terminate();
-  for (int tn = 0; tn < NUM_TEENSY_MAX; tn++)
+  for (int tn = 0; tn < teensyCnt; tn++)
   {
     edge[tn].terminate();
     motor[tn].terminate();
@@ -514,8 +561,14 @@ void UService::terminate()
     // terminate sensors before Teensy
     teensy[tn].terminate();
   }
+  // I/O loop for all Teensy boards
+  teensyIo.terminate();
   mqtt.terminate(); // outgoing to MQTT server
   mqttin.terminate(); // from MQTT server
+  // flush and close all module logfiles
+  logger.terminate();
+  // deferred ini values from the modules
+  config.flush();
   // service must be the last to close
   if (not ini.has("ini"))
   {
@@ -531,6 +584,7 @@ void UService::terminate()
     iniFile->write(ini, true);
     printf("# UService:: configuration saved to %s\n", iniFileName.c_str());
   }
+  config.terminate();
   if (logfile != nullptr)
   {
     fprintf(logfile, "%lu.%04ld All terminated; closing logfile\n", t.getSec(), t.getMicrosec()/100);
@@ -565,6 +619,76 @@ bool UService::GetLineFromCin()
   return result;  
 }
 
+void UService::printLatency()
+{
+  printf("# Latency (ms)                   count     mean      p50      p90      p99      max\n");
+  for (int tn = 0; tn < teensyCnt; tn++)
+  {
+    if (teensy[tn].disabled)
+      continue;
+    teensy[tn].sampleHist.print("Teensy sample to read");
+    teensy[tn].rxHist.print("Teensy msg handled");
+    mvel[tn].latency.print("encoder to velocity");
+    motor[tn].latency.print("velocity to motor");
+    teensy[tn].txHist.print("motor write (tx)");
+    motor[tn].loopHist.print("sample to motor (loop)");
+    teensy[tn].rttHist.print("confirm round trip");
+    printf("#   Teensy[%d] clock offset %.4f sec (host - Teensy)\n", tn, teensy[tn].getClockOffset());
+  }
+  linefollow.latency.print("line sensor to turnrate");
+  fusion.latency.print("velocity to fused pose");
+  vision.latency.print("capture to vision detection");
+  mqtt.queueHist.print("MQTT queue to published");
+  mqtt.pubHist.print("MQTT publish");
+  pipeline.print();
+  realtime.print();
+  if (replay)
+  { // more details
+    for (int tn = 0; tn < teensyCnt; tn++)
+    {
+      if (teensy[tn].disabled)
+        continue;
+      teensy[tn].rxHist.printBins("Teensy msg handled");
+      mvel[tn].latency.printBins("encoder to velocity");
+      motor[tn].latency.printBins("velocity to motor");
+    }
+    mqtt.pubHist.printBins("MQTT publish");
+  }
+}
+
+void UService::publishLatency()
+{
+  const int MSL = 2000;
+  char s[MSL];
+  const int MLL = 150;
+  char line[MLL];
+  s[0] = '\0';
+  for (int tn = 0; tn < teensyCnt; tn++)
+  {
+    if (teensy[tn].disabled)
+      continue;
+    std::string t = "T" + std::to_string(tn) + "/";
+    strncat(s, teensy[tn].sampleHist.format((t + "sample").c_str(), line, MLL), MSL - strlen(s) - 1);
+    strncat(s, teensy[tn].rxHist.format((t + "rx").c_str(), line, MLL), MSL - strlen(s) - 1);
+    strncat(s, mvel[tn].latency.format((t + "vel").c_str(), line, MLL), MSL - strlen(s) - 1);
+    strncat(s, motor[tn].latency.format((t + "pid").c_str(), line, MLL), MSL - strlen(s) - 1);
+    strncat(s, teensy[tn].txHist.format((t + "tx").c_str(), line, MLL), MSL - strlen(s) - 1);
+    strncat(s, motor[tn].loopHist.format((t + "loop").c_str(), line, MLL), MSL - strlen(s) - 1);
+    strncat(s, teensy[tn].rttHist.format((t + "rtt").c_str(), line, MLL), MSL - strlen(s) - 1);
+    snprintf(line, MLL, "%soffset %.4f\n", t.c_str(), teensy[tn].getClockOffset());
+    strncat(s, line, MSL - strlen(s) - 1);
+  }
+  strncat(s, linefollow.latency.format("line", line, MLL), MSL - strlen(s) - 1);
+  strncat(s, fusion.latency.format("fusion", line, MLL), MSL - strlen(s) - 1);
+  strncat(s, vision.latency.format("vision", line, MLL), MSL - strlen(s) - 1);
+  strncat(s, mqtt.queueHist.format("mqtt_queue", line, MLL), MSL - strlen(s) - 1);
+  strncat(s, mqtt.pubHist.format("mqtt", line, MLL), MSL - strlen(s) - 1);
+  pipeline.format(s, MSL);
+  realtime.format(s, MSL);
+  UTime t("now");
+  mqtt.publish(topicLatency.c_str(), s, t);
+}
+
 void UService::run()
 { // 
   UTime t("now");
@@ -625,6 +749,15 @@ void UService::run()
             printf("# Logging already started\n");
         }
       }
+      else if (strncmp(p1, "stat", 4) == 0)
+      {
+        for (int tn = 0; tn < teensyCnt; tn++)
+          teensy[tn].printRxStat();
+      }
+      else if (strncmp(p1, "lat", 3) == 0)
+      {
+        printLatency();
+      }
       else if (*p1 == 'h')
       {
         printf("# Available commands:\n");
@@ -633,6 +766,8 @@ void UService::run()
         printf("#     sub xx i \tSubscribe to additional data from Teensy.\n");
         printf("#              \txx is subject (see rsewiki).\n");
         printf("#              \ti is interval in ms (i=0 stops subscription).\n");
+        printf("#     stat \tTeensy receive statistics (syscalls/s, lines/s, line latency).\n");
+        printf("#     lat \tLatency of each processing stage (ms).\n");
         printf("#     help \tThis help message.\n");
       }
       if (not stopNowRequest)
@@ -680,6 +815,28 @@ void UService::run()
                 t.getSec(), t.getMicrosec()/100,
                 masterAliveID);
     }
+    if (latencyInterval > 0 and latencyPublished.getTimePassed() > latencyInterval)
+    { // latency statistics on MQTT
+      latencyPublished.now();
+      if (config.get()->mqtt.use)
+        publishLatency();
+    }
+    for (int tn = 0; tn < teensyCnt; tn++)
+    { // a reconnected Teensy needs module setup,
+      // this waits for the Teensy queue, so it can not be done by the I/O loop
+      if (teensy[tn].reconnectSetup.exchange(false))
+        setupTeensyConnection(tn);
+    }
+    // apply deferred ini writes from data threads
+    config.flush();
+    // wall clock for logfiles and MQTT follows clock changes (NTP)
+    double wallStep = UTime::updateWallOffset();
+    if (fabs(wallStep) > 0.1)
+    {
+      printf("# UService::run: wall clock changed %.3f sec (NTP?)\n", wallStep);
+      if (logfile != nullptr)
+        fprintf(logfile, "%lu.%04ld Wall clock changed %.3f sec\n", t2.getSec(), t2.getMicrosec()/100, wallStep);
+    }
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
     app_time += 0.1; // rough estimate of app time without using system time
     //
@@ -704,7 +861,7 @@ void UService::run()
 float UService::usedBatteryCapacity()
 { // sum used capacity from each of the Teensy boards connected
   double usedWh = 0;
-  for (int i=0; i < NUM_TEENSY_MAX; i++)
+  for (int i=0; i < teensyCnt; i++)
     usedWh += robot[i].batteryUsedWh;
   return usedWh;
 }
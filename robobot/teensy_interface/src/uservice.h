@@ -37,13 +37,6 @@ public:
      * \returns true if app is to end now (error, help or calibration)
     */
     bool setup(int argc,char **argv);
-    /**
-     * decode messages from Teensy
-     * \param msg already CRC checked text line from teensy
-     * \param msgTime is time of arrival of the message
-     * \param tn is the Teensy interface number.
-     * \returns true, if the message was used. */
-    bool decode(const char * msg, UTime & msgTime, int tn);
     /**
      * decode MQTT message to be split to either Teensy or a more
      * abstract message handler
@@ -89,8 +82,17 @@ public:
      * \returns the number of times this mane occur in the process list */
     int isThisProcessRunning(std::string name);
     /**
-     * Do all the Teensy releated setup */
-    void setupTeensyConnection();
+     * Do all the Teensy releated setup
+     * \param board is the Teensy to set up (after a reconnect), -1 is all */
+    void setupTeensyConnection(int board = -1);
+    /**
+     * Print latency statistics for the processing stages
+     * (Teensy message, velocity, motor control and MQTT publish) */
+    void printLatency();
+    /**
+     * Publish latency statistics on MQTT (topic 'latency'),
+     * one line for each stage: name count mean p50 p90 p99 max (ms) */
+    void publishLatency();
 public:
     // file with calibration values etc.
     std::string iniFileName = "robot.ini";
@@ -113,6 +115,10 @@ public:
     UTime startedLogging; // system time
     float app_time = 0; // seconds since start of app
     bool setupComplete = false;
+    /// Teensy messages are replayed from a logfile (command line option)
+    bool replay = false;
+    /// number of Teensy boards in use (robot.ini [service] teensy_count)
+    int teensyCnt = 1;
 
 private:
     static void runObj(UService * obj)
@@ -138,6 +144,10 @@ private:
     int masterAliveErr = 0;
     //
     std::string topicMaster;
+    /// latency statistics topic and interval (sec), 0 is not published
+    std::string topicLatency;
+    float latencyInterval = 10;
+    UTime latencyPublished;
 };
 
 extern UService service;
@@ -0,0 +1,169 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ushmframes.h"
+
+static_assert(sizeof(UShmFramesHeader) == 64, "shared memory header must be 64 bytes");
+static_assert(sizeof(UShmSlot) == 64, "shared memory slot header must be 64 bytes");
+
+
+UShmFrames::~UShmFrames()
+{
+  close();
+}
+
+bool UShmFrames::create(const std::string & shmName, int w, int h, int ch, int slots)
+{
+  name = shmName;
+  size_t imgBytes = size_t(w) * h * ch;
+  // round to whole cache lines
+  size_t slotSize = (sizeof(UShmSlot) + imgBytes + 63) & ~size_t(63);
+  size = sizeof(UShmFramesHeader) + slotSize * slots;
+  // remove any old (e.g. after a crash)
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+  {
+    perror("# UShmFrames::create: shm_open failed");
+    return false;
+  }
+  bool isOK = ftruncate(fd, size) == 0;
+  void * p = MAP_FAILED;
+  if (isOK)
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+  {
+    perror("# UShmFrames::create: failed to map shared memory");
+    shm_unlink(name.c_str());
+    return false;
+  }
+  hdr = (UShmFramesHeader *)p;
+  memset(p, 0, sizeof(UShmFramesHeader));
+  hdr->version = UShmFramesHeader::VERSION;
+  hdr->slotCnt = slots;
+  hdr->slotSize = slotSize;
+  hdr->width = w;
+  hdr->height = h;
+  hdr->channels = ch;
+  hdr->writerPid = getpid();
+  hdr->latest.store(0);
+  for (int i = 0; i < slots; i++)
+  {
+    UShmSlot * s = slot(i);
+    s->seq.store(0);
+    s->width = w;
+    s->height = h;
+    s->channels = ch;
+  }
+  // valid for readers from now
+  std::atomic_thread_fence(std::memory_order_release);
+  hdr->magic = UShmFramesHeader::MAGIC;
+  isWriter = true;
+  return true;
+}
+
+bool UShmFrames::attach(const std::string & shmName)
+{
+  name = shmName;
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  void * p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 and st.st_size >= (off_t)sizeof(UShmFramesHeader))
+  {
+    size = st.st_size;
+    p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  hdr = (UShmFramesHeader *)p;
+  bool isOK = hdr->magic == UShmFramesHeader::MAGIC and
+              hdr->version == UShmFramesHeader::VERSION and
+              sizeof(UShmFramesHeader) + size_t(hdr->slotSize) * hdr->slotCnt <= size;
+  if (not isOK)
+  {
+    printf("# UShmFrames::attach: %s is not a frame ring (or wrong version)\n", name.c_str());
+    close();
+  }
+  return isOK;
+}
+
+void UShmFrames::close()
+{
+  if (hdr != nullptr)
+  {
+    munmap(hdr, size);
+    hdr = nullptr;
+    if (isWriter)
+      shm_unlink(name.c_str());
+    isWriter = false;
+  }
+}
+
+UShmSlot * UShmFrames::slot(uint64_t n) const
+{
+  return (UShmSlot *)((uint8_t *)hdr + sizeof(UShmFramesHeader) + (n % hdr->slotCnt) * hdr->slotSize);
+}
+
+uint8_t * UShmFrames::beginWrite(uint64_t & n)
+{
+  n = hdr->latest.load(std::memory_order_relaxed) + 1;
+  UShmSlot * s = slot(n);
+  // readers of the old frame in this slot can see it is being overwritten
+  s->seq.store(2 * n - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return (uint8_t *)s + sizeof(UShmSlot);
+}
+
+void UShmFrames::endWrite(uint64_t n, UTime & captureTime)
+{
+  UShmSlot * s = slot(n);
+  s->captureTime_us = uint64_t(captureTime.getSec()) * 1000000 + captureTime.getMicrosec();
+  s->seq.store(2 * n, std::memory_order_release);
+  hdr->latest.store(n, std::memory_order_release);
+}
+
+const uint8_t * UShmFrames::frame(uint64_t n, UTime & captureTime) const
+{
+  if (n == 0 or not isValid(n))
+    return nullptr;
+  UShmSlot * s = slot(n);
+  captureTime.setTime(s->captureTime_us / 1000000, s->captureTime_us % 1000000);
+  return (const uint8_t *)s + sizeof(UShmSlot);
+}
+
+bool UShmFrames::isValid(uint64_t n) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot(n)->seq.load(std::memory_order_acquire) == 2 * n;
+}
@@ -0,0 +1,139 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef USHMFRAMES_H
+#define USHMFRAMES_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "utime.h"
+
+/**
+ * Start of the shared memory, 64 bytes,
+ * followed by 'slotCnt' slots of 'slotSize' bytes.
+ * */
+struct UShmFramesHeader
+{
+  static const uint32_t MAGIC = 0x52464252; // "RBFR"
+  static const uint32_t VERSION = 1;
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slotCnt;
+  /// bytes in each slot, including the slot header (multiple of 64)
+  uint32_t slotSize;
+  uint32_t width;
+  uint32_t height;
+  /// 3 for BGR (8 bit each)
+  uint32_t channels;
+  int32_t writerPid;
+  /// newest complete frame number (0 is no frame yet)
+  std::atomic<uint64_t> latest;
+  uint8_t reserved[24];
+};
+
+/**
+ * Slot header, 64 bytes, image data follows (height * width * channels).
+ * */
+struct UShmSlot
+{
+  /// 2n-1 while frame n is written, 2n when frame n is complete
+  std::atomic<uint64_t> seq;
+  /// capture time (host clock) in microseconds since epoch
+  uint64_t captureTime_us;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  uint8_t reserved[36];
+};
+
+/**
+ * Ring buffer of camera frames in POSIX shared memory.
+ * One writer (stream_server/camera_shm.py for the Pi camera,
+ * or frame_broker for a USB camera) and any number of readers,
+ * also from other processes (e.g. Python using mmap, see
+ * stream_server/shm_frames.py).
+ * frame() gives the image in the shared memory (no copy), the reader
+ * should check that the frame is still valid after use, as the writer
+ * overwrites the oldest slot. UFrameSourceShm (vision) copies each frame,
+ * as the frame is passed on to other threads.
+ * */
+class UShmFrames
+{
+public:
+  ~UShmFrames();
+  /**
+   * Create the shared memory (writer)
+   * \param shmName is like "/robobot_frames"
+   * \param slots is the number of frames in the ring
+   * \returns false on error */
+  bool create(const std::string & shmName, int w, int h, int ch, int slots);
+  /**
+   * Attach to existing shared memory (reader)
+   * \returns false if not available (broker not running) */
+  bool attach(const std::string & shmName);
+  /** unmap and (writer) remove shared memory */
+  void close();
+  /**
+   * Get image buffer for the next frame (writer)
+   * \param n is set to the new frame number
+   * \returns pointer to the image data */
+  uint8_t * beginWrite(uint64_t & n);
+  /**
+   * Frame n is complete (writer) */
+  void endWrite(uint64_t n, UTime & captureTime);
+  /** newest complete frame number, 0 if none */
+  uint64_t latest() const
+  {
+    if (hdr == nullptr)
+      return 0;
+    return hdr->latest.load(std::memory_order_acquire);
+  }
+  /**
+   * Get frame n (reader)
+   * \param captureTime is set to the capture time
+   * \returns pointer to image data, or nullptr if frame n is overwritten */
+  const uint8_t * frame(uint64_t n, UTime & captureTime) const;
+  /**
+   * Is frame n still in the ring (not being overwritten),
+   * call after using the image data */
+  bool isValid(uint64_t n) const;
+  /** is open (created or attached) */
+  bool isOpen() const
+  {
+    return hdr != nullptr;
+  }
+  int width() const { return hdr->width; }
+  int height() const { return hdr->height; }
+  int channels() const { return hdr->channels; }
+  std::string name;
+
+private:
+  UShmSlot * slot(uint64_t n) const;
+  UShmFramesHeader * hdr = nullptr;
+  size_t size = 0;
+  bool isWriter = false;
+};
+
+#endif
@@ -0,0 +1,113 @@
+/*  
+ * 
+ * Copyright © 2023 DTU,
+ * Author:
+ * Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "uteensyio.h"
+#include "steensy.h"
+#include "urealtime.h"
+
+UTeensyIo teensyIo;
+
+
+void UTeensyIo::add(STeensy * board)
+{
+  std::lock_guard<std::mutex> lock(boardLock);
+  boards.push_back(board);
+  if (th1 == nullptr)
+    th1 = new std::thread(runObj, this);
+}
+
+void UTeensyIo::terminate()
+{
+  stop = true;
+  if (th1 != nullptr)
+  {
+    th1->join();
+    th1 = nullptr;
+  }
+}
+
+void UTeensyIo::run()
+{
+  // port and wake-up handle for each board
+  std::vector<struct pollfd> pfd;
+  std::vector<STeensy *> pBoard;
+  realtime.configure("teensy_io");
+  while (not stop)
+  { // wait for data from a Teensy, a queued message or timeout
+    pfd.clear();
+    pBoard.clear();
+    int timeout = 100;
+    boardLock.lock();
+    for (STeensy * b : boards)
+    {
+      struct pollfd p;
+      p.events = POLLIN;
+      p.revents = 0;
+      if (b->teensyConnectionOpen and b->getPortFd() >= 0)
+      {
+        p.fd = b->getPortFd();
+        pfd.push_back(p);
+        pBoard.push_back(b);
+        int t = b->getPollTimeout();
+        if (t < timeout)
+          timeout = t;
+      }
+      if (b->getWakeFd() >= 0)
+      { // a message is queued for this board
+        p.fd = b->getWakeFd();
+        pfd.push_back(p);
+        pBoard.push_back(b);
+      }
+    }
+    boardLock.unlock();
+    int e = poll(pfd.data(), pfd.size(), timeout);
+    if (e < 0 and errno != EINTR)
+    {
+      perror("# UTeensyIo::run poll error");
+      usleep(1000);
+    }
+    else if (e > 0)
+    { // handle events
+      for (int i = 0; i < (int)pfd.size(); i++)
+      {
+        if (pfd[i].revents == 0)
+          continue;
+        if (pfd[i].fd == pBoard[i]->getWakeFd())
+          pBoard[i]->wakeEvent();
+        else if (pfd[i].fd == pBoard[i]->getPortFd())
+          pBoard[i]->portEvent(pfd[i].revents);
+      }
+    }
+    // connection, send queue and keep-alive for all boards
+    boardLock.lock();
+    for (STeensy * b : boards)
+      b->tick();
+    boardLock.unlock();
+  }
+}
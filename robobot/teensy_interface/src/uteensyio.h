@@ -0,0 +1,68 @@
+/*  
+ * 
+ * Copyright © 2023 DTU, Christian Andersen jcan@dtu.dk
+ * 
+ * The MIT License (MIT)  https://mit-license.org/
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the “Software”), to deal in the Software without restriction, 
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute, 
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies 
+ * or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, 
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR 
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE 
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, 
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN 
+ * THE SOFTWARE. */
+
+
+#ifndef UTEENSYIO_H
+#define UTEENSYIO_H
+
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+class STeensy;
+
+/**
+ * One I/O loop (thread) for all Teensy boards.
+ * Waits (poll) for data on all Teensy ports and for queued messages,
+ * then calls the Teensy tick() to handle connection, send queue and keep-alive.
+ * So CPU use follows the message rate, not the number of boards. */
+class UTeensyIo
+{
+public:
+  /**
+   * Add a Teensy to the loop, the loop thread is started by the first board.
+   * Boards are not removed, a terminated board closes its port in tick() */
+  void add(STeensy * board);
+  /**
+   * Stop the loop, call after all boards are terminated */
+  void terminate();
+
+private:
+  /** the I/O loop */
+  void run();
+  static void runObj(UTeensyIo * obj)
+  { // called, when thread is started
+    // transfer to the class run() function.
+    obj->run();
+  }
+  std::vector<STeensy *> boards;
+  std::mutex boardLock;
+  std::thread * th1 = nullptr;
+  std::atomic<bool> stop = false;
+};
+
+/**
+ * Make this visible to the rest of the software */
+extern UTeensyIo teensyIo;
+
+#endif
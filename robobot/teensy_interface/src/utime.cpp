@@ -52,83 +52,110 @@ UTime::~UTime()
 
 void UTime::clear()
 { // clear to zero
-  time.tv_sec = 0;
-  time.tv_usec = 0;
+  ns = 0;
   valid = false;
 }
 
-unsigned long UTime::getSec()
+std::atomic<int64_t> UTime::wallOffsetNs{0};
+
+int64_t UTime::wallOffset()
+{ // time order uses the monotonic clock only, the offset is for output
+  int64_t offset = wallOffsetNs.load(std::memory_order_relaxed);
+  if (offset == 0)
+  { // first use
+    updateWallOffset();
+    offset = wallOffsetNs.load(std::memory_order_relaxed);
+  }
+  return offset;
+}
+
+double UTime::updateWallOffset()
 {
-  if (valid)
-    return time.tv_sec;
-  else
+  struct timespec w;
+  int64_t m0 = nowNs();
+  clock_gettime(CLOCK_REALTIME, &w);
+  int64_t m1 = nowNs();
+  int64_t offset = int64_t(w.tv_sec) * 1000000000LL + w.tv_nsec - (m0 + m1) / 2;
+  int64_t old = wallOffsetNs.exchange(offset, std::memory_order_relaxed);
+  if (old == 0)
     return 0;
+  return (offset - old) * 1e-9;
 }
 
-/////////////////////////////////////////
-
-float UTime::getDecSec()
+int64_t UTime::getWallUs() const
 {
   if (valid)
-    return float(time.tv_sec) + float(time.tv_usec) * 1e-6;
+    return wallNs() / 1000;
   else
     return 0;
 }
 
-double UTime::getDDecSec()
+unsigned long UTime::getSec() const
 {
   if (valid)
-    return double(time.tv_sec) + double(time.tv_usec) * 1e-6;
+    return wallSec();
   else
     return 0;
 }
 
 /////////////////////////////////////////
 
-float UTime::getDecSec(UTime t1)
-{ // get time compared to t1
-  return float(time.tv_sec - t1.time.tv_sec) + float(time.tv_usec - t1.time.tv_usec) * 1e-6;
+float UTime::getDecSec() const
+{
+  if (valid)
+    return float(wallNs() * 1e-9);
+  else
+    return 0;
 }
 
-/////////////////////////////////////////
-
-float UTime::getTimePassed()
+double UTime::getDDecSec() const
 {
-  UTime t;
-  t.now();
-  return (t - *this);
+  if (valid)
+    return wallNs() * 1e-9;
+  else
+    return 0;
 }
 
 /////////////////////////////////////////
 
-long UTime::getMillisec()
+long UTime::getMillisec() const
 {
   if (valid)
-    return time.tv_usec / 1000;
+    return (wallNs() % 1000000000LL) / 1000000;
   else
     return 0;
 }
 
 ///////////////////////////////////////////////
 
-unsigned long UTime::getMicrosec()
+unsigned long UTime::getMicrosec() const
 {
   if (valid)
-    return time.tv_usec;
+    return (wallNs() % 1000000000LL) / 1000;
   else
     return 0;
 }
 
+struct timeval UTime::getTimeval() const
+{
+  struct timeval tv;
+  int64_t us = getWallUs();
+  tv.tv_sec = us / 1000000;
+  tv.tv_usec = us % 1000000;
+  return tv;
+}
+
 /////////////////////////////////////////////
 
 int UTime::getTimeAsString(char * info, bool local)
 { // writes time to string in format "hh:mm:ss.msec"
   struct tm ymd;
+  time_t sec = wallSec();
   //
   if (local)
-    localtime_r(&time.tv_sec, &ymd);
+    localtime_r(&sec, &ymd);
   else
-    gmtime_r(&time.tv_sec, &ymd);
+    gmtime_r(&sec, &ymd);
   //
   sprintf(info, "%2d:%02d:%02d.%03d", ymd.tm_hour,
             ymd.tm_min, ymd.tm_sec, (int)getMillisec());
@@ -140,11 +167,12 @@ int UTime::getTimeAsString(char * info, bool local)
 char * UTime::getForFilename(char * info, bool local /*= true*/)
 {
   struct tm ymd;
+  time_t sec = wallSec();
   //
   if (local)
-    localtime_r(&time.tv_sec, &ymd);
+    localtime_r(&sec, &ymd);
   else
-    gmtime_r(&time.tv_sec, &ymd);
+    gmtime_r(&sec, &ymd);
   //
   sprintf(info, "%04d%02d%02d_%02d%02d%02d.%03d",
             ymd.tm_year+1900, ymd.tm_mon+1, ymd.tm_mday,
@@ -166,11 +194,12 @@ std::string UTime::getForFilename()
 char * UTime::getDateTimeAsString(char * info, bool local /*= true*/)
 {
   struct tm ymd;
+  time_t sec = wallSec();
   //
   if (local)
-    localtime_r(&time.tv_sec, &ymd);
+    localtime_r(&sec, &ymd);
   else
-    gmtime_r(&time.tv_sec, &ymd);
+    gmtime_r(&sec, &ymd);
   //
   sprintf(info, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
           ymd.tm_year+1900, ymd.tm_mon+1, ymd.tm_mday,
@@ -184,29 +213,28 @@ char * UTime::getDateTimeAsString(char * info, bool local /*= true*/)
 
 void UTime::setTime(timeval iTime)
 {
-  time = iTime;
-  valid = true;
+  setTime(iTime.tv_sec, iTime.tv_usec);
 }
 
 /////////////////////////////////////////
 
 void UTime::setTime(long sec, long uSec)
-{
-  time.tv_sec = sec;
-  time.tv_usec = uSec;
+{ // from wall clock
+  ns = int64_t(sec) * 1000000000LL + int64_t(uSec) * 1000 - wallOffset();
   valid = true;
 }
 
 /////////////////////////////////////////
 
-struct tm UTime::getTimeTm(bool local)
+struct tm UTime::getTimeTm(bool local) const
 {
   struct tm ymd;
+  time_t sec = wallSec();
   //
   if (local)
-    localtime_r(&time.tv_sec, &ymd);
+    localtime_r(&sec, &ymd);
   else
-    gmtime_r(&time.tv_sec, &ymd);
+    gmtime_r(&sec, &ymd);
   //
   return ymd;
 }
@@ -230,37 +258,3 @@ UTime UTime::operator- (float seconds)
 }
 
 /////////////////////////////////////////////
-
-void UTime::add(float seconds)
-{
-  float rem = seconds - long(seconds);
-  long remL = (unsigned long)(rem * 1000000.0);
-  //
-  time.tv_sec += (unsigned long)seconds;
-  if (time.tv_usec + remL > 1000000)
-  { // adjust if overflow
-    time.tv_sec++;
-    time.tv_usec += remL - 1000000;
-  }
-  else
-    time.tv_usec += remL;
-}
-
-void UTime::sub(float seconds)
-{
-  float rem = seconds - long(seconds);
-  long remL = (unsigned long)(rem * 1000000.0);
-  //
-  time.tv_sec -= (unsigned long)seconds;
-  if (time.tv_usec < remL)
-  { // adjust if overflow
-    time.tv_sec--;
-    time.tv_usec += 1000000 - remL;
-  }
-  else
-    time.tv_usec -= remL;
-}
-/////////////////////////////////////////////
-
-
-
@@ -26,11 +26,19 @@
 #define UTIME_H
 
 #include <sys/time.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
 
 
 /**
-Class encapsulation the time structure used by 'gettimeofday'
-with resolution in years down to micro-seconds.
+Timestamp as 64-bit nanoseconds on CLOCK_MONOTONIC, so time differences
+are not affected by NTP updates or other system clock changes.
+Wall clock (seconds since 1 Jan 1970) is found only when needed
+(log, MQTT and strings), using an offset to the monotonic clock,
+that is measured again by updateWallOffset() (called by the service loop),
+so the wall clock follows NTP steps.
 The class has functions to make simple time calculations and
 conversion to and from string in localized format. */
 class UTime
@@ -50,31 +58,52 @@ public:
   void clear();
   /**
   Get time value in seconds (since 1 Jan 1970) */
-  unsigned long getSec();
+  unsigned long getSec() const;
   /**
   Get millisecond value within second in range 0..999 */
-  long getMillisec();
+  long getMillisec() const;
   /**
   Get microsecond value within second in range 0..999999 */
-  unsigned long getMicrosec();
+  unsigned long getMicrosec() const;
   /**
   Get second value with microsecond as decimals */
-  float getDecSec();
+  float getDecSec() const;
   /**
-   * Get time since t1 as decimal seconds.
-   * @returns as double allow time since epoc (about ms precision)
+   * Get time since epoch as decimal seconds.
+   * @returns as double allow time since epoc (about us precision)
    */
-  double getDDecSec();
+  double getDDecSec() const;
   /**
   Get time since t1 as decimal seconds. */
-  float getDecSec(UTime t1);
+  float getDecSec(const UTime & t1) const
+  { return (ns - t1.ns) * 1e-9f; }
   /**
   Get time past since this time in seconds */
-  float getTimePassed();
+  float getTimePassed() const
+  { return (nowNs() - ns) * 1e-9f; }
   /**
-  Set time value to system time now using gettimeofday() */
+  Set time value to now (monotonic clock) */
   inline void now()
-  { gettimeofday(&time, nullptr); valid = true; }
+  { ns = nowNs(); valid = true; }
+  /**
+   * Monotonic time now in nanoseconds (vDSO, no system call) */
+  static inline int64_t nowNs()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+  }
+  /**
+   * Monotonic time in nanoseconds, for ordering and latency */
+  inline int64_t getNs() const
+  { return ns; }
+  /**
+   * Set from monotonic time in nanoseconds */
+  inline void setNs(int64_t nanoSec)
+  { ns = nanoSec; valid = true; }
+  /**
+   * Wall clock in microseconds since 1 Jan 1970 (for log and MQTT) */
+  int64_t getWallUs() const;
   /**
   Set time from a timeval structure */
   void setTime(timeval iTime);
@@ -107,49 +136,25 @@ public:
    *  Compare two times */
   inline UTime operator=(timeval newTime)
   {
-    time = newTime;
-    valid = true;
+    setTime(newTime);
     return *this;
   };
   /**
   Compare two times */
-  inline bool operator==(UTime other)
-  {
-    bool result;
-    if ((time.tv_sec == other.time.tv_sec) and (time.tv_usec == other.time.tv_usec))
-      result = true;
-    else
-      result = false;
-    return result;
-  };
+  inline bool operator==(const UTime & other) const
+  { return ns == other.ns; };
   /**
   Compare two times */
-  inline bool operator> (UTime other)
-  {
-    bool result;
-    if ((time.tv_sec > other.time.tv_sec) or
-         ((time.tv_sec == other.time.tv_sec) and (time.tv_usec > other.time.tv_usec)))
-      result = true;
-    else
-      result = false;
-    return result;
-  };
+  inline bool operator> (const UTime & other) const
+  { return ns > other.ns; };
   /**
   Compare two times */
-  inline bool operator>= (UTime other)
-  { return not (*this < other); };
+  inline bool operator>= (const UTime & other) const
+  { return ns >= other.ns; };
   /**
   Compare two times */
-  inline bool operator< (UTime other)
-  {
-    bool result;
-    if ((time.tv_sec < other.time.tv_sec) or
-         ((time.tv_sec == other.time.tv_sec) and (time.tv_usec < other.time.tv_usec)))
-      result = true;
-    else
-      result = false;
-    return result;
-  };
+  inline bool operator< (const UTime & other) const
+  { return ns < other.ns; };
   /**
   Compare two times, where other is a float float */
   inline bool operator< (float other)
@@ -176,17 +181,15 @@ public:
   };
   /**
   Compare two times */
-  inline bool operator<= (UTime other)
-  { return not (*this > other); };
+  inline bool operator<= (const UTime & other) const
+  { return ns <= other.ns; };
   /**
   Compare two times */
-  inline bool operator!=(UTime other)
-  {
-    return not (*this == other);
-  };
+  inline bool operator!=(const UTime & other) const
+  { return ns != other.ns; };
   /**
   Subtract two UTime values and get result in decimal seconds */
-  inline float operator- (UTime old)
+  inline float operator- (const UTime & old) const
   { return getDecSec(old);};
   /**
   Add a number of seconds to this time */
@@ -204,22 +207,20 @@ public:
     { sub(seconds); };
   /**
   Add this number of seconds to the current value */
-  void add(float seconds);
+  inline void add(float seconds)
+  { ns += int64_t(double(seconds) * 1e9); }
   /**
-  Subtract a number of seconds from this time.
-  Can not handle negative time, and seconds must be positive. */
-  void sub(float seconds);
+  Subtract a number of seconds from this time. */
+  inline void sub(float seconds)
+  { ns -= int64_t(double(seconds) * 1e9); }
   /**
   Convert seconds to time_tm strucure.
   \param when 'local' is true the local time is returned, else GMT.
   \return the structure with year (year 1900 == 0), month, day, hour, min and sec. */
-  struct tm getTimeTm(bool local = true);
+  struct tm getTimeTm(bool local = true) const;
   /**
-  Get copy of timevalue structure */
-  inline struct timeval getTimeval()
-  {
-    return time;
-  }
+  Get wall clock as a timeval structure */
+  struct timeval getTimeval() const;
   /**
   Get month number form 3 character string.
   String value must match one of:
@@ -233,13 +234,34 @@ public:
   print date and time on console */
   inline void print(const char * prestring = nullptr)
     { show(prestring); };
-public:
   /**
-  Time as 'timeval' - i.e. same format as in 'timeofday' call. */
-  timeval time;
+  Measure wall clock minus monotonic clock again, so that wall clock output
+  follows clock changes (e.g. NTP after boot without RTC).
+  Call regularly, e.g. from the service loop.
+  \returns the change (seconds) since last measurement */
+  static double updateWallOffset();
+public:
   /**
   A valid flag, that are used when setting the time */
   bool valid;
+
+private:
+  /**
+  Time in nanoseconds on CLOCK_MONOTONIC */
+  int64_t ns;
+  /**
+  Wall clock minus monotonic clock (nanoseconds),
+  measured at first use and by updateWallOffset() */
+  static int64_t wallOffset();
+  static std::atomic<int64_t> wallOffsetNs;
+  /**
+  Wall clock in nanoseconds since 1 Jan 1970 */
+  inline int64_t wallNs() const
+  { return ns + wallOffset(); }
+  /**
+  Wall clock seconds, e.g. for localtime_r() */
+  inline time_t wallSec() const
+  { return time_t(wallNs() / 1000000000LL); }
 };
 
 